@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include <bcm_host.h>
+#include "emu.h"
+
+static int num_displays_opened = 0;
+
+void bcm_host_init(void)
+{
+}
+
+void bcm_host_deinit(void)
+{
+}
+
+DISPMANX_DISPLAY_HANDLE_T vc_dispmanx_display_open(uint32_t device)
+{
+    if (device != 0)
+        return DISPMANX_NO_HANDLE;
+    num_displays_opened ++;
+    return 1;
+}
+
+int vc_dispmanx_display_close(DISPMANX_DISPLAY_HANDLE_T display)
+{
+    if (display != 1 || num_displays_opened == 0)
+        return -1;
+    num_displays_opened --;
+    return DISPMANX_SUCCESS;
+}
+
+int vc_dispmanx_display_get_info(DISPMANX_DISPLAY_HANDLE_T display,
+                                 DISPMANX_MODEINFO_T *pinfo)
+{
+    if (display != 1)
+        return -1;
+    pinfo->width  = emu_getenv_uint("RPIGRAFX_EMU_SCREEN_WIDTH",  1920);
+    pinfo->height = emu_getenv_uint("RPIGRAFX_EMU_SCREEN_HEIGHT", 1080);
+    pinfo->transform = DISPMANX_NO_ROTATE;
+    pinfo->input_format = VCOS_DISPLAY_INPUT_FORMAT_RGB888;
+    pinfo->display_num = 0;
+    return DISPMANX_SUCCESS;
+}
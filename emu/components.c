@@ -0,0 +1,468 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Host-side emulation of the VideoCore components used by librpigrafx.
+ *
+ * Sources (camera and rawcam) produce frames at RPIGRAFX_EMU_FPS frames per
+ * second (default: 30; 0 means as fast as downstream returns buffers). The
+ * frames are read from RPIGRAFX_EMU_CAMERA_FILE if it is set and synthetic
+ * otherwise: pixel (x, y) of frame n is (256x/w, 256y/h, n) in RGB. The file
+ * contains tightly packed frames in the encoding of the port and is looped.
+ *
+ * Processing components spend RPIGRAFX_EMU_LATENCY_US microseconds on each
+ * input buffer before doing their actual work. This can be overridden per
+ * component type by RPIGRAFX_EMU_{SPLITTER,ISP,RENDER}_LATENCY_US.
+ */
+
+#include <interface/mmal/mmal.h>
+#include <interface/mmal/util/mmal_default_components.h>
+#include "emu.h"
+
+#define CAMERA_CAPTURE_PORT 2
+
+struct source_state {
+    FILE *fp;
+    _Bool file_failed;
+};
+
+static void pattern_rgb(uint8_t rgb[3], const uint32_t x, const uint32_t y,
+                        const uint32_t width, const uint32_t height,
+                        const uint64_t seq)
+{
+    rgb[0] = x * 256 / width;
+    rgb[1] = y * 256 / height;
+    rgb[2] = seq;
+}
+
+/* Returns 0 for R, 1 for G and 2 for B at (x, y) of a Bayer image. */
+static int bayer_channel(const MMAL_FOURCC_T encoding,
+                         const uint32_t x, const uint32_t y)
+{
+    const int pos = (y & 1) * 2 + (x & 1);
+
+    switch (encoding) {
+        case MMAL_ENCODING_BAYER_SBGGR8:
+        case MMAL_ENCODING_BAYER_SBGGR10P:
+        case MMAL_ENCODING_BAYER_SBGGR12P:
+            return (const int[]) {2, 1, 1, 0}[pos];
+        case MMAL_ENCODING_BAYER_SGRBG8:
+        case MMAL_ENCODING_BAYER_SGRBG10P:
+        case MMAL_ENCODING_BAYER_SGRBG12P:
+            return (const int[]) {1, 0, 2, 1}[pos];
+        case MMAL_ENCODING_BAYER_SGBRG8:
+        case MMAL_ENCODING_BAYER_SGBRG10P:
+        case MMAL_ENCODING_BAYER_SGBRG12P:
+            return (const int[]) {1, 2, 0, 1}[pos];
+        default:
+            return (const int[]) {0, 1, 1, 2}[pos];
+    }
+}
+
+static void fill_synthetic(const MMAL_ES_FORMAT_T *format, uint8_t *data,
+                           const uint32_t stride, const uint64_t seq)
+{
+    const MMAL_FOURCC_T encoding = format->encoding;
+    const uint32_t width  = format->es->video.crop.width,
+                   height = format->es->video.crop.height;
+    uint32_t x, y;
+
+    for (y = 0; y < height; y ++) {
+        uint8_t *row = data + y * stride;
+        for (x = 0; x < width; x ++) {
+            uint8_t rgb[3];
+            pattern_rgb(rgb, x, y, width, height, seq);
+            switch (encoding) {
+                case MMAL_ENCODING_RGB24:
+                    row[x * 3 + 0] = rgb[0];
+                    row[x * 3 + 1] = rgb[1];
+                    row[x * 3 + 2] = rgb[2];
+                    break;
+                case MMAL_ENCODING_BGR24:
+                    row[x * 3 + 0] = rgb[2];
+                    row[x * 3 + 1] = rgb[1];
+                    row[x * 3 + 2] = rgb[0];
+                    break;
+                case MMAL_ENCODING_BAYER_SBGGR8:
+                case MMAL_ENCODING_BAYER_SGBRG8:
+                case MMAL_ENCODING_BAYER_SGRBG8:
+                case MMAL_ENCODING_BAYER_SRGGB8:
+                    row[x] = rgb[bayer_channel(encoding, x, y)];
+                    break;
+                case MMAL_ENCODING_BAYER_SBGGR10P:
+                case MMAL_ENCODING_BAYER_SGRBG10P:
+                case MMAL_ENCODING_BAYER_SGBRG10P:
+                case MMAL_ENCODING_BAYER_SRGGB10P: {
+                    /* Four pixels take five bytes; LSBs are in the fifth. */
+                    const uint8_t v = rgb[bayer_channel(encoding, x, y)];
+                    uint8_t *group = row + x / 4 * 5;
+                    group[x % 4] = v;
+                    if (x % 4 == 0)
+                        group[4] = 0;
+                    group[4] |= (v >> 6) << (x % 4 * 2);
+                    break;
+                }
+                default:
+                    return;
+            }
+        }
+    }
+}
+
+/* Reads one tightly packed frame from the file. Returns 0 on success. */
+static int fill_from_file(struct source_state *state,
+                          const MMAL_ES_FORMAT_T *format, uint8_t *data,
+                          const uint32_t stride, const uint32_t row_bytes)
+{
+    const uint32_t height = format->es->video.crop.height;
+    const char *path = getenv("RPIGRAFX_EMU_CAMERA_FILE");
+    uint32_t y;
+
+    if (path == NULL || *path == '\0' || state->file_failed || row_bytes == 0)
+        return 1;
+    if (state->fp == NULL) {
+        state->fp = fopen(path, "rb");
+        if (state->fp == NULL) {
+            fprintf(stderr, "mmal-emu: Failed to open %s: %s\n",
+                    path, strerror(errno));
+            state->file_failed = !0;
+            return 1;
+        }
+    }
+
+    for (y = 0; y < height; y ++) {
+        if (fread(data + y * stride, row_bytes, 1, state->fp) != 1) {
+            if (y != 0 || ftell(state->fp) == 0) {
+                fprintf(stderr, "mmal-emu: %s is shorter than a frame\n",
+                        path);
+                state->file_failed = !0;
+                return 1;
+            }
+            rewind(state->fp);
+            y --;
+        }
+    }
+    return 0;
+}
+
+static void source_cleanup(MMAL_COMPONENT_T *component)
+{
+    struct source_state *state = component->priv->state;
+
+    if (state == NULL)
+        return;
+    if (state->fp != NULL)
+        fclose(state->fp);
+    free(state);
+}
+
+static void source_produce(MMAL_COMPONENT_T *component)
+{
+    struct MMAL_COMPONENT_PRIVATE_T *priv = component->priv;
+    const _Bool wait = emu_getenv_uint("RPIGRAFX_EMU_FPS", 30) == 0;
+    struct source_state *state = priv->state;
+    unsigned i;
+
+    if (state == NULL) {
+        state = priv->state = calloc(1, sizeof(*state));
+        if (state == NULL)
+            return;
+    }
+
+    for (i = 0; i < component->output_num; i ++) {
+        MMAL_PORT_T *port = component->output[i];
+        MMAL_BUFFER_HEADER_T *buffer;
+        uint32_t stride, row_bytes, size;
+
+        if (!port->is_enabled)
+            continue;
+        if (!strcmp(component->name, MMAL_COMPONENT_DEFAULT_CAMERA)
+                && i == CAMERA_CAPTURE_PORT && !port->priv->capture)
+            continue;
+
+        buffer = emu_port_get_buffer(port, wait);
+        if (buffer == NULL) {
+            if (port->is_enabled)
+                emu_port_drop(port);
+            continue;
+        }
+
+        size = emu_frame_size(port->format, &stride, &row_bytes);
+        if (size > buffer->alloc_size) {
+            buffer->length = 0;
+        } else {
+            if (fill_from_file(state, port->format, buffer->data,
+                               stride, row_bytes))
+                fill_synthetic(port->format, buffer->data, stride,
+                               priv->sequence);
+            buffer->length = size;
+        }
+        buffer->pts = buffer->dts = emu_time_us();
+        buffer->flags = MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+        emu_port_deliver(port, buffer);
+    }
+}
+
+static MMAL_STATUS_T camera_info_parameter_get(MMAL_PORT_T *port,
+                                               MMAL_PARAMETER_HEADER_T *param)
+{
+    MMAL_PARAMETER_CAMERA_INFO_T *info = (MMAL_PARAMETER_CAMERA_INFO_T*) param;
+    unsigned i;
+
+    MMAL_PARAM_UNUSED(port);
+    if (param->id != MMAL_PARAMETER_CAMERA_INFO)
+        return MMAL_ENOSYS;
+
+    info->num_cameras = MMAL_MIN(emu_getenv_uint("RPIGRAFX_EMU_NUM_CAMERAS", 1),
+                                 MMAL_PARAMETER_CAMERA_INFO_MAX_CAMERAS);
+    info->num_flashes = 0;
+    for (i = 0; i < info->num_cameras; i ++) {
+        info->cameras[i].port_id = i;
+        info->cameras[i].max_width =
+                        emu_getenv_uint("RPIGRAFX_EMU_CAMERA_MAX_WIDTH", 3280);
+        info->cameras[i].max_height =
+                        emu_getenv_uint("RPIGRAFX_EMU_CAMERA_MAX_HEIGHT", 2464);
+        info->cameras[i].lens_present = MMAL_FALSE;
+        snprintf(info->cameras[i].camera_name,
+                 sizeof(info->cameras[i].camera_name), "emu%u", i);
+    }
+    return MMAL_SUCCESS;
+}
+
+/* Copies the input frame to every enabled output which has a buffer. */
+static void splitter_process(MMAL_COMPONENT_T *component, MMAL_PORT_T *input,
+                             MMAL_BUFFER_HEADER_T *buffer)
+{
+    unsigned i;
+
+    for (i = 0; i < component->output_num; i ++) {
+        MMAL_PORT_T *output = component->output[i];
+        MMAL_BUFFER_HEADER_T *out;
+        uint32_t length;
+
+        if (!output->is_enabled)
+            continue;
+        out = emu_port_get_buffer(output, 0);
+        if (out == NULL) {
+            emu_port_drop(output);
+            continue;
+        }
+        length = MMAL_MIN(buffer->length, out->alloc_size);
+        memcpy(out->data, buffer->data + buffer->offset, length);
+        out->length = length;
+        out->flags = buffer->flags;
+        out->pts = buffer->pts;
+        out->dts = buffer->dts;
+        emu_port_deliver(output, out);
+    }
+    emu_port_deliver(input, buffer);
+}
+
+static int read_rgb(const MMAL_FOURCC_T encoding, const uint8_t *p,
+                    uint8_t rgb[3])
+{
+    switch (encoding) {
+        case MMAL_ENCODING_RGB24:
+        case MMAL_ENCODING_RGBA:
+            rgb[0] = p[0];
+            rgb[1] = p[1];
+            rgb[2] = p[2];
+            return 0;
+        case MMAL_ENCODING_BGR24:
+        case MMAL_ENCODING_BGRA:
+            rgb[0] = p[2];
+            rgb[1] = p[1];
+            rgb[2] = p[0];
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static unsigned bytes_per_pixel(const MMAL_FOURCC_T encoding)
+{
+    switch (encoding) {
+        case MMAL_ENCODING_RGB24:
+        case MMAL_ENCODING_BGR24:
+            return 3;
+        case MMAL_ENCODING_RGBA:
+        case MMAL_ENCODING_BGRA:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+/*
+ * Crops the input, scales it to the output size by nearest neighbour and
+ * converts it to the output encoding.
+ */
+static void isp_convert(const MMAL_ES_FORMAT_T *in_format,
+                        const MMAL_RECT_T *crop, const uint8_t *in,
+                        const MMAL_ES_FORMAT_T *out_format, uint8_t *out)
+{
+    const MMAL_FOURCC_T in_enc = in_format->encoding,
+                        out_enc = out_format->encoding;
+    const uint32_t in_bpp = bytes_per_pixel(in_enc),
+                   out_bpp = bytes_per_pixel(out_enc),
+                   out_width  = out_format->es->video.crop.width,
+                   out_height = out_format->es->video.crop.height,
+                   out_aligned_height = out_format->es->video.height;
+    uint32_t in_stride, out_stride, x, y;
+
+    emu_frame_size(in_format, &in_stride, NULL);
+    emu_frame_size(out_format, &out_stride, NULL);
+
+    for (y = 0; y < out_height; y ++) {
+        const uint8_t *in_row =
+                in + (crop->y + y * crop->height / out_height) * in_stride;
+        uint8_t *out_row = out + y * out_stride;
+
+        for (x = 0; x < out_width; x ++) {
+            const uint32_t sx = crop->x + x * crop->width / out_width;
+            uint8_t rgb[3] = {0, 0, 0};
+
+            read_rgb(in_enc, in_row + sx * in_bpp, rgb);
+            switch (out_enc) {
+                case MMAL_ENCODING_RGB24:
+                case MMAL_ENCODING_RGBA:
+                    out_row[x * out_bpp + 0] = rgb[0];
+                    out_row[x * out_bpp + 1] = rgb[1];
+                    out_row[x * out_bpp + 2] = rgb[2];
+                    if (out_bpp == 4)
+                        out_row[x * out_bpp + 3] = 0xff;
+                    break;
+                case MMAL_ENCODING_BGR24:
+                case MMAL_ENCODING_BGRA:
+                    out_row[x * out_bpp + 0] = rgb[2];
+                    out_row[x * out_bpp + 1] = rgb[1];
+                    out_row[x * out_bpp + 2] = rgb[0];
+                    if (out_bpp == 4)
+                        out_row[x * out_bpp + 3] = 0xff;
+                    break;
+                case MMAL_ENCODING_I420: {
+                    /* BT.601 full range; chroma from the top-left pixel. */
+                    uint8_t *u = out + out_stride * out_aligned_height,
+                            *v = u + out_stride / 2 * out_aligned_height / 2;
+                    out_row[x] = (77 * rgb[0] + 150 * rgb[1] + 29 * rgb[2])
+                                                                          >> 8;
+                    if ((x & 1) == 0 && (y & 1) == 0) {
+                        const uint32_t ci = y / 2 * (out_stride / 2) + x / 2;
+                        u[ci] = ((-43 * rgb[0] - 85 * rgb[1] + 128 * rgb[2])
+                                                                  >> 8) + 128;
+                        v[ci] = ((128 * rgb[0] - 107 * rgb[1] - 21 * rgb[2])
+                                                                  >> 8) + 128;
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+/*
+ * Unlike the splitter, the isp stalls until an output buffer is available,
+ * holding its input buffer and thus applying back-pressure upstream.
+ */
+static void isp_process(MMAL_COMPONENT_T *component, MMAL_PORT_T *input,
+                        MMAL_BUFFER_HEADER_T *buffer)
+{
+    MMAL_PORT_T *output = component->output[0];
+    MMAL_BUFFER_HEADER_T *out = NULL;
+    MMAL_RECT_T crop;
+    uint32_t size;
+
+    if (output->is_enabled)
+        out = emu_port_get_buffer(output, !0);
+    if (out == NULL) {
+        emu_port_drop(output);
+        emu_port_deliver(input, buffer);
+        return;
+    }
+
+    size = emu_frame_size(output->format, NULL, NULL);
+    if (size <= out->alloc_size
+            && buffer->length >= emu_frame_size(input->format, NULL, NULL)) {
+        pthread_mutex_lock(&input->priv->crop_mutex);
+        crop = input->priv->has_crop ? input->priv->crop
+                                     : input->format->es->video.crop;
+        pthread_mutex_unlock(&input->priv->crop_mutex);
+        isp_convert(input->format, &crop, buffer->data + buffer->offset,
+                    output->format, out->data);
+        out->length = size;
+    } else {
+        out->length = 0;
+    }
+    out->flags = MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+    out->pts = buffer->pts;
+    out->dts = buffer->dts;
+    emu_port_deliver(input, buffer);
+    emu_port_deliver(output, out);
+}
+
+static void sink_process(MMAL_COMPONENT_T *component, MMAL_PORT_T *input,
+                         MMAL_BUFFER_HEADER_T *buffer)
+{
+    MMAL_PARAM_UNUSED(component);
+    emu_port_deliver(input, buffer);
+}
+
+static const struct emu_component_type types[] = {
+    {
+        .name = MMAL_COMPONENT_DEFAULT_CAMERA_INFO,
+        .parameter_get = camera_info_parameter_get
+    }, {
+        .name = MMAL_COMPONENT_DEFAULT_CAMERA,
+        .output_num = 3,
+        .produce = source_produce,
+        .cleanup = source_cleanup
+    }, {
+        .name = "vc.ril.rawcam",
+        .output_num = 1,
+        .produce = source_produce,
+        .cleanup = source_cleanup
+    }, {
+        .name = MMAL_COMPONENT_DEFAULT_VIDEO_SPLITTER,
+        .input_num = 1,
+        .output_num = 4,
+        .latency_env = "RPIGRAFX_EMU_SPLITTER_LATENCY_US",
+        .process = splitter_process
+    }, {
+        .name = "vc.ril.isp",
+        .input_num = 1,
+        .output_num = 1,
+        .latency_env = "RPIGRAFX_EMU_ISP_LATENCY_US",
+        .process = isp_process
+    }, {
+        .name = MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER,
+        .input_num = 1,
+        .latency_env = "RPIGRAFX_EMU_RENDER_LATENCY_US",
+        .process = sink_process
+    }, {
+        .name = MMAL_COMPONENT_DEFAULT_NULL_SINK,
+        .input_num = 3,
+        .process = sink_process
+    }, {
+        .name = "vc.ril.null_sink",
+        .input_num = 3,
+        .process = sink_process
+    }
+};
+
+const struct emu_component_type* emu_component_type_find(const char *name)
+{
+    unsigned i;
+
+    for (i = 0; i < sizeof(types) / sizeof(types[0]); i ++)
+        if (!strcmp(types[i].name, name))
+            return &types[i];
+    return NULL;
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include <interface/mmal/mmal.h>
+#include <interface/mmal/util/mmal_connection.h>
+#include "emu.h"
+
+struct emu_connection {
+    MMAL_CONNECTION_T connection;
+    int refcount;
+    char name[160];
+};
+
+static void connection_output_cb(MMAL_PORT_T *port,
+                                 MMAL_BUFFER_HEADER_T *buffer)
+{
+    MMAL_CONNECTION_T *connection = (MMAL_CONNECTION_T*) port->userdata;
+
+    mmal_queue_put(connection->queue, buffer);
+    if (connection->callback != NULL)
+        connection->callback(connection);
+}
+
+static void connection_input_cb(MMAL_PORT_T *port,
+                                MMAL_BUFFER_HEADER_T *buffer)
+{
+    MMAL_PARAM_UNUSED(port);
+    mmal_buffer_header_release(buffer);
+}
+
+static MMAL_BOOL_T connection_release_cb(MMAL_POOL_T *pool,
+                                         MMAL_BUFFER_HEADER_T *buffer,
+                                         void *userdata)
+{
+    MMAL_CONNECTION_T *connection = userdata;
+
+    mmal_queue_put(pool->queue, buffer);
+    if (connection->callback != NULL)
+        connection->callback(connection);
+    return MMAL_FALSE;
+}
+
+MMAL_STATUS_T mmal_connection_create(MMAL_CONNECTION_T **connection,
+                                     MMAL_PORT_T *out, MMAL_PORT_T *in,
+                                     uint32_t flags)
+{
+    struct emu_connection *c = NULL;
+    MMAL_STATUS_T status;
+
+    if (out->type != MMAL_PORT_TYPE_OUTPUT || in->type != MMAL_PORT_TYPE_INPUT)
+        return MMAL_EINVAL;
+
+    c = calloc(1, sizeof(*c));
+    if (c == NULL)
+        return MMAL_ENOMEM;
+    c->refcount = 1;
+    snprintf(c->name, sizeof(c->name), "%s/%s", out->name, in->name);
+    c->connection.name = c->name;
+    c->connection.flags = flags;
+    c->connection.out = out;
+    c->connection.in = in;
+    c->connection.time_setup = emu_time_us();
+
+    if (!(flags & MMAL_CONNECTION_FLAG_KEEP_PORT_FORMATS)) {
+        mmal_format_full_copy(in->format, out->format);
+        if ((status = mmal_port_format_commit(in)) != MMAL_SUCCESS)
+            goto fail;
+    }
+    if (!(flags & MMAL_CONNECTION_FLAG_KEEP_BUFFER_REQUIREMENTS)) {
+        out->buffer_num = in->buffer_num =
+                 MMAL_MAX(out->buffer_num_recommended,
+                          in->buffer_num_recommended);
+        out->buffer_size = in->buffer_size =
+                 MMAL_MAX(out->buffer_size_recommended,
+                          in->buffer_size_recommended);
+    }
+
+    if (flags & MMAL_CONNECTION_FLAG_TUNNELLING) {
+        if ((status = mmal_port_connect(out, in)) != MMAL_SUCCESS)
+            goto fail;
+    } else {
+        c->connection.queue = mmal_queue_create();
+        c->connection.pool = mmal_port_pool_create(out,
+                                     MMAL_MAX(out->buffer_num, in->buffer_num),
+                                     MMAL_MAX(out->buffer_size,
+                                              in->buffer_size));
+        if (c->connection.queue == NULL || c->connection.pool == NULL) {
+            status = MMAL_ENOMEM;
+            goto fail;
+        }
+        mmal_pool_callback_set(c->connection.pool, connection_release_cb,
+                               &c->connection);
+    }
+
+    out->userdata = (struct MMAL_PORT_USERDATA_T*) &c->connection;
+    in->userdata = (struct MMAL_PORT_USERDATA_T*) &c->connection;
+    *connection = &c->connection;
+    return MMAL_SUCCESS;
+
+fail:
+    if (c->connection.queue != NULL)
+        mmal_queue_destroy(c->connection.queue);
+    free(c);
+    return status;
+}
+
+void mmal_connection_acquire(MMAL_CONNECTION_T *connection)
+{
+    struct emu_connection *c = (struct emu_connection*) connection;
+
+    __atomic_add_fetch(&c->refcount, 1, __ATOMIC_SEQ_CST);
+}
+
+MMAL_STATUS_T mmal_connection_release(MMAL_CONNECTION_T *connection)
+{
+    struct emu_connection *c = (struct emu_connection*) connection;
+
+    if (__atomic_sub_fetch(&c->refcount, 1, __ATOMIC_SEQ_CST))
+        return MMAL_SUCCESS;
+
+    if (connection->is_enabled)
+        mmal_connection_disable(connection);
+    if (connection->flags & MMAL_CONNECTION_FLAG_TUNNELLING)
+        mmal_port_disconnect(connection->out);
+    connection->out->userdata = NULL;
+    connection->in->userdata = NULL;
+    if (connection->pool != NULL)
+        mmal_port_pool_destroy(connection->out, connection->pool);
+    if (connection->queue != NULL)
+        mmal_queue_destroy(connection->queue);
+    free(c);
+    return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_connection_destroy(MMAL_CONNECTION_T *connection)
+{
+    return mmal_connection_release(connection);
+}
+
+MMAL_STATUS_T mmal_connection_enable(MMAL_CONNECTION_T *connection)
+{
+    MMAL_STATUS_T status;
+
+    if (connection->is_enabled)
+        return MMAL_SUCCESS;
+    connection->time_enable = emu_time_us();
+
+    if (connection->flags & MMAL_CONNECTION_FLAG_TUNNELLING) {
+        if ((status = mmal_port_enable(connection->out, NULL)) != MMAL_SUCCESS)
+            return status;
+    } else {
+        status = mmal_port_enable(connection->in, connection_input_cb);
+        if (status != MMAL_SUCCESS)
+            return status;
+        status = mmal_port_enable(connection->out, connection_output_cb);
+        if (status != MMAL_SUCCESS) {
+            mmal_port_disable(connection->in);
+            return status;
+        }
+    }
+
+    connection->time_enable = emu_time_us() - connection->time_enable;
+    connection->is_enabled = !0;
+    return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_connection_disable(MMAL_CONNECTION_T *connection)
+{
+    MMAL_BUFFER_HEADER_T *buffer;
+
+    if (!connection->is_enabled)
+        return MMAL_SUCCESS;
+    connection->time_disable = emu_time_us();
+
+    if (connection->flags & MMAL_CONNECTION_FLAG_TUNNELLING) {
+        mmal_port_disable(connection->out);
+    } else {
+        mmal_port_disable(connection->out);
+        mmal_port_disable(connection->in);
+        /* Return the buffers which were never taken by the client. */
+        while ((buffer = mmal_queue_get(connection->queue)) != NULL)
+            mmal_buffer_header_release(buffer);
+    }
+
+    connection->time_disable = emu_time_us() - connection->time_disable;
+    connection->is_enabled = 0;
+    return MMAL_SUCCESS;
+}
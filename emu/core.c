@@ -0,0 +1,1224 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include <interface/mmal/mmal.h>
+#include <interface/mmal/mmal_emu.h>
+#include <interface/mmal/util/mmal_util.h>
+#include <interface/mmal/util/mmal_util_params.h>
+#include <pthread.h>
+#include <time.h>
+#include "emu.h"
+
+#define QUEUE_POLL_MS 50
+
+static pthread_mutex_t live_mutex = PTHREAD_MUTEX_INITIALIZER;
+static MMAL_COMPONENT_T *live_components = NULL;
+static uint32_t next_component_id = 0;
+
+int64_t emu_time_us(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (int64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+unsigned emu_getenv_uint(const char *name, const unsigned def)
+{
+    const char *s = getenv(name);
+
+    if (s == NULL || *s == '\0')
+        return def;
+    return strtoul(s, NULL, 0);
+}
+
+const char* mmal_status_to_string(MMAL_STATUS_T status)
+{
+    static const char *strings[] = {
+        "SUCCESS", "ENOMEM", "ENOSPC", "EINVAL", "ENOSYS", "ENOENT", "ENXIO",
+        "EIO", "ESPIPE", "ECORRUPT", "ENOTREADY", "ECONFIG", "EISCONN",
+        "ENOTCONN", "EAGAIN", "EFAULT"
+    };
+
+    if ((unsigned) status >= sizeof(strings) / sizeof(strings[0]))
+        return "UNKNOWN";
+    return strings[status];
+}
+
+
+/* Formats. */
+
+MMAL_ES_FORMAT_T* mmal_format_alloc(void)
+{
+    struct {
+        MMAL_ES_FORMAT_T format;
+        MMAL_ES_SPECIFIC_FORMAT_T es;
+    } *p = calloc(1, sizeof(*p));
+
+    if (p == NULL)
+        return NULL;
+    p->format.es = &p->es;
+    return &p->format;
+}
+
+void mmal_format_free(MMAL_ES_FORMAT_T *format)
+{
+    free(format);
+}
+
+void mmal_format_copy(MMAL_ES_FORMAT_T *format_dest,
+                      MMAL_ES_FORMAT_T *format_src)
+{
+    MMAL_ES_SPECIFIC_FORMAT_T *es = format_dest->es;
+
+    *format_dest = *format_src;
+    format_dest->es = es;
+    *format_dest->es = *format_src->es;
+    format_dest->extradata_size = 0;
+    format_dest->extradata = NULL;
+}
+
+MMAL_STATUS_T mmal_format_full_copy(MMAL_ES_FORMAT_T *format_dest,
+                                    MMAL_ES_FORMAT_T *format_src)
+{
+    mmal_format_copy(format_dest, format_src);
+    return MMAL_SUCCESS;
+}
+
+/*
+ * Returns the size of a frame of the format. *stride is set to the number of
+ * bytes between rows of the (first) plane and *row_bytes to the number of
+ * meaningful bytes in a row of the cropped image.
+ */
+uint32_t emu_frame_size(const MMAL_ES_FORMAT_T *format, uint32_t *stride,
+                        uint32_t *row_bytes)
+{
+    const uint32_t width  = format->es->video.width,
+                   height = format->es->video.height,
+                   crop_width = format->es->video.crop.width;
+    uint32_t s, r, size;
+
+    switch (format->encoding) {
+        case MMAL_ENCODING_RGB24:
+        case MMAL_ENCODING_BGR24:
+            s = width * 3;
+            r = crop_width * 3;
+            size = s * height;
+            break;
+        case MMAL_ENCODING_RGBA:
+        case MMAL_ENCODING_BGRA:
+            s = width * 4;
+            r = crop_width * 4;
+            size = s * height;
+            break;
+        case MMAL_ENCODING_I420:
+            s = width;
+            r = crop_width;
+            size = s * height * 3 / 2;
+            break;
+        case MMAL_ENCODING_BAYER_SBGGR8:
+        case MMAL_ENCODING_BAYER_SGBRG8:
+        case MMAL_ENCODING_BAYER_SGRBG8:
+        case MMAL_ENCODING_BAYER_SRGGB8:
+            s = width;
+            r = crop_width;
+            size = s * height;
+            break;
+        case MMAL_ENCODING_BAYER_SBGGR10P:
+        case MMAL_ENCODING_BAYER_SGRBG10P:
+        case MMAL_ENCODING_BAYER_SGBRG10P:
+        case MMAL_ENCODING_BAYER_SRGGB10P:
+            s = VCOS_ALIGN_UP(width * 5 / 4, 32);
+            r = crop_width * 5 / 4;
+            size = s * height;
+            break;
+        case MMAL_ENCODING_BAYER_SBGGR12P:
+        case MMAL_ENCODING_BAYER_SGRBG12P:
+        case MMAL_ENCODING_BAYER_SGBRG12P:
+        case MMAL_ENCODING_BAYER_SRGGB12P:
+            s = VCOS_ALIGN_UP(width * 3 / 2, 32);
+            r = crop_width * 3 / 2;
+            size = s * height;
+            break;
+        default:
+            /* Opaque handles. */
+            s = r = 0;
+            size = 128;
+            break;
+    }
+
+    if (stride != NULL)
+        *stride = s;
+    if (row_bytes != NULL)
+        *row_bytes = r;
+    return size;
+}
+
+
+/* Buffer headers. */
+
+void mmal_buffer_header_acquire(MMAL_BUFFER_HEADER_T *header)
+{
+    __atomic_add_fetch(&header->priv->refcount, 1, __ATOMIC_SEQ_CST);
+}
+
+void mmal_buffer_header_reset(MMAL_BUFFER_HEADER_T *header)
+{
+    header->length = 0;
+    header->offset = 0;
+    header->flags = 0;
+    header->pts = MMAL_TIME_UNKNOWN;
+    header->dts = MMAL_TIME_UNKNOWN;
+}
+
+void mmal_buffer_header_release(MMAL_BUFFER_HEADER_T *header)
+{
+    struct emu_pool *pool;
+
+    if (__atomic_sub_fetch(&header->priv->refcount, 1, __ATOMIC_SEQ_CST) != 0)
+        return;
+
+    pool = (struct emu_pool*) header->priv->pool;
+    header->priv->refcount = 1;
+    if (header->priv->reference != NULL) {
+        mmal_buffer_header_release(header->priv->reference);
+        header->priv->reference = NULL;
+        header->data = header->priv->payload;
+        header->alloc_size = header->priv->payload_size;
+    }
+    mmal_buffer_header_reset(header);
+    if (pool->cb != NULL && !pool->cb(&pool->pool, header, pool->cb_userdata))
+        return;
+    mmal_queue_put(pool->pool.queue, header);
+}
+
+/*
+ * Makes dest refer to the payload of src, which is kept until dest is
+ * released.
+ */
+MMAL_STATUS_T mmal_buffer_header_replicate(MMAL_BUFFER_HEADER_T *dest,
+                                           MMAL_BUFFER_HEADER_T *src)
+{
+    if (dest == NULL || src == NULL || dest->priv->reference != NULL)
+        return MMAL_EINVAL;
+    mmal_buffer_header_acquire(src);
+    dest->priv->reference = src;
+    dest->cmd = src->cmd;
+    dest->data = src->data;
+    dest->alloc_size = src->alloc_size;
+    dest->offset = src->offset;
+    dest->length = src->length;
+    dest->flags = src->flags;
+    dest->pts = src->pts;
+    dest->dts = src->dts;
+    return MMAL_SUCCESS;
+}
+
+
+/* Queues. */
+
+MMAL_QUEUE_T* mmal_queue_create(void)
+{
+    MMAL_QUEUE_T *queue = calloc(1, sizeof(*queue));
+
+    if (queue == NULL)
+        return NULL;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->cond, NULL);
+    queue->first = NULL;
+    queue->last = &queue->first;
+    return queue;
+}
+
+void mmal_queue_put(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer)
+{
+    pthread_mutex_lock(&queue->mutex);
+    buffer->next = NULL;
+    *queue->last = buffer;
+    queue->last = &buffer->next;
+    queue->length ++;
+    if (queue->length > queue->max_length)
+        queue->max_length = queue->length;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+void mmal_queue_put_back(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer)
+{
+    pthread_mutex_lock(&queue->mutex);
+    buffer->next = queue->first;
+    queue->first = buffer;
+    if (queue->last == &queue->first)
+        queue->last = &buffer->next;
+    queue->length ++;
+    if (queue->length > queue->max_length)
+        queue->max_length = queue->length;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static MMAL_BUFFER_HEADER_T* queue_get_locked(MMAL_QUEUE_T *queue)
+{
+    MMAL_BUFFER_HEADER_T *buffer = queue->first;
+
+    if (buffer == NULL)
+        return NULL;
+    queue->first = buffer->next;
+    if (queue->first == NULL)
+        queue->last = &queue->first;
+    buffer->next = NULL;
+    queue->length --;
+    return buffer;
+}
+
+MMAL_BUFFER_HEADER_T* mmal_queue_get(MMAL_QUEUE_T *queue)
+{
+    MMAL_BUFFER_HEADER_T *buffer;
+
+    pthread_mutex_lock(&queue->mutex);
+    buffer = queue_get_locked(queue);
+    pthread_mutex_unlock(&queue->mutex);
+    return buffer;
+}
+
+MMAL_BUFFER_HEADER_T* mmal_queue_wait(MMAL_QUEUE_T *queue)
+{
+    MMAL_BUFFER_HEADER_T *buffer;
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->first == NULL)
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    buffer = queue_get_locked(queue);
+    pthread_mutex_unlock(&queue->mutex);
+    return buffer;
+}
+
+MMAL_BUFFER_HEADER_T* mmal_queue_timedwait(MMAL_QUEUE_T *queue,
+                                           VCOS_UNSIGNED timeout)
+{
+    MMAL_BUFFER_HEADER_T *buffer;
+    struct timespec t;
+
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_sec  += timeout / 1000;
+    t.tv_nsec += (timeout % 1000) * 1000000;
+    if (t.tv_nsec >= 1000000000) {
+        t.tv_sec ++;
+        t.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->first == NULL)
+        if (pthread_cond_timedwait(&queue->cond, &queue->mutex, &t) != 0)
+            break;
+    buffer = queue_get_locked(queue);
+    pthread_mutex_unlock(&queue->mutex);
+    return buffer;
+}
+
+unsigned int mmal_queue_length(MMAL_QUEUE_T *queue)
+{
+    unsigned length;
+
+    pthread_mutex_lock(&queue->mutex);
+    length = queue->length;
+    pthread_mutex_unlock(&queue->mutex);
+    return length;
+}
+
+void mmal_queue_destroy(MMAL_QUEUE_T *queue)
+{
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->mutex);
+    free(queue);
+}
+
+
+/* Pools. */
+
+static MMAL_POOL_T* pool_create(MMAL_PORT_T *port, unsigned int headers,
+                                uint32_t payload_size)
+{
+    struct emu_pool *pool = NULL;
+    unsigned i;
+
+    pool = calloc(1, sizeof(*pool));
+    if (pool == NULL)
+        return NULL;
+    pool->port = port;
+    pool->pool.queue = mmal_queue_create();
+    pool->pool.header = calloc(headers, sizeof(*pool->pool.header));
+    if (pool->pool.queue == NULL || pool->pool.header == NULL)
+        goto fail;
+
+    for (i = 0; i < headers; i ++) {
+        struct {
+            MMAL_BUFFER_HEADER_T header;
+            struct MMAL_BUFFER_HEADER_PRIVATE_T priv;
+        } *p = calloc(1, sizeof(*p));
+
+        if (p == NULL)
+            goto fail;
+        p->header.priv = &p->priv;
+        p->priv.refcount = 1;
+        p->priv.pool = &pool->pool;
+        p->priv.payload_port = port;
+        if (payload_size != 0) {
+            if (port != NULL)
+                p->header.data = mmal_port_payload_alloc(port, payload_size);
+            else
+                p->header.data = malloc(payload_size);
+            if (p->header.data == NULL) {
+                free(p);
+                goto fail;
+            }
+            p->header.alloc_size = payload_size;
+        }
+        p->priv.payload = p->header.data;
+        p->priv.payload_size = p->header.alloc_size;
+        mmal_buffer_header_reset(&p->header);
+        pool->pool.header[pool->pool.headers_num ++] = &p->header;
+        mmal_queue_put(pool->pool.queue, &p->header);
+    }
+    return &pool->pool;
+
+fail:
+    mmal_pool_destroy(&pool->pool);
+    return NULL;
+}
+
+MMAL_POOL_T* mmal_pool_create(unsigned int headers, uint32_t payload_size)
+{
+    return pool_create(NULL, headers, payload_size);
+}
+
+MMAL_POOL_T* mmal_port_pool_create(MMAL_PORT_T *port, unsigned int headers,
+                                   uint32_t payload_size)
+{
+    return pool_create(port, headers, payload_size);
+}
+
+void mmal_pool_destroy(MMAL_POOL_T *pool)
+{
+    unsigned i;
+
+    if (pool == NULL)
+        return;
+    for (i = 0; i < pool->headers_num; i ++) {
+        MMAL_BUFFER_HEADER_T *header = pool->header[i];
+        if (header->priv->payload_port != NULL)
+            mmal_port_payload_free(header->priv->payload_port,
+                                   header->priv->payload);
+        else
+            free(header->priv->payload);
+        free(header);
+    }
+    free(pool->header);
+    if (pool->queue != NULL)
+        mmal_queue_destroy(pool->queue);
+    free(pool);
+}
+
+void mmal_port_pool_destroy(MMAL_PORT_T *port, MMAL_POOL_T *pool)
+{
+    MMAL_PARAM_UNUSED(port);
+    mmal_pool_destroy(pool);
+}
+
+void mmal_pool_callback_set(MMAL_POOL_T *pool, MMAL_POOL_BH_CB_T cb,
+                            void *userdata)
+{
+    struct emu_pool *p = (struct emu_pool*) pool;
+
+    p->cb = cb;
+    p->cb_userdata = userdata;
+}
+
+
+/* Ports. */
+
+uint8_t* mmal_port_payload_alloc(MMAL_PORT_T *port, uint32_t payload_size)
+{
+    void *p = NULL;
+
+    MMAL_PARAM_UNUSED(port);
+    if (posix_memalign(&p, 64, payload_size))
+        return NULL;
+    return p;
+}
+
+void mmal_port_payload_free(MMAL_PORT_T *port, uint8_t *payload)
+{
+    MMAL_PARAM_UNUSED(port);
+    free(payload);
+}
+
+MMAL_STATUS_T mmal_port_format_commit(MMAL_PORT_T *port)
+{
+    const uint32_t size = emu_frame_size(port->format, NULL, NULL);
+
+    if (port->type != MMAL_PORT_TYPE_INPUT
+            && port->type != MMAL_PORT_TYPE_OUTPUT)
+        return MMAL_EINVAL;
+    if (port->is_enabled)
+        return MMAL_EISCONN;
+
+    port->format->type = MMAL_ES_TYPE_VIDEO;
+    /* The crop of the new format replaces that of MMAL_PARAMETER_CROP. */
+    pthread_mutex_lock(&port->priv->crop_mutex);
+    port->priv->has_crop = 0;
+    pthread_mutex_unlock(&port->priv->crop_mutex);
+    port->buffer_size_min = size;
+    port->buffer_size_recommended = size;
+    if (port->buffer_size < port->buffer_size_min)
+        port->buffer_size = port->buffer_size_min;
+    return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_connect(MMAL_PORT_T *port, MMAL_PORT_T *other_port)
+{
+    if (port->priv->connected != NULL || other_port->priv->connected != NULL)
+        return MMAL_EISCONN;
+    port->priv->connected = other_port;
+    other_port->priv->connected = port;
+    return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_disconnect(MMAL_PORT_T *port)
+{
+    MMAL_PORT_T *other_port = port->priv->connected;
+
+    if (other_port == NULL)
+        return MMAL_ENOTCONN;
+    if (port->is_enabled)
+        mmal_port_disable(port);
+    if (other_port->is_enabled)
+        mmal_port_disable(other_port);
+    port->priv->connected = NULL;
+    other_port->priv->connected = NULL;
+    return MMAL_SUCCESS;
+}
+
+static void tunnel_forward(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+    if (mmal_port_send_buffer(port->priv->connected, buffer) != MMAL_SUCCESS)
+        mmal_buffer_header_release(buffer);
+}
+
+static void tunnel_return(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+    MMAL_PARAM_UNUSED(port);
+    mmal_buffer_header_release(buffer);
+}
+
+static MMAL_BOOL_T tunnel_recycle(MMAL_POOL_T *pool,
+                                  MMAL_BUFFER_HEADER_T *buffer, void *userdata)
+{
+    MMAL_PORT_T *output = userdata;
+
+    MMAL_PARAM_UNUSED(pool);
+    if (output->is_enabled
+            && mmal_port_send_buffer(output, buffer) == MMAL_SUCCESS)
+        return MMAL_FALSE;
+    return MMAL_TRUE;
+}
+
+/*
+ * Each enabled input port has a worker thread which hands the buffers sent to
+ * the port to the component. This is where the per-buffer latency is spent.
+ */
+static void* input_worker(void *arg)
+{
+    MMAL_PORT_T *port = arg;
+    MMAL_COMPONENT_T *component = port->component;
+    struct MMAL_COMPONENT_PRIVATE_T *cpriv = component->priv;
+
+    while (port->priv->running) {
+        MMAL_BUFFER_HEADER_T *buffer;
+        int64_t start;
+
+        buffer = mmal_queue_timedwait(port->priv->queue, QUEUE_POLL_MS);
+        if (buffer == NULL)
+            continue;
+
+        __atomic_add_fetch(&port->priv->buffers, 1, __ATOMIC_RELAXED);
+        if (cpriv->latency_us != 0)
+            usleep(cpriv->latency_us);
+        start = emu_time_us();
+        pthread_mutex_lock(&cpriv->process_mutex);
+        cpriv->type->process(component, port, buffer);
+        pthread_mutex_unlock(&cpriv->process_mutex);
+        __atomic_add_fetch(&port->priv->busy_ns,
+                           (emu_time_us() - start) * 1000, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+MMAL_STATUS_T mmal_port_enable(MMAL_PORT_T *port, MMAL_PORT_BH_CB_T cb)
+{
+    MMAL_PORT_T *connected = port->priv->connected;
+
+    if (port->is_enabled)
+        return MMAL_EISCONN;
+
+    if (connected != NULL) {
+        /* Tunnels are enabled from their output side. */
+        if (port->type != MMAL_PORT_TYPE_OUTPUT)
+            return MMAL_EINVAL;
+        port->buffer_num  = MMAL_MAX(port->buffer_num,  connected->buffer_num);
+        port->buffer_size = MMAL_MAX(port->buffer_size, connected->buffer_size);
+        port->priv->tunnel_pool = mmal_port_pool_create(port, port->buffer_num,
+                                                        port->buffer_size);
+        if (port->priv->tunnel_pool == NULL)
+            return MMAL_ENOMEM;
+        mmal_pool_callback_set(port->priv->tunnel_pool, tunnel_recycle, port);
+        connected->priv->cb = tunnel_return;
+        cb = tunnel_forward;
+    } else if (cb == NULL) {
+        return MMAL_EINVAL;
+    }
+
+    port->priv->cb = cb;
+    port->priv->running = !0;
+    port->is_enabled = !0;
+
+    if (connected != NULL) {
+        MMAL_STATUS_T status = MMAL_SUCCESS;
+        MMAL_BUFFER_HEADER_T *header;
+
+        connected->priv->running = !0;
+        connected->is_enabled = !0;
+        if (connected->component->priv->type->process != NULL) {
+            if (pthread_create(&connected->priv->worker, NULL, input_worker,
+                               connected))
+                return MMAL_ENOMEM;
+            connected->priv->has_worker = !0;
+        }
+        while ((header = mmal_queue_get(port->priv->tunnel_pool->queue))
+                                                                      != NULL)
+            if ((status = mmal_port_send_buffer(port, header)) != MMAL_SUCCESS)
+                return status;
+    } else if (port->type == MMAL_PORT_TYPE_INPUT
+            && port->component->priv->type->process != NULL) {
+        if (pthread_create(&port->priv->worker, NULL, input_worker, port))
+            return MMAL_ENOMEM;
+        port->priv->has_worker = !0;
+    }
+    return MMAL_SUCCESS;
+}
+
+/* Returns all the buffers pending on the port to their owner. */
+static void port_drain(MMAL_PORT_T *port)
+{
+    MMAL_BUFFER_HEADER_T *buffer;
+
+    while ((buffer = mmal_queue_get(port->priv->queue)) != NULL) {
+        buffer->length = 0;
+        if (port->priv->cb != NULL)
+            port->priv->cb(port, buffer);
+        else
+            mmal_buffer_header_release(buffer);
+    }
+}
+
+static void port_stop(MMAL_PORT_T *port)
+{
+    port->priv->running = 0;
+    port->is_enabled = 0;
+    if (port->priv->has_worker) {
+        pthread_join(port->priv->worker, NULL);
+        port->priv->has_worker = 0;
+    }
+}
+
+MMAL_STATUS_T mmal_port_disable(MMAL_PORT_T *port)
+{
+    MMAL_PORT_T *connected = port->priv->connected;
+
+    if (!port->is_enabled)
+        return MMAL_EINVAL;
+
+    if (connected != NULL && port->type == MMAL_PORT_TYPE_INPUT)
+        return mmal_port_disable(connected);
+
+    port_stop(port);
+    /*
+     * The component may be running on, with its other ports. Waiting for it
+     * to finish with the buffer at hand, which sees the port stopped, leaves
+     * none of the port in its hands.
+     */
+    if (port->type == MMAL_PORT_TYPE_OUTPUT)
+        pthread_mutex_lock(&port->component->priv->process_mutex);
+    if (connected != NULL) {
+        port_stop(connected);
+        port_drain(connected);
+    }
+    port_drain(port);
+    if (port->priv->tunnel_pool != NULL) {
+        mmal_pool_destroy(port->priv->tunnel_pool);
+        port->priv->tunnel_pool = NULL;
+    }
+    port->priv->cb = NULL;
+    if (port->type == MMAL_PORT_TYPE_OUTPUT)
+        pthread_mutex_unlock(&port->component->priv->process_mutex);
+    return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_flush(MMAL_PORT_T *port)
+{
+    port_drain(port);
+    return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T *port,
+                                    MMAL_BUFFER_HEADER_T *buffer)
+{
+    if (!port->is_enabled)
+        return MMAL_EINVAL;
+    if (port->type != MMAL_PORT_TYPE_INPUT
+            && port->type != MMAL_PORT_TYPE_OUTPUT)
+        return MMAL_EINVAL;
+    mmal_queue_put(port->priv->queue, buffer);
+    return MMAL_SUCCESS;
+}
+
+/*
+ * Takes an empty buffer which a peer has sent to an output port. If wait is
+ * set, blocks until one arrives or the port is disabled.
+ */
+MMAL_BUFFER_HEADER_T* emu_port_get_buffer(MMAL_PORT_T *port, const _Bool wait)
+{
+    MMAL_BUFFER_HEADER_T *buffer;
+
+    if (!wait)
+        return mmal_queue_get(port->priv->queue);
+    do {
+        buffer = mmal_queue_timedwait(port->priv->queue, QUEUE_POLL_MS);
+    } while (buffer == NULL && port->priv->running);
+    return buffer;
+}
+
+/*
+ * Passes a filled output buffer or a consumed input buffer back to its peer.
+ * An output buffer is counted once the peer has it, so that whoever sees the
+ * count can find the buffer.
+ */
+void emu_port_deliver(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+    port->priv->cb(port, buffer);
+    if (port->type == MMAL_PORT_TYPE_OUTPUT)
+        __atomic_add_fetch(&port->priv->buffers, 1, __ATOMIC_SEQ_CST);
+}
+
+void emu_port_drop(MMAL_PORT_T *port)
+{
+    __atomic_add_fetch(&port->priv->dropped, 1, __ATOMIC_RELAXED);
+}
+
+
+/* Parameters. */
+
+MMAL_STATUS_T mmal_port_parameter_set(MMAL_PORT_T *port,
+                                      const MMAL_PARAMETER_HEADER_T *param)
+{
+    struct MMAL_PORT_PRIVATE_T *priv = port->priv;
+
+    switch (param->id) {
+        case MMAL_PARAMETER_ZERO_COPY:
+            priv->zero_copy = ((const MMAL_PARAMETER_BOOLEAN_T*) param)->enable;
+            return MMAL_SUCCESS;
+        case MMAL_PARAMETER_CAPTURE:
+            priv->capture = ((const MMAL_PARAMETER_BOOLEAN_T*) param)->enable;
+            return MMAL_SUCCESS;
+        case MMAL_PARAMETER_CAMERA_NUM:
+            port->component->priv->camera_num =
+                                ((const MMAL_PARAMETER_INT32_T*) param)->value;
+            return MMAL_SUCCESS;
+        case MMAL_PARAMETER_DISPLAYREGION: {
+            const MMAL_DISPLAYREGION_T *region =
+                                          (const MMAL_DISPLAYREGION_T*) param;
+            if (region->set & MMAL_DISPLAY_SET_FULLSCREEN)
+                priv->region.fullscreen = region->fullscreen;
+            if (region->set & MMAL_DISPLAY_SET_DEST_RECT)
+                priv->region.dest_rect = region->dest_rect;
+            if (region->set & MMAL_DISPLAY_SET_LAYER)
+                priv->region.layer = region->layer;
+            priv->region.set |= region->set;
+            return MMAL_SUCCESS;
+        }
+        case MMAL_PARAMETER_CAMERA_RX_CONFIG:
+            memcpy(&priv->rx_cfg, param, sizeof(priv->rx_cfg));
+            return MMAL_SUCCESS;
+        case MMAL_PARAMETER_CROP: {
+            const MMAL_RECT_T *rect = &((const MMAL_PARAMETER_CROP_T*) param)
+                                                                        ->rect;
+            if (rect->x < 0 || rect->y < 0
+                    || rect->width <= 0 || rect->height <= 0
+                    || rect->x + rect->width
+                                       > (int32_t) port->format->es->video.width
+                    || rect->y + rect->height
+                                     > (int32_t) port->format->es->video.height)
+                return MMAL_EINVAL;
+            pthread_mutex_lock(&priv->crop_mutex);
+            priv->crop = *rect;
+            priv->has_crop = !0;
+            pthread_mutex_unlock(&priv->crop_mutex);
+            return MMAL_SUCCESS;
+        }
+    }
+    return MMAL_ENOSYS;
+}
+
+MMAL_STATUS_T mmal_port_parameter_get(MMAL_PORT_T *port,
+                                      MMAL_PARAMETER_HEADER_T *param)
+{
+    struct MMAL_PORT_PRIVATE_T *priv = port->priv;
+    const struct emu_component_type *type = port->component->priv->type;
+
+    switch (param->id) {
+        case MMAL_PARAMETER_ZERO_COPY:
+            ((MMAL_PARAMETER_BOOLEAN_T*) param)->enable = priv->zero_copy;
+            return MMAL_SUCCESS;
+        case MMAL_PARAMETER_CAPTURE:
+            ((MMAL_PARAMETER_BOOLEAN_T*) param)->enable = priv->capture;
+            return MMAL_SUCCESS;
+        case MMAL_PARAMETER_SYSTEM_TIME:
+            /* The sources stamp buffers with emu_time_us. */
+            ((MMAL_PARAMETER_UINT64_T*) param)->value = emu_time_us();
+            return MMAL_SUCCESS;
+        case MMAL_PARAMETER_CAMERA_NUM:
+            ((MMAL_PARAMETER_INT32_T*) param)->value =
+                                             port->component->priv->camera_num;
+            return MMAL_SUCCESS;
+        case MMAL_PARAMETER_DISPLAYREGION:
+            memcpy((uint8_t*) param + sizeof(*param),
+                   (uint8_t*) &priv->region + sizeof(*param),
+                   sizeof(priv->region) - sizeof(*param));
+            return MMAL_SUCCESS;
+        case MMAL_PARAMETER_CAMERA_RX_CONFIG:
+            memcpy((uint8_t*) param + sizeof(*param),
+                   (uint8_t*) &priv->rx_cfg + sizeof(*param),
+                   sizeof(priv->rx_cfg) - sizeof(*param));
+            return MMAL_SUCCESS;
+        case MMAL_PARAMETER_CROP:
+            pthread_mutex_lock(&priv->crop_mutex);
+            ((MMAL_PARAMETER_CROP_T*) param)->rect =
+                       priv->has_crop ? priv->crop : port->format->es->video.crop;
+            pthread_mutex_unlock(&priv->crop_mutex);
+            return MMAL_SUCCESS;
+    }
+    if (type->parameter_get != NULL)
+        return type->parameter_get(port, param);
+    return MMAL_ENOSYS;
+}
+
+MMAL_STATUS_T mmal_port_parameter_set_boolean(MMAL_PORT_T *port, uint32_t id,
+                                              MMAL_BOOL_T value)
+{
+    MMAL_PARAMETER_BOOLEAN_T param = {{id, sizeof(param)}, value};
+    return mmal_port_parameter_set(port, &param.hdr);
+}
+
+MMAL_STATUS_T mmal_port_parameter_get_boolean(MMAL_PORT_T *port, uint32_t id,
+                                              MMAL_BOOL_T *value)
+{
+    MMAL_PARAMETER_BOOLEAN_T param = {{id, sizeof(param)}, 0};
+    MMAL_STATUS_T status = mmal_port_parameter_get(port, &param.hdr);
+    if (status == MMAL_SUCCESS)
+        *value = param.enable;
+    return status;
+}
+
+MMAL_STATUS_T mmal_port_parameter_set_int32(MMAL_PORT_T *port, uint32_t id,
+                                            int32_t value)
+{
+    MMAL_PARAMETER_INT32_T param = {{id, sizeof(param)}, value};
+    return mmal_port_parameter_set(port, &param.hdr);
+}
+
+MMAL_STATUS_T mmal_port_parameter_get_int32(MMAL_PORT_T *port, uint32_t id,
+                                            int32_t *value)
+{
+    MMAL_PARAMETER_INT32_T param = {{id, sizeof(param)}, 0};
+    MMAL_STATUS_T status = mmal_port_parameter_get(port, &param.hdr);
+    if (status == MMAL_SUCCESS)
+        *value = param.value;
+    return status;
+}
+
+MMAL_STATUS_T mmal_port_parameter_set_uint32(MMAL_PORT_T *port, uint32_t id,
+                                             uint32_t value)
+{
+    MMAL_PARAMETER_UINT32_T param = {{id, sizeof(param)}, value};
+    return mmal_port_parameter_set(port, &param.hdr);
+}
+
+MMAL_STATUS_T mmal_port_parameter_get_uint32(MMAL_PORT_T *port, uint32_t id,
+                                             uint32_t *value)
+{
+    MMAL_PARAMETER_UINT32_T param = {{id, sizeof(param)}, 0};
+    MMAL_STATUS_T status = mmal_port_parameter_get(port, &param.hdr);
+    if (status == MMAL_SUCCESS)
+        *value = param.value;
+    return status;
+}
+
+MMAL_STATUS_T mmal_port_parameter_get_uint64(MMAL_PORT_T *port, uint32_t id,
+                                             uint64_t *value)
+{
+    MMAL_PARAMETER_UINT64_T param = {{id, sizeof(param)}, 0};
+    MMAL_STATUS_T status = mmal_port_parameter_get(port, &param.hdr);
+    if (status == MMAL_SUCCESS)
+        *value = param.value;
+    return status;
+}
+
+
+/* Components. */
+
+static MMAL_PORT_T* port_alloc(MMAL_COMPONENT_T *component,
+                               const MMAL_PORT_TYPE_T type,
+                               const unsigned index, const unsigned index_all)
+{
+    static const char *type_names[] = {"?", "ctr", "in", "out", "clk"};
+    struct {
+        MMAL_PORT_T port;
+        struct MMAL_PORT_PRIVATE_T priv;
+    } *p = calloc(1, sizeof(*p));
+
+    if (p == NULL)
+        return NULL;
+    p->port.priv = &p->priv;
+    p->priv.format.es = &p->priv.es;
+    p->priv.queue = mmal_queue_create();
+    if (p->priv.queue == NULL) {
+        free(p);
+        return NULL;
+    }
+    snprintf(p->priv.name, sizeof(p->priv.name), "%s:%s:%u",
+             component->name, type_names[type], index);
+    p->port.name = p->priv.name;
+    p->port.type = type;
+    p->port.index = index;
+    p->port.index_all = index_all;
+    p->port.format = &p->priv.format;
+    p->port.component = component;
+    p->port.buffer_num_min = 1;
+    p->port.buffer_num_recommended =
+                             emu_getenv_uint("RPIGRAFX_EMU_BUFFER_NUM", 3);
+    p->port.buffer_num = p->port.buffer_num_recommended;
+    p->port.buffer_alignment_min = 64;
+    p->priv.rx_cfg.hdr.id = MMAL_PARAMETER_CAMERA_RX_CONFIG;
+    p->priv.rx_cfg.hdr.size = sizeof(p->priv.rx_cfg);
+    p->priv.rx_cfg.encode_block_length = 0;
+    p->priv.rx_cfg.embedded_data_lines = 0;
+    p->priv.region.hdr.id = MMAL_PARAMETER_DISPLAYREGION;
+    p->priv.region.hdr.size = sizeof(p->priv.region);
+    pthread_mutex_init(&p->priv.crop_mutex, NULL);
+    return &p->port;
+}
+
+static void port_free(MMAL_PORT_T *port)
+{
+    if (port == NULL)
+        return;
+    if (port->priv->connected != NULL)
+        mmal_port_disconnect(port);
+    else if (port->is_enabled)
+        mmal_port_disable(port);
+    mmal_queue_destroy(port->priv->queue);
+    pthread_mutex_destroy(&port->priv->crop_mutex);
+    free(port);
+}
+
+MMAL_STATUS_T mmal_component_create(const char *name,
+                                    MMAL_COMPONENT_T **component)
+{
+    const struct emu_component_type *type = emu_component_type_find(name);
+    MMAL_COMPONENT_T *c = NULL;
+    unsigned i, n = 0;
+
+    if (type == NULL)
+        return MMAL_ENOENT;
+
+    {
+        struct {
+            MMAL_COMPONENT_T component;
+            struct MMAL_COMPONENT_PRIVATE_T priv;
+        } *p = calloc(1, sizeof(*p));
+        if (p == NULL)
+            return MMAL_ENOMEM;
+        c = &p->component;
+        c->priv = &p->priv;
+    }
+    c->name = type->name;
+    c->priv->type = type;
+    c->priv->refcount = 1;
+    pthread_mutex_init(&c->priv->process_mutex, NULL);
+    c->priv->latency_us = emu_getenv_uint("RPIGRAFX_EMU_LATENCY_US", 0);
+    if (type->latency_env != NULL)
+        c->priv->latency_us = emu_getenv_uint(type->latency_env,
+                                              c->priv->latency_us);
+    c->input_num  = type->input_num;
+    c->output_num = type->output_num;
+    c->port_num = 1 + c->input_num + c->output_num;
+    c->port = calloc(c->port_num, sizeof(*c->port));
+    if (c->port == NULL)
+        goto fail;
+    c->input  = c->port + 1;
+    c->output = c->port + 1 + c->input_num;
+
+    if ((c->control = port_alloc(c, MMAL_PORT_TYPE_CONTROL, 0, n)) == NULL)
+        goto fail;
+    c->port[n ++] = c->control;
+    for (i = 0; i < c->input_num; i ++, n ++)
+        if ((c->port[n] = port_alloc(c, MMAL_PORT_TYPE_INPUT, i, n)) == NULL)
+            goto fail;
+    for (i = 0; i < c->output_num; i ++, n ++)
+        if ((c->port[n] = port_alloc(c, MMAL_PORT_TYPE_OUTPUT, i, n)) == NULL)
+            goto fail;
+
+    pthread_mutex_lock(&live_mutex);
+    c->id = next_component_id ++;
+    c->priv->next = live_components;
+    live_components = c;
+    pthread_mutex_unlock(&live_mutex);
+
+    *component = c;
+    return MMAL_SUCCESS;
+
+fail:
+    if (c->port != NULL)
+        for (i = 0; i < c->port_num; i ++)
+            port_free(c->port[i]);
+    free(c->port);
+    pthread_mutex_destroy(&c->priv->process_mutex);
+    free(c);
+    return MMAL_ENOMEM;
+}
+
+void mmal_component_acquire(MMAL_COMPONENT_T *component)
+{
+    __atomic_add_fetch(&component->priv->refcount, 1, __ATOMIC_SEQ_CST);
+}
+
+MMAL_STATUS_T mmal_component_release(MMAL_COMPONENT_T *component)
+{
+    MMAL_COMPONENT_T **pp;
+    unsigned i;
+
+    if (__atomic_sub_fetch(&component->priv->refcount, 1, __ATOMIC_SEQ_CST))
+        return MMAL_SUCCESS;
+
+    if (component->is_enabled)
+        mmal_component_disable(component);
+
+    pthread_mutex_lock(&live_mutex);
+    for (pp = &live_components; *pp != NULL; pp = &(*pp)->priv->next) {
+        if (*pp == component) {
+            *pp = component->priv->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&live_mutex);
+
+    /* Disable the outputs first so that tunnels are torn down in order. */
+    for (i = component->port_num; i > 0; i --)
+        port_free(component->port[i - 1]);
+    free(component->port);
+    if (component->priv->type->cleanup != NULL)
+        component->priv->type->cleanup(component);
+    else
+        free(component->priv->state);
+    pthread_mutex_destroy(&component->priv->process_mutex);
+    free(component);
+    return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_component_destroy(MMAL_COMPONENT_T *component)
+{
+    return mmal_component_release(component);
+}
+
+/*
+ * Sources have a thread which calls produce() once per frame period. With
+ * RPIGRAFX_EMU_FPS=0 there is no pacing and produce() is expected to block
+ * until downstream returns a buffer.
+ */
+static void* source_thread(void *arg)
+{
+    MMAL_COMPONENT_T *component = arg;
+    struct MMAL_COMPONENT_PRIVATE_T *priv = component->priv;
+    const unsigned fps = emu_getenv_uint("RPIGRAFX_EMU_FPS", 30);
+    const int64_t period = fps != 0 ? 1000000 / fps : 0;
+    int64_t next = emu_time_us();
+
+    while (priv->running) {
+        if (period != 0) {
+            const int64_t now = emu_time_us();
+            if (next > now)
+                usleep(next - now);
+            next += period;
+            if (next < now)
+                next = now + period;
+        }
+        pthread_mutex_lock(&priv->process_mutex);
+        priv->type->produce(component);
+        pthread_mutex_unlock(&priv->process_mutex);
+        priv->sequence ++;
+    }
+    return NULL;
+}
+
+MMAL_STATUS_T mmal_component_enable(MMAL_COMPONENT_T *component)
+{
+    struct MMAL_COMPONENT_PRIVATE_T *priv = component->priv;
+
+    if (component->is_enabled)
+        return MMAL_SUCCESS;
+    component->is_enabled = !0;
+    if (priv->type->produce != NULL) {
+        priv->running = !0;
+        if (pthread_create(&priv->source, NULL, source_thread, component)) {
+            priv->running = 0;
+            component->is_enabled = 0;
+            return MMAL_ENOMEM;
+        }
+        priv->has_source = !0;
+    }
+    return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_component_disable(MMAL_COMPONENT_T *component)
+{
+    struct MMAL_COMPONENT_PRIVATE_T *priv = component->priv;
+
+    if (!component->is_enabled)
+        return MMAL_SUCCESS;
+    priv->running = 0;
+    if (priv->has_source) {
+        unsigned i;
+        /* Wake up a producer waiting for a buffer. */
+        for (i = 0; i < component->output_num; i ++)
+            component->output[i]->priv->running = 0;
+        pthread_join(priv->source, NULL);
+        priv->has_source = 0;
+        for (i = 0; i < component->output_num; i ++)
+            component->output[i]->priv->running =
+                                               component->output[i]->is_enabled;
+    }
+    component->is_enabled = 0;
+    return MMAL_SUCCESS;
+}
+
+
+/* Utilities. */
+
+MMAL_PORT_T* mmal_util_get_port(MMAL_COMPONENT_T *comp, MMAL_PORT_TYPE_T type,
+                                unsigned index)
+{
+    switch (type) {
+        case MMAL_PORT_TYPE_CONTROL:
+            return index == 0 ? comp->control : NULL;
+        case MMAL_PORT_TYPE_INPUT:
+            return index < comp->input_num ? comp->input[index] : NULL;
+        case MMAL_PORT_TYPE_OUTPUT:
+            return index < comp->output_num ? comp->output[index] : NULL;
+        default:
+            return NULL;
+    }
+}
+
+MMAL_STATUS_T mmal_util_set_display_region(MMAL_PORT_T *port,
+                                           MMAL_DISPLAYREGION_T *region)
+{
+    region->hdr.id = MMAL_PARAMETER_DISPLAYREGION;
+    region->hdr.size = sizeof(*region);
+    return mmal_port_parameter_set(port, &region->hdr);
+}
+
+const char* mmal_port_type_to_string(MMAL_PORT_TYPE_T type)
+{
+    switch (type) {
+        case MMAL_PORT_TYPE_CONTROL:
+            return "ctr";
+        case MMAL_PORT_TYPE_INPUT:
+            return "in";
+        case MMAL_PORT_TYPE_OUTPUT:
+            return "out";
+        case MMAL_PORT_TYPE_CLOCK:
+            return "clk";
+        default:
+            return "invalid";
+    }
+}
+
+
+/* Statistics. */
+
+unsigned mmal_emu_get_port_stats(MMAL_EMU_PORT_STATS_T *stats,
+                                 const unsigned max)
+{
+    MMAL_COMPONENT_T *c;
+    unsigned n = 0;
+
+    pthread_mutex_lock(&live_mutex);
+    for (c = live_components; c != NULL; c = c->priv->next) {
+        unsigned i;
+        for (i = 1; i < c->port_num; i ++) {
+            MMAL_PORT_T *port = c->port[i];
+            if (n < max && stats != NULL) {
+                MMAL_EMU_PORT_STATS_T *s = &stats[n];
+                s->component = c->name;
+                s->component_id = c->id;
+                s->type = port->type;
+                s->index = port->index;
+                s->buffers = __atomic_load_n(&port->priv->buffers,
+                                             __ATOMIC_RELAXED);
+                s->dropped = __atomic_load_n(&port->priv->dropped,
+                                             __ATOMIC_RELAXED);
+                s->busy_ns = __atomic_load_n(&port->priv->busy_ns,
+                                             __ATOMIC_RELAXED);
+                pthread_mutex_lock(&port->priv->queue->mutex);
+                s->max_queue_depth = port->priv->queue->max_length;
+                pthread_mutex_unlock(&port->priv->queue->mutex);
+            }
+            n ++;
+        }
+    }
+    pthread_mutex_unlock(&live_mutex);
+    return n;
+}
+
+void mmal_emu_print_stats(FILE *fp)
+{
+    MMAL_EMU_PORT_STATS_T *stats = NULL;
+    unsigned i, n;
+
+    n = mmal_emu_get_port_stats(NULL, 0);
+    stats = calloc(n, sizeof(*stats));
+    if (stats == NULL)
+        return;
+    n = mmal_emu_get_port_stats(stats, n);
+    fprintf(fp, "%-28s %10s %10s %6s %12s\n",
+            "port", "buffers", "dropped", "depth", "busy[ms]");
+    for (i = 0; i < n; i ++) {
+        const MMAL_EMU_PORT_STATS_T *s = &stats[i];
+        char name[64];
+        if (s->buffers == 0 && s->dropped == 0)
+            continue;
+        snprintf(name, sizeof(name), "%s#%u:%s:%u", s->component,
+                 s->component_id, mmal_port_type_to_string(s->type), s->index);
+        fprintf(fp, "%-28s %10llu %10llu %6u %12.3f\n", name,
+                (unsigned long long) s->buffers,
+                (unsigned long long) s->dropped,
+                s->max_queue_depth, s->busy_ns * 1e-6);
+    }
+    free(stats);
+}
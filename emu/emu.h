@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef EMU_H
+#define EMU_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <interface/mmal/mmal.h>
+
+    struct MMAL_QUEUE_T {
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        MMAL_BUFFER_HEADER_T *first, **last;
+        unsigned length, max_length;
+    };
+
+    struct MMAL_BUFFER_HEADER_PRIVATE_T {
+        int refcount;
+        MMAL_POOL_T *pool;
+        /* Port whose payload allocator owns data, or NULL for malloc. */
+        MMAL_PORT_T *payload_port;
+        /* data and alloc_size of the header when it replicates none. */
+        uint8_t *payload;
+        uint32_t payload_size;
+        /* The header this one replicates, released along with it. */
+        MMAL_BUFFER_HEADER_T *reference;
+    };
+
+    struct emu_pool {
+        MMAL_POOL_T pool;
+        MMAL_POOL_BH_CB_T cb;
+        void *cb_userdata;
+        MMAL_PORT_T *port;
+    };
+
+    struct MMAL_PORT_PRIVATE_T {
+        char name[64];
+        MMAL_ES_FORMAT_T format;
+        MMAL_ES_SPECIFIC_FORMAT_T es;
+        MMAL_PORT_BH_CB_T cb;
+        /* Buffers sent to this port and not yet consumed by the component. */
+        MMAL_QUEUE_T *queue;
+        /* Peer port and the pool allocated for a tunnel. */
+        MMAL_PORT_T *connected;
+        MMAL_POOL_T *tunnel_pool;
+        pthread_t worker;
+        _Bool has_worker;
+        volatile int running;
+
+        MMAL_BOOL_T zero_copy, capture;
+        MMAL_DISPLAYREGION_T region;
+        MMAL_PARAMETER_CAMERA_RX_CONFIG_T rx_cfg;
+        /*
+         * Set by MMAL_PARAMETER_CROP in place of the crop of the format, so
+         * that it can change while buffers are processed.
+         */
+        pthread_mutex_t crop_mutex;
+        MMAL_RECT_T crop;
+        _Bool has_crop;
+
+        uint64_t buffers, dropped, busy_ns;
+    };
+
+    struct emu_component_type {
+        const char *name;
+        unsigned input_num, output_num;
+        /* Per-buffer processing latency in microseconds. */
+        const char *latency_env;
+        /* Called for each buffer sent to an input port. */
+        void (*process)(MMAL_COMPONENT_T *component, MMAL_PORT_T *input,
+                        MMAL_BUFFER_HEADER_T *buffer);
+        /* Called once per frame period while the component is enabled. */
+        void (*produce)(MMAL_COMPONENT_T *component);
+        MMAL_STATUS_T (*parameter_get)(MMAL_PORT_T *port,
+                                       MMAL_PARAMETER_HEADER_T *param);
+        /* Frees component->priv->state. */
+        void (*cleanup)(MMAL_COMPONENT_T *component);
+    };
+
+    struct MMAL_COMPONENT_PRIVATE_T {
+        const struct emu_component_type *type;
+        int refcount;
+        unsigned latency_us;
+        int32_t camera_num;
+        uint64_t sequence;
+        pthread_t source;
+        _Bool has_source;
+        volatile int running;
+        /*
+         * Held while an input buffer is processed or a source produces a
+         * frame, so that an output port is not disabled while the component
+         * is filling it.
+         */
+        pthread_mutex_t process_mutex;
+        void *state;
+        MMAL_COMPONENT_T *next;
+    };
+
+    /* core.c */
+    int64_t emu_time_us(void);
+    unsigned emu_getenv_uint(const char *name, const unsigned def);
+    uint32_t emu_frame_size(const MMAL_ES_FORMAT_T *format, uint32_t *stride,
+                            uint32_t *row_bytes);
+    MMAL_BUFFER_HEADER_T* emu_port_get_buffer(MMAL_PORT_T *port,
+                                              const _Bool wait);
+    void emu_port_deliver(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer);
+    void emu_port_drop(MMAL_PORT_T *port);
+
+    /* components.c */
+    const struct emu_component_type* emu_component_type_find(const char *name);
+
+#endif /* EMU_H */
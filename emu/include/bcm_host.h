@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Host-side stand-in for the part of bcm_host and dispmanx which librpigrafx
+ * uses. The display size can be set with RPIGRAFX_EMU_SCREEN_WIDTH and
+ * RPIGRAFX_EMU_SCREEN_HEIGHT (default: 1920x1080).
+ */
+
+#ifndef EMU_BCM_HOST_H
+#define EMU_BCM_HOST_H
+
+#include <stdint.h>
+#include <interface/vcos/vcos.h>
+
+    typedef uint32_t DISPMANX_DISPLAY_HANDLE_T;
+
+#define DISPMANX_NO_HANDLE 0
+#define DISPMANX_SUCCESS   0
+
+    typedef enum {
+        DISPMANX_NO_ROTATE = 0
+    } DISPMANX_TRANSFORM_T;
+
+    typedef enum {
+        VCOS_DISPLAY_INPUT_FORMAT_INVALID = 0,
+        VCOS_DISPLAY_INPUT_FORMAT_RGB888,
+        VCOS_DISPLAY_INPUT_FORMAT_RGB565
+    } DISPLAY_INPUT_FORMAT_T;
+
+    typedef struct {
+        int32_t width;
+        int32_t height;
+        DISPMANX_TRANSFORM_T transform;
+        DISPLAY_INPUT_FORMAT_T input_format;
+        uint32_t display_num;
+    } DISPMANX_MODEINFO_T;
+
+    void bcm_host_init(void);
+    void bcm_host_deinit(void);
+
+    DISPMANX_DISPLAY_HANDLE_T vc_dispmanx_display_open(uint32_t device);
+    int vc_dispmanx_display_close(DISPMANX_DISPLAY_HANDLE_T display);
+    int vc_dispmanx_display_get_info(DISPMANX_DISPLAY_HANDLE_T display,
+                                     DISPMANX_MODEINFO_T *pinfo);
+
+#endif /* EMU_BCM_HOST_H */
@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Host-side stand-in for the Multi-Media Abstraction Layer.
+ *
+ * Only the part of the MMAL API which librpigrafx and its tests use is
+ * declared here. Names, types and semantics follow the VideoCore userland
+ * headers so that src/mmal.c compiles unchanged against either of them.
+ */
+
+#ifndef EMU_MMAL_H
+#define EMU_MMAL_H
+
+#include <stdint.h>
+#include <interface/vcos/vcos.h>
+
+    /* mmal_common.h */
+
+    typedef int32_t MMAL_BOOL_T;
+#define MMAL_FALSE 0
+#define MMAL_TRUE  1
+
+    typedef uint32_t MMAL_FOURCC_T;
+#define MMAL_FOURCC(a, b, c, d) \
+    ((uint32_t) (a) | ((uint32_t) (b) << 8) | \
+     ((uint32_t) (c) << 16) | ((uint32_t) (d) << 24))
+
+#define MMAL_MAX(a, b) ((a) < (b) ? (b) : (a))
+#define MMAL_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MMAL_PARAM_UNUSED(a) (void) (a)
+
+#define MMAL_TIME_UNKNOWN (INT64_C(1) << 63)
+
+    typedef enum {
+        MMAL_SUCCESS = 0,
+        MMAL_ENOMEM,
+        MMAL_ENOSPC,
+        MMAL_EINVAL,
+        MMAL_ENOSYS,
+        MMAL_ENOENT,
+        MMAL_ENXIO,
+        MMAL_EIO,
+        MMAL_ESPIPE,
+        MMAL_ECORRUPT,
+        MMAL_ENOTREADY,
+        MMAL_ECONFIG,
+        MMAL_EISCONN,
+        MMAL_ENOTCONN,
+        MMAL_EAGAIN,
+        MMAL_EFAULT,
+        MMAL_STATUS_MAX = 0x7fffffff
+    } MMAL_STATUS_T;
+
+    const char* mmal_status_to_string(MMAL_STATUS_T status);
+
+    /* mmal_types.h */
+
+    typedef struct {
+        int32_t x, y, width, height;
+    } MMAL_RECT_T;
+
+    typedef struct {
+        int32_t num, den;
+    } MMAL_RATIONAL_T;
+
+    /* mmal_encodings.h */
+
+#define MMAL_ENCODING_I420   MMAL_FOURCC('I', '4', '2', '0')
+#define MMAL_ENCODING_RGB24  MMAL_FOURCC('R', 'G', 'B', '3')
+#define MMAL_ENCODING_BGR24  MMAL_FOURCC('B', 'G', 'R', '3')
+#define MMAL_ENCODING_RGBA   MMAL_FOURCC('R', 'G', 'B', 'A')
+#define MMAL_ENCODING_BGRA   MMAL_FOURCC('B', 'G', 'R', 'A')
+#define MMAL_ENCODING_OPAQUE MMAL_FOURCC('O', 'P', 'Q', 'V')
+
+#define MMAL_ENCODING_BAYER_SBGGR8   MMAL_FOURCC('B', 'A', '8', '1')
+#define MMAL_ENCODING_BAYER_SGBRG8   MMAL_FOURCC('G', 'B', 'R', 'G')
+#define MMAL_ENCODING_BAYER_SGRBG8   MMAL_FOURCC('G', 'R', 'B', 'G')
+#define MMAL_ENCODING_BAYER_SRGGB8   MMAL_FOURCC('R', 'G', 'G', 'B')
+#define MMAL_ENCODING_BAYER_SBGGR10P MMAL_FOURCC('p', 'B', 'A', 'A')
+#define MMAL_ENCODING_BAYER_SGRBG10P MMAL_FOURCC('p', 'g', 'A', 'A')
+#define MMAL_ENCODING_BAYER_SGBRG10P MMAL_FOURCC('p', 'G', 'A', 'A')
+#define MMAL_ENCODING_BAYER_SRGGB10P MMAL_FOURCC('p', 'R', 'A', 'A')
+#define MMAL_ENCODING_BAYER_SBGGR12P MMAL_FOURCC('B', 'Y', '1', '2')
+#define MMAL_ENCODING_BAYER_SGRBG12P MMAL_FOURCC('b', 'a', '1', '2')
+#define MMAL_ENCODING_BAYER_SGBRG12P MMAL_FOURCC('g', 'b', '1', '2')
+#define MMAL_ENCODING_BAYER_SRGGB12P MMAL_FOURCC('r', 'g', '1', '2')
+
+    /* mmal_format.h */
+
+    typedef enum {
+        MMAL_ES_TYPE_UNKNOWN,
+        MMAL_ES_TYPE_CONTROL,
+        MMAL_ES_TYPE_AUDIO,
+        MMAL_ES_TYPE_VIDEO,
+        MMAL_ES_TYPE_SUBPICTURE
+    } MMAL_ES_TYPE_T;
+
+    typedef struct {
+        uint32_t width, height;
+        MMAL_RECT_T crop;
+        MMAL_RATIONAL_T frame_rate;
+        MMAL_RATIONAL_T par;
+        MMAL_FOURCC_T color_space;
+    } MMAL_VIDEO_FORMAT_T;
+
+    typedef union {
+        MMAL_VIDEO_FORMAT_T video;
+    } MMAL_ES_SPECIFIC_FORMAT_T;
+
+    typedef struct MMAL_ES_FORMAT_T {
+        MMAL_ES_TYPE_T type;
+        MMAL_FOURCC_T encoding;
+        MMAL_FOURCC_T encoding_variant;
+        MMAL_ES_SPECIFIC_FORMAT_T *es;
+        uint32_t bitrate;
+        uint32_t flags;
+        uint32_t extradata_size;
+        uint8_t *extradata;
+    } MMAL_ES_FORMAT_T;
+
+    MMAL_ES_FORMAT_T* mmal_format_alloc(void);
+    void mmal_format_free(MMAL_ES_FORMAT_T *format);
+    void mmal_format_copy(MMAL_ES_FORMAT_T *format_dest,
+                          MMAL_ES_FORMAT_T *format_src);
+    MMAL_STATUS_T mmal_format_full_copy(MMAL_ES_FORMAT_T *format_dest,
+                                        MMAL_ES_FORMAT_T *format_src);
+
+    /* mmal_buffer.h */
+
+#define MMAL_BUFFER_HEADER_FLAG_EOS           (1 << 0)
+#define MMAL_BUFFER_HEADER_FLAG_FRAME_START   (1 << 1)
+#define MMAL_BUFFER_HEADER_FLAG_FRAME_END     (1 << 2)
+#define MMAL_BUFFER_HEADER_FLAG_FRAME \
+    (MMAL_BUFFER_HEADER_FLAG_FRAME_START | MMAL_BUFFER_HEADER_FLAG_FRAME_END)
+#define MMAL_BUFFER_HEADER_FLAG_KEYFRAME      (1 << 3)
+#define MMAL_BUFFER_HEADER_FLAG_DISCONTINUITY (1 << 4)
+#define MMAL_BUFFER_HEADER_FLAG_CONFIG        (1 << 5)
+#define MMAL_BUFFER_HEADER_FLAG_ENCRYPTED     (1 << 6)
+#define MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO (1 << 7)
+#define MMAL_BUFFER_HEADER_FLAG_SNAPSHOT      (1 << 8)
+#define MMAL_BUFFER_HEADER_FLAG_CORRUPTED     (1 << 9)
+
+    typedef struct MMAL_BUFFER_HEADER_T {
+        struct MMAL_BUFFER_HEADER_T *next;
+        struct MMAL_BUFFER_HEADER_PRIVATE_T *priv;
+        uint32_t cmd;
+        uint8_t *data;
+        uint32_t alloc_size;
+        uint32_t length;
+        uint32_t offset;
+        uint32_t flags;
+        int64_t pts;
+        int64_t dts;
+        void *type;
+        void *user_data;
+    } MMAL_BUFFER_HEADER_T;
+
+    void mmal_buffer_header_acquire(MMAL_BUFFER_HEADER_T *header);
+    void mmal_buffer_header_reset(MMAL_BUFFER_HEADER_T *header);
+    void mmal_buffer_header_release(MMAL_BUFFER_HEADER_T *header);
+    MMAL_STATUS_T mmal_buffer_header_replicate(MMAL_BUFFER_HEADER_T *dest,
+                                               MMAL_BUFFER_HEADER_T *src);
+
+    /* mmal_queue.h */
+
+    typedef struct MMAL_QUEUE_T MMAL_QUEUE_T;
+
+    MMAL_QUEUE_T* mmal_queue_create(void);
+    void mmal_queue_put(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer);
+    void mmal_queue_put_back(MMAL_QUEUE_T *queue,
+                             MMAL_BUFFER_HEADER_T *buffer);
+    MMAL_BUFFER_HEADER_T* mmal_queue_get(MMAL_QUEUE_T *queue);
+    MMAL_BUFFER_HEADER_T* mmal_queue_wait(MMAL_QUEUE_T *queue);
+    MMAL_BUFFER_HEADER_T* mmal_queue_timedwait(MMAL_QUEUE_T *queue,
+                                               VCOS_UNSIGNED timeout);
+    unsigned int mmal_queue_length(MMAL_QUEUE_T *queue);
+    void mmal_queue_destroy(MMAL_QUEUE_T *queue);
+
+    /* mmal_pool.h */
+
+    typedef struct MMAL_POOL_T {
+        MMAL_QUEUE_T *queue;
+        uint32_t headers_num;
+        MMAL_BUFFER_HEADER_T **header;
+    } MMAL_POOL_T;
+
+    typedef MMAL_BOOL_T (*MMAL_POOL_BH_CB_T)(MMAL_POOL_T *pool,
+                                             MMAL_BUFFER_HEADER_T *buffer,
+                                             void *userdata);
+
+    MMAL_POOL_T* mmal_pool_create(unsigned int headers, uint32_t payload_size);
+    void mmal_pool_destroy(MMAL_POOL_T *pool);
+    void mmal_pool_callback_set(MMAL_POOL_T *pool, MMAL_POOL_BH_CB_T cb,
+                                void *userdata);
+
+    /* mmal_parameters_common.h */
+
+#define MMAL_PARAMETER_GROUP_COMMON (0 << 16)
+#define MMAL_PARAMETER_GROUP_CAMERA (1 << 16)
+#define MMAL_PARAMETER_GROUP_VIDEO  (2 << 16)
+
+    enum {
+        MMAL_PARAMETER_UNUSED = MMAL_PARAMETER_GROUP_COMMON,
+        MMAL_PARAMETER_ZERO_COPY,
+        MMAL_PARAMETER_BUFFER_REQUIREMENTS,
+        /* The clock of the pts of the buffers, in microseconds. */
+        MMAL_PARAMETER_SYSTEM_TIME,
+        MMAL_PARAMETER_CROP
+    };
+
+    enum {
+        MMAL_PARAMETER_CAMERA_NUM = MMAL_PARAMETER_GROUP_CAMERA,
+        MMAL_PARAMETER_CAPTURE,
+        MMAL_PARAMETER_CAMERA_INFO,
+        MMAL_PARAMETER_CAMERA_RX_CONFIG
+    };
+
+    enum {
+        MMAL_PARAMETER_DISPLAYREGION = MMAL_PARAMETER_GROUP_VIDEO
+    };
+
+    typedef struct MMAL_PARAMETER_HEADER_T {
+        uint32_t id;
+        uint32_t size;
+    } MMAL_PARAMETER_HEADER_T;
+
+    typedef struct {
+        MMAL_PARAMETER_HEADER_T hdr;
+        MMAL_BOOL_T enable;
+    } MMAL_PARAMETER_BOOLEAN_T;
+
+    typedef struct {
+        MMAL_PARAMETER_HEADER_T hdr;
+        int32_t value;
+    } MMAL_PARAMETER_INT32_T;
+
+    typedef struct MMAL_PARAMETER_CROP_T {
+        MMAL_PARAMETER_HEADER_T hdr;
+        MMAL_RECT_T rect;
+    } MMAL_PARAMETER_CROP_T;
+
+    typedef struct {
+        MMAL_PARAMETER_HEADER_T hdr;
+        uint32_t value;
+    } MMAL_PARAMETER_UINT32_T;
+
+    typedef struct {
+        MMAL_PARAMETER_HEADER_T hdr;
+        uint64_t value;
+    } MMAL_PARAMETER_UINT64_T;
+
+    /* mmal_parameters_camera.h */
+
+#define MMAL_PARAMETER_CAMERA_INFO_MAX_CAMERAS 4
+#define MMAL_PARAMETER_CAMERA_INFO_MAX_STR_LEN 16
+
+    typedef struct {
+        uint32_t port_id;
+        uint32_t max_width;
+        uint32_t max_height;
+        MMAL_BOOL_T lens_present;
+        char camera_name[MMAL_PARAMETER_CAMERA_INFO_MAX_STR_LEN];
+    } MMAL_PARAMETER_CAMERA_INFO_CAMERA_T;
+
+    typedef struct {
+        MMAL_PARAMETER_HEADER_T hdr;
+        uint32_t num_cameras;
+        uint32_t num_flashes;
+        MMAL_PARAMETER_CAMERA_INFO_CAMERA_T
+                                 cameras[MMAL_PARAMETER_CAMERA_INFO_MAX_CAMERAS];
+    } MMAL_PARAMETER_CAMERA_INFO_T;
+
+    typedef enum {
+        MMAL_CAMERA_RX_CONFIG_DECODE_NONE,
+        MMAL_CAMERA_RX_CONFIG_DECODE_DPCM8TO10,
+        MMAL_CAMERA_RX_CONFIG_DECODE_DPCM7TO10,
+        MMAL_CAMERA_RX_CONFIG_DECODE_DPCM6TO10,
+        MMAL_CAMERA_RX_CONFIG_DECODE_DPCM8TO12,
+        MMAL_CAMERA_RX_CONFIG_DECODE_DPCM7TO12,
+        MMAL_CAMERA_RX_CONFIG_DECODE_DPCM6TO12,
+        MMAL_CAMERA_RX_CONFIG_DECODE_DPCM10TO14,
+        MMAL_CAMERA_RX_CONFIG_DECODE_DPCM8TO14,
+        MMAL_CAMERA_RX_CONFIG_DECODE_DPCM12TO16,
+        MMAL_CAMERA_RX_CONFIG_DECODE_DPCM10TO16,
+        MMAL_CAMERA_RX_CONFIG_DECODE_DPCM8TO16,
+        MMAL_CAMERA_RX_CONFIG_DECODE_DUMMY = 0x7fffffff
+    } MMAL_CAMERA_RX_CONFIG_DECODE;
+
+    typedef enum {
+        MMAL_CAMERA_RX_CONFIG_ENCODE_NONE,
+        MMAL_CAMERA_RX_CONFIG_ENCODE_DPCM10TO8,
+        MMAL_CAMERA_RX_CONFIG_ENCODE_DPCM12TO8,
+        MMAL_CAMERA_RX_CONFIG_ENCODE_DPCM14TO8,
+        MMAL_CAMERA_RX_CONFIG_ENCODE_DUMMY = 0x7fffffff
+    } MMAL_CAMERA_RX_CONFIG_ENCODE;
+
+    typedef enum {
+        MMAL_CAMERA_RX_CONFIG_UNPACK_NONE,
+        MMAL_CAMERA_RX_CONFIG_UNPACK_6,
+        MMAL_CAMERA_RX_CONFIG_UNPACK_7,
+        MMAL_CAMERA_RX_CONFIG_UNPACK_8,
+        MMAL_CAMERA_RX_CONFIG_UNPACK_10,
+        MMAL_CAMERA_RX_CONFIG_UNPACK_12,
+        MMAL_CAMERA_RX_CONFIG_UNPACK_14,
+        MMAL_CAMERA_RX_CONFIG_UNPACK_16,
+        MMAL_CAMERA_RX_CONFIG_UNPACK_DUMMY = 0x7fffffff
+    } MMAL_CAMERA_RX_CONFIG_UNPACK;
+
+    typedef enum {
+        MMAL_CAMERA_RX_CONFIG_PACK_NONE,
+        MMAL_CAMERA_RX_CONFIG_PACK_8,
+        MMAL_CAMERA_RX_CONFIG_PACK_10,
+        MMAL_CAMERA_RX_CONFIG_PACK_12,
+        MMAL_CAMERA_RX_CONFIG_PACK_14,
+        MMAL_CAMERA_RX_CONFIG_PACK_16,
+        MMAL_CAMERA_RX_CONFIG_PACK_RAW10,
+        MMAL_CAMERA_RX_CONFIG_PACK_RAW12,
+        MMAL_CAMERA_RX_CONFIG_PACK_DUMMY = 0x7fffffff
+    } MMAL_CAMERA_RX_CONFIG_PACK;
+
+    typedef struct {
+        MMAL_PARAMETER_HEADER_T hdr;
+        MMAL_CAMERA_RX_CONFIG_DECODE decode;
+        MMAL_CAMERA_RX_CONFIG_ENCODE encode;
+        MMAL_CAMERA_RX_CONFIG_UNPACK unpack;
+        MMAL_CAMERA_RX_CONFIG_PACK pack;
+        uint32_t data_lanes;
+        uint32_t encode_block_length;
+        uint32_t embedded_data_lines;
+        uint32_t image_id;
+    } MMAL_PARAMETER_CAMERA_RX_CONFIG_T;
+
+    /* mmal_parameters_video.h */
+
+    typedef enum {
+        MMAL_DISPLAY_ROT0 = 0
+    } MMAL_DISPLAYTRANSFORM_T;
+
+    typedef enum {
+        MMAL_DISPLAY_MODE_FILL = 0,
+        MMAL_DISPLAY_MODE_LETTERBOX = 1
+    } MMAL_DISPLAYMODE_T;
+
+#define MMAL_DISPLAY_SET_NONE        0
+#define MMAL_DISPLAY_SET_NUM         (1 << 0)
+#define MMAL_DISPLAY_SET_FULLSCREEN  (1 << 1)
+#define MMAL_DISPLAY_SET_TRANSFORM   (1 << 2)
+#define MMAL_DISPLAY_SET_DEST_RECT   (1 << 3)
+#define MMAL_DISPLAY_SET_SRC_RECT    (1 << 4)
+#define MMAL_DISPLAY_SET_MODE        (1 << 5)
+#define MMAL_DISPLAY_SET_PIXEL       (1 << 6)
+#define MMAL_DISPLAY_SET_NOASPECT    (1 << 7)
+#define MMAL_DISPLAY_SET_LAYER       (1 << 8)
+#define MMAL_DISPLAY_SET_COPYPROTECT (1 << 9)
+#define MMAL_DISPLAY_SET_ALPHA       (1 << 10)
+
+    typedef struct {
+        MMAL_PARAMETER_HEADER_T hdr;
+        uint32_t set;
+        uint32_t display_num;
+        MMAL_BOOL_T fullscreen;
+        MMAL_DISPLAYTRANSFORM_T transform;
+        MMAL_RECT_T dest_rect;
+        MMAL_RECT_T src_rect;
+        MMAL_BOOL_T noaspect;
+        MMAL_DISPLAYMODE_T mode;
+        uint32_t pixel_x, pixel_y;
+        int32_t layer;
+        MMAL_BOOL_T copyprotect_required;
+        uint32_t alpha;
+    } MMAL_DISPLAYREGION_T;
+
+    /* mmal_port.h */
+
+    typedef enum {
+        MMAL_PORT_TYPE_UNKNOWN = 0,
+        MMAL_PORT_TYPE_CONTROL,
+        MMAL_PORT_TYPE_INPUT,
+        MMAL_PORT_TYPE_OUTPUT,
+        MMAL_PORT_TYPE_CLOCK,
+        MMAL_PORT_TYPE_INVALID = 0xffffffff
+    } MMAL_PORT_TYPE_T;
+
+    typedef struct MMAL_PORT_T {
+        struct MMAL_PORT_PRIVATE_T *priv;
+        const char *name;
+        MMAL_PORT_TYPE_T type;
+        uint16_t index;
+        uint16_t index_all;
+        uint32_t is_enabled;
+        MMAL_ES_FORMAT_T *format;
+        uint32_t buffer_num_min;
+        uint32_t buffer_size_min;
+        uint32_t buffer_alignment_min;
+        uint32_t buffer_num_recommended;
+        uint32_t buffer_size_recommended;
+        uint32_t buffer_num;
+        uint32_t buffer_size;
+        struct MMAL_COMPONENT_T *component;
+        struct MMAL_PORT_USERDATA_T *userdata;
+        uint32_t capabilities;
+    } MMAL_PORT_T;
+
+    typedef void (*MMAL_PORT_BH_CB_T)(MMAL_PORT_T *port,
+                                      MMAL_BUFFER_HEADER_T *buffer);
+
+    MMAL_STATUS_T mmal_port_format_commit(MMAL_PORT_T *port);
+    MMAL_STATUS_T mmal_port_enable(MMAL_PORT_T *port, MMAL_PORT_BH_CB_T cb);
+    MMAL_STATUS_T mmal_port_disable(MMAL_PORT_T *port);
+    MMAL_STATUS_T mmal_port_flush(MMAL_PORT_T *port);
+    MMAL_STATUS_T mmal_port_parameter_set(MMAL_PORT_T *port,
+                                        const MMAL_PARAMETER_HEADER_T *param);
+    MMAL_STATUS_T mmal_port_parameter_get(MMAL_PORT_T *port,
+                                          MMAL_PARAMETER_HEADER_T *param);
+    MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T *port,
+                                        MMAL_BUFFER_HEADER_T *buffer);
+    MMAL_STATUS_T mmal_port_connect(MMAL_PORT_T *port, MMAL_PORT_T *other_port);
+    MMAL_STATUS_T mmal_port_disconnect(MMAL_PORT_T *port);
+    uint8_t* mmal_port_payload_alloc(MMAL_PORT_T *port, uint32_t payload_size);
+    void mmal_port_payload_free(MMAL_PORT_T *port, uint8_t *payload);
+    MMAL_POOL_T* mmal_port_pool_create(MMAL_PORT_T *port,
+                                       unsigned int headers,
+                                       uint32_t payload_size);
+    void mmal_port_pool_destroy(MMAL_PORT_T *port, MMAL_POOL_T *pool);
+
+    /* mmal_component.h */
+
+    typedef struct MMAL_COMPONENT_T {
+        struct MMAL_COMPONENT_PRIVATE_T *priv;
+        struct MMAL_COMPONENT_USERDATA_T *userdata;
+        const char *name;
+        uint32_t is_enabled;
+        MMAL_PORT_T *control;
+        uint32_t input_num;
+        MMAL_PORT_T **input;
+        uint32_t output_num;
+        MMAL_PORT_T **output;
+        uint32_t clock_num;
+        MMAL_PORT_T **clock;
+        uint32_t port_num;
+        MMAL_PORT_T **port;
+        uint32_t id;
+    } MMAL_COMPONENT_T;
+
+    MMAL_STATUS_T mmal_component_create(const char *name,
+                                        MMAL_COMPONENT_T **component);
+    void mmal_component_acquire(MMAL_COMPONENT_T *component);
+    MMAL_STATUS_T mmal_component_release(MMAL_COMPONENT_T *component);
+    MMAL_STATUS_T mmal_component_destroy(MMAL_COMPONENT_T *component);
+    MMAL_STATUS_T mmal_component_enable(MMAL_COMPONENT_T *component);
+    MMAL_STATUS_T mmal_component_disable(MMAL_COMPONENT_T *component);
+
+#endif /* EMU_MMAL_H */
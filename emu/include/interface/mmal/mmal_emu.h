@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Introspection interface of the host-side MMAL stand-in. This header does not
+ * exist in the VideoCore userland; include it only when HAVE_MMAL_EMU is
+ * defined.
+ */
+
+#ifndef EMU_MMAL_EMU_H
+#define EMU_MMAL_EMU_H
+
+#include <stdio.h>
+#include <interface/mmal/mmal.h>
+
+    typedef struct {
+        /* Name of the component the port belongs to. */
+        const char *component;
+        unsigned component_id;
+        MMAL_PORT_TYPE_T type;
+        unsigned index;
+        /* Buffers received from (input) or sent to (output) peers. */
+        uint64_t buffers;
+        /* Frames dropped because no buffer was available on this port. */
+        uint64_t dropped;
+        /* Deepest the pending-buffer queue of the port has been. */
+        unsigned max_queue_depth;
+        /* Time spent processing buffers of this port, in nanoseconds. */
+        uint64_t busy_ns;
+    } MMAL_EMU_PORT_STATS_T;
+
+    unsigned mmal_emu_get_port_stats(MMAL_EMU_PORT_STATS_T *stats,
+                                     const unsigned max);
+    void mmal_emu_print_stats(FILE *fp);
+
+#endif /* EMU_MMAL_EMU_H */
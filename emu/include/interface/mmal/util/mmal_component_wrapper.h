@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef EMU_MMAL_COMPONENT_WRAPPER_H
+#define EMU_MMAL_COMPONENT_WRAPPER_H
+
+#include <interface/mmal/mmal.h>
+
+    typedef struct MMAL_WRAPPER_T MMAL_WRAPPER_T;
+
+    typedef void (*MMAL_WRAPPER_CALLBACK_T)(MMAL_WRAPPER_T *wrapper);
+
+    struct MMAL_WRAPPER_T {
+        void *user_data;
+        MMAL_WRAPPER_CALLBACK_T callback;
+        MMAL_COMPONENT_T *component;
+        MMAL_STATUS_T status;
+        MMAL_PORT_T *control;
+        uint32_t input_num;
+        MMAL_PORT_T **input;
+        MMAL_POOL_T **input_pool;
+        uint32_t output_num;
+        MMAL_PORT_T **output;
+        MMAL_POOL_T **output_pool;
+        MMAL_QUEUE_T **output_queue;
+        int64_t time_setup;
+        int64_t time_enable;
+        int64_t time_disable;
+    };
+
+#define MMAL_WRAPPER_FLAG_WAIT                       1
+#define MMAL_WRAPPER_FLAG_PAYLOAD_ALLOCATE           2
+#define MMAL_WRAPPER_FLAG_PAYLOAD_USE_SHARED_MEMORY  4
+
+    MMAL_STATUS_T mmal_wrapper_create(MMAL_WRAPPER_T **ctx, const char *name);
+    MMAL_STATUS_T mmal_wrapper_destroy(MMAL_WRAPPER_T *ctx);
+    MMAL_STATUS_T mmal_wrapper_port_enable(MMAL_PORT_T *port, uint32_t flags);
+    MMAL_STATUS_T mmal_wrapper_port_disable(MMAL_PORT_T *port);
+    MMAL_STATUS_T mmal_wrapper_buffer_get_empty(MMAL_PORT_T *port,
+                                                MMAL_BUFFER_HEADER_T **buffer,
+                                                uint32_t flags);
+    MMAL_STATUS_T mmal_wrapper_buffer_get_full(MMAL_PORT_T *port,
+                                               MMAL_BUFFER_HEADER_T **buffer,
+                                               uint32_t flags);
+
+#endif /* EMU_MMAL_COMPONENT_WRAPPER_H */
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef EMU_MMAL_CONNECTION_H
+#define EMU_MMAL_CONNECTION_H
+
+#include <interface/mmal/mmal.h>
+
+#define MMAL_CONNECTION_FLAG_TUNNELLING               0x1
+#define MMAL_CONNECTION_FLAG_ALLOCATION_ON_INPUT      0x2
+#define MMAL_CONNECTION_FLAG_ALLOCATION_ON_OUTPUT     0x4
+#define MMAL_CONNECTION_FLAG_KEEP_BUFFER_REQUIREMENTS 0x8
+#define MMAL_CONNECTION_FLAG_DIRECT                   0x10
+#define MMAL_CONNECTION_FLAG_KEEP_PORT_FORMATS        0x20
+
+    typedef struct MMAL_CONNECTION_T MMAL_CONNECTION_T;
+
+    typedef void (*MMAL_CONNECTION_CALLBACK_T)(MMAL_CONNECTION_T *connection);
+
+    struct MMAL_CONNECTION_T {
+        void *user_data;
+        MMAL_CONNECTION_CALLBACK_T callback;
+        uint32_t is_enabled;
+        uint32_t flags;
+        MMAL_PORT_T *in;
+        MMAL_PORT_T *out;
+        MMAL_POOL_T *pool;
+        MMAL_QUEUE_T *queue;
+        const char *name;
+        int64_t time_setup;
+        int64_t time_enable;
+        int64_t time_disable;
+    };
+
+    MMAL_STATUS_T mmal_connection_create(MMAL_CONNECTION_T **connection,
+                                         MMAL_PORT_T *out, MMAL_PORT_T *in,
+                                         uint32_t flags);
+    void mmal_connection_acquire(MMAL_CONNECTION_T *connection);
+    MMAL_STATUS_T mmal_connection_release(MMAL_CONNECTION_T *connection);
+    MMAL_STATUS_T mmal_connection_destroy(MMAL_CONNECTION_T *connection);
+    MMAL_STATUS_T mmal_connection_enable(MMAL_CONNECTION_T *connection);
+    MMAL_STATUS_T mmal_connection_disable(MMAL_CONNECTION_T *connection);
+
+#endif /* EMU_MMAL_CONNECTION_H */
@@ -0,0 +1,19 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef EMU_MMAL_DEFAULT_COMPONENTS_H
+#define EMU_MMAL_DEFAULT_COMPONENTS_H
+
+#define MMAL_COMPONENT_DEFAULT_VIDEO_SPLITTER "vc.ril.video_splitter"
+#define MMAL_COMPONENT_DEFAULT_VIDEO_RENDERER "vc.ril.video_render"
+#define MMAL_COMPONENT_DEFAULT_CAMERA         "vc.ril.camera"
+#define MMAL_COMPONENT_DEFAULT_CAMERA_INFO    "vc.camera_info"
+#define MMAL_COMPONENT_DEFAULT_NULL_SINK      "vc.null_sink"
+
+#endif /* EMU_MMAL_DEFAULT_COMPONENTS_H */
@@ -0,0 +1,21 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef EMU_MMAL_UTIL_H
+#define EMU_MMAL_UTIL_H
+
+#include <interface/mmal/mmal.h>
+
+    MMAL_PORT_T* mmal_util_get_port(MMAL_COMPONENT_T *comp,
+                                    MMAL_PORT_TYPE_T type, unsigned index);
+    MMAL_STATUS_T mmal_util_set_display_region(MMAL_PORT_T *port,
+                                               MMAL_DISPLAYREGION_T *region);
+    const char* mmal_port_type_to_string(MMAL_PORT_TYPE_T type);
+
+#endif /* EMU_MMAL_UTIL_H */
@@ -0,0 +1,32 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#ifndef EMU_MMAL_UTIL_PARAMS_H
+#define EMU_MMAL_UTIL_PARAMS_H
+
+#include <interface/mmal/mmal.h>
+
+    MMAL_STATUS_T mmal_port_parameter_set_boolean(MMAL_PORT_T *port,
+                                                  uint32_t id,
+                                                  MMAL_BOOL_T value);
+    MMAL_STATUS_T mmal_port_parameter_get_boolean(MMAL_PORT_T *port,
+                                                  uint32_t id,
+                                                  MMAL_BOOL_T *value);
+    MMAL_STATUS_T mmal_port_parameter_set_int32(MMAL_PORT_T *port,
+                                                uint32_t id, int32_t value);
+    MMAL_STATUS_T mmal_port_parameter_get_int32(MMAL_PORT_T *port,
+                                                uint32_t id, int32_t *value);
+    MMAL_STATUS_T mmal_port_parameter_set_uint32(MMAL_PORT_T *port,
+                                                 uint32_t id, uint32_t value);
+    MMAL_STATUS_T mmal_port_parameter_get_uint32(MMAL_PORT_T *port,
+                                                 uint32_t id, uint32_t *value);
+    MMAL_STATUS_T mmal_port_parameter_get_uint64(MMAL_PORT_T *port,
+                                                 uint32_t id, uint64_t *value);
+
+#endif /* EMU_MMAL_UTIL_PARAMS_H */
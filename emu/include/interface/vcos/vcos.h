@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Minimal subset of VideoCore OS Abstraction Layer used by librpigrafx,
+ * implemented on top of POSIX for the host-side MMAL stand-in.
+ */
+
+#ifndef EMU_VCOS_H
+#define EMU_VCOS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+    typedef uint32_t VCOS_UNSIGNED;
+
+#define VCOS_ALIGN_UP(value, round_to) \
+    (((value) + (round_to) - 1) & ~((round_to) - 1))
+#define VCOS_ALIGN_DOWN(value, round_to) \
+    ((value) & ~((round_to) - 1))
+
+#ifndef ALIGN_UP
+#define ALIGN_UP(value, round_to) VCOS_ALIGN_UP(value, round_to)
+#endif /* ALIGN_UP */
+
+    static inline void vcos_sleep(uint32_t ms)
+    {
+        usleep(ms * 1000);
+    }
+
+#endif /* EMU_VCOS_H */
@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+#include <interface/mmal/mmal.h>
+#include <interface/mmal/util/mmal_component_wrapper.h>
+#include "emu.h"
+
+static void wrapper_control_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+    MMAL_PARAM_UNUSED(port);
+    mmal_buffer_header_release(buffer);
+}
+
+static void wrapper_input_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+    MMAL_PARAM_UNUSED(port);
+    mmal_buffer_header_release(buffer);
+}
+
+static void wrapper_output_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+    MMAL_WRAPPER_T *wrapper = (MMAL_WRAPPER_T*) port->userdata;
+
+    mmal_queue_put(wrapper->output_queue[port->index], buffer);
+    if (wrapper->callback != NULL)
+        wrapper->callback(wrapper);
+}
+
+static MMAL_BOOL_T wrapper_release_cb(MMAL_POOL_T *pool,
+                                      MMAL_BUFFER_HEADER_T *buffer,
+                                      void *userdata)
+{
+    MMAL_WRAPPER_T *wrapper = userdata;
+
+    mmal_queue_put(pool->queue, buffer);
+    if (wrapper->callback != NULL)
+        wrapper->callback(wrapper);
+    return MMAL_FALSE;
+}
+
+MMAL_STATUS_T mmal_wrapper_create(MMAL_WRAPPER_T **ctx, const char *name)
+{
+    MMAL_WRAPPER_T *wrapper = NULL;
+    MMAL_COMPONENT_T *component = NULL;
+    MMAL_STATUS_T status;
+    unsigned i;
+
+    status = mmal_component_create(name, &component);
+    if (status != MMAL_SUCCESS)
+        return status;
+
+    wrapper = calloc(1, sizeof(*wrapper));
+    if (wrapper == NULL) {
+        mmal_component_destroy(component);
+        return MMAL_ENOMEM;
+    }
+    wrapper->time_setup = emu_time_us();
+    wrapper->component = component;
+    wrapper->control = component->control;
+    wrapper->input_num = component->input_num;
+    wrapper->input = component->input;
+    wrapper->output_num = component->output_num;
+    wrapper->output = component->output;
+    wrapper->input_pool = calloc(component->input_num + 1,
+                                 sizeof(*wrapper->input_pool));
+    wrapper->output_pool = calloc(component->output_num + 1,
+                                  sizeof(*wrapper->output_pool));
+    wrapper->output_queue = calloc(component->output_num + 1,
+                                   sizeof(*wrapper->output_queue));
+    if (wrapper->input_pool == NULL || wrapper->output_pool == NULL
+            || wrapper->output_queue == NULL) {
+        status = MMAL_ENOMEM;
+        goto fail;
+    }
+    for (i = 0; i < component->output_num; i ++) {
+        wrapper->output_queue[i] = mmal_queue_create();
+        if (wrapper->output_queue[i] == NULL) {
+            status = MMAL_ENOMEM;
+            goto fail;
+        }
+    }
+    for (i = 0; i < component->port_num; i ++)
+        component->port[i]->userdata = (struct MMAL_PORT_USERDATA_T*) wrapper;
+
+    if ((status = mmal_port_enable(wrapper->control, wrapper_control_cb))
+                                                               != MMAL_SUCCESS)
+        goto fail;
+    if ((status = mmal_component_enable(component)) != MMAL_SUCCESS)
+        goto fail;
+
+    wrapper->time_setup = emu_time_us() - wrapper->time_setup;
+    *ctx = wrapper;
+    return MMAL_SUCCESS;
+
+fail:
+    mmal_wrapper_destroy(wrapper);
+    return status;
+}
+
+MMAL_STATUS_T mmal_wrapper_destroy(MMAL_WRAPPER_T *ctx)
+{
+    unsigned i;
+
+    mmal_component_disable(ctx->component);
+    for (i = 0; i < ctx->input_num; i ++)
+        if (ctx->input[i]->is_enabled)
+            mmal_wrapper_port_disable(ctx->input[i]);
+    for (i = 0; i < ctx->output_num; i ++)
+        if (ctx->output[i]->is_enabled)
+            mmal_wrapper_port_disable(ctx->output[i]);
+    for (i = 0; ctx->output_queue != NULL && i < ctx->output_num; i ++)
+        if (ctx->output_queue[i] != NULL)
+            mmal_queue_destroy(ctx->output_queue[i]);
+    free(ctx->input_pool);
+    free(ctx->output_pool);
+    free(ctx->output_queue);
+    mmal_component_destroy(ctx->component);
+    free(ctx);
+    return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_wrapper_port_enable(MMAL_PORT_T *port, uint32_t flags)
+{
+    MMAL_WRAPPER_T *wrapper = (MMAL_WRAPPER_T*) port->userdata;
+    const _Bool is_input = port->type == MMAL_PORT_TYPE_INPUT;
+    MMAL_POOL_T *pool;
+    MMAL_STATUS_T status;
+
+    if (port->buffer_num < port->buffer_num_min)
+        port->buffer_num = port->buffer_num_recommended;
+    if (port->buffer_size < port->buffer_size_min)
+        port->buffer_size = port->buffer_size_recommended;
+
+    pool = mmal_port_pool_create(port, port->buffer_num,
+                       (flags & MMAL_WRAPPER_FLAG_PAYLOAD_ALLOCATE)
+                                                       ? port->buffer_size : 0);
+    if (pool == NULL)
+        return MMAL_ENOMEM;
+    mmal_pool_callback_set(pool, wrapper_release_cb, wrapper);
+
+    status = mmal_port_enable(port,
+                              is_input ? wrapper_input_cb : wrapper_output_cb);
+    if (status != MMAL_SUCCESS) {
+        mmal_port_pool_destroy(port, pool);
+        return status;
+    }
+
+    if (is_input)
+        wrapper->input_pool[port->index] = pool;
+    else
+        wrapper->output_pool[port->index] = pool;
+    return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_wrapper_port_disable(MMAL_PORT_T *port)
+{
+    MMAL_WRAPPER_T *wrapper = (MMAL_WRAPPER_T*) port->userdata;
+    const _Bool is_input = port->type == MMAL_PORT_TYPE_INPUT;
+    MMAL_POOL_T **pool = is_input ? &wrapper->input_pool[port->index]
+                                  : &wrapper->output_pool[port->index];
+    MMAL_STATUS_T status;
+
+    status = mmal_port_disable(port);
+    if (status != MMAL_SUCCESS)
+        return status;
+    if (!is_input) {
+        MMAL_BUFFER_HEADER_T *buffer;
+        while ((buffer = mmal_queue_get(wrapper->output_queue[port->index]))
+                                                                       != NULL)
+            mmal_buffer_header_release(buffer);
+    }
+    mmal_port_pool_destroy(port, *pool);
+    *pool = NULL;
+    return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_wrapper_buffer_get_empty(MMAL_PORT_T *port,
+                                            MMAL_BUFFER_HEADER_T **buffer,
+                                            uint32_t flags)
+{
+    MMAL_WRAPPER_T *wrapper = (MMAL_WRAPPER_T*) port->userdata;
+    MMAL_POOL_T *pool = port->type == MMAL_PORT_TYPE_INPUT
+                            ? wrapper->input_pool[port->index]
+                            : wrapper->output_pool[port->index];
+
+    if (pool == NULL)
+        return MMAL_EINVAL;
+    if (flags & MMAL_WRAPPER_FLAG_WAIT)
+        *buffer = mmal_queue_wait(pool->queue);
+    else
+        *buffer = mmal_queue_get(pool->queue);
+    if (*buffer == NULL)
+        return MMAL_EAGAIN;
+    mmal_buffer_header_reset(*buffer);
+    return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_wrapper_buffer_get_full(MMAL_PORT_T *port,
+                                           MMAL_BUFFER_HEADER_T **buffer,
+                                           uint32_t flags)
+{
+    MMAL_WRAPPER_T *wrapper = (MMAL_WRAPPER_T*) port->userdata;
+
+    if (port->type != MMAL_PORT_TYPE_OUTPUT)
+        return MMAL_EINVAL;
+    if (flags & MMAL_WRAPPER_FLAG_WAIT)
+        *buffer = mmal_queue_wait(wrapper->output_queue[port->index]);
+    else
+        *buffer = mmal_queue_get(wrapper->output_queue[port->index]);
+    if (*buffer == NULL)
+        return MMAL_EAGAIN;
+    return MMAL_SUCCESS;
+}
@@ -12,7 +12,8 @@
 
     struct priv_rpigrafx_called {
         int main, mmal, dispmanx;
-    } priv_rpigrafx_called;
+    };
+    extern struct priv_rpigrafx_called priv_rpigrafx_called;
 
     extern int priv_rpigrafx_verbose;
 
@@ -21,9 +22,169 @@
     void print_error_core(const char *file, const int line, const char *func,
                           const char *fmt, ...);
 
+    /* arena.c */
+    struct priv_rpigrafx_arena {
+        uint8_t *base;
+        size_t size, used;
+    };
+    extern unsigned long priv_rpigrafx_num_heap_allocs;
+    void* priv_rpigrafx_malloc(const size_t size);
+    int priv_rpigrafx_memalign(void **pp, const size_t align,
+                               const size_t size);
+    void priv_rpigrafx_free(void *p);
+    int priv_rpigrafx_arena_init(struct priv_rpigrafx_arena *arena,
+                                 const size_t size);
+    void priv_rpigrafx_arena_finalize(struct priv_rpigrafx_arena *arena);
+    void* priv_rpigrafx_arena_alloc(struct priv_rpigrafx_arena *arena,
+                                    const size_t size);
+    void priv_rpigrafx_arena_reset(struct priv_rpigrafx_arena *arena);
+
+    /* awb.c */
+    struct priv_rpigrafx_awb {
+        rpigrafx_awb_mode_t mode;
+        /* Weight of the newest estimate; 1 follows it without smoothing. */
+        float speed;
+        _Bool is_locked;
+        /* R, G and B. */
+        float gains[3];
+    };
+    void priv_rpigrafx_awb_init(struct priv_rpigrafx_awb *awb,
+                                const float gain_r, const float gain_g,
+                                const float gain_b);
+    int priv_rpigrafx_awb_estimate(const rpigrafx_awb_mode_t mode,
+                                   const rpigrafx_bayer_stats_t *stats,
+                                   float gains[3]);
+    void priv_rpigrafx_awb_update(struct priv_rpigrafx_awb *awb,
+                                  const rpigrafx_bayer_stats_t *stats);
+
+    /* rawproc_neon.c */
+    void priv_rpigrafx_interpolate_neon(uint8_t *d, const uint8_t *up,
+                                        const uint8_t *cur, const uint8_t *dn,
+                                        const int32_t width,
+                                        const _Bool is_odd_row,
+                                        const _Bool is_edge_aware);
+
+    /* latency.c */
+    void priv_rpigrafx_latency_hist_add(rpigrafx_latency_hist_t *hist,
+                                        const uint64_t ns);
+    void priv_rpigrafx_latency_hist_read(const rpigrafx_latency_hist_t *hist,
+                                         rpigrafx_latency_hist_t *dst);
+    void priv_rpigrafx_latency_hist_clear(rpigrafx_latency_hist_t *hist);
+
+    /* profile.c */
+    extern _Bool priv_rpigrafx_is_profiling;
+    void priv_rpigrafx_atomic_max(uint64_t *p, const uint64_t value);
+    uint64_t priv_rpigrafx_profile_begin();
+    void priv_rpigrafx_profile_end(rpigrafx_stage_stats_t *stats,
+                                   const uint64_t start,
+                                   const uint64_t num_bytes);
+    void priv_rpigrafx_stage_stats_read(const rpigrafx_stage_stats_t *stats,
+                                        rpigrafx_stage_stats_t *dst);
+    void priv_rpigrafx_stage_stats_clear(rpigrafx_stage_stats_t *stats);
+
+    /* workers.c */
+#define PRIV_RPIGRAFX_MAX_WORKERS 16
+    struct priv_rpigrafx_workers;
+    struct priv_rpigrafx_workers* priv_rpigrafx_workers_create(const int
+                                                                  num_threads);
+    void priv_rpigrafx_workers_destroy(struct priv_rpigrafx_workers *workers);
+    int priv_rpigrafx_workers_num_threads(const struct priv_rpigrafx_workers
+                                                                     *workers);
+    uint64_t priv_rpigrafx_workers_task_ns(const struct priv_rpigrafx_workers
+                                                                     *workers,
+                                           const int task);
+    int priv_rpigrafx_workers_run(struct priv_rpigrafx_workers *workers,
+                                  const int num_tasks,
+                                  void (*func)(void *arg, const int task),
+                                  void *arg);
+
     /* mmal.c */
     int priv_rpigrafx_mmal_init();
     int priv_rpigrafx_mmal_finalize();
+    int priv_rpigrafx_get_frame_format(const rpigrafx_frame_config_t *fcp,
+                                       MMAL_FOURCC_T *encoding,
+                                       int32_t *width, int32_t *height,
+                                       int32_t *aligned_width,
+                                       int32_t *aligned_height,
+                                       uint32_t *size);
+
+    /* rawproc.c */
+    void priv_rpigrafx_bayer_stats_clear(rpigrafx_bayer_stats_t *stats);
+    void priv_rpigrafx_bayer_stats_add(rpigrafx_bayer_stats_t *dst,
+                                       const rpigrafx_bayer_stats_t *src);
+    int32_t priv_rpigrafx_raw10_stride(const int32_t width);
+    size_t priv_rpigrafx_demosaic_scratch_size(const rpigrafx_demosaic_t
+                                                                      demosaic,
+                                               const int32_t width);
+    void priv_rpigrafx_interpolate_scalar(uint8_t *d, const uint8_t *up,
+                                          const uint8_t *cur,
+                                          const uint8_t *dn, int32_t x,
+                                          const int32_t width,
+                                          const _Bool is_odd_row,
+                                          const _Bool is_edge_aware);
+    int priv_rpigrafx_raw10bggr_to_rgb888_gain(uint8_t *dst,
+                                               const int32_t dst_stride,
+                                               const uint8_t *src,
+                                               const int32_t src_stride,
+                                               const int32_t width,
+                                               const int32_t height,
+                                               const float gain_r,
+                                               const float gain_g,
+                                               const float gain_b,
+                                               const rpigrafx_demosaic_t
+                                                                      demosaic,
+                                               uint8_t *scratch);
+    int priv_rpigrafx_raw10bggr_to_rgb888_gain_rows(uint8_t *dst,
+                                                    const int32_t dst_stride,
+                                                    const uint8_t *src,
+                                                    const int32_t src_stride,
+                                                    const int32_t width,
+                                                    const int32_t height,
+                                                    const int32_t y_begin,
+                                                    const int32_t y_end,
+                                                    const float gain_r,
+                                                    const float gain_g,
+                                                    const float gain_b,
+                                                    const rpigrafx_demosaic_t
+                                                                      demosaic,
+                                                    uint8_t *scratch,
+                                                    rpigrafx_bayer_stats_t
+                                                                        *stats,
+                                                    const int stats_step);
+    int priv_rpigrafx_raw10bggr_to_rgb888_gain_ref(uint8_t *dst,
+                                                   const int32_t dst_stride,
+                                                   const uint8_t *src,
+                                                   const int32_t src_stride,
+                                                   const int32_t width,
+                                                   const int32_t height,
+                                                   const float gain_r,
+                                                   const float gain_g,
+                                                   const float gain_b,
+                                                   const rpigrafx_demosaic_t
+                                                                      demosaic,
+                                                   uint8_t *scratch);
+    int priv_rpigrafx_raw10bggr_to_raw8_gain_rows(uint8_t *dst,
+                                                  const int32_t dst_stride,
+                                                  const uint8_t *src,
+                                                  const int32_t src_stride,
+                                                  const int32_t width,
+                                                  const int32_t height,
+                                                  const int32_t y_begin,
+                                                  const int32_t y_end,
+                                                  const float gain_r,
+                                                  const float gain_g,
+                                                  const float gain_b);
+    int priv_rpigrafx_raw10bggr_stats_rows(const uint8_t *src,
+                                           const int32_t src_stride,
+                                           const int32_t width,
+                                           const int32_t height,
+                                           const int32_t y_begin,
+                                           const int32_t y_end,
+                                           const float gain_r,
+                                           const float gain_g,
+                                           const float gain_b,
+                                           rpigrafx_bayer_stats_t *stats,
+                                           const int stats_step);
 
     /* dispmanx.c */
     int priv_rpigrafx_dispmanx_init();
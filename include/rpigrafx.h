@@ -47,6 +47,226 @@
         RPIGRAFX_RAWCAM_IMX219_BINNING_MODE_NONE
     } rpigrafx_rawcam_imx219_binning_mode_t;
 
+    typedef enum {
+        RPIGRAFX_DEMOSAIC_NEAREST,
+        RPIGRAFX_DEMOSAIC_BILINEAR,
+        RPIGRAFX_DEMOSAIC_EDGE_AWARE
+    } rpigrafx_demosaic_t;
+
+    typedef enum {
+        RPIGRAFX_DROP_POLICY_BLOCK,
+        RPIGRAFX_DROP_POLICY_DROP_NEWEST,
+        RPIGRAFX_DROP_POLICY_DROP_OLDEST
+    } rpigrafx_drop_policy_t;
+
+    typedef enum {
+        RPIGRAFX_AWB_MODE_GREY_WORLD,
+        RPIGRAFX_AWB_MODE_WHITE_PATCH
+    } rpigrafx_awb_mode_t;
+
+    typedef enum {
+        RPIGRAFX_DELIVERY_FIFO,
+        RPIGRAFX_DELIVERY_LATEST
+    } rpigrafx_delivery_t;
+
+    /* Connections on the way from a camera to an output. */
+    typedef enum {
+        RPIGRAFX_HOP_CAMERA_SPLITTER,
+        RPIGRAFX_HOP_SPLITTER_ISP,
+        RPIGRAFX_HOP_ISP_RENDER,
+        RPIGRAFX_NUM_HOPS
+    } rpigrafx_hop_t;
+
+    typedef struct {
+        uint32_t num_buffers;
+        /* Times the pool had no buffer for the producer of the hop. */
+        uint64_t num_dry;
+    } rpigrafx_pool_stats_t;
+
+    /* How the frames of a camera are fanned out to an output. */
+    typedef struct {
+        /* video_splitters of the camera, the cascaded ones included. */
+        int num_splitters;
+        /* Splitters a frame goes through on the way to the output. */
+        int num_splitter_hops;
+        /* Time rpigrafx_finish_config took to set up the camera. */
+        uint64_t setup_ns;
+        /*
+         * Time the last rpigrafx_reconfig_camera_frame of the output took,
+         * or 0.
+         */
+        uint64_t reconfig_ns;
+        /* isps of the camera; identical outputs share one. */
+        int num_isps;
+        /* Outputs that the isp of the output feeds, the output included. */
+        int num_isp_consumers;
+    } rpigrafx_graph_info_t;
+
+    /* What is known of a frame of an output. Times are in nanoseconds. */
+    typedef struct {
+        /* Of the camera, in microseconds; MMAL_TIME_UNKNOWN if none. */
+        int64_t pts;
+        /* pts on CLOCK_MONOTONIC; 0 if pts is unknown. */
+        uint64_t sensor_ns;
+        /* CLOCK_MONOTONIC time at which the isp emitted the frame. */
+        uint64_t receive_ns;
+        /* Frames the isp emitted for the output before this one. */
+        uint64_t sequence;
+    } rpigrafx_frame_info_t;
+
+    /*
+     * How a set of frames of rpigrafx_capture_synced_frames or
+     * rpigrafx_capture_camera_frames matched.
+     */
+    typedef struct {
+        /* Between the sensor times of the oldest and newest frame. */
+        uint64_t skew_ns;
+        /* Frames taken and replaced for matching none of the others. */
+        uint64_t num_dropped;
+    } rpigrafx_sync_info_t;
+
+    /* Spans of the way of a frame from the sensor to the user. */
+    typedef enum {
+        RPIGRAFX_LATENCY_SENSOR_TO_ISP_OUT,
+        RPIGRAFX_LATENCY_ISP_OUT_TO_USER,
+        RPIGRAFX_LATENCY_SENSOR_TO_USER,
+        RPIGRAFX_NUM_LATENCIES
+    } rpigrafx_latency_t;
+
+#define RPIGRAFX_LATENCY_HIST_BINS 24
+
+    /*
+     * Bin 0 counts latencies under 1 us and bin n those in [2^(n-1), 2^n) us;
+     * the last bin also counts all the longer ones.
+     */
+    typedef struct {
+        uint64_t count[RPIGRAFX_LATENCY_HIST_BINS];
+        uint64_t num_samples;
+        uint64_t sum_us, max_us;
+    } rpigrafx_latency_hist_t;
+
+#define RPIGRAFX_STATS_HIST_BINS 16
+
+    /*
+     * Statistics of a raw frame, sampled on a grid of Bayer quads. Index 0, 1
+     * and 2 are R, G and B. Sums and histograms are of the 8-bit values
+     * before the gains; saturation is counted after them.
+     */
+    typedef struct {
+        uint32_t num_samples[3];
+        uint64_t sum[3];
+        uint32_t num_saturated[3];
+        uint32_t hist[3][RPIGRAFX_STATS_HIST_BINS];
+    } rpigrafx_bayer_stats_t;
+
+    /*
+     * Steps of getting a frame, for rpigrafx_get_stats. The ones named WAIT
+     * and TRIGGER wait on the VideoCore, except READY_WAIT, which waits on
+     * the rawcam producer thread; the others are work on the CPU.
+     */
+    typedef enum {
+        /* All of rpigrafx_capture_next_frame. */
+        RPIGRAFX_STAGE_CAPTURE,
+        /* Starting a capture on the camera capture port. */
+        RPIGRAFX_STAGE_TRIGGER,
+        /* Waiting for a raw frame from rawcam. */
+        RPIGRAFX_STAGE_RAW_WAIT,
+        /* Unpacking, gains, demosaicing and statistics, done in one pass. */
+        RPIGRAFX_STAGE_CONVERT,
+        /* AWB and the exposure tuner. */
+        RPIGRAFX_STAGE_TUNER,
+        /* Waiting for a converted frame in rawcam streaming mode. */
+        RPIGRAFX_STAGE_READY_WAIT,
+        /* Waiting for a free splitter input buffer. */
+        RPIGRAFX_STAGE_SPLITTER_INPUT_WAIT,
+        /* Handing a converted frame to the splitter. */
+        RPIGRAFX_STAGE_SPLITTER_SEND,
+        /* Waiting for the isp to emit a frame. */
+        RPIGRAFX_STAGE_ISP_WAIT,
+        RPIGRAFX_NUM_STAGES
+    } rpigrafx_stage_t;
+
+    typedef struct {
+        uint64_t num_calls;
+        uint64_t total_ns, max_ns;
+        /* Bytes read and written. */
+        uint64_t num_bytes;
+    } rpigrafx_stage_stats_t;
+
+    /* Time spent on a band of rows of the last rawcam frame. */
+    typedef struct {
+        int32_t y, height;
+        uint64_t ns;
+    } rpigrafx_band_timing_t;
+
+    /*
+     * Writes the frames of an output to a file on a thread of its own. See
+     * rpigrafx_open_recorder.
+     */
+    typedef struct rpigrafx_recorder rpigrafx_recorder_t;
+
+    typedef struct {
+        /* Frames taken by rpigrafx_record_frame and written to the file. */
+        uint64_t num_recorded, num_written;
+        uint64_t num_bytes;
+        /* Frames refused because every slot was full (DROP_NEWEST). */
+        uint64_t num_dropped;
+        /* Times rpigrafx_record_frame waited for a free slot (BLOCK). */
+        uint64_t num_blocked, blocked_ns;
+        /* Time the writer spent writing. */
+        uint64_t write_ns;
+        int num_slots;
+        /* Frames waiting for the writer, now and at most. */
+        int num_queued, max_queued;
+        /* Whether the file is written bypassing the page cache. */
+        _Bool is_direct;
+    } rpigrafx_recorder_stats_t;
+
+#define RPIGRAFX_RECORDING_MAGIC "RPGXREC1"
+#define RPIGRAFX_RECORDING_VERSION 1
+#define RPIGRAFX_RECORDING_ALIGN 4096
+#define RPIGRAFX_RECORDING_FRAME_OFFSET 64
+
+    /*
+     * A recording is this header, padded to RPIGRAFX_RECORDING_ALIGN bytes,
+     * followed by records of record_size bytes, so frame n is at
+     * RPIGRAFX_RECORDING_ALIGN + n * record_size. A record is a
+     * rpigrafx_recording_frame_t and, RPIGRAFX_RECORDING_FRAME_OFFSET bytes
+     * from its start, the frame as the isp emitted it. Integers are in the
+     * byte order of the host.
+     */
+    typedef struct {
+        char magic[8];
+        uint32_t version;
+        MMAL_FOURCC_T encoding;
+        int32_t width, height;
+        /*
+         * Of the buffer: rows are aligned_width pixels apart or, in packed
+         * raw, frame_size / aligned_height bytes apart.
+         */
+        int32_t aligned_width, aligned_height;
+        uint32_t frame_size, record_size;
+        /* 0 until the recorder is closed; the file size tells it then. */
+        uint64_t num_frames;
+    } rpigrafx_recording_header_t;
+
+    typedef struct {
+        /* Bytes of the frame in the record. */
+        uint32_t length;
+        uint32_t reserved;
+        /* As in rpigrafx_frame_info_t. */
+        int64_t pts;
+        uint64_t sensor_ns, receive_ns, sequence;
+    } rpigrafx_recording_frame_t;
+
+    /*
+     * Called with each frame of an output in callback mode, on a thread of
+     * the library. The frame is recycled when it returns unless it calls
+     * rpigrafx_hold_frame().
+     */
+    typedef void (*rpigrafx_frame_callback_t)(rpigrafx_frame_config_t *fcp,
+                                              void *frame, void *userdata);
+
     int rpigrafx_init()     __attribute__((constructor));
     int rpigrafx_finalize() __attribute__((destructor));
 
@@ -71,6 +291,21 @@
                                       rpigrafx_rawcam_imx219_binning_mode_t
                                                                    binning_mode,
                                       rpigrafx_frame_config_t *fcp);
+    int rpigrafx_config_replay(const int32_t camera_number, const char *path,
+                               const float fps, const _Bool is_looping);
+    int rpigrafx_config_rawcam_demosaic(const rpigrafx_demosaic_t demosaic,
+                                        rpigrafx_frame_config_t *fcp);
+    int rpigrafx_config_rawcam_num_threads(const int num_threads,
+                                           rpigrafx_frame_config_t *fcp);
+    int rpigrafx_config_rawcam_stats(const int step,
+                                     rpigrafx_frame_config_t *fcp);
+    int rpigrafx_config_rawcam_awb(const rpigrafx_awb_mode_t mode,
+                                   const float speed,
+                                   rpigrafx_frame_config_t *fcp);
+    int rpigrafx_config_rawcam_streaming(const int queue_depth,
+                                         const rpigrafx_drop_policy_t
+                                                                   drop_policy,
+                                         rpigrafx_frame_config_t *fcp);
     int rpigrafx_config_camera_port(const int32_t camera_number,
                                     const rpigrafx_camera_port_t camera_port);
     int rpigrafx_config_camera_frame_render(const _Bool is_fullscreen,
@@ -78,13 +313,86 @@
                                             const int32_t width, const int32_t height,
                                             const int32_t layer,
                                             rpigrafx_frame_config_t *fcp);
+    int rpigrafx_config_camera_frame_roi(const float x, const float y,
+                                         const float width, const float height,
+                                         rpigrafx_frame_config_t *fcp);
+    int rpigrafx_config_camera_frame_delivery(const rpigrafx_delivery_t
+                                                                      delivery,
+                                              rpigrafx_frame_config_t *fcp);
+    int rpigrafx_config_pool_depth(const rpigrafx_hop_t hop,
+                                   const int num_buffers,
+                                   rpigrafx_frame_config_t *fcp);
     int rpigrafx_finish_config();
+    int rpigrafx_reconfig_camera_frame(const int32_t width,
+                                       const int32_t height,
+                                       const MMAL_FOURCC_T encoding,
+                                       rpigrafx_frame_config_t *fcp);
 
     void rpigrafx_set_verbose(const int verbose);
+    void rpigrafx_set_profiling(const _Bool is_enabled);
+    unsigned long rpigrafx_get_num_heap_allocs();
 
     int rpigrafx_capture_next_frame(rpigrafx_frame_config_t *fcp);
+    int rpigrafx_try_capture_next_frame(rpigrafx_frame_config_t *fcp,
+                                        _Bool *is_captured);
+    int rpigrafx_get_frame_fd(rpigrafx_frame_config_t *fcp);
+    int rpigrafx_capture_camera_frames(rpigrafx_frame_config_t *const *fcps,
+                                       const int num, const int timeout_ms,
+                                       rpigrafx_sync_info_t *info);
+    int rpigrafx_capture_synced_frames(rpigrafx_frame_config_t *const *fcps,
+                                       const int num,
+                                       const uint64_t tolerance_ns,
+                                       const int timeout_ms,
+                                       rpigrafx_sync_info_t *info);
+    int rpigrafx_set_frame_callback(rpigrafx_frame_config_t *fcp,
+                                    rpigrafx_frame_callback_t func,
+                                    void *userdata);
+    int rpigrafx_hold_frame(rpigrafx_frame_config_t *fcp);
+    int rpigrafx_release_frame(rpigrafx_frame_config_t *fcp, void *frame);
     void* rpigrafx_get_frame(rpigrafx_frame_config_t *fcp);
     int rpigrafx_free_frame(rpigrafx_frame_config_t *fcp);
+    uint64_t rpigrafx_get_num_dropped_frames(rpigrafx_frame_config_t *fcp);
+    int rpigrafx_get_frame_info(rpigrafx_frame_config_t *fcp,
+                                rpigrafx_frame_info_t *info);
+    int rpigrafx_get_latency_hists(rpigrafx_frame_config_t *fcp,
+                                   rpigrafx_latency_hist_t
+                                               hists[RPIGRAFX_NUM_LATENCIES]);
+    void rpigrafx_reset_latency_hists(rpigrafx_frame_config_t *fcp);
+    int rpigrafx_get_stats(rpigrafx_frame_config_t *fcp,
+                           rpigrafx_stage_stats_t stats[RPIGRAFX_NUM_STAGES]);
+    void rpigrafx_reset_stats(rpigrafx_frame_config_t *fcp);
+    int rpigrafx_get_graph_info(rpigrafx_frame_config_t *fcp,
+                                rpigrafx_graph_info_t *info);
+    int rpigrafx_get_camera_frame_roi(rpigrafx_frame_config_t *fcp,
+                                      MMAL_RECT_T *rect);
+    int rpigrafx_get_pool_stats(rpigrafx_frame_config_t *fcp,
+                                rpigrafx_pool_stats_t
+                                                   stats[RPIGRAFX_NUM_HOPS]);
+    int rpigrafx_get_rawcam_band_timings(rpigrafx_frame_config_t *fcp,
+                                         rpigrafx_band_timing_t *timings,
+                                         int *num_bands);
+    int rpigrafx_get_rawcam_stats(rpigrafx_frame_config_t *fcp,
+                                  rpigrafx_bayer_stats_t *stats);
+    int rpigrafx_lock_rawcam_awb(const _Bool is_locked,
+                                 rpigrafx_frame_config_t *fcp);
+    int rpigrafx_set_rawcam_awb_gains(const float gain_r, const float gain_g,
+                                      const float gain_b,
+                                      rpigrafx_frame_config_t *fcp);
+    int rpigrafx_get_rawcam_awb_gains(rpigrafx_frame_config_t *fcp,
+                                      float *gain_r, float *gain_g,
+                                      float *gain_b);
+    int rpigrafx_get_rawcam_stream_stats(rpigrafx_frame_config_t *fcp,
+                                         uint64_t *num_frames,
+                                         uint64_t *num_dropped);
+    int rpigrafx_open_recorder(const char *path,
+                               rpigrafx_frame_config_t *fcp,
+                               const int num_slots,
+                               const rpigrafx_drop_policy_t drop_policy,
+                               rpigrafx_recorder_t **recp);
+    int rpigrafx_record_frame(rpigrafx_recorder_t *rec, const void *frame);
+    int rpigrafx_get_recorder_stats(rpigrafx_recorder_t *rec,
+                                    rpigrafx_recorder_stats_t *stats);
+    int rpigrafx_close_recorder(rpigrafx_recorder_t *rec);
     /*void* rpigrafx_get_output_buffer(rpigrafx_frame_config_t *fcp);*/
     /*void* rpigrafx_get_input_buffer(rpigrafx_frame_config_t *fcp);*/
     int rpigrafx_register_frame_pool_to_qmkl(rpigrafx_frame_config_t *fcp);
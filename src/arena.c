@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Scratch arena for per-frame intermediates.
+ *
+ * An arena is allocated once when the configuration is finished and is
+ * rewound at the start of every frame, so capturing does not touch the heap.
+ */
+
+#include "rpigrafx.h"
+#include "local.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#define ARENA_ALIGN 32
+
+unsigned long priv_rpigrafx_num_heap_allocs = 0;
+
+/* Allocations may be made from several threads, by recorders for one. */
+static void count_heap_alloc()
+{
+    __atomic_add_fetch(&priv_rpigrafx_num_heap_allocs, 1, __ATOMIC_RELAXED);
+}
+
+void* priv_rpigrafx_malloc(const size_t size)
+{
+    count_heap_alloc();
+    return malloc(size);
+}
+
+/* posix_memalign that is counted; returns its error number. */
+int priv_rpigrafx_memalign(void **pp, const size_t align, const size_t size)
+{
+    const int err = posix_memalign(pp, align, size);
+
+    if (err == 0)
+        count_heap_alloc();
+    return err;
+}
+
+void priv_rpigrafx_free(void *p)
+{
+    free(p);
+}
+
+int priv_rpigrafx_arena_init(struct priv_rpigrafx_arena *arena,
+                             const size_t size)
+{
+    int ret = 0;
+
+    arena->size = VCOS_ALIGN_UP(size, ARENA_ALIGN);
+    arena->used = 0;
+    arena->base = NULL;
+    if (arena->size == 0)
+        goto end;
+
+    if ((errno = priv_rpigrafx_memalign((void**) &arena->base, ARENA_ALIGN,
+                                        arena->size))) {
+        print_error("Failed to allocate arena of %zu bytes: %s",
+                    arena->size, strerror(errno));
+        arena->base = NULL;
+        arena->size = 0;
+        ret = 1;
+        goto end;
+    }
+
+    /* Fault the pages in now rather than on the first frame. */
+    memset(arena->base, 0, arena->size);
+
+end:
+    return ret;
+}
+
+void priv_rpigrafx_arena_finalize(struct priv_rpigrafx_arena *arena)
+{
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = arena->used = 0;
+}
+
+void* priv_rpigrafx_arena_alloc(struct priv_rpigrafx_arena *arena,
+                                const size_t size)
+{
+    const size_t aligned = VCOS_ALIGN_UP(size, ARENA_ALIGN);
+    void *p = NULL;
+
+    if (arena->size - arena->used < aligned) {
+        print_error("Arena exhausted: %zu of %zu bytes used, %zu requested",
+                    arena->used, arena->size, size);
+        goto end;
+    }
+    p = arena->base + arena->used;
+    arena->used += aligned;
+
+end:
+    return p;
+}
+
+void priv_rpigrafx_arena_reset(struct priv_rpigrafx_arena *arena)
+{
+    arena->used = 0;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Auto white balance for rawcam.
+ *
+ * The gains are estimated from the decimated Bayer statistics that the
+ * conversion of a frame gathers and are applied by the gain stage of the
+ * next frame. The statistics are taken before the gains, so the estimate does
+ * not depend on the gains currently applied.
+ */
+
+#include "rpigrafx.h"
+#include "local.h"
+
+/* Fewer samples than this per channel leave the gains as they are. */
+#define MIN_SAMPLES 64
+/* Nor do channels darker than this, where noise dominates. */
+#define MIN_LEVEL 4.0f
+#define MIN_GAIN 0.125f
+#define MAX_GAIN 8.0f
+/* The white patch is the brightest this fraction of the samples. */
+#define WHITE_PATCH_FRACTION 0.02f
+
+void priv_rpigrafx_awb_init(struct priv_rpigrafx_awb *awb,
+                            const float gain_r, const float gain_g,
+                            const float gain_b)
+{
+    awb->mode = RPIGRAFX_AWB_MODE_GREY_WORLD;
+    awb->speed = 0.25f;
+    awb->is_locked = 0;
+    awb->gains[0] = gain_r;
+    awb->gains[1] = gain_g;
+    awb->gains[2] = gain_b;
+}
+
+static float mean(const rpigrafx_bayer_stats_t *stats, const int c)
+{
+    return (float) stats->sum[c] / stats->num_samples[c];
+}
+
+/*
+ * The level below which all but WHITE_PATCH_FRACTION of the samples lie,
+ * interpolated linearly within the histogram bin it falls in, or 0 if it falls
+ * in the lowest bin.
+ */
+static float white_level(const rpigrafx_bayer_stats_t *stats, const int c)
+{
+    const float bin_width = 256.0f / RPIGRAFX_STATS_HIST_BINS;
+    const float target = stats->num_samples[c] * WHITE_PATCH_FRACTION;
+    float above = 0;
+    int i;
+
+    for (i = RPIGRAFX_STATS_HIST_BINS - 1; i > 0; i --) {
+        const uint32_t n = stats->hist[c][i];
+        if (above + n >= target)
+            return bin_width * (i + 1 - (target - above) / n);
+        above += n;
+    }
+    /* Nothing brighter than the lowest bin to go on. */
+    return 0;
+}
+
+static float clamp_gain(const float gain)
+{
+    return gain < MIN_GAIN ? MIN_GAIN : gain > MAX_GAIN ? MAX_GAIN : gain;
+}
+
+int priv_rpigrafx_awb_estimate(const rpigrafx_awb_mode_t mode,
+                               const rpigrafx_bayer_stats_t *stats,
+                               float gains[3])
+{
+    float level[3];
+    int c;
+
+    for (c = 0; c < 3; c ++)
+        if (stats->num_samples[c] < MIN_SAMPLES)
+            return 1;
+
+    for (c = 0; c < 3; c ++) {
+        switch (mode) {
+            case RPIGRAFX_AWB_MODE_GREY_WORLD:
+                level[c] = mean(stats, c);
+                break;
+            case RPIGRAFX_AWB_MODE_WHITE_PATCH:
+                level[c] = white_level(stats, c);
+                break;
+            default:
+                print_error("Invalid AWB mode: %d", mode);
+                return 1;
+        }
+        if (level[c] < MIN_LEVEL)
+            return 1;
+    }
+
+    /* G is the reference so that the overall brightness is kept. */
+    for (c = 0; c < 3; c ++)
+        gains[c] = clamp_gain(level[1] / level[c]);
+    return 0;
+}
+
+void priv_rpigrafx_awb_update(struct priv_rpigrafx_awb *awb,
+                              const rpigrafx_bayer_stats_t *stats)
+{
+    float target[3];
+    int c;
+
+    if (awb->is_locked)
+        return;
+    if (priv_rpigrafx_awb_estimate(awb->mode, stats, target))
+        return;
+
+    /* Move a part of the way each frame so the colour does not flicker. */
+    for (c = 0; c < 3; c ++)
+        awb->gains[c] += awb->speed * (target[c] - awb->gains[c]);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Latency histograms.
+ *
+ * They are updated on the threads that move the frames and read by the user
+ * at any time, so every field is accessed atomically and without a lock. A
+ * reader may see a sample counted in one field and not yet in another.
+ */
+
+#include "rpigrafx.h"
+#include "local.h"
+
+static int bin_of(const uint64_t us)
+{
+    int bin = 0;
+
+    if (us != 0)
+        bin = 64 - __builtin_clzll(us);
+    return bin < RPIGRAFX_LATENCY_HIST_BINS
+           ? bin : RPIGRAFX_LATENCY_HIST_BINS - 1;
+}
+
+void priv_rpigrafx_latency_hist_add(rpigrafx_latency_hist_t *hist,
+                                    const uint64_t ns)
+{
+    const uint64_t us = ns / 1000;
+
+    __atomic_add_fetch(&hist->count[bin_of(us)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hist->sum_us, us, __ATOMIC_RELAXED);
+    priv_rpigrafx_atomic_max(&hist->max_us, us);
+    __atomic_add_fetch(&hist->num_samples, 1, __ATOMIC_RELAXED);
+}
+
+void priv_rpigrafx_latency_hist_read(const rpigrafx_latency_hist_t *hist,
+                                     rpigrafx_latency_hist_t *dst)
+{
+    int i;
+
+    for (i = 0; i < RPIGRAFX_LATENCY_HIST_BINS; i ++)
+        dst->count[i] = __atomic_load_n(&hist->count[i], __ATOMIC_RELAXED);
+    dst->num_samples = __atomic_load_n(&hist->num_samples, __ATOMIC_RELAXED);
+    dst->sum_us = __atomic_load_n(&hist->sum_us, __ATOMIC_RELAXED);
+    dst->max_us = __atomic_load_n(&hist->max_us, __ATOMIC_RELAXED);
+}
+
+void priv_rpigrafx_latency_hist_clear(rpigrafx_latency_hist_t *hist)
+{
+    int i;
+
+    for (i = 0; i < RPIGRAFX_LATENCY_HIST_BINS; i ++)
+        __atomic_store_n(&hist->count[i], 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&hist->num_samples, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&hist->sum_us, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&hist->max_us, 0, __ATOMIC_RELAXED);
+}
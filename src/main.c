@@ -60,6 +60,7 @@ int rpigrafx_finalize()
     }
 
     priv_rpigrafx_verbose = 0;
+    priv_rpigrafx_is_profiling = 0;
 
 end:
     priv_rpigrafx_called.main --;
@@ -70,3 +71,19 @@ void rpigrafx_set_verbose(const int verbose)
 {
     priv_rpigrafx_verbose = verbose;
 }
+
+/* Turns the per-stage counters of rpigrafx_get_stats on or off. */
+void rpigrafx_set_profiling(const _Bool is_enabled)
+{
+    __atomic_store_n(&priv_rpigrafx_is_profiling, is_enabled,
+                     __ATOMIC_RELAXED);
+}
+
+/*
+ * Number of heap allocations made by the library so far. Capturing does not
+ * allocate once configured, so this stays the same across frames.
+ */
+unsigned long rpigrafx_get_num_heap_allocs()
+{
+    return __atomic_load_n(&priv_rpigrafx_num_heap_allocs, __ATOMIC_RELAXED);
+}
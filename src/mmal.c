@@ -16,6 +16,16 @@
 #include "rpigrafx.h"
 #include "local.h"
 #include "config.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #ifdef HAVE_RPICAM
 #include <rpicam.h>
@@ -31,9 +41,19 @@
 
 
 #define MAX_CAMERAS          MMAL_PARAMETER_CAMERA_INFO_MAX_CAMERAS
-#define NUM_SPLITTER_OUTPUTS 4
+/* Outputs of a camera, and of one video_splitter. */
+#define MAX_OUTPUTS 16
+#define SPLITTER_PORTS 4
+/* Enough cascaded splitters to fan a camera out to MAX_OUTPUTS. */
+#define MAX_SPLITTERS \
+    (1 + (MAX_OUTPUTS - SPLITTER_PORTS + SPLITTER_PORTS - 2) \
+         / (SPLITTER_PORTS - 1))
 #define CAMERA_PREVIEW_PORT 0
 #define CAMERA_CAPTURE_PORT 2
+/* Frames of an output that the user can hold at a time in callback mode. */
+#define MAX_HELD_FRAMES 8
+/* How often blocked rawcam producers and consumers check for errors. */
+#define STREAM_POLL_MS 100
 
 static int32_t num_cameras = 0;
 
@@ -104,6 +124,26 @@ static int32_t num_cameras = 0;
  *   [0]    [0]    [0]    [0]
  *  render render render render
  *
+ * A replay (rpigrafx_config_replay) takes the place of rawcam#: the frames
+ * are read from a mapped recording and either demosaiced as above or, for
+ * RGB24 recordings, copied to the splitter#.
+ *
+ * With more than four outputs, ports of the splitter feed further splitters
+ * instead of isps, breadth first, so that a frame goes through as few of them
+ * as possible. Five outputs, for example, are fanned out as:
+ *                splitter
+ *   [0]        [1]    [2]    [3]
+ *    /          /      /      /
+ *   [0]        [0]    [0]    [0]
+ * splitter     isp    isp    isp
+ *  [0] [1]
+ *   /   /
+ *  [0] [0]
+ *  isp isp
+ *
+ * Outputs that ask for the same size and encoding are fed by one isp and its
+ * render, and get replicas of its frames (see share_isps).
+ *
  * However, rawcam is used and use_isp_for_demosaicing is set,
  * another isp instance is used for demosaicing.
  *            rawcam
@@ -127,6 +167,29 @@ static int32_t num_cameras = 0;
  *  render render render render
  */
 
+/*
+ * ** Threads **
+ *
+ * Configuration, rpigrafx_finish_config and the teardown are made from one
+ * thread while nothing else runs. After that, each frame config may be used
+ * by one thread at a time, and different ones in parallel: there is no lock
+ * over the whole library. What the outputs of a camera share is either
+ * atomic (statistics, profiles, latency histograms), a thread-safe MMAL
+ * queue, or guarded by a lock of the camera or of the isp:
+ *   - isp_frames[][].mutex orders the stamping of the frames an isp emits.
+ *     No one waits for it: whoever holds it collects for the others.
+ *   - A frame of an isp shared by several outputs goes back to the isp when
+ *     the last of them releases it, which an atomic count tells.
+ *   - cameras_config[].capture_mutex serialises the synchronous rawcam and
+ *     replay captures of the outputs of a camera, which convert the frame on
+ *     the calling thread. The streaming mode has its producer do that.
+ *   - cameras_config[].stats_mutex guards the statistics, AWB state and band
+ *     timings of a rawcam.
+ * The outputs of different cameras thus share nothing but the MMAL service.
+ * rpigrafx_reconfig_camera_frame rebuilds the isp of one output while the
+ * others go on; it takes nothing but the splitter port of that output away.
+ */
+
 /*
  * Because raw image from camera won't be directly passed to render, we need to
  * allocate port pools for rawcam->output[0] and splitter->input[0] manually,
@@ -142,12 +205,41 @@ static MMAL_WRAPPER_T *cpw_rawcams[MAX_CAMERAS];
 static MMAL_COMPONENT_T *cp_splitters[MAX_CAMERAS];
 static MMAL_WRAPPER_T *cpw_splitters[MAX_CAMERAS];
 static MMAL_COMPONENT_T *cp_nulls[MAX_CAMERAS];
-static MMAL_COMPONENT_T *cp_isps[MAX_CAMERAS][NUM_SPLITTER_OUTPUTS];
-static MMAL_COMPONENT_T *cp_renders[MAX_CAMERAS][NUM_SPLITTER_OUTPUTS];
+static MMAL_COMPONENT_T *cp_isps[MAX_CAMERAS][MAX_OUTPUTS];
+static MMAL_COMPONENT_T *cp_renders[MAX_CAMERAS][MAX_OUTPUTS];
 static MMAL_CONNECTION_T *conn_camera_nulls[MAX_CAMERAS];
 static MMAL_CONNECTION_T *conn_camera_splitters[MAX_CAMERAS];
-static MMAL_CONNECTION_T *conn_splitters_isps[MAX_CAMERAS][NUM_SPLITTER_OUTPUTS];
-static MMAL_CONNECTION_T *conn_isps_renders[MAX_CAMERAS][NUM_SPLITTER_OUTPUTS];
+static MMAL_CONNECTION_T *conn_splitters_isps[MAX_CAMERAS][MAX_OUTPUTS];
+static MMAL_CONNECTION_T *conn_isps_renders[MAX_CAMERAS][MAX_OUTPUTS];
+/* Splitters fed by another splitter; [i][0] is unused. */
+static MMAL_COMPONENT_T *cp_cascades[MAX_CAMERAS][MAX_SPLITTERS];
+static MMAL_CONNECTION_T *conn_cascades[MAX_CAMERAS][MAX_SPLITTERS];
+
+/* A rawcam frame being converted by the workers, split into row bands. */
+struct rawcam_job {
+    struct cameras_config *cfg;
+    uint8_t *dst;
+    const uint8_t *src;
+    /* Bytes between rows of src. */
+    int32_t src_stride;
+    float gain_r, gain_g, gain_b;
+    int num_bands;
+    struct rawcam_band {
+        int32_t y_begin, y_end;
+        uint8_t *demosaic_scratch;
+        rpigrafx_bayer_stats_t stats;
+        int ret;
+    } bands[PRIV_RPIGRAFX_MAX_WORKERS];
+};
+
+/* A raw frame of rawcam or of a replay, waiting to be converted. */
+struct raw_frame {
+    const uint8_t *data;
+    /* In microseconds, in the clock of the firmware for rawcam. */
+    int64_t pts;
+    /* The rawcam buffer holding data, or NULL for replay. */
+    MMAL_BUFFER_HEADER_T *header;
+};
 
 static struct cameras_config {
     _Bool is_used;
@@ -156,19 +248,121 @@ static struct cameras_config {
     unsigned camera_output_port_index;
     _Bool use_camera_capture_port;
 
+    /*
+     * The outputs are fanned out by a tree of video_splitters. Splitter 0 is
+     * fed by the camera and each of the others by a port of one before it;
+     * see plan_splitters.
+     */
     struct splitter_config {
         int next_output_idx;
+        int num_splitters;
+        struct splitter_port {
+            int splitter, port;
+        } feeds[MAX_SPLITTERS], outputs[MAX_OUTPUTS];
+        /* Splitters on the way to each output. */
+        int num_hops[MAX_OUTPUTS];
     } splitter;
+    /* Time rpigrafx_finish_config took to set up the camera. */
+    uint64_t setup_ns;
     struct isp_config {
         int32_t width, height;
         MMAL_FOURCC_T encoding;
         _Bool is_zero_copy_rendering;
-    } isp[NUM_SPLITTER_OUTPUTS];
+        /* Buffers per hop; 0 for the default of MMAL. */
+        int pool_depths[RPIGRAFX_NUM_HOPS];
+        rpigrafx_delivery_t delivery;
+        /*
+         * Frames skipped by RPIGRAFX_DELIVERY_LATEST or, on a shared isp,
+         * dropped because the output fell behind.
+         */
+        uint64_t num_dropped;
+        /*
+         * The output whose isp emits the frames of this one: itself unless
+         * an earlier output is identical; see share_isps.
+         */
+        int shared_with;
+        /*
+         * Region of the camera frame that the isp scales to the output, in
+         * fractions of its width and height; see get_isp_crop.
+         */
+        struct roi {
+            float x, y, width, height;
+        } roi;
+        _Bool has_roi;
+        /* Time the last rpigrafx_reconfig_camera_frame took, or 0. */
+        uint64_t reconfig_ns;
+    } isp[MAX_OUTPUTS];
     struct render_config {
         MMAL_DISPLAYREGION_T region;
-    } render[NUM_SPLITTER_OUTPUTS];
+    } render[MAX_OUTPUTS];
+
+    /* Per-frame intermediates; sized on rpigrafx_finish_config. */
+    struct priv_rpigrafx_arena scratch;
+    /* Times the rawcam converter found no free splitter input buffer. */
+    uint64_t num_splitter_input_dry;
+    /* CLOCK_MONOTONIC minus the clock of pts, if is_pts_clock_known. */
+    int64_t pts_offset_ns;
+    _Bool is_pts_clock_known;
+    /* Profile of the stages shared by the outputs. */
+    rpigrafx_stage_stats_t stages[RPIGRAFX_NUM_STAGES];
 
+    /*
+     * Frames are made on the CPU and sent to the splitter wrapper, from
+     * rawcam or, if is_replay, from a recording.
+     */
     _Bool is_rawcam;
+    _Bool is_replay;
+    /* Bytes between rows of the raw frames, as rawcam or the recording has. */
+    int32_t raw_stride;
+    /* The recording mapped by rpigrafx_config_replay. */
+    struct replay {
+        const uint8_t *base;
+        size_t size;
+        rpigrafx_recording_header_t header;
+        uint64_t num_frames, next_frame;
+        /* 0 for as fast as frames are taken. */
+        float fps;
+        _Bool is_looping;
+        /* When the current frame is due; 0 until the first one. */
+        uint64_t due_ns;
+    } replay;
+    rpigrafx_demosaic_t demosaic;
+    /* 0 for the number of online cores. */
+    int num_threads;
+    struct priv_rpigrafx_workers *workers;
+    struct rawcam_job job;
+    /* Of the last frame; under stats_mutex, as the job is reused meanwhile. */
+    rpigrafx_band_timing_t band_timings[PRIV_RPIGRAFX_MAX_WORKERS];
+    int num_band_timings;
+    /* Statistics of the last frame, sampled every stats_step quads. */
+    int stats_step;
+    rpigrafx_bayer_stats_t stats;
+    struct priv_rpigrafx_awb awb;
+    /*
+     * Streaming mode: a producer thread converts raw frames ahead of demand
+     * into splitter input buffers and queues them in ready.
+     */
+    struct rawcam_stream {
+        /* 0 for synchronous capture. */
+        int queue_depth;
+        rpigrafx_drop_policy_t drop_policy;
+        pthread_t thread;
+        _Bool is_running, is_exiting;
+        pthread_mutex_t mutex;
+        /* Signalled when a ready frame is taken. */
+        pthread_cond_t cond;
+        MMAL_QUEUE_T *ready;
+        /*
+         * In callback mode, frames are sent to the splitter as soon as they
+         * are converted instead of being queued in ready.
+         */
+        _Bool is_pushing;
+        /* Error of the producer; it stops on error. */
+        int ret;
+        uint64_t num_frames, num_dropped;
+    } stream;
+    /* See Threads. */
+    pthread_mutex_t capture_mutex, stats_mutex;
 #ifdef IMPL_RAWCAM
     MMAL_FOURCC_T raw_encoding;
     rpigrafx_rawcam_camera_model_t rawcam_camera_model;
@@ -179,7 +373,91 @@ static struct cameras_config {
     } rpicam_config;
 #endif /* IMPL_RAWCAM */
 } cameras_config[MAX_CAMERAS];
-static struct callback_context *ctxs[MAX_CAMERAS][NUM_SPLITTER_OUTPUTS];
+static struct callback_context *ctxs[MAX_CAMERAS][MAX_OUTPUTS];
+/*
+ * Callback mode: the full headers of conn_isps_renders are passed to func on
+ * the thread that queues them, instead of waiting in
+ * rpigrafx_capture_next_frame.
+ */
+static struct frame_callback {
+    rpigrafx_frame_callback_t func;
+    void *userdata;
+    rpigrafx_frame_config_t fc;
+    /* Serialises the deliveries; held while func runs. */
+    pthread_mutex_t mutex;
+    /* The frame being delivered, on thread. */
+    MMAL_BUFFER_HEADER_T *header;
+    pthread_t thread;
+    _Bool is_held;
+    /* Frames that func held and the user has not released yet. */
+    pthread_mutex_t held_mutex;
+    MMAL_BUFFER_HEADER_T *held[MAX_HELD_FRAMES];
+    int num_held;
+} frame_callbacks[MAX_CAMERAS][MAX_OUTPUTS];
+/*
+ * Readable while a full header may be waiting on conn_isps_renders or, for
+ * rawcam, a converted frame may be waiting to be sent to the splitter.
+ */
+static int frame_fds[MAX_CAMERAS][MAX_OUTPUTS];
+/*
+ * Whether rpigrafx_try_capture_next_frame triggered the capture port or sent
+ * a rawcam frame to the splitter for the output and is waiting for it.
+ */
+static _Bool is_frame_requested[MAX_CAMERAS][MAX_OUTPUTS];
+/*
+ * Pool accounting of conn_isps_renders. The isp holds the buffers sent to it
+ * and not yet received from conn->queue; it has run dry when that is none.
+ */
+static struct isp_pool_stats {
+    uint64_t num_sent, num_received;
+    uint64_t num_dry;
+} isp_pool_stats[MAX_CAMERAS][MAX_OUTPUTS];
+/*
+ * Frames that the isp emitted on conn_isps_renders. The connection callback
+ * stamps them and moves them from conn->queue to arrived, so that their
+ * receive time does not depend on when they are taken. Each header of the
+ * pool points to its frame_meta by user_data.
+ */
+struct frame_meta {
+    uint64_t receive_ns, sequence;
+    /* The header of the pool, and its outputs yet to release it if shared. */
+    MMAL_BUFFER_HEADER_T *header;
+    unsigned num_refs;
+};
+static struct isp_frames {
+    int camera_number, output_index;
+    /* Serialises the stamping so that arrived stays in order. */
+    pthread_mutex_t mutex;
+    /* Set by those who found the mutex taken; see collect_isp_frames. */
+    _Bool is_collect_pending;
+    MMAL_QUEUE_T *arrived;
+    /*
+     * For the outputs of a shared isp, the headers of arrived: each refers to
+     * the payload of a header of the pool of the isp, which goes back to it
+     * once all the outputs have released their replica.
+     */
+    MMAL_POOL_T *replicas;
+    /*
+     * Frames arrived keeps when the isp is shared, or 0 for no limit. Older
+     * ones are dropped so that an output that falls behind does not hold the
+     * buffers of the others.
+     */
+    unsigned max_backlog;
+    struct frame_meta *metas;
+    uint64_t num_arrived;
+    rpigrafx_latency_hist_t hists[RPIGRAFX_NUM_LATENCIES];
+    /* Profile of the stages of the output alone; see is_output_stage. */
+    rpigrafx_stage_stats_t stages[RPIGRAFX_NUM_STAGES];
+} isp_frames[MAX_CAMERAS][MAX_OUTPUTS];
+/* Stages profiled per output rather than per camera. */
+static const _Bool is_output_stage[RPIGRAFX_NUM_STAGES] = {
+    [RPIGRAFX_STAGE_CAPTURE] = !0,
+    [RPIGRAFX_STAGE_ISP_WAIT] = !0,
+};
+static int start_rawcam_stream(const int i);
+static void stop_rawcam_stream(const int i);
+static void close_replay(const int i);
+static void teardown_camera(const int i);
 
 #define WARN_HEADER(pre, header, post) \
     do { \
@@ -211,16 +489,12 @@ static MMAL_STATUS_T config_port_crop(MMAL_PORT_T *port,
                                       const MMAL_FOURCC_T encoding,
                                       const int32_t actual_width,
                                       const int32_t actual_height,
-                                      const int32_t crop_width,
-                                      const int32_t crop_height)
+                                      const MMAL_RECT_T *crop)
 {
     port->format->encoding = encoding;
     port->format->es->video.width  = VCOS_ALIGN_UP(actual_width,  32);
     port->format->es->video.height = VCOS_ALIGN_UP(actual_height, 16);
-    port->format->es->video.crop.x = 0;
-    port->format->es->video.crop.y = 0;
-    port->format->es->video.crop.width  = crop_width;
-    port->format->es->video.crop.height = crop_height;
+    port->format->es->video.crop = *crop;
     return mmal_port_format_commit(port);
 }
 
@@ -238,17 +512,49 @@ int priv_rpigrafx_mmal_init()
         cp_cameras[i] = NULL;
         cfg->is_used = 0;
         cfg->is_rawcam = 0;
+        cfg->scratch.base = NULL;
+        cfg->scratch.size = cfg->scratch.used = 0;
+        cfg->is_replay = 0;
+        cfg->replay.base = NULL;
+        cfg->workers = NULL;
+        cfg->job.num_bands = 0;
+        cfg->num_band_timings = 0;
+        cfg->stream.queue_depth = 0;
+        cfg->stream.is_running = 0;
+        pthread_mutex_init(&cfg->capture_mutex, NULL);
+        pthread_mutex_init(&cfg->stats_mutex, NULL);
         if ((ret = rpigrafx_config_camera_port(i,
                                                RPIGRAFX_CAMERA_PORT_PREVIEW)))
             goto end;
 
         cp_splitters[i] = NULL;
         cfg->splitter.next_output_idx = 0;
+        cfg->splitter.num_splitters = 0;
+        cfg->setup_ns = 0;
         conn_camera_splitters[i] = NULL;
+        for (j = 0; j < MAX_SPLITTERS; j ++) {
+            cp_cascades[i][j] = NULL;
+            conn_cascades[i][j] = NULL;
+        }
 
-        for (j = 0; j < NUM_SPLITTER_OUTPUTS; j ++) {
+        for (j = 0; j < MAX_OUTPUTS; j ++) {
+            struct frame_callback *cb = &frame_callbacks[i][j];
+            struct isp_frames *frames = &isp_frames[i][j];
             cp_isps[i][j] = NULL;
             conn_splitters_isps[i][j] = NULL;
+            conn_isps_renders[i][j] = NULL;
+            frame_fds[i][j] = -1;
+            is_frame_requested[i][j] = 0;
+            cb->func = NULL;
+            cb->header = NULL;
+            cb->num_held = 0;
+            pthread_mutex_init(&cb->mutex, NULL);
+            pthread_mutex_init(&cb->held_mutex, NULL);
+            frames->camera_number = i;
+            frames->output_index = j;
+            frames->arrived = NULL;
+            frames->metas = NULL;
+            pthread_mutex_init(&frames->mutex, NULL);
         }
     }
 
@@ -277,12 +583,10 @@ int priv_rpigrafx_mmal_init()
             goto end;
         }
 
+        /* Replays can still be configured without cameras. */
         num_cameras = camera_info.num_cameras;
-        if (num_cameras <= 0) {
+        if (num_cameras <= 0 && priv_rpigrafx_verbose)
             print_error("No cameras found: 0x%08x", num_cameras);
-            ret = 1;
-            goto end;
-        }
 
         for (i = 0; i < num_cameras; i ++) {
             struct cameras_config *cfg = &cameras_config[i];
@@ -320,14 +624,43 @@ int priv_rpigrafx_mmal_finalize()
 
     for (i = 0; i < MAX_CAMERAS; i ++) {
         struct cameras_config *cfg = &cameras_config[i];
-        cp_cameras[i] = cp_splitters[i] = NULL;
-        for (j = 0; j < NUM_SPLITTER_OUTPUTS; j ++)
-            cp_isps[i][j] = NULL;
+        /* The producer sends to the splitter. */
+        stop_rawcam_stream(i);
+        for (j = 0; j < MAX_OUTPUTS; j ++) {
+            struct frame_callback *cb = &frame_callbacks[i][j];
+            /* Frames that arrive from now on are just recycled. */
+            pthread_mutex_lock(&cb->mutex);
+            cb->func = NULL;
+            pthread_mutex_unlock(&cb->mutex);
+            pthread_mutex_lock(&cb->held_mutex);
+            while (cb->num_held != 0)
+                mmal_buffer_header_release(cb->held[-- cb->num_held]);
+            pthread_mutex_unlock(&cb->held_mutex);
+        }
+        teardown_camera(i);
+        for (j = 0; j < MAX_OUTPUTS; j ++) {
+            struct isp_frames *frames = &isp_frames[i][j];
+            if (frames->arrived != NULL) {
+                mmal_queue_destroy(frames->arrived);
+                frames->arrived = NULL;
+            }
+            priv_rpigrafx_free(ctxs[i][j]);
+            ctxs[i][j] = NULL;
+            if (frame_fds[i][j] != -1) {
+                close(frame_fds[i][j]);
+                frame_fds[i][j] = -1;
+            }
+        }
         cfg->width  = -1;
         cfg->height = -1;
         cfg->max_width  = -1;
         cfg->max_height = -1;
         cfg->splitter.next_output_idx = 0;
+        cfg->splitter.num_splitters = 0;
+        priv_rpigrafx_arena_finalize(&cfg->scratch);
+        priv_rpigrafx_workers_destroy(cfg->workers);
+        cfg->workers = NULL;
+        close_replay(i);
     }
 
 skip:
@@ -349,6 +682,380 @@ static void callback_conn(MMAL_CONNECTION_T *conn)
                     conn->name, conn->out->name, conn->in->name);
 }
 
+static void signal_frame_fd(const int fd)
+{
+    const uint64_t one = 1;
+
+    /* It only fails when the counter is about to overflow; it is set then. */
+    if (write(fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+        print_error("Failed to signal frame fd %d: %s", fd, strerror(errno));
+}
+
+static void clear_frame_fd(const int fd)
+{
+    uint64_t count;
+
+    if (read(fd, &count, sizeof(count)) != sizeof(count) && errno != EAGAIN)
+        print_error("Failed to clear frame fd %d: %s", fd, strerror(errno));
+}
+
+static uint64_t get_time_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* The time at which the sensor captured header on CLOCK_MONOTONIC, or 0. */
+static uint64_t sensor_time_ns(const int i, const MMAL_BUFFER_HEADER_T *header)
+{
+    const struct cameras_config *cfg = &cameras_config[i];
+
+    if (!cfg->is_pts_clock_known || header->pts == MMAL_TIME_UNKNOWN)
+        return 0;
+    return header->pts * 1000 + cfg->pts_offset_ns;
+}
+
+/* Adds the span from start to end to a histogram unless start is unknown. */
+static void add_latency(struct isp_frames *frames,
+                        const rpigrafx_latency_t latency,
+                        const uint64_t start, const uint64_t end)
+{
+    if (start == 0)
+        return;
+    /* The clocks may drift a little apart. */
+    priv_rpigrafx_latency_hist_add(&frames->hists[latency],
+                                   end > start ? end - start : 0);
+}
+
+/* The output that owns the isp, the render and the connection of output j. */
+static int isp_of(const int i, const int j)
+{
+    return cameras_config[i].isp[j].shared_with;
+}
+
+/* Outputs fed by the isp of output j, itself included. */
+static int num_isp_consumers(const int i, const int j)
+{
+    const struct cameras_config *cfg = &cameras_config[i];
+    int k, n = 0;
+
+    for (k = 0; k < cfg->splitter.next_output_idx; k ++)
+        if (cfg->isp[k].shared_with == j)
+            n ++;
+    return n;
+}
+
+/*
+ * Drops a reference to a frame of a shared isp, sending it back to the isp if
+ * it was the last. The outputs may release their replicas on different
+ * threads, which the reference count of MMAL is not safe for.
+ */
+static void unref_isp_frame(struct frame_meta *meta)
+{
+    if (__atomic_sub_fetch(&meta->num_refs, 1, __ATOMIC_ACQ_REL) == 0)
+        mmal_buffer_header_release(meta->header);
+}
+
+/* Pool callback of the replicas, called on the thread releasing one. */
+static MMAL_BOOL_T callback_replica_released(MMAL_POOL_T *pool,
+                                             MMAL_BUFFER_HEADER_T *header,
+                                             void *userdata)
+{
+    (void) pool;
+    (void) userdata;
+
+    unref_isp_frame(header->user_data);
+    return MMAL_TRUE;
+}
+
+/*
+ * Puts a replica of a full header of the shared isp in arrived of output j.
+ * The header must count a reference for it. Called with the mutex of the isp
+ * held.
+ */
+static void replicate_isp_frame(const int i, const int j,
+                                MMAL_BUFFER_HEADER_T *header)
+{
+    struct isp_frames *frames = &isp_frames[i][j];
+    struct frame_meta *meta = header->user_data;
+    MMAL_BUFFER_HEADER_T *replica = mmal_queue_get(frames->replicas->queue);
+
+    /* The pools are as large, so this only happens if the user leaks. */
+    if (replica == NULL) {
+        __atomic_add_fetch(&cameras_config[i].isp[j].num_dropped, 1,
+                           __ATOMIC_SEQ_CST);
+        unref_isp_frame(meta);
+        return;
+    }
+    replica->cmd = header->cmd;
+    replica->data = header->data;
+    replica->alloc_size = header->alloc_size;
+    replica->offset = header->offset;
+    replica->length = header->length;
+    replica->flags = header->flags;
+    replica->pts = header->pts;
+    replica->dts = header->dts;
+    replica->user_data = meta;
+    if (j != isp_of(i, j))
+        add_latency(frames, RPIGRAFX_LATENCY_SENSOR_TO_ISP_OUT,
+                    sensor_time_ns(i, header), meta->receive_ns);
+    mmal_queue_put(frames->arrived, replica);
+}
+
+/* Drops the oldest frames of output j beyond its max_backlog. */
+static void trim_isp_frames(const int i, const int j)
+{
+    struct isp_frames *frames = &isp_frames[i][j];
+    MMAL_BUFFER_HEADER_T *header = NULL;
+
+    if (frames->max_backlog == 0)
+        return;
+    while (mmal_queue_length(frames->arrived) > frames->max_backlog) {
+        if ((header = mmal_queue_get(frames->arrived)) == NULL)
+            break;
+        if (header->length != 0)
+            __atomic_add_fetch(&cameras_config[i].isp[j].num_dropped, 1,
+                               __ATOMIC_SEQ_CST);
+        if (priv_rpigrafx_verbose)
+            WARN_HEADER("Dropping backlogged header ", header, "");
+        mmal_buffer_header_release(header);
+    }
+}
+
+/*
+ * Stamps the headers that the isp of output j emitted and moves them to
+ * arrived of the outputs it feeds, signalling their frame fds.
+ *
+ * The outputs of a shared isp and its connection callback may call this on
+ * different threads at once. Rather than waiting for the one holding the
+ * mutex, the others flag that there may be more headers and return, and the
+ * holder goes round again if it finds the flag set after letting go. They
+ * then find the headers in arrived.
+ */
+static void collect_isp_frames(const int i, const int j)
+{
+    const struct cameras_config *cfg = &cameras_config[i];
+    const int l = isp_of(i, j), num_consumers = num_isp_consumers(i, l);
+    MMAL_CONNECTION_T *conn = conn_isps_renders[i][l];
+    struct isp_frames *frames = &isp_frames[i][l];
+    MMAL_BUFFER_HEADER_T *header = NULL;
+    struct frame_meta *meta = NULL;
+    unsigned num_collected;
+    int k;
+
+    do {
+        __atomic_store_n(&frames->is_collect_pending, !0, __ATOMIC_SEQ_CST);
+        if (pthread_mutex_trylock(&frames->mutex))
+            return;
+        num_collected = 0;
+        while (__atomic_exchange_n(&frames->is_collect_pending, 0,
+                                   __ATOMIC_SEQ_CST)) {
+            while ((header = mmal_queue_get(conn->queue)) != NULL) {
+                __atomic_add_fetch(&isp_pool_stats[i][l].num_received, 1,
+                                   __ATOMIC_SEQ_CST);
+                num_collected ++;
+                meta = header->user_data;
+                /* The camera capture port emits empty headers in between. */
+                if (header->length != 0) {
+                    meta->receive_ns = get_time_ns();
+                    meta->sequence = frames->num_arrived ++;
+                    add_latency(frames, RPIGRAFX_LATENCY_SENSOR_TO_ISP_OUT,
+                                sensor_time_ns(i, header), meta->receive_ns);
+                }
+                if (header->length == 0 || num_consumers == 1) {
+                    mmal_queue_put(frames->arrived, header);
+                    continue;
+                }
+                /* Held by the replicas, and by us until all are made. */
+                __atomic_store_n(&meta->num_refs, num_consumers + 1,
+                                 __ATOMIC_SEQ_CST);
+                for (k = l; k < cfg->splitter.next_output_idx; k ++)
+                    if (cfg->isp[k].shared_with == l)
+                        replicate_isp_frame(i, k, header);
+                unref_isp_frame(meta);
+            }
+        }
+        pthread_mutex_unlock(&frames->mutex);
+
+        if (num_collected == 0)
+            continue;
+        /* Releasing may call back into us, so it is done without the mutex. */
+        for (k = l; k < cfg->splitter.next_output_idx; k ++) {
+            if (cfg->isp[k].shared_with != l)
+                continue;
+            trim_isp_frames(i, k);
+            if (mmal_queue_length(isp_frames[i][k].arrived) != 0)
+                signal_frame_fd(frame_fds[i][k]);
+        }
+    } while (__atomic_load_n(&frames->is_collect_pending, __ATOMIC_SEQ_CST));
+}
+
+/* Headers that the isp emitted for output j and it has not taken yet. */
+static unsigned num_isp_frames_waiting(const int i, const int j)
+{
+    return mmal_queue_length(conn_isps_renders[i][isp_of(i, j)]->queue)
+           + mmal_queue_length(isp_frames[i][j].arrived);
+}
+
+/* Records the latencies of a frame that is being handed to the user. */
+static void hand_over_frame(const int i, const int j,
+                            const MMAL_BUFFER_HEADER_T *header)
+{
+    struct isp_frames *frames = &isp_frames[i][j];
+    const struct frame_meta *meta = header->user_data;
+    const uint64_t now = get_time_ns();
+
+    add_latency(frames, RPIGRAFX_LATENCY_ISP_OUT_TO_USER,
+                meta->receive_ns, now);
+    add_latency(frames, RPIGRAFX_LATENCY_SENSOR_TO_USER,
+                sensor_time_ns(i, header), now);
+}
+
+/* Connection callback of conn_isps_renders outside callback mode. */
+static void callback_conn_frames(MMAL_CONNECTION_T *conn)
+{
+    const struct isp_frames *frames = conn->user_data;
+
+    callback_conn(conn);
+    collect_isp_frames(frames->camera_number, frames->output_index);
+}
+
+/* Sends the free buffers of the isp of output j back to it. */
+static void refill_isp(const int i, const int j)
+{
+    const int l = isp_of(i, j);
+    MMAL_CONNECTION_T *conn = conn_isps_renders[i][l];
+    struct isp_pool_stats *stats = &isp_pool_stats[i][l];
+    MMAL_BUFFER_HEADER_T *header = NULL;
+    MMAL_STATUS_T status;
+    _Bool is_first = !0;
+
+    while ((header = mmal_queue_get(conn->pool->queue)) != NULL) {
+        if (is_first) {
+            const uint64_t num_sent =
+                        __atomic_load_n(&stats->num_sent, __ATOMIC_SEQ_CST),
+                           num_received =
+                        __atomic_load_n(&stats->num_received, __ATOMIC_SEQ_CST);
+            /* The first buffers sent after connecting do not count. */
+            if (num_sent != 0 && num_sent - num_received
+                                    <= mmal_queue_length(conn->queue))
+                __atomic_add_fetch(&stats->num_dry, 1, __ATOMIC_SEQ_CST);
+            is_first = 0;
+        }
+        if (priv_rpigrafx_verbose)
+            WARN_HEADER("Got header ", header,
+                        " from conn->pool->queue; Sending to conn->out");
+        status = mmal_port_send_buffer(conn->out, header);
+        if (status != MMAL_SUCCESS) {
+            print_error("Sending pool buffer to %s failed: 0x%08x",
+                        conn->name, status);
+            mmal_queue_put_back(conn->pool->queue, header);
+            break;
+        }
+        __atomic_add_fetch(&stats->num_sent, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* Takes a header that the isp emitted, waiting for one if is_waiting. */
+static MMAL_BUFFER_HEADER_T* receive_from_isp(const int i, const int j,
+                                              const _Bool is_waiting)
+{
+    MMAL_QUEUE_T *arrived = isp_frames[i][j].arrived;
+    MMAL_BUFFER_HEADER_T *header = NULL;
+
+    uint64_t start;
+
+    /* The connection callback collects them too, but may not have yet. */
+    collect_isp_frames(i, j);
+    if (is_waiting) {
+        start = priv_rpigrafx_profile_begin();
+        header = mmal_queue_wait(arrived);
+        priv_rpigrafx_profile_end(
+                        &isp_frames[i][j].stages[RPIGRAFX_STAGE_ISP_WAIT],
+                        start, header != NULL ? header->length : 0);
+    } else
+        header = mmal_queue_get(arrived);
+    if (header != NULL && priv_rpigrafx_verbose)
+        WARN_HEADER("Got header ", header, " from arrived");
+    return header;
+}
+
+/*
+ * In RPIGRAFX_DELIVERY_LATEST, replaces a full header taken from the isp with
+ * the newest full one queued after it. The older ones go back to the isp.
+ */
+static MMAL_BUFFER_HEADER_T* skip_to_latest(const int i, const int j,
+                                            MMAL_BUFFER_HEADER_T *header)
+{
+    struct isp_config *isp = &cameras_config[i].isp[j];
+    MMAL_BUFFER_HEADER_T *next = NULL;
+    _Bool is_skipped = 0;
+
+    if (isp->delivery != RPIGRAFX_DELIVERY_LATEST)
+        return header;
+
+    while ((next = receive_from_isp(i, j, 0)) != NULL) {
+        if (next->length != 0) {
+            if (priv_rpigrafx_verbose)
+                WARN_HEADER("Dropping stale header ", header, "");
+            mmal_buffer_header_release(header);
+            __atomic_add_fetch(&isp->num_dropped, 1, __ATOMIC_SEQ_CST);
+            header = next;
+        } else
+            mmal_buffer_header_release(next);
+        is_skipped = !0;
+    }
+    if (is_skipped)
+        refill_isp(i, j);
+    return header;
+}
+
+/*
+ * Connection callback of conn_isps_renders in callback mode. It is called
+ * both when the isp emits a frame and when a frame is released to the pool.
+ */
+static void deliver_frames(MMAL_CONNECTION_T *conn)
+{
+    struct frame_callback *cb = conn->user_data;
+    const int i = cb->fc.camera_number, j = cb->fc.splitter_output_port_index;
+    MMAL_BUFFER_HEADER_T *header = NULL;
+
+    refill_isp(i, j);
+
+    /*
+     * Releasing a frame calls us again on the same thread, and the isp may
+     * call us while the user releases a held frame on another. Only the one
+     * that takes the mutex delivers; it looks at the queue again after
+     * unlocking so that no frame queued meanwhile is left behind.
+     */
+    do {
+        collect_isp_frames(i, j);
+        if (pthread_mutex_trylock(&cb->mutex))
+            return;
+        while ((header = receive_from_isp(i, j, 0)) != NULL) {
+            /* The camera capture port emits empty headers in between. */
+            if (header->length == 0 || cb->func == NULL) {
+                mmal_buffer_header_release(header);
+                continue;
+            }
+            header = skip_to_latest(i, j, header);
+            hand_over_frame(i, j, header);
+            if (priv_rpigrafx_verbose)
+                WARN_HEADER("Delivering header ", header, "");
+            cb->header = header;
+            cb->thread = pthread_self();
+            cb->is_held = 0;
+            cb->func(&cb->fc, header->data, cb->userdata);
+            cb->header = NULL;
+            if (!cb->is_held)
+                mmal_buffer_header_release(header);
+        }
+        pthread_mutex_unlock(&cb->mutex);
+    } while (num_isp_frames_waiting(i, j) != 0);
+}
+
 int rpigrafx_config_camera_frame(const int32_t camera_number,
                                  const int32_t width, const int32_t height,
                                  const MMAL_FOURCC_T encoding,
@@ -357,11 +1064,18 @@ int rpigrafx_config_camera_frame(const int32_t camera_number,
 {
     int32_t max_width, max_height;
     int idx;
-    struct cameras_config *cfg = &cameras_config[camera_number];
+    struct cameras_config *cfg = NULL;
     struct callback_context *ctx = NULL;
     int ret = 0;
 
-    if (camera_number >= num_cameras) {
+    if (camera_number < 0 || camera_number >= MAX_CAMERAS) {
+        print_error("Invalid camera_number: %d", camera_number);
+        ret = 1;
+        goto end;
+    }
+    cfg = &cameras_config[camera_number];
+    /* A replay does not need a camera behind it. */
+    if (camera_number >= num_cameras && !cfg->is_replay) {
         print_error("camera_number(%d) exceeds num_cameras(%d)",
                     camera_number, num_cameras);
         ret = 1;
@@ -388,7 +1102,7 @@ int rpigrafx_config_camera_frame(const int32_t camera_number,
      */
     cfg->is_used = !0;
 
-    if (cfg->splitter.next_output_idx == NUM_SPLITTER_OUTPUTS - 1) {
+    if (cfg->splitter.next_output_idx == MAX_OUTPUTS) {
         print_error("Too many splitter clients(%d) of camera %d",
                     cfg->splitter.next_output_idx,
                     camera_number);
@@ -401,8 +1115,14 @@ int rpigrafx_config_camera_frame(const int32_t camera_number,
     cfg->isp[idx].height = height;
     cfg->isp[idx].encoding = encoding;
     cfg->isp[idx].is_zero_copy_rendering = is_zero_copy_rendering;
-
-    ctx = malloc(sizeof(*ctx));
+    memset(cfg->isp[idx].pool_depths, 0, sizeof(cfg->isp[idx].pool_depths));
+    cfg->isp[idx].delivery = RPIGRAFX_DELIVERY_FIFO;
+    cfg->isp[idx].num_dropped = 0;
+    cfg->isp[idx].shared_with = idx;
+    cfg->isp[idx].has_roi = 0;
+    cfg->isp[idx].reconfig_ns = 0;
+
+    ctx = priv_rpigrafx_malloc(sizeof(*ctx));
     if (ctx == NULL) {
         print_error("Failed to allocate context");
         ret = 1;
@@ -413,6 +1133,13 @@ int rpigrafx_config_camera_frame(const int32_t camera_number,
     ctx->is_header_passed_to_render = 0;
     ctxs[camera_number][idx] = ctx;
 
+    frame_fds[camera_number][idx] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (frame_fds[camera_number][idx] == -1) {
+        print_error("Failed to create frame fd: %s", strerror(errno));
+        ret = 1;
+        goto end;
+    }
+
     fcp->camera_number = camera_number;
     fcp->splitter_output_port_index = idx;
     fcp->is_zero_copy_rendering = is_zero_copy_rendering;
@@ -514,6 +1241,17 @@ int rpigrafx_config_rawcam(const rpigrafx_rawcam_camera_model_t camera_model,
     memcpy(&cfg->rx_cfg, &rx_cfg, sizeof(rx_cfg));
     cfg->nbits_of_raw_from_camera = nbits_of_raw_from_camera;
     cfg->rawcam_camera_model = camera_model;
+    cfg->demosaic = RPIGRAFX_DEMOSAIC_NEAREST;
+    cfg->num_threads = 0;
+    cfg->stats_step = 4;
+    priv_rpigrafx_bayer_stats_clear(&cfg->stats);
+    /* Start from the gains tuned for the module under daylight. */
+    if (camera_model == RPIGRAFX_RAWCAM_CAMERA_MODEL_IMX219)
+        priv_rpigrafx_awb_init(&cfg->awb, 1.55, 1.0, 1.5);
+    else
+        priv_rpigrafx_awb_init(&cfg->awb, 1.0, 1.0, 1.0);
+    cfg->stream.queue_depth = 0;
+    cfg->stream.drop_policy = RPIGRAFX_DROP_POLICY_BLOCK;
     cfg->is_rawcam = !0;
     cfg->raw_encoding = encoding;
 
@@ -605,63 +1343,480 @@ end:
 #endif /* IMPL_RAWCAM */
 }
 
-int rpigrafx_config_camera_port(const int32_t camera_number,
-                                const rpigrafx_camera_port_t camera_port)
+/*
+ * Makes camera_number replay the recording at path, made by
+ * rpigrafx_open_recorder or written in its container, instead of capturing
+ * from a camera. The frames are paced to fps per second, or taken as fast as
+ * they are asked for if fps is 0, and start over at the end if is_looping.
+ * Raw10 BGGR recordings go through the converter of rawcam; RGB24 ones are
+ * copied to the splitter as they are. Call it before
+ * rpigrafx_config_camera_frame; no camera needs to be behind camera_number.
+ */
+int rpigrafx_config_replay(const int32_t camera_number, const char *path,
+                           const float fps, const _Bool is_looping)
 {
-    struct cameras_config *cfg = &cameras_config[camera_number];
+    struct cameras_config *cfg = NULL;
+    struct replay *replay = NULL;
+    rpigrafx_recording_header_t header;
+    struct stat st;
+    void *base = MAP_FAILED;
+    uint64_t num_frames;
+    int fd = -1;
     int ret = 0;
 
-    switch (camera_port) {
-        case RPIGRAFX_CAMERA_PORT_PREVIEW:
-            cfg->camera_output_port_index = CAMERA_PREVIEW_PORT;
-            cfg->use_camera_capture_port = 0;
+    if (camera_number < 0 || camera_number >= MAX_CAMERAS) {
+        print_error("Invalid camera_number: %d", camera_number);
+        ret = 1;
+        goto end;
+    }
+    cfg = &cameras_config[camera_number];
+    replay = &cfg->replay;
+    if (cfg->is_used) {
+        print_error("Frames of camera %d are already configured",
+                    camera_number);
+        ret = 1;
+        goto end;
+    }
+    if (!(fps >= 0)) {
+        print_error("Invalid fps: %f", fps);
+        ret = 1;
+        goto end;
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        print_error("Failed to open %s: %s", path, strerror(errno));
+        ret = 1;
+        goto end;
+    }
+    if (fstat(fd, &st) == -1) {
+        print_error("Failed to stat %s: %s", path, strerror(errno));
+        ret = 1;
+        goto end;
+    }
+    if (st.st_size < RPIGRAFX_RECORDING_ALIGN) {
+        print_error("%s is too short to be a recording", path);
+        ret = 1;
+        goto end;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+        print_error("Failed to map %s: %s", path, strerror(errno));
+        ret = 1;
+        goto end;
+    }
+    /* Frames are taken in order; let the kernel read ahead. */
+    (void) madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, RPIGRAFX_RECORDING_MAGIC, sizeof(header.magic))
+            || header.version != RPIGRAFX_RECORDING_VERSION) {
+        print_error("%s is not a recording of version %d", path,
+                    RPIGRAFX_RECORDING_VERSION);
+        ret = 1;
+        goto end;
+    }
+    if (header.width <= 0 || header.height <= 0
+            || header.record_size % RPIGRAFX_RECORDING_ALIGN != 0
+            || header.record_size < RPIGRAFX_RECORDING_FRAME_OFFSET
+                                    + (uint64_t) header.frame_size) {
+        print_error("Bad header of %s: %dx%d, %u-byte frames in %u-byte "
+                    "records", path, header.width, header.height,
+                    header.frame_size, header.record_size);
+        ret = 1;
+        goto end;
+    }
+    switch (header.encoding) {
+        case MMAL_ENCODING_BAYER_SBGGR10P:
+            /* Packed rows are not a whole number of pixels apart. */
+            if (header.width % 4 != 0 || header.height % 2 != 0
+                    || header.aligned_height < header.height
+                    || header.frame_size / header.aligned_height
+                        < (uint64_t) header.width * 5 / 4) {
+                print_error("Unsupported raw10 recording: %dx%d in %u bytes",
+                            header.width, header.height, header.frame_size);
+                ret = 1;
+                goto end;
+            }
             break;
-        case RPIGRAFX_CAMERA_PORT_CAPTURE:
-            cfg->camera_output_port_index = CAMERA_CAPTURE_PORT;
-            cfg->use_camera_capture_port = !0;
+        case MMAL_ENCODING_RGB24:
+            if (header.aligned_width != ALIGN_UP(header.width, 32)
+                    || header.frame_size
+                        < (uint64_t) header.aligned_width * 3 * header.height) {
+                print_error("Unsupported RGB24 recording: %dx%d in %u bytes",
+                            header.aligned_width, header.height,
+                            header.frame_size);
+                ret = 1;
+                goto end;
+            }
             break;
         default:
-            print_error("Unknown rpigrafx_camera_port_t value: %d\n",
-                        camera_port);
+            print_error("Unsupported encoding of recording: 0x%08x",
+                        header.encoding);
             ret = 1;
             goto end;
-            break;
     }
+    /* A recording that was not closed has the frames written so far. */
+    num_frames = (st.st_size - RPIGRAFX_RECORDING_ALIGN) / header.record_size;
+    if (header.num_frames != 0)
+        num_frames = MMAL_MIN(num_frames, header.num_frames);
+    if (num_frames == 0) {
+        print_error("%s has no frames", path);
+        ret = 1;
+        goto end;
+    }
+
+    close_replay(camera_number);
+    replay->base = base;
+    replay->size = st.st_size;
+    memcpy(&replay->header, &header, sizeof(header));
+    replay->num_frames = num_frames;
+    replay->next_frame = 0;
+    replay->fps = fps;
+    replay->is_looping = is_looping;
+    replay->due_ns = 0;
+    base = MAP_FAILED;
+
+    cfg->max_width = header.width;
+    cfg->max_height = header.height;
+    if (header.encoding == MMAL_ENCODING_BAYER_SBGGR10P)
+        cfg->raw_stride = header.frame_size / header.aligned_height;
+    cfg->demosaic = RPIGRAFX_DEMOSAIC_NEAREST;
+    cfg->num_threads = 0;
+    cfg->stats_step = 4;
+    priv_rpigrafx_bayer_stats_clear(&cfg->stats);
+    /* The recorded frames are taken to be balanced already. */
+    priv_rpigrafx_awb_init(&cfg->awb, 1.0, 1.0, 1.0);
+    cfg->stream.queue_depth = 0;
+    cfg->stream.drop_policy = RPIGRAFX_DROP_POLICY_BLOCK;
+    cfg->is_rawcam = !0;
+    cfg->is_replay = !0;
 
 end:
+    if (base != MAP_FAILED)
+        munmap(base, st.st_size);
+    if (fd != -1)
+        close(fd);
     return ret;
 }
 
-int rpigrafx_config_camera_frame_render(const _Bool is_fullscreen,
-                           const int32_t x, const int32_t y,
-                           const int32_t width, const int32_t height,
-                           const int32_t layer,
-                           rpigrafx_frame_config_t *fcp)
+static void close_replay(const int i)
 {
-    MMAL_DISPLAYREGION_T region = {
-        .fullscreen = is_fullscreen,
-        .dest_rect = {
-            .x = x, .y = y,
-            .width = width, .height = height
-        },
-        .layer = layer,
-        .set =   MMAL_DISPLAY_SET_FULLSCREEN
-               | MMAL_DISPLAY_SET_DEST_RECT
-               | MMAL_DISPLAY_SET_LAYER
-    };
-    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
-    int ret = 0;
-
-    memcpy(&cfg->render[fcp->splitter_output_port_index].region,
-           &region, sizeof(region));
+    struct cameras_config *cfg = &cameras_config[i];
 
-    return ret;
+    if (cfg->replay.base != NULL)
+        munmap((void*) cfg->replay.base, cfg->replay.size);
+    cfg->replay.base = NULL;
+    cfg->is_replay = 0;
 }
 
-static int setup_cp_camera_rawcam(const int i,
-                                  const int32_t width, const int32_t height)
+int rpigrafx_config_rawcam_demosaic(const rpigrafx_demosaic_t demosaic,
+                                    rpigrafx_frame_config_t *fcp)
 {
-#ifdef IMPL_RAWCAM
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int ret = 0;
+
+    if (!cfg->is_rawcam) {
+        print_error("Camera %d is not configured for rawcam",
+                    fcp->camera_number);
+        ret = 1;
+        goto end;
+    }
+
+    switch (demosaic) {
+        case RPIGRAFX_DEMOSAIC_NEAREST:
+        case RPIGRAFX_DEMOSAIC_BILINEAR:
+        case RPIGRAFX_DEMOSAIC_EDGE_AWARE:
+            cfg->demosaic = demosaic;
+            break;
+        default:
+            print_error("Unknown rpigrafx_demosaic_t value: %d", demosaic);
+            ret = 1;
+            goto end;
+    }
+
+end:
+    return ret;
+}
+
+int rpigrafx_config_rawcam_num_threads(const int num_threads,
+                                       rpigrafx_frame_config_t *fcp)
+{
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int ret = 0;
+
+    if (!cfg->is_rawcam) {
+        print_error("Camera %d is not configured for rawcam",
+                    fcp->camera_number);
+        ret = 1;
+        goto end;
+    }
+    if (num_threads < 0 || num_threads > PRIV_RPIGRAFX_MAX_WORKERS) {
+        print_error("num_threads(%d) must be in [0, %d]",
+                    num_threads, PRIV_RPIGRAFX_MAX_WORKERS);
+        ret = 1;
+        goto end;
+    }
+    cfg->num_threads = num_threads;
+
+end:
+    return ret;
+}
+
+int rpigrafx_config_rawcam_streaming(const int queue_depth,
+                                     const rpigrafx_drop_policy_t drop_policy,
+                                     rpigrafx_frame_config_t *fcp)
+{
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int ret = 0;
+
+    if (!cfg->is_rawcam) {
+        print_error("Camera %d is not configured for rawcam",
+                    fcp->camera_number);
+        ret = 1;
+        goto end;
+    }
+    if (queue_depth < 0) {
+        print_error("Invalid queue_depth: %d", queue_depth);
+        ret = 1;
+        goto end;
+    }
+    switch (drop_policy) {
+        case RPIGRAFX_DROP_POLICY_BLOCK:
+        case RPIGRAFX_DROP_POLICY_DROP_NEWEST:
+        case RPIGRAFX_DROP_POLICY_DROP_OLDEST:
+            break;
+        default:
+            print_error("Unknown rpigrafx_drop_policy_t value: %d",
+                        drop_policy);
+            ret = 1;
+            goto end;
+    }
+    cfg->stream.queue_depth = queue_depth;
+    cfg->stream.drop_policy = drop_policy;
+
+end:
+    return ret;
+}
+
+int rpigrafx_config_rawcam_stats(const int step,
+                                 rpigrafx_frame_config_t *fcp)
+{
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int ret = 0;
+
+    if (!cfg->is_rawcam) {
+        print_error("Camera %d is not configured for rawcam",
+                    fcp->camera_number);
+        ret = 1;
+        goto end;
+    }
+    if (step < 1) {
+        print_error("Invalid step: %d", step);
+        ret = 1;
+        goto end;
+    }
+    cfg->stats_step = step;
+
+end:
+    return ret;
+}
+
+int rpigrafx_config_rawcam_awb(const rpigrafx_awb_mode_t mode,
+                               const float speed,
+                               rpigrafx_frame_config_t *fcp)
+{
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int ret = 0;
+
+    if (!cfg->is_rawcam) {
+        print_error("Camera %d is not configured for rawcam",
+                    fcp->camera_number);
+        ret = 1;
+        goto end;
+    }
+    switch (mode) {
+        case RPIGRAFX_AWB_MODE_GREY_WORLD:
+        case RPIGRAFX_AWB_MODE_WHITE_PATCH:
+            break;
+        default:
+            print_error("Invalid AWB mode: %d", mode);
+            ret = 1;
+            goto end;
+    }
+    if (!(speed > 0 && speed <= 1)) {
+        print_error("Invalid speed: %f", speed);
+        ret = 1;
+        goto end;
+    }
+    pthread_mutex_lock(&cfg->stats_mutex);
+    cfg->awb.mode = mode;
+    cfg->awb.speed = speed;
+    pthread_mutex_unlock(&cfg->stats_mutex);
+
+end:
+    return ret;
+}
+
+int rpigrafx_config_camera_port(const int32_t camera_number,
+                                const rpigrafx_camera_port_t camera_port)
+{
+    struct cameras_config *cfg = &cameras_config[camera_number];
+    int ret = 0;
+
+    switch (camera_port) {
+        case RPIGRAFX_CAMERA_PORT_PREVIEW:
+            cfg->camera_output_port_index = CAMERA_PREVIEW_PORT;
+            cfg->use_camera_capture_port = 0;
+            break;
+        case RPIGRAFX_CAMERA_PORT_CAPTURE:
+            cfg->camera_output_port_index = CAMERA_CAPTURE_PORT;
+            cfg->use_camera_capture_port = !0;
+            break;
+        default:
+            print_error("Unknown rpigrafx_camera_port_t value: %d\n",
+                        camera_port);
+            ret = 1;
+            goto end;
+            break;
+    }
+
+end:
+    return ret;
+}
+
+int rpigrafx_config_camera_frame_render(const _Bool is_fullscreen,
+                           const int32_t x, const int32_t y,
+                           const int32_t width, const int32_t height,
+                           const int32_t layer,
+                           rpigrafx_frame_config_t *fcp)
+{
+    MMAL_DISPLAYREGION_T region = {
+        .fullscreen = is_fullscreen,
+        .dest_rect = {
+            .x = x, .y = y,
+            .width = width, .height = height
+        },
+        .layer = layer,
+        .set =   MMAL_DISPLAY_SET_FULLSCREEN
+               | MMAL_DISPLAY_SET_DEST_RECT
+               | MMAL_DISPLAY_SET_LAYER
+    };
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int ret = 0;
+
+    memcpy(&cfg->render[fcp->splitter_output_port_index].region,
+           &region, sizeof(region));
+
+    return ret;
+}
+
+/*
+ * The rectangle of the camera frame that the isp of output j scales: its
+ * region of interest or, by default, the largest one from the top left that
+ * is a whole multiple of the output size.
+ */
+static void get_isp_crop(const int i, const int j, MMAL_RECT_T *crop)
+{
+    const struct cameras_config *cfg = &cameras_config[i];
+    const struct isp_config *isp = &cfg->isp[j];
+
+    if (!isp->has_roi) {
+        crop->x = crop->y = 0;
+        crop->width  = isp->width  * (cfg->width  / isp->width );
+        crop->height = isp->height * (cfg->height / isp->height);
+        return;
+    }
+    /* Even, so that the chroma of YUV frames lines up. */
+    crop->x = (int32_t) (isp->roi.x * cfg->width ) & ~1;
+    crop->y = (int32_t) (isp->roi.y * cfg->height) & ~1;
+    crop->width  = MMAL_MAX(2, (int32_t) (isp->roi.width  * cfg->width  + .5f)
+                               & ~1);
+    crop->height = MMAL_MAX(2, (int32_t) (isp->roi.height * cfg->height + .5f)
+                               & ~1);
+    crop->width  = MMAL_MIN(crop->width,  cfg->width  - crop->x);
+    crop->height = MMAL_MIN(crop->height, cfg->height - crop->y);
+}
+
+/*
+ * Makes the isp of the output scale only a region of the camera frame to it,
+ * given in fractions of the width and height of the frame: a crop, or a
+ * digital zoom. Before rpigrafx_finish_config, the camera is run large enough
+ * for the region to have as many pixels as the output, if it can. After, the
+ * region moves at once on the isp, which must not be shared with other
+ * outputs.
+ */
+int rpigrafx_config_camera_frame_roi(const float x, const float y,
+                                     const float width, const float height,
+                                     rpigrafx_frame_config_t *fcp)
+{
+    const int i = fcp->camera_number, j = fcp->splitter_output_port_index;
+    struct isp_config *isp = &cameras_config[i].isp[j];
+    const struct roi old_roi = isp->roi;
+    const _Bool had_roi = isp->has_roi;
+    MMAL_PARAMETER_CROP_T param = {
+        .hdr = {MMAL_PARAMETER_CROP, sizeof(param)}
+    };
+    MMAL_STATUS_T status;
+    int ret = 0;
+
+    /* Written so that NaNs fail too. */
+    if (!(x >= 0 && y >= 0 && width > 0 && height > 0
+            && x + width <= 1 && y + height <= 1)) {
+        print_error("Invalid region of interest (%g,%g) %gx%g of isp %d,%d",
+                    x, y, width, height, i, j);
+        ret = 1;
+        goto end;
+    }
+    if (conn_isps_renders[i][isp_of(i, j)] != NULL
+            && num_isp_consumers(i, isp_of(i, j)) != 1) {
+        print_error("isp %d,%d is shared by %d outputs", i, j,
+                    num_isp_consumers(i, isp_of(i, j)));
+        ret = 1;
+        goto end;
+    }
+    isp->roi.x = x;
+    isp->roi.y = y;
+    isp->roi.width = width;
+    isp->roi.height = height;
+    isp->has_roi = !0;
+    if (conn_isps_renders[i][j] == NULL)
+        goto end;
+
+    get_isp_crop(i, j, &param.rect);
+    status = mmal_port_parameter_set(cp_isps[i][j]->input[0], &param.hdr);
+    if (status != MMAL_SUCCESS) {
+        print_error("Setting crop of isp %d,%d to (%d,%d) %dx%d failed: "
+                    "0x%08x", i, j, param.rect.x, param.rect.y,
+                    param.rect.width, param.rect.height, status);
+        isp->roi = old_roi;
+        isp->has_roi = had_roi;
+        ret = 1;
+        goto end;
+    }
+
+end:
+    return ret;
+}
+
+/*
+ * Buffers of the camera-splitter hop: the most that any output of the camera
+ * asked for, or 0 for the default.
+ */
+static int camera_pool_depth(const struct cameras_config *cfg)
+{
+    int j, depth = 0;
+
+    for (j = 0; j < cfg->splitter.next_output_idx; j ++)
+        depth = MMAL_MAX(depth,
+                        cfg->isp[j].pool_depths[RPIGRAFX_HOP_CAMERA_SPLITTER]);
+    return depth;
+}
+
+static int setup_cp_camera_rawcam(const int i,
+                                  const int32_t width, const int32_t height)
+{
+#ifdef IMPL_RAWCAM
 
     struct cameras_config *cfg = &cameras_config[i];
     MMAL_STATUS_T status;
@@ -710,6 +1865,15 @@ static int setup_cp_camera_rawcam(const int i,
             ret = 1;
             goto end;
         }
+        /* rawcam pads the rows of packed raw as it likes. */
+        cfg->raw_stride = output->buffer_size_min
+                          / output->format->es->video.height;
+        if (cfg->raw_stride < width * 5 / 4) {
+            print_error("Rows of rawcam %d are %d bytes apart for width %d",
+                        i, cfg->raw_stride, width);
+            ret = 1;
+            goto end;
+        }
 
         status = mmal_port_parameter_get(output, &rx_cfg.hdr);
         if (status != MMAL_SUCCESS) {
@@ -939,11 +2103,166 @@ end:
     return ret;
 }
 
-static int setup_cp_splitter(const int i, const int len,
+/*
+ * Makes each output that asks for the same frames as an earlier one share
+ * its isp: the same size, region of interest, encoding, pool depths and
+ * render. Only outputs in RPIGRAFX_DELIVERY_LATEST are merged, since one that
+ * falls behind drops its oldest frames rather than holding up the isp; a
+ * FIFO output gets every frame and so keeps an isp of its own. Outputs with a
+ * callback keep their own too, since deliver_frames owns the connection of
+ * the isp.
+ */
+static void share_isps(const int i, const int len)
+{
+    struct cameras_config *cfg = &cameras_config[i];
+    int j, k;
+
+    for (j = 0; j < len; j ++) {
+        const struct isp_config *isp = &cfg->isp[j];
+        cfg->isp[j].shared_with = j;
+        if (frame_callbacks[i][j].func != NULL
+                || isp->delivery != RPIGRAFX_DELIVERY_LATEST)
+            continue;
+        for (k = 0; k < j; k ++) {
+            const struct isp_config *other = &cfg->isp[k];
+            if (other->shared_with == k
+                    && frame_callbacks[i][k].func == NULL
+                    && other->width == isp->width
+                    && other->height == isp->height
+                    && other->encoding == isp->encoding
+                    && other->delivery == isp->delivery
+                    && !memcmp(other->pool_depths, isp->pool_depths,
+                               sizeof(isp->pool_depths))
+                    && other->has_roi == isp->has_roi
+                    && (!isp->has_roi
+                        || !memcmp(&other->roi, &isp->roi, sizeof(isp->roi)))
+                    && other->is_zero_copy_rendering
+                                            == isp->is_zero_copy_rendering
+                    && !memcmp(&cfg->render[k].region, &cfg->render[j].region,
+                               sizeof(cfg->render[j].region))) {
+                cfg->isp[j].shared_with = k;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Lays out the splitters of camera i for the isps of len outputs. Each
+ * splitter after the first takes a port of one before it, breadth first, so
+ * that the outputs configured first go through the fewest splitters.
+ */
+static void plan_splitters(const int i, const int len)
+{
+    const struct cameras_config *cfg = &cameras_config[i];
+    struct splitter_config *sp = &cameras_config[i].splitter;
+    struct splitter_port ports[MAX_SPLITTERS * SPLITTER_PORTS];
+    int depths[MAX_SPLITTERS];
+    int num_isps = 0, head = 0, tail = 0, j, k, p;
+
+    for (j = 0; j < len; j ++)
+        if (cfg->isp[j].shared_with == j)
+            num_isps ++;
+    sp->num_splitters = 1 + (MMAL_MAX(num_isps - SPLITTER_PORTS, 0)
+                             + SPLITTER_PORTS - 2) / (SPLITTER_PORTS - 1);
+    for (k = 0; k < sp->num_splitters; k ++) {
+        if (k == 0)
+            depths[k] = 1;
+        else {
+            sp->feeds[k] = ports[head ++];
+            depths[k] = depths[sp->feeds[k].splitter] + 1;
+        }
+        for (p = 0; p < SPLITTER_PORTS; p ++) {
+            ports[tail].splitter = k;
+            ports[tail].port = p;
+            tail ++;
+        }
+    }
+    for (j = 0; j < len; j ++) {
+        const int l = cfg->isp[j].shared_with;
+        sp->outputs[j] = l == j ? ports[head ++] : sp->outputs[l];
+        sp->num_hops[j] = depths[sp->outputs[j].splitter];
+    }
+}
+
+static MMAL_PORT_T* get_splitter_output(const int i,
+                                        const struct splitter_port *port)
+{
+    if (port->splitter != 0)
+        return cp_cascades[i][port->splitter]->output[port->port];
+    if (!cameras_config[i].is_rawcam)
+        return cp_splitters[i]->output[port->port];
+    return cpw_splitters[i]->output[port->port];
+}
+
+/*
+ * Sets the formats of the used ports of splitter k of camera i. A port that
+ * feeds an output is cropped for its isp; one that feeds another splitter
+ * passes the whole frame on.
+ */
+static int config_splitter_outputs(const int i, const int k,
+                                   MMAL_COMPONENT_T *component,
+                                   const int32_t width, const int32_t height)
+{
+    const struct cameras_config *cfg = &cameras_config[i];
+    const struct splitter_config *sp = &cfg->splitter;
+    MMAL_STATUS_T status;
+    int p, j, ret = 0;
+
+    for (p = 0; p < SPLITTER_PORTS; p ++) {
+        MMAL_PORT_T *output = mmal_util_get_port(component,
+                                                 MMAL_PORT_TYPE_OUTPUT, p);
+        MMAL_RECT_T crop = {0, 0, width, height};
+        _Bool is_used = 0;
+
+        for (j = 0; j < sp->next_output_idx; j ++) {
+            if (sp->outputs[j].splitter != k || sp->outputs[j].port != p)
+                continue;
+            get_isp_crop(i, j, &crop);
+            is_used = !0;
+        }
+        for (j = 1; j < sp->num_splitters; j ++)
+            if (sp->feeds[j].splitter == k && sp->feeds[j].port == p)
+                is_used = !0;
+        if (!is_used)
+            continue;
+
+        if (output == NULL) {
+            print_error("Getting output port of splitter %d,%d,%d failed",
+                        i, k, p);
+            ret = 1;
+            goto end;
+        }
+
+        status = config_port_crop(output, MMAL_ENCODING_RGB24, width, height,
+                                  &crop);
+        if (status != MMAL_SUCCESS) {
+            print_error("Setting format of " \
+                        "splitter %d,%d output %d failed: 0x%08x",
+                        i, k, p, status);
+            ret = 1;
+            goto end;
+        }
+
+        status = mmal_port_parameter_set_boolean(output,
+                                            MMAL_PARAMETER_ZERO_COPY, MMAL_TRUE);
+        if (status != MMAL_SUCCESS) {
+            print_error("Setting zero-copy on " \
+                        "splitter %d,%d output %d failed: 0x%08x",
+                        i, k, p, status);
+            ret = 1;
+            goto end;
+        }
+    }
+
+end:
+    return ret;
+}
+
+static int setup_cp_splitter(const int i,
                              const int32_t width, const int32_t height,
                              const _Bool is_rawcam)
 {
-    int j;
     MMAL_COMPONENT_T *component = NULL;
     struct cameras_config *cfg = &cameras_config[i];
     MMAL_STATUS_T status;
@@ -1018,6 +2337,18 @@ static int setup_cp_splitter(const int i, const int len,
         }
 
         if (is_rawcam) {
+            /*
+             * The splitter input pool is the camera-splitter hop. In
+             * streaming mode, the ready frames, the one being converted and
+             * the one in the splitter all hold an input buffer.
+             */
+            const int depth = camera_pool_depth(cfg);
+            if (depth != 0)
+                input->buffer_num = MMAL_MAX(input->buffer_num_min,
+                                             (uint32_t) depth);
+            if (cfg->stream.queue_depth != 0)
+                input->buffer_num = MMAL_MAX(input->buffer_num,
+                                     (uint32_t) cfg->stream.queue_depth + 2);
             status = mmal_wrapper_port_enable(input,
                                             MMAL_WRAPPER_FLAG_PAYLOAD_ALLOCATE);
             if (status != MMAL_SUCCESS) {
@@ -1029,48 +2360,94 @@ static int setup_cp_splitter(const int i, const int len,
             }
         }
     }
-    for (j = 0; j < len; j ++) {
-        MMAL_PORT_T *output = mmal_util_get_port(component,
-                                                 MMAL_PORT_TYPE_OUTPUT, j);
-        const int32_t output_width  = cfg->isp[j].width,
-                      output_height = cfg->isp[j].height;
+    if ((ret = config_splitter_outputs(i, 0, component, width, height)))
+        goto end;
 
-        if (output == NULL) {
-            print_error("Getting output port of splitter %d,%d failed", i, j);
-            ret = 1;
-            goto end;
-        }
-
-        status = config_port_crop(output, MMAL_ENCODING_RGB24,
-                                  width, height,
-                                  output_width  * (width  / output_width ),
-                                  output_height * (height / output_height));
+    if (!is_rawcam) {
+        status = mmal_component_enable(cp_splitters[i]);
         if (status != MMAL_SUCCESS) {
-            print_error("Setting format of " \
-                        "splitter %d output %d failed: 0x%08x", i, j, status);
+            print_error("Enabling splitter component of " \
+                        "camera %d failed: 0x%08x", i, status);
             ret = 1;
             goto end;
         }
+    }
 
-        status = mmal_port_parameter_set_boolean(output,
-                                            MMAL_PARAMETER_ZERO_COPY, MMAL_TRUE);
+end:
+    return ret;
+}
+
+/* Sets up splitter k of camera i, which is fed by another splitter. */
+static int setup_cp_cascade(const int i, const int k,
+                            const int32_t width, const int32_t height)
+{
+    MMAL_STATUS_T status;
+    int ret = 0;
+
+    status = mmal_component_create(MMAL_COMPONENT_DEFAULT_VIDEO_SPLITTER,
+                                   &cp_cascades[i][k]);
+    if (status != MMAL_SUCCESS) {
+        print_error("Creating splitter component %d,%d failed: 0x%08x",
+                    i, k, status);
+        ret = 1;
+        goto end;
+    }
+    {
+        MMAL_PORT_T *control = mmal_util_get_port(cp_cascades[i][k],
+                                                  MMAL_PORT_TYPE_CONTROL, 0);
+
+        if (control == NULL) {
+            print_error("Getting control port of splitter %d,%d failed", i, k);
+            ret = 1;
+            goto end;
+        }
+
+        status = mmal_port_enable(control, callback_control);
         if (status != MMAL_SUCCESS) {
-            print_error("Setting zero-copy on " \
-                        "splitter %d output %d failed: 0x%08x", i, j, status);
+            print_error("Enabling control port of " \
+                        "splitter %d,%d failed: 0x%08x", i, k, status);
             ret = 1;
             goto end;
         }
     }
+    {
+        MMAL_PORT_T *input = mmal_util_get_port(cp_cascades[i][k],
+                                                MMAL_PORT_TYPE_INPUT, 0);
 
-    if (!is_rawcam) {
-        status = mmal_component_enable(cp_splitters[i]);
+        if (input == NULL) {
+            print_error("Getting input port of splitter %d,%d failed", i, k);
+            ret = 1;
+            goto end;
+        }
+
+        status = config_port(input, MMAL_ENCODING_RGB24, width, height);
         if (status != MMAL_SUCCESS) {
-            print_error("Enabling splitter component of " \
-                        "camera %d failed: 0x%08x", i, status);
+            print_error("Setting format of " \
+                        "splitter %d,%d input failed: 0x%08x", i, k, status);
+            ret = 1;
+            goto end;
+        }
+
+        status = mmal_port_parameter_set_boolean(input,
+                                                 MMAL_PARAMETER_ZERO_COPY,
+                                                 MMAL_TRUE);
+        if (status != MMAL_SUCCESS) {
+            print_error("Setting zero-copy on " \
+                        "splitter %d,%d input failed: 0x%08x", i, k, status);
             ret = 1;
             goto end;
         }
     }
+    if ((ret = config_splitter_outputs(i, k, cp_cascades[i][k],
+                                       width, height)))
+        goto end;
+    status = mmal_component_enable(cp_cascades[i][k]);
+    if (status != MMAL_SUCCESS) {
+        print_error("Enabling splitter component %d,%d failed: 0x%08x",
+                    i, k, status);
+        ret = 1;
+        goto end;
+    }
 
 end:
     return ret;
@@ -1110,8 +2487,7 @@ static int setup_cp_isp(const int i, const int j,
     {
         MMAL_PORT_T *input = mmal_util_get_port(cp_isps[i][j],
                                                 MMAL_PORT_TYPE_INPUT, 0);
-        const int32_t output_width  = cfg->isp[j].width,
-                      output_height = cfg->isp[j].height;
+        MMAL_RECT_T crop;
 
         if (input == NULL) {
             print_error("Getting input port of isp %d,%d failed", i, j);
@@ -1119,9 +2495,9 @@ static int setup_cp_isp(const int i, const int j,
             goto end;
         }
 
+        get_isp_crop(i, j, &crop);
         status = config_port_crop(input, MMAL_ENCODING_RGB24, width, height,
-                                  output_width  * (width  / output_width ),
-                                  output_height * (height / output_height));
+                                  &crop);
         if (status != MMAL_SUCCESS) {
             print_error("Setting format of " \
                         "isp %d input %d failed: 0x%08x", i, j, status);
@@ -1263,9 +2639,206 @@ end:
     return ret;
 }
 
+/*
+ * Sets the number of buffers of a connection about to be created, if depth is
+ * not 0, and returns the flag that keeps mmal_connection_create from
+ * overriding it.
+ */
+static uint32_t set_pool_depth(MMAL_PORT_T *out, MMAL_PORT_T *in,
+                               const int depth)
+{
+    if (depth == 0)
+        return 0;
+    out->buffer_num = in->buffer_num =
+                MMAL_MAX((uint32_t) depth,
+                         MMAL_MAX(out->buffer_num_min, in->buffer_num_min));
+    out->buffer_size = in->buffer_size =
+                MMAL_MAX(MMAL_MAX(out->buffer_size_recommended,
+                                  out->buffer_size_min),
+                         MMAL_MAX(in->buffer_size_recommended,
+                                  in->buffer_size_min));
+    return MMAL_CONNECTION_FLAG_KEEP_BUFFER_REQUIREMENTS;
+}
+
+/*
+ * Prepares isp_frames[i][j] for the pool of the connection of its isp. The
+ * outputs of a shared isp may keep all but one buffer of the pool for each
+ * of them, and the isp the one left.
+ */
+static int setup_isp_frames(const int i, const int j)
+{
+    const int l = isp_of(i, j), num_consumers = num_isp_consumers(i, l);
+    MMAL_POOL_T *pool = conn_isps_renders[i][l]->pool;
+    struct isp_frames *frames = &isp_frames[i][j];
+    unsigned k;
+    int ret = 0;
+
+    if (frames->arrived == NULL) {
+        frames->arrived = mmal_queue_create();
+        if (frames->arrived == NULL) {
+            print_error("Creating queue of isp %d,%d failed", i, j);
+            ret = 1;
+            goto end;
+        }
+    }
+    for (k = 0; k < RPIGRAFX_NUM_LATENCIES; k ++)
+        priv_rpigrafx_latency_hist_clear(&frames->hists[k]);
+    frames->max_backlog = num_consumers == 1 ? 0
+                      : MMAL_MAX(1, (int) pool->headers_num - 1 - num_consumers);
+    if (frames->replicas != NULL) {
+        mmal_pool_destroy(frames->replicas);
+        frames->replicas = NULL;
+    }
+
+    /* The outputs of a shared isp get replicas of the frames of l. */
+    if (num_consumers != 1) {
+        frames->replicas = mmal_pool_create(pool->headers_num, 0);
+        if (frames->replicas == NULL) {
+            print_error("Creating replicas of isp %d,%d failed", i, j);
+            ret = 1;
+            goto end;
+        }
+        mmal_pool_callback_set(frames->replicas, callback_replica_released,
+                               NULL);
+    }
+    /* Their metadata are those of l. */
+    if (l != j)
+        goto end;
+    priv_rpigrafx_free(frames->metas);
+    frames->metas = priv_rpigrafx_malloc(pool->headers_num
+                                         * sizeof(*frames->metas));
+    if (frames->metas == NULL) {
+        print_error("Allocating frame metadata of isp %d,%d failed", i, j);
+        ret = 1;
+        goto end;
+    }
+    for (k = 0; k < pool->headers_num; k ++) {
+        frames->metas[k].receive_ns = frames->metas[k].sequence = 0;
+        frames->metas[k].header = pool->header[k];
+        frames->metas[k].num_refs = 0;
+        pool->header[k]->user_data = &frames->metas[k];
+    }
+    frames->num_arrived = 0;
+
+end:
+    return ret;
+}
+
+/*
+ * Buffers of a hop leading to the isp of output l: the most that any output
+ * it feeds asked for. A shared isp gets at least two per output on the
+ * isp-render hop, so that each can lag a frame behind without starving it.
+ */
+static int isp_pool_depth(const int i, const int l, const rpigrafx_hop_t hop)
+{
+    const struct cameras_config *cfg = &cameras_config[i];
+    const int num_consumers = num_isp_consumers(i, l);
+    int k, depth = 0;
+
+    for (k = l; k < cfg->splitter.next_output_idx; k ++)
+        if (cfg->isp[k].shared_with == l)
+            depth = MMAL_MAX(depth, cfg->isp[k].pool_depths[hop]);
+    if (hop == RPIGRAFX_HOP_ISP_RENDER && num_consumers != 1) {
+        if (depth == 0)
+            depth = cp_isps[i][l]->output[0]->buffer_num_recommended;
+        depth = MMAL_MAX(depth, 2 * num_consumers + 1);
+    }
+    return depth;
+}
+
+/* Connects the isp of output j to its splitter port and to its render. */
+static int connect_isp(const int i, const int j)
+{
+    struct cameras_config *cfg = &cameras_config[i];
+    MMAL_PORT_T *splitter_output = NULL;
+    MMAL_STATUS_T status;
+    int ret = 0;
+
+    splitter_output = get_splitter_output(i, &cfg->splitter.outputs[j]);
+    status = mmal_connection_create(&conn_splitters_isps[i][j],
+                                    splitter_output,
+                                    cp_isps[i][j]->input[0],
+                                    MMAL_CONNECTION_FLAG_TUNNELLING
+                    | set_pool_depth(splitter_output,
+                                     cp_isps[i][j]->input[0],
+                       isp_pool_depth(i, j, RPIGRAFX_HOP_SPLITTER_ISP)));
+    if (status != MMAL_SUCCESS) {
+        print_error("Connecting "
+                    "splitter and isp ports %d,%d failed: 0x%08x",
+                    i, j, status);
+        ret = 1;
+        goto end;
+    }
+    status = mmal_connection_create(&conn_isps_renders[i][j],
+                                    cp_isps[i][j]->output[0],
+                                    cp_renders[i][j]->input[0],
+                                    set_pool_depth(cp_isps[i][j]->output[0],
+                                                   cp_renders[i][j]->input[0],
+                         isp_pool_depth(i, j, RPIGRAFX_HOP_ISP_RENDER)));
+    if (status != MMAL_SUCCESS) {
+        print_error("Connecting "
+                    "isp and render ports %d,%d failed: 0x%08x",
+                    i, j, status);
+        ret = 1;
+        goto end;
+    }
+
+end:
+    return ret;
+}
+
+/* Enables the connections of the isp of output j, downstream first. */
+static int enable_isp(const int i, const int j)
+{
+    MMAL_STATUS_T status;
+    int ret = 0;
+
+    if (frame_callbacks[i][j].func != NULL) {
+        conn_isps_renders[i][j]->user_data = &frame_callbacks[i][j];
+        conn_isps_renders[i][j]->callback = deliver_frames;
+    } else {
+        conn_isps_renders[i][j]->user_data = &isp_frames[i][j];
+        conn_isps_renders[i][j]->callback = callback_conn_frames;
+    }
+    status = mmal_connection_enable(conn_isps_renders[i][j]);
+    if (status != MMAL_SUCCESS) {
+        print_error("Enabling connection between "
+                    "splitter and isp %d,%d failed: 0x%08x", i, j, status);
+        ret = 1;
+        goto end;
+    }
+    conn_splitters_isps[i][j]->callback = callback_conn;
+    status = mmal_connection_enable(conn_splitters_isps[i][j]);
+    if (status != MMAL_SUCCESS) {
+        print_error("Enabling connection between "
+                    "splitter and isp %d,%d failed: 0x%08x", i, j, status);
+        ret = 1;
+        goto end;
+    }
+
+end:
+    return ret;
+}
+
+/* Sends the buffers of the pool of the isp of output j to it. */
+static int prime_isp(const int i, const int j)
+{
+    MMAL_CONNECTION_T *conn = conn_isps_renders[i][j];
+    int ret = 0;
+
+    memset(&isp_pool_stats[i][j], 0, sizeof(isp_pool_stats[i][j]));
+    refill_isp(i, j);
+    if (mmal_queue_length(conn->pool->queue) != 0) {
+        print_error("Sending pool buffers to isp-render conn %d,%d failed",
+                    i, j);
+        ret = 1;
+    }
+    return ret;
+}
+
 static int connect_ports(const int i, const int len)
 {
-    int j;
+    int j, k;
     struct cameras_config *cfg = &cameras_config[i];
     MMAL_STATUS_T status;
     int ret = 0;
@@ -1286,11 +2859,12 @@ static int connect_ports(const int i, const int len)
     }
 
     if (!cfg->is_rawcam) {
-        status = mmal_connection_create(&conn_camera_splitters[i],
-                                        cp_cameras[i]->
+        MMAL_PORT_T *out = cp_cameras[i]->
                                           output[cfg->camera_output_port_index],
-                                        cp_splitters[i]->input[0],
-                                        MMAL_CONNECTION_FLAG_TUNNELLING);
+                    *in = cp_splitters[i]->input[0];
+        status = mmal_connection_create(&conn_camera_splitters[i], out, in,
+                                        MMAL_CONNECTION_FLAG_TUNNELLING
+                              | set_pool_depth(out, in, camera_pool_depth(cfg)));
         if (status != MMAL_SUCCESS) {
             print_error("Connecting " \
                         "camera and splitter ports %d failed: 0x%08x", i, status);
@@ -1299,51 +2873,39 @@ static int connect_ports(const int i, const int len)
         }
     }
 
-    for (j = 0; j < len; j ++) {
-        if (!cfg->is_rawcam)
-            status = mmal_connection_create(&conn_splitters_isps[i][j],
-                                            cp_splitters[i]->output[j],
-                                            cp_isps[i][j]->input[0],
-                                            MMAL_CONNECTION_FLAG_TUNNELLING);
-        else
-            status = mmal_connection_create(&conn_splitters_isps[i][j],
-                                            cpw_splitters[i]->output[j],
-                                            cp_isps[i][j]->input[0],
-                                            MMAL_CONNECTION_FLAG_TUNNELLING);
-        if (status != MMAL_SUCCESS) {
-            print_error("Connecting "
-                        "splitter and isp ports %d,%d failed: 0x%08x",
-                        i, j, status);
-            ret = 1;
-            goto end;
-        }
-        status = mmal_connection_create(&conn_isps_renders[i][j],
-                                        cp_isps[i][j]->output[0],
-                                        cp_renders[i][j]->input[0],
-                                        0);
+    for (k = 1; k < cfg->splitter.num_splitters; k ++) {
+        status = mmal_connection_create(&conn_cascades[i][k],
+                            get_splitter_output(i, &cfg->splitter.feeds[k]),
+                                        cp_cascades[i][k]->input[0],
+                                        MMAL_CONNECTION_FLAG_TUNNELLING);
         if (status != MMAL_SUCCESS) {
             print_error("Connecting "
-                        "isp and render ports %d,%d failed: 0x%08x",
-                        i, j, status);
+                        "splitter and splitter ports %d,%d failed: 0x%08x",
+                        i, k, status);
             ret = 1;
             goto end;
         }
     }
 
-    for (j = 0; j < len; j ++) {
-        conn_isps_renders[i][j]->callback = callback_conn;
-        status = mmal_connection_enable(conn_isps_renders[i][j]);
-        if (status != MMAL_SUCCESS) {
-            print_error("Enabling connection between "
-                        "splitter and isp %d,%d failed: 0x%08x", i, j, status);
-            ret = 1;
+    for (j = 0; j < len; j ++)
+        if (isp_of(i, j) == j)
+            if ((ret = connect_isp(i, j)))
+                goto end;
+    for (j = 0; j < len; j ++)
+        if ((ret = setup_isp_frames(i, j)))
             goto end;
-        }
-        conn_splitters_isps[i][j]->callback = callback_conn;
-        status = mmal_connection_enable(conn_splitters_isps[i][j]);
+    for (j = 0; j < len; j ++)
+        if (isp_of(i, j) == j)
+            if ((ret = enable_isp(i, j)))
+                goto end;
+    /* Downstream first: the deeper splitters come later in the plan. */
+    for (k = cfg->splitter.num_splitters - 1; k >= 1; k --) {
+        conn_cascades[i][k]->callback = callback_conn;
+        status = mmal_connection_enable(conn_cascades[i][k]);
         if (status != MMAL_SUCCESS) {
             print_error("Enabling connection between "
-                        "splitter and isp %d,%d failed: 0x%08x", i, j, status);
+                        "splitter and splitter %d,%d failed: 0x%08x",
+                        i, k, status);
             ret = 1;
             goto end;
         }
@@ -1369,278 +2931,2028 @@ static int connect_ports(const int i, const int len)
         }
     }
 
-    for (j = 0; j < len; j ++) {
-        MMAL_BUFFER_HEADER_T *header = NULL;
-        MMAL_CONNECTION_T *conn = conn_isps_renders[i][j];
-        while ((header = mmal_queue_get(conn->pool->queue)) != NULL) {
-            status = mmal_port_send_buffer(conn->out, header);
-            if (status != MMAL_SUCCESS) {
-                print_error("Sending pool buffer to "
-                            "isp-render conn %d,%d failed: 0x%08x", status);
-                ret = 1;
+    for (j = 0; j < len; j ++)
+        if (isp_of(i, j) == j)
+            if ((ret = prime_isp(i, j)))
                 goto end;
-            }
-        }
-    }
 
 end:
     return ret;
 }
 
-int rpigrafx_finish_config()
+static void destroy_connection(MMAL_CONNECTION_T **connp)
 {
-    int i, j;
-    int ret = 0;
+    MMAL_STATUS_T status;
 
-    for (i = 0; i < num_cameras; i ++) {
-        int len;
-        /* Maximum width/height of the requested frames. */
-        int32_t max_width, max_height;
-        struct cameras_config *cfg = &cameras_config[i];
+    if (*connp == NULL)
+        return;
+    status = mmal_connection_destroy(*connp);
+    if (status != MMAL_SUCCESS)
+        print_error("Destroying connection %s failed: 0x%08x",
+                    (*connp)->name, status);
+    *connp = NULL;
+}
 
-        if (!cfg->is_used)
-            continue;
+static void destroy_component(MMAL_COMPONENT_T **componentp)
+{
+    MMAL_STATUS_T status;
 
-        len = cfg->splitter.next_output_idx;
+    if (*componentp == NULL)
+        return;
+    status = mmal_component_destroy(*componentp);
+    if (status != MMAL_SUCCESS)
+        print_error("Destroying component %s failed: 0x%08x",
+                    (*componentp)->name, status);
+    *componentp = NULL;
+}
 
-        max_width = max_height = 0;
-        for (j = 0; j < len; j ++) {
-            max_width  = MMAL_MAX(max_width,  cfg->isp[j].width);
-            max_height = MMAL_MAX(max_height, cfg->isp[j].height);
+/*
+ * Tears down the isp of output l and its render. The frames of the outputs
+ * it feeds, held or not, go back to its pool first, since destroying the
+ * connection frees it. The splitter port that fed it is left disabled.
+ */
+static void teardown_isp(const int i, const int l)
+{
+    const struct cameras_config *cfg = &cameras_config[i];
+    MMAL_CONNECTION_T *conn = conn_isps_renders[i][l];
+    MMAL_BUFFER_HEADER_T *header = NULL;
+    int k;
+
+    /*
+     * The isp stops on its output first, since it waits there for a frame
+     * to fill, then on its input.
+     */
+    if (conn != NULL) {
+        conn->callback = NULL;
+        mmal_connection_disable(conn);
+        for (k = l; k < cfg->splitter.next_output_idx; k ++) {
+            struct callback_context *ctx = ctxs[i][k];
+            if (cfg->isp[k].shared_with != l)
+                continue;
+            if (ctx->header != NULL && !ctx->is_header_passed_to_render)
+                mmal_buffer_header_release(ctx->header);
+            ctx->header = NULL;
+            ctx->is_header_passed_to_render = 0;
+            while ((header = mmal_queue_get(isp_frames[i][k].arrived)) != NULL)
+                mmal_buffer_header_release(header);
+            is_frame_requested[i][k] = 0;
         }
-#ifdef IMPL_RAWCAM
-        if (cfg->is_rawcam) {
-            switch (cfg->rawcam_camera_model) {
-                case RPIGRAFX_RAWCAM_CAMERA_MODEL_IMX219: {
-                    const int32_t mag = MMAL_MIN(cfg->max_width  / max_width,
-                                                 cfg->max_height / max_height);
-                    max_width  *= mag;
-                    max_height *= mag;
-                    break;
-                }
-            }
+    }
+    destroy_connection(&conn_splitters_isps[i][l]);
+    destroy_connection(&conn_isps_renders[i][l]);
+    for (k = l; k < cfg->splitter.next_output_idx; k ++) {
+        struct isp_frames *frames = &isp_frames[i][k];
+        if (cfg->isp[k].shared_with != l)
+            continue;
+        if (frames->replicas != NULL) {
+            mmal_pool_destroy(frames->replicas);
+            frames->replicas = NULL;
         }
+    }
+    priv_rpigrafx_free(isp_frames[i][l].metas);
+    isp_frames[i][l].metas = NULL;
+    destroy_component(&cp_renders[i][l]);
+    destroy_component(&cp_isps[i][l]);
+}
+
+/*
+ * Tears down the graph of camera i, upstream first so that no frame is on
+ * its way while the rest goes.
+ */
+static void teardown_camera(const int i)
+{
+    struct cameras_config *cfg = &cameras_config[i];
+    int j, k;
+
+    destroy_connection(&conn_camera_splitters[i]);
+    destroy_connection(&conn_camera_nulls[i]);
+    for (k = 1; k < MAX_SPLITTERS; k ++)
+        destroy_connection(&conn_cascades[i][k]);
+    for (j = 0; j < cfg->splitter.next_output_idx; j ++)
+        if (cp_isps[i][j] != NULL)
+            teardown_isp(i, j);
+    for (k = 1; k < MAX_SPLITTERS; k ++)
+        destroy_component(&cp_cascades[i][k]);
+    if (cpw_splitters[i] != NULL) {
+        mmal_wrapper_destroy(cpw_splitters[i]);
+        cpw_splitters[i] = NULL;
+    }
+    destroy_component(&cp_splitters[i]);
+    destroy_component(&cp_nulls[i]);
+    destroy_component(&cp_cameras[i]);
+#ifdef IMPL_RAWCAM
+    if (cpw_rawcams[i] != NULL) {
+        mmal_wrapper_destroy(cpw_rawcams[i]);
+        cpw_rawcams[i] = NULL;
+    }
 #endif /* IMPL_RAWCAM */
-        cfg->width = max_width;
-        cfg->height = max_height;
+}
 
-        if (cfg->is_rawcam) {
-            if ((ret = setup_cp_camera_rawcam(i, max_width, max_height)))
-                goto end;
-        } else {
-            if ((ret = setup_cp_camera(i, max_width, max_height,
-                                       cfg->use_camera_capture_port)))
-                goto end;
-        }
-        if ((ret = setup_cp_splitter(i, len, max_width, max_height,
-                                     cfg->is_rawcam)))
-            goto end;
-        if (cfg->use_camera_capture_port)
-            if ((ret = setup_cp_null(i, max_width, max_height)))
-                goto end;
-        for (j = 0; j < len; j ++) {
-            if ((ret = setup_cp_isp(i, j, max_width, max_height)))
-                goto end;
-            if ((ret = setup_cp_render(i, j)))
-                goto end;
-        }
-        if ((ret = connect_ports(i, len)))
-            goto end;
+/*
+ * Bytes of scratch that rpigrafx_capture_next_frame takes from cfg->scratch
+ * for one frame of the camera.
+ */
+static size_t scratch_size(const struct cameras_config *cfg)
+{
+    size_t size = 0;
+
+    if (cfg->is_rawcam) {
+        /* Each band has its own demosaic window. */
+        size += priv_rpigrafx_workers_num_threads(cfg->workers)
+                * VCOS_ALIGN_UP(priv_rpigrafx_demosaic_scratch_size(
+                                               cfg->demosaic, cfg->width), 32);
     }
 
-end:
-    return ret;
+    return size;
 }
 
-int rpigrafx_capture_next_frame(rpigrafx_frame_config_t *fcp)
+/*
+ * Chooses whether the output hands out the frames the isp emitted in order
+ * (RPIGRAFX_DELIVERY_FIFO, the default) or only the newest one, returning the
+ * older ones to the isp (RPIGRAFX_DELIVERY_LATEST).
+ */
+int rpigrafx_config_camera_frame_delivery(const rpigrafx_delivery_t delivery,
+                                          rpigrafx_frame_config_t *fcp)
 {
-    struct callback_context *ctx = fcp->ctx;
     struct cameras_config *cfg = &cameras_config[fcp->camera_number];
     int ret = 0;
-    MMAL_BUFFER_HEADER_T *header = NULL;
-    MMAL_STATUS_T status;
 
-    if (cfg->use_camera_capture_port) {
-        status = mmal_port_parameter_set_boolean(cp_cameras[fcp->camera_number]
-                                        ->output[cfg->camera_output_port_index],
-                                                 MMAL_PARAMETER_CAPTURE,
-                                                 MMAL_TRUE);
-        if (status != MMAL_SUCCESS) {
-            print_error("Setting capture to "
-                        "camera %d output %d failed: 0x%08x\n",
-                        fcp->camera_number, cfg->camera_output_port_index,
-                        status);
+    switch (delivery) {
+        case RPIGRAFX_DELIVERY_FIFO:
+        case RPIGRAFX_DELIVERY_LATEST:
+            break;
+        default:
+            print_error("Invalid delivery: %d", delivery);
             ret = 1;
             goto end;
-        }
     }
+    cfg->isp[fcp->splitter_output_port_index].delivery = delivery;
 
-    ret = rpigrafx_free_frame(fcp);
-    if (ret) {
-        print_error("rpigrafx_free_frame failed: %d\n", ret);
-        return ret;
+end:
+    return ret;
+}
+
+/*
+ * Sets the number of buffers in flight on a hop leading to the output; 0
+ * restores the default of MMAL. The camera-splitter hop is shared by the
+ * outputs of the camera and gets the most any of them asks for.
+ */
+int rpigrafx_config_pool_depth(const rpigrafx_hop_t hop, const int num_buffers,
+                               rpigrafx_frame_config_t *fcp)
+{
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int ret = 0;
+
+    if (hop < 0 || hop >= RPIGRAFX_NUM_HOPS) {
+        print_error("Invalid hop: %d", hop);
+        ret = 1;
+        goto end;
+    }
+    if (num_buffers < 0) {
+        print_error("Invalid number of buffers: %d", num_buffers);
+        ret = 1;
+        goto end;
     }
+    cfg->isp[fcp->splitter_output_port_index].pool_depths[hop] = num_buffers;
+
+end:
+    return ret;
+}
+
+/*
+ * Relates the clock of the pts of camera i, which is that of the firmware, to
+ * CLOCK_MONOTONIC. Frames get no sensor time if the camera does not tell.
+ */
+static void measure_pts_clock(const int i)
+{
+    struct cameras_config *cfg = &cameras_config[i];
+    MMAL_PORT_T *control = cp_cameras[i] != NULL ? cp_cameras[i]->control
+                                                 : NULL;
+    uint64_t before, after, system_time;
+    MMAL_STATUS_T status;
 
+    if (cfg->is_replay) {
+        /* Replayed frames get the time they are taken as their pts. */
+        cfg->pts_offset_ns = 0;
+        cfg->is_pts_clock_known = !0;
+        return;
+    }
 #ifdef IMPL_RAWCAM
-    if (cfg->is_rawcam) {
-        const int32_t width = cfg->width,
-                      height = cfg->height,
-                      /* Stride in header->data. */
-                      stride = ALIGN_UP(width, 32),
-                      raw_width = rpiraw_width_raw8_to_raw10_rpi(width);
-        for (; ; ) {
-            MMAL_PORT_T *output = cpw_rawcams[fcp->camera_number]->output[0],
-                        *input = cpw_splitters[fcp->camera_number]->input[0];
-            MMAL_QUEUE_T *input_queue = cpw_splitters[fcp->camera_number]->
-                                                           input_pool[0]->queue;
-            uint8_t *raw8 = NULL;
-
-            for (; ; ) {
-                _Bool exit_loop = 0;
-                status = mmal_wrapper_buffer_get_empty(output, &header, 0);
-                switch (status) {
-                    case MMAL_SUCCESS:
-                        status = mmal_port_send_buffer(output, header);
-                        if (status != MMAL_SUCCESS) {
-                            print_error("Failed to send empty buffer to rawcam:"
-                                        " 0x%08x", status);
-                            ret = 1;
-                            goto end;
-                        }
-                        break;
-                    case MMAL_EAGAIN:
-                        exit_loop = !0;
-                        break;
-                    default:
-                        print_error("Failed to get empty header: 0x%08x",
-                                    status);
-                        ret = 1;
-                        goto end;
-                }
-                if (exit_loop)
-                    break;
-            }
+    if (cfg->is_rawcam)
+        control = cpw_rawcams[i]->control;
+#endif /* IMPL_RAWCAM */
+    cfg->is_pts_clock_known = 0;
+    if (control == NULL)
+        return;
+
+    before = get_time_ns();
+    status = mmal_port_parameter_get_uint64(control, MMAL_PARAMETER_SYSTEM_TIME,
+                                            &system_time);
+    after = get_time_ns();
+    if (status != MMAL_SUCCESS) {
+        print_error("Getting system time of camera %d failed: 0x%08x; "
+                    "frames have no sensor time", i, status);
+        return;
+    }
+    cfg->pts_offset_ns = (int64_t) (before + (after - before) / 2)
+                         - (int64_t) system_time * 1000;
+    cfg->is_pts_clock_known = !0;
+}
 
-            status = mmal_wrapper_buffer_get_full(output, &header,
-                                                  MMAL_WRAPPER_FLAG_WAIT);
-            if (status != MMAL_SUCCESS) {
-                print_error("Failed to get full header from rawcam: 0x%08x",
-                            status);
+int rpigrafx_finish_config()
+{
+    int i, j;
+    int ret = 0;
+
+    /* Replays may be on camera numbers beyond num_cameras. */
+    for (i = 0; i < MAX_CAMERAS; i ++) {
+        int len, num_callbacks = 0;
+        /* Maximum width/height of the requested frames. */
+        int32_t max_width, max_height;
+        struct cameras_config *cfg = &cameras_config[i];
+        uint64_t start;
+
+        if (!cfg->is_used)
+            continue;
+
+        start = get_time_ns();
+        len = cfg->splitter.next_output_idx;
+        share_isps(i, len);
+        plan_splitters(i, len);
+        for (j = 0; j < len; j ++)
+            if (frame_callbacks[i][j].func != NULL)
+                num_callbacks ++;
+        if (cfg->is_rawcam && num_callbacks != 0) {
+            /* Nobody captures, so the producer has to feed the splitter. */
+            if (num_callbacks != len || cfg->stream.queue_depth == 0) {
+                print_error("Callback mode of rawcam %d needs streaming mode "
+                            "and callbacks on all its outputs", i);
                 ret = 1;
                 goto end;
             }
+        }
+        cfg->stream.is_pushing = num_callbacks != 0;
 
-            /* Raw info etc... */
-            if (header->flags & MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO) {
-                mmal_buffer_header_release(header);
-                continue;
+        max_width = max_height = 0;
+        for (j = 0; j < len; j ++) {
+            const struct isp_config *isp = &cfg->isp[j];
+            int32_t width = isp->width, height = isp->height;
+            /* A region is as large as its output if the camera allows. */
+            if (isp->has_roi) {
+                width  = MMAL_MIN(cfg->max_width,
+                                  (int32_t) (width  / isp->roi.width  + .5f));
+                height = MMAL_MIN(cfg->max_height,
+                                  (int32_t) (height / isp->roi.height + .5f));
             }
-
-            raw8 = malloc(width * height);
-            if (raw8 == NULL) {
-                print_error("Failed to allocate raw8: %s", strerror(errno));
-                ret = 1;
-                goto end;
+            max_width  = MMAL_MAX(max_width,  width);
+            max_height = MMAL_MAX(max_height, height);
+        }
+#ifdef IMPL_RAWCAM
+        if (cfg->is_rawcam && !cfg->is_replay) {
+            switch (cfg->rawcam_camera_model) {
+                case RPIGRAFX_RAWCAM_CAMERA_MODEL_IMX219: {
+                    const int32_t mag = MMAL_MIN(cfg->max_width  / max_width,
+                                                 cfg->max_height / max_height);
+                    max_width  *= mag;
+                    max_height *= mag;
+                    break;
+                }
             }
+        }
+#endif /* IMPL_RAWCAM */
+        /* The frames of a replay are as large as they were recorded. */
+        if (cfg->is_replay) {
+            max_width  = cfg->max_width;
+            max_height = cfg->max_height;
+        }
+        cfg->width = max_width;
+        cfg->height = max_height;
 
-            /* xxx: Add stride argument to this call. */
-            ret = rpiraw_convert_raw10_to_raw8(raw8, header->data,
-                                               width, height, raw_width);
-            if (ret) {
-                print_error("rpiraw_convert_raw10_to_raw8: %d", ret);
+        if (cfg->is_rawcam) {
+            int num_threads = cfg->num_threads;
+            if (num_threads == 0)
+                num_threads = MMAL_MAX(1, MMAL_MIN(PRIV_RPIGRAFX_MAX_WORKERS,
+                                          sysconf(_SC_NPROCESSORS_ONLN)));
+            priv_rpigrafx_workers_destroy(cfg->workers);
+            cfg->workers = priv_rpigrafx_workers_create(num_threads);
+            if (cfg->workers == NULL) {
+                ret = 1;
                 goto end;
             }
+        }
 
-            mmal_buffer_header_release(header);
+        priv_rpigrafx_arena_finalize(&cfg->scratch);
+        if ((ret = priv_rpigrafx_arena_init(&cfg->scratch, scratch_size(cfg))))
+            goto end;
+        cfg->num_splitter_input_dry = 0;
 
-            header = mmal_queue_wait(input_queue);
-            if (header == NULL) {
-                print_error("Failed to wait for header from rawcam");
+        if (cfg->is_replay) {
+            /* Nothing to set up: the frames are read from the recording. */
+        } else if (cfg->is_rawcam) {
+            if ((ret = setup_cp_camera_rawcam(i, max_width, max_height)))
+                goto end;
+        } else {
+            if ((ret = setup_cp_camera(i, max_width, max_height,
+                                       cfg->use_camera_capture_port)))
+                goto end;
+        }
+        if ((ret = setup_cp_splitter(i, max_width, max_height,
+                                     cfg->is_rawcam)))
+            goto end;
+        for (j = 1; j < cfg->splitter.num_splitters; j ++)
+            if ((ret = setup_cp_cascade(i, j, max_width, max_height)))
+                goto end;
+        if (cfg->use_camera_capture_port)
+            if ((ret = setup_cp_null(i, max_width, max_height)))
+                goto end;
+        for (j = 0; j < len; j ++) {
+            if (isp_of(i, j) != j)
+                continue;
+            if ((ret = setup_cp_isp(i, j, max_width, max_height)))
+                goto end;
+            if ((ret = setup_cp_render(i, j)))
+                goto end;
+        }
+        if ((ret = connect_ports(i, len)))
+            goto end;
+        measure_pts_clock(i);
+        if (cfg->use_camera_capture_port && num_callbacks != 0) {
+            /* Capture continuously instead of per rpigrafx_capture_next_frame. */
+            MMAL_STATUS_T status = mmal_port_parameter_set_boolean(
+                        cp_cameras[i]->output[cfg->camera_output_port_index],
+                        MMAL_PARAMETER_CAPTURE, MMAL_TRUE);
+            if (status != MMAL_SUCCESS) {
+                print_error("Setting capture to camera %d output %d failed: "
+                            "0x%08x", i, cfg->camera_output_port_index, status);
                 ret = 1;
                 goto end;
             }
-
-            if (cfg->rawcam_camera_model == RPIGRAFX_RAWCAM_CAMERA_MODEL_IMX219) {
-                ret = rpiraw_raw8bggr_component_gain(raw8, width, raw8, width,
-                                               width, height, 1.55, 1.0, 1.5);
-                if (ret) {
-                    print_error("rpiraw_raw8bggr_component_gain: %d", ret);
-                    goto end;
-                }
-            }
-            ret = rpiraw_raw8bggr_to_rgb888_nearest_neighbor(header->data,
-                                                             stride,
-                                                             raw8,
-                                                             width, width,
-                                                             height);
-            if (ret) {
-                print_error("rpiraw_raw8bggr_to_rgb888_nearest_neighbor: %d",
-                            ret);
+        }
+        if (cfg->is_rawcam && cfg->stream.queue_depth != 0)
+            if ((ret = start_rawcam_stream(i)))
                 goto end;
-            }
+        cfg->setup_ns = get_time_ns() - start;
+    }
 
-            free(raw8);
+end:
+    return ret;
+}
 
-            {
-                uint32_t hist_r[256], hist_g[256], hist_b[256], sum = 0;
-                ret = rpiraw_calc_histogram_rgb888(hist_r, hist_g, hist_b,
-                                                   header->data,
-                                                   stride, width, height);
-                sum = hist_r[255] + hist_g[255] + hist_b[255];
-                ret = rpicam_imx219_tuner(RPICAM_IMX219_TUNER_METHOD_HEURISTIC,
-                                          &cfg->rpicam_config.imx219, sum);
-            }
+/* Sets up the isp of output j and its render, and starts them. */
+static int build_isp(const int i, const int j)
+{
+    const struct cameras_config *cfg = &cameras_config[i];
+    int ret = 0;
 
-            /*
-             * Wait! The header here is not the one the user requested. We pass
-             * it to the splitter and wait for the isp to crop them.
-             */
+    if ((ret = setup_cp_isp(i, j, cfg->width, cfg->height)))
+        goto end;
+    if ((ret = setup_cp_render(i, j)))
+        goto end;
+    if ((ret = connect_isp(i, j)))
+        goto end;
+    if ((ret = setup_isp_frames(i, j)))
+        goto end;
+    if ((ret = enable_isp(i, j)))
+        goto end;
+    ret = prime_isp(i, j);
 
-            /* xxx: stride * height * 3 ? */
-            header->length = width * height * 3;
-            header->flags = MMAL_BUFFER_HEADER_FLAG_EOS;
-            status = mmal_port_send_buffer(input, header);
-            if (status != MMAL_SUCCESS) {
-                print_error("Failed to send buffer to splitter: 0x%08x",
-                            status);
+end:
+    return ret;
+}
+
+/*
+ * Changes the size and encoding of an output after rpigrafx_finish_config.
+ * Only its isp and render are rebuilt: the camera and the other outputs go
+ * on streaming, even from other threads, but fcp must not be in use. The
+ * current frame of the output is freed and the frames it held are gone. The
+ * output cannot grow beyond the camera frame, which is as large as the
+ * largest output was on rpigrafx_finish_config. On failure the output is
+ * rebuilt as it was.
+ */
+int rpigrafx_reconfig_camera_frame(const int32_t width, const int32_t height,
+                                   const MMAL_FOURCC_T encoding,
+                                   rpigrafx_frame_config_t *fcp)
+{
+    const int i = fcp->camera_number, j = fcp->splitter_output_port_index;
+    struct cameras_config *cfg = &cameras_config[i];
+    struct isp_config *isp = &cfg->isp[j];
+    const int32_t old_width = isp->width, old_height = isp->height;
+    const MMAL_FOURCC_T old_encoding = isp->encoding;
+    const uint64_t start = get_time_ns();
+    int ret = 0;
+
+    if (cfg->splitter.num_splitters == 0) {
+        print_error("Camera %d is not set up yet", i);
+        ret = 1;
+        goto end;
+    }
+    if (frame_callbacks[i][j].func != NULL) {
+        print_error("Frames of isp %d,%d are passed to a callback", i, j);
+        ret = 1;
+        goto end;
+    }
+    if (num_isp_consumers(i, isp_of(i, j)) != 1) {
+        print_error("isp %d,%d is shared by %d outputs", i, j,
+                    num_isp_consumers(i, isp_of(i, j)));
+        ret = 1;
+        goto end;
+    }
+    /* The camera goes on at the size rpigrafx_finish_config chose. */
+    if (width <= 0 || height <= 0
+            || width > cfg->width || height > cfg->height) {
+        print_error("Invalid size %dx%d of isp %d,%d for camera of %dx%d",
+                    width, height, i, j, cfg->width, cfg->height);
+        ret = 1;
+        goto end;
+    }
+
+    teardown_isp(i, j);
+    isp->width  = width;
+    isp->height = height;
+    isp->encoding = encoding;
+    if ((ret = build_isp(i, j)) == 0) {
+        isp->reconfig_ns = get_time_ns() - start;
+        goto end;
+    }
+
+    print_error("Reconfiguring isp %d,%d to %dx%d failed; restoring %dx%d",
+                i, j, width, height, old_width, old_height);
+    teardown_isp(i, j);
+    isp->width  = old_width;
+    isp->height = old_height;
+    isp->encoding = old_encoding;
+    if (build_isp(i, j))
+        print_error("Restoring isp %d,%d failed", i, j);
+
+end:
+    return ret;
+}
+
+static void process_rawcam_band(void *arg, const int task)
+{
+    struct rawcam_job *job = arg;
+    struct rawcam_band *band = &job->bands[task];
+    const struct cameras_config *cfg = job->cfg;
+    const int32_t width = cfg->width,
+                  height = cfg->height,
+                  /* Strides in bytes of header->data. */
+                  stride = ALIGN_UP(width, 32) * 3;
+
+    /*
+     * Unpack, gain and demosaic straight from the rawcam buffer into the
+     * splitter buffer in one pass, taking statistics on the way.
+     */
+    priv_rpigrafx_bayer_stats_clear(&band->stats);
+    band->ret = priv_rpigrafx_raw10bggr_to_rgb888_gain_rows(job->dst, stride,
+                                                           job->src,
+                                                           job->src_stride,
+                                                           width, height,
+                                                           band->y_begin,
+                                                           band->y_end,
+                                                           job->gain_r,
+                                                           job->gain_g,
+                                                           job->gain_b,
+                                                           cfg->demosaic,
+                                                       band->demosaic_scratch,
+                                                           &band->stats,
+                                                           cfg->stats_step);
+    if (band->ret)
+        print_error("priv_rpigrafx_raw10bggr_to_rgb888_gain_rows: %d",
+                    band->ret);
+}
+
+/*
+ * Converts a raw frame, whose rows are src_stride bytes apart, into dst and
+ * runs the tuner on it. The frame is split into one band of rows per worker
+ * thread; bands start on even rows so that each one covers whole Bayer quads.
+ */
+static int process_rawcam_frame(struct cameras_config *cfg, uint8_t *dst,
+                                const uint8_t *src, const int32_t src_stride)
+{
+    struct rawcam_job *job = &cfg->job;
+    const int num_threads = priv_rpigrafx_workers_num_threads(cfg->workers);
+    const int32_t height = cfg->height,
+                  band_height = ALIGN_UP((height + num_threads - 1)
+                                                           / num_threads, 2);
+    const size_t demosaic_scratch_size =
+                priv_rpigrafx_demosaic_scratch_size(cfg->demosaic, cfg->width);
+    rpigrafx_bayer_stats_t stats;
+    uint64_t start;
+    int i, ret = 0;
+
+    job->cfg = cfg;
+    job->dst = dst;
+    job->src = src;
+    job->src_stride = src_stride;
+    pthread_mutex_lock(&cfg->stats_mutex);
+    job->gain_r = cfg->awb.gains[0];
+    job->gain_g = cfg->awb.gains[1];
+    job->gain_b = cfg->awb.gains[2];
+    pthread_mutex_unlock(&cfg->stats_mutex);
+
+    priv_rpigrafx_arena_reset(&cfg->scratch);
+    job->num_bands = 0;
+    for (i = 0; i < num_threads && i * band_height < height; i ++) {
+        struct rawcam_band *band = &job->bands[i];
+        band->y_begin = i * band_height;
+        band->y_end = MMAL_MIN(height, band->y_begin + band_height);
+        band->demosaic_scratch = NULL;
+        if (demosaic_scratch_size != 0) {
+            band->demosaic_scratch =
+                priv_rpigrafx_arena_alloc(&cfg->scratch, demosaic_scratch_size);
+            if (band->demosaic_scratch == NULL) {
                 ret = 1;
                 goto end;
             }
+        }
+        job->num_bands ++;
+    }
 
-            break;
+    start = priv_rpigrafx_profile_begin();
+    if ((ret = priv_rpigrafx_workers_run(cfg->workers, job->num_bands,
+                                         process_rawcam_band, job)))
+        goto end;
+    priv_rpigrafx_profile_end(&cfg->stages[RPIGRAFX_STAGE_CONVERT], start,
+                              (uint64_t) height
+                              * (src_stride + ALIGN_UP(cfg->width, 32) * 3));
+
+    start = priv_rpigrafx_profile_begin();
+    priv_rpigrafx_bayer_stats_clear(&stats);
+    for (i = 0; i < job->num_bands; i ++) {
+        const struct rawcam_band *band = &job->bands[i];
+        if (band->ret) {
+            ret = band->ret;
+            goto end;
         }
+        priv_rpigrafx_bayer_stats_add(&stats, &band->stats);
+    }
+    pthread_mutex_lock(&cfg->stats_mutex);
+    for (i = 0; i < job->num_bands; i ++) {
+        const struct rawcam_band *band = &job->bands[i];
+        cfg->band_timings[i].y = band->y_begin;
+        cfg->band_timings[i].height = band->y_end - band->y_begin;
+        cfg->band_timings[i].ns = priv_rpigrafx_workers_task_ns(cfg->workers,
+                                                                i);
+    }
+    cfg->num_band_timings = job->num_bands;
+    memcpy(&cfg->stats, &stats, sizeof(stats));
+    /* The gains for the next frame. */
+    priv_rpigrafx_awb_update(&cfg->awb, &stats);
+    pthread_mutex_unlock(&cfg->stats_mutex);
+
+#ifdef IMPL_RAWCAM
+    /* A replayed frame has no sensor behind it to tune. */
+    if (!cfg->is_replay) {
+        /*
+         * The tuner was tuned on the number of saturated components of the
+         * nearest-neighbour RGB frame, where an R or B sample covers four
+         * pixels and a G sample two. Scale the sampled counts to match.
+         */
+        const uint32_t sum = (4 * (stats.num_saturated[0]
+                                   + stats.num_saturated[2])
+                              + 2 * stats.num_saturated[1])
+                             * cfg->stats_step * cfg->stats_step;
+
+        ret = rpicam_imx219_tuner(RPICAM_IMX219_TUNER_METHOD_HEURISTIC,
+                                  &cfg->rpicam_config.imx219, sum);
+        if (ret)
+            print_error("rpicam_imx219_tuner: %d", ret);
     }
 #endif /* IMPL_RAWCAM */
+    priv_rpigrafx_profile_end(&cfg->stages[RPIGRAFX_STAGE_TUNER], start, 0);
+
+end:
+    return ret;
+}
+
+#ifdef IMPL_RAWCAM
+/* Sends all the empty buffers of rawcam to it. */
+static int feed_rawcam(const int i)
+{
+    MMAL_PORT_T *output = cpw_rawcams[i]->output[0];
+    MMAL_BUFFER_HEADER_T *header = NULL;
+    MMAL_STATUS_T status;
+    int ret = 0;
+
+    for (; ; ) {
+        status = mmal_wrapper_buffer_get_empty(output, &header, 0);
+        if (status == MMAL_EAGAIN)
+            break;
+        if (status != MMAL_SUCCESS) {
+            print_error("Failed to get empty header: 0x%08x", status);
+            ret = 1;
+            goto end;
+        }
+        status = mmal_port_send_buffer(output, header);
+        if (status != MMAL_SUCCESS) {
+            print_error("Failed to send empty buffer to rawcam: 0x%08x",
+                        status);
+            ret = 1;
+            goto end;
+        }
+    }
+
+end:
+    return ret;
+}
+
+/*
+ * Gets the next raw frame of rawcam i, waiting at most timeout_ms or forever
+ * if timeout_ms is 0. *raw_headerp is set to NULL on timeout.
+ */
+static int get_rawcam_raw_frame(const int i, const unsigned timeout_ms,
+                                MMAL_BUFFER_HEADER_T **raw_headerp)
+{
+    MMAL_QUEUE_T *queue = cpw_rawcams[i]->output_queue[0];
+    MMAL_BUFFER_HEADER_T *raw_header = NULL;
+    int ret = 0;
 
     for (; ; ) {
-        MMAL_CONNECTION_T *conn = conn_isps_renders[fcp->camera_number]
-                                              [fcp->splitter_output_port_index];
+        uint64_t start;
 
-        while ((header = mmal_queue_get(conn->pool->queue)) != NULL) {
-            if (priv_rpigrafx_verbose)
-                WARN_HEADER("Got header ", header,
-                            " from conn->pool->queue; "
-                            "Sending to conn->out");
-            mmal_port_send_buffer(conn->out, header);
+        if ((ret = feed_rawcam(i)))
+            goto end;
+
+        start = priv_rpigrafx_profile_begin();
+        if (timeout_ms == 0)
+            raw_header = mmal_queue_wait(queue);
+        else
+            raw_header = mmal_queue_timedwait(queue, timeout_ms);
+        if (raw_header != NULL)
+            priv_rpigrafx_profile_end(
+                        &cameras_config[i].stages[RPIGRAFX_STAGE_RAW_WAIT],
+                        start, 0);
+        if (raw_header == NULL) {
+            if (timeout_ms == 0) {
+                print_error("Failed to get full header from rawcam");
+                ret = 1;
+            }
+            goto end;
         }
 
-        header = mmal_queue_wait(conn->queue);
-        if (priv_rpigrafx_verbose)
-            WARN_HEADER("Got header ", header, " from conn->queue");
-        /*
-         * camera[2] returns empty queue once every two headers.
-         * Retry until we get the full header.
-         * It's safe to do this for preview port or rawcam.
-         */
-        /* xxx: Not to do this here? */
-        if (header->length == 0) {
-            mmal_buffer_header_release(header);
+        /* Raw info etc... */
+        if (raw_header->flags & MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO) {
+            mmal_buffer_header_release(raw_header);
             continue;
         }
         break;
     }
 
-    ctx->header = header;
+end:
+    *raw_headerp = raw_header;
+    return ret;
+}
+
+#endif /* IMPL_RAWCAM */
+
+/*
+ * Gets the next frame of the replay of camera i, at the pace of the replay.
+ * Waits at most timeout_ms or forever if timeout_ms is 0; raw->data is set to
+ * NULL on timeout.
+ */
+static int get_replay_frame(const int i, const unsigned timeout_ms,
+                            struct raw_frame *raw)
+{
+    struct cameras_config *cfg = &cameras_config[i];
+    struct replay *replay = &cfg->replay;
+    const uint64_t start = priv_rpigrafx_profile_begin(),
+                   now = get_time_ns();
+    struct timespec due;
+    int ret = 0;
+
+    raw->data = NULL;
+    raw->header = NULL;
+    if (replay->next_frame == replay->num_frames) {
+        if (!replay->is_looping) {
+            print_error("End of replay of camera %d", i);
+            ret = 1;
+            goto end;
+        }
+        replay->next_frame = 0;
+    }
+
+    if (replay->fps > 0) {
+        if (replay->due_ns == 0 || replay->due_ns + 1000000000 < now)
+            /* Start over instead of catching up with the frames missed. */
+            replay->due_ns = now;
+        if (timeout_ms != 0
+                && replay->due_ns > now + (uint64_t) timeout_ms * 1000000) {
+            struct timespec ts = {
+                .tv_sec = timeout_ms / 1000,
+                .tv_nsec = (timeout_ms % 1000) * 1000000
+            };
+            nanosleep(&ts, NULL);
+            goto end;
+        }
+        due.tv_sec = replay->due_ns / 1000000000;
+        due.tv_nsec = replay->due_ns % 1000000000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL)
+                                                                    == EINTR)
+            ;
+        replay->due_ns += (uint64_t) (1e9 / replay->fps);
+    }
+
+    raw->data = (const uint8_t*) replay->base + RPIGRAFX_RECORDING_ALIGN
+                + (size_t) replay->next_frame * replay->header.record_size
+                + RPIGRAFX_RECORDING_FRAME_OFFSET;
+    raw->pts = get_time_ns() / 1000;
+    replay->next_frame ++;
+    priv_rpigrafx_profile_end(&cfg->stages[RPIGRAFX_STAGE_RAW_WAIT], start, 0);
+
+end:
+    return ret;
+}
+
+/*
+ * Gets the next raw frame of camera i, which is a rawcam or a replay. See
+ * get_rawcam_raw_frame for timeout_ms.
+ */
+static int get_raw_frame(const int i, const unsigned timeout_ms,
+                         struct raw_frame *raw)
+{
+    int ret = 0;
+
+    if (cameras_config[i].is_replay)
+        return get_replay_frame(i, timeout_ms, raw);
+
+#ifdef IMPL_RAWCAM
+    ret = get_rawcam_raw_frame(i, timeout_ms, &raw->header);
+    if (raw->header != NULL) {
+        raw->data = raw->header->data;
+        raw->pts = raw->header->pts;
+    } else
+        raw->data = NULL;
+#else /* IMPL_RAWCAM */
+    raw->data = NULL;
+    raw->header = NULL;
+    print_error("librpicam and librpiraw is needed to use rawcam");
+    ret = 1;
+#endif /* IMPL_RAWCAM */
+    return ret;
+}
+
+static void release_raw_frame(struct raw_frame *raw)
+{
+    if (raw->header != NULL)
+        mmal_buffer_header_release(raw->header);
+    raw->header = NULL;
+    raw->data = NULL;
+}
+
+/* Converts raw into header, which is an input buffer of the splitter. */
+static int fill_splitter_buffer(struct cameras_config *cfg,
+                                MMAL_BUFFER_HEADER_T *header,
+                                const struct raw_frame *raw)
+{
+    int ret;
+
+    if (cfg->is_replay && cfg->replay.header.encoding == MMAL_ENCODING_RGB24) {
+        /* The replayed frames are laid out as the splitter takes them. */
+        const size_t size = (size_t) cfg->replay.header.aligned_width * 3
+                            * cfg->height;
+        const uint64_t start = priv_rpigrafx_profile_begin();
+        memcpy(header->data, raw->data, size);
+        priv_rpigrafx_profile_end(&cfg->stages[RPIGRAFX_STAGE_CONVERT], start,
+                                  2 * size);
+    } else {
+        ret = process_rawcam_frame(cfg, header->data, raw->data,
+                                   cfg->raw_stride);
+        if (ret)
+            return ret;
+    }
+
+    /*
+     * The whole buffer as the splitter input is committed, padding included;
+     * the isp takes a shorter one for an empty frame.
+     */
+    header->length = ALIGN_UP(cfg->width, 32) * 3 * ALIGN_UP(cfg->height, 16);
+    header->flags = MMAL_BUFFER_HEADER_FLAG_EOS;
+    header->pts = raw->pts;
+    return 0;
+}
+
+/*
+ * Takes a free splitter input buffer, waiting up to timeout_ms (0 for ever)
+ * and counting it if none was free.
+ */
+static MMAL_BUFFER_HEADER_T* get_splitter_input_buffer(struct cameras_config
+                                                                          *cfg,
+                                                       MMAL_QUEUE_T *queue,
+                                                       const unsigned
+                                                                    timeout_ms)
+{
+    const uint64_t start = priv_rpigrafx_profile_begin();
+    MMAL_BUFFER_HEADER_T *header = mmal_queue_get(queue);
+
+    if (header == NULL) {
+        __atomic_add_fetch(&cfg->num_splitter_input_dry, 1, __ATOMIC_SEQ_CST);
+        header = timeout_ms == 0 ? mmal_queue_wait(queue)
+                                 : mmal_queue_timedwait(queue, timeout_ms);
+    }
+    if (header != NULL)
+        priv_rpigrafx_profile_end(
+                            &cfg->stages[RPIGRAFX_STAGE_SPLITTER_INPUT_WAIT],
+                            start, 0);
+    return header;
+}
+
+/* Hands a converted frame to the splitter of camera i. */
+static int send_to_splitter(const int i, MMAL_BUFFER_HEADER_T *header)
+{
+    struct cameras_config *cfg = &cameras_config[i];
+    const uint32_t length = header->length;
+    const uint64_t start = priv_rpigrafx_profile_begin();
+    MMAL_STATUS_T status;
+
+    status = mmal_port_send_buffer(cpw_splitters[i]->input[0], header);
+    if (status != MMAL_SUCCESS) {
+        print_error("Failed to send buffer to splitter: 0x%08x", status);
+        return 1;
+    }
+    priv_rpigrafx_profile_end(&cfg->stages[RPIGRAFX_STAGE_SPLITTER_SEND],
+                              start, length);
+    return 0;
+}
+
+/* Synchronous capture: waits for a raw frame and converts it. */
+static int convert_rawcam_frame(const int i, MMAL_BUFFER_HEADER_T **headerp)
+{
+    struct cameras_config *cfg = &cameras_config[i];
+    MMAL_QUEUE_T *input_queue = cpw_splitters[i]->input_pool[0]->queue;
+    MMAL_BUFFER_HEADER_T *header = NULL;
+    struct raw_frame raw;
+    int ret = 0;
+
+    /* Outputs of the camera on other threads wait for their own frame. */
+    pthread_mutex_lock(&cfg->capture_mutex);
+    if ((ret = get_raw_frame(i, 0, &raw)))
+        goto end;
+
+    header = get_splitter_input_buffer(cfg, input_queue, 0);
+    if (header == NULL) {
+        print_error("Failed to wait for header from rawcam");
+        release_raw_frame(&raw);
+        ret = 1;
+        goto end;
+    }
+
+    ret = fill_splitter_buffer(cfg, header, &raw);
+    release_raw_frame(&raw);
+    if (ret) {
+        mmal_buffer_header_release(header);
+        header = NULL;
+        goto end;
+    }
+
+end:
+    pthread_mutex_unlock(&cfg->capture_mutex);
+    *headerp = header;
+    return ret;
+}
+
+static _Bool is_rawcam_stream_exiting(struct rawcam_stream *stream)
+{
+    _Bool is_exiting;
+
+    pthread_mutex_lock(&stream->mutex);
+    is_exiting = stream->is_exiting;
+    pthread_mutex_unlock(&stream->mutex);
+    return is_exiting;
+}
+
+/*
+ * The producer of streaming mode. It converts raw frames as they come and
+ * queues them in stream->ready. When queue_depth frames are ready, it waits
+ * for the consumer (RPIGRAFX_DROP_POLICY_BLOCK), discards the new raw frame
+ * (RPIGRAFX_DROP_POLICY_DROP_NEWEST) or discards the oldest ready frame
+ * (RPIGRAFX_DROP_POLICY_DROP_OLDEST). Ready frames are not sent to the
+ * splitter until captured: past it, each goes to the isp of every output and
+ * their deliveries, not queue_depth and the policy, would decide what is
+ * dropped. Only in callback mode, where nothing is captured, are they sent
+ * as soon as they are converted.
+ */
+static void* rawcam_producer(void *arg)
+{
+    const int i = (intptr_t) arg;
+    struct cameras_config *cfg = &cameras_config[i];
+    struct rawcam_stream *stream = &cfg->stream;
+    MMAL_QUEUE_T *input_queue = cpw_splitters[i]->input_pool[0]->queue;
+    int ret = 0;
+
+    for (; ; ) {
+        MMAL_BUFFER_HEADER_T *header = NULL;
+        struct raw_frame raw;
+        _Bool is_full;
+
+        pthread_mutex_lock(&stream->mutex);
+        if (stream->drop_policy == RPIGRAFX_DROP_POLICY_BLOCK)
+            while (!stream->is_exiting && (int) mmal_queue_length(stream->ready)
+                                                        >= stream->queue_depth)
+                pthread_cond_wait(&stream->cond, &stream->mutex);
+        if (stream->is_exiting) {
+            pthread_mutex_unlock(&stream->mutex);
+            break;
+        }
+        pthread_mutex_unlock(&stream->mutex);
+
+        if ((ret = get_raw_frame(i, STREAM_POLL_MS, &raw)))
+            break;
+        if (raw.data == NULL)
+            continue;
+
+        is_full = (int) mmal_queue_length(stream->ready) >= stream->queue_depth;
+        if (is_full && stream->drop_policy
+                                        == RPIGRAFX_DROP_POLICY_DROP_NEWEST) {
+            release_raw_frame(&raw);
+            pthread_mutex_lock(&stream->mutex);
+            stream->num_dropped ++;
+            pthread_mutex_unlock(&stream->mutex);
+            continue;
+        }
+        if (is_full && stream->drop_policy
+                                        == RPIGRAFX_DROP_POLICY_DROP_OLDEST) {
+            /* The consumer may have taken it meanwhile. */
+            MMAL_BUFFER_HEADER_T *oldest = mmal_queue_get(stream->ready);
+            if (oldest != NULL) {
+                mmal_buffer_header_release(oldest);
+                pthread_mutex_lock(&stream->mutex);
+                stream->num_dropped ++;
+                pthread_mutex_unlock(&stream->mutex);
+            }
+        }
+
+        header = get_splitter_input_buffer(cfg, input_queue, STREAM_POLL_MS);
+        while (header == NULL && !is_rawcam_stream_exiting(stream))
+            header = mmal_queue_timedwait(input_queue, STREAM_POLL_MS);
+        if (header == NULL) {
+            release_raw_frame(&raw);
+            break;
+        }
+
+        ret = fill_splitter_buffer(cfg, header, &raw);
+        release_raw_frame(&raw);
+        if (ret) {
+            mmal_buffer_header_release(header);
+            break;
+        }
+
+        if (stream->is_pushing) {
+            if ((ret = send_to_splitter(i, header))) {
+                mmal_buffer_header_release(header);
+                break;
+            }
+        } else {
+            int j;
+            mmal_queue_put(stream->ready, header);
+            for (j = 0; j < cfg->splitter.next_output_idx; j ++)
+                signal_frame_fd(frame_fds[i][j]);
+        }
+        pthread_mutex_lock(&stream->mutex);
+        stream->num_frames ++;
+        pthread_mutex_unlock(&stream->mutex);
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    stream->ret = ret;
+    pthread_mutex_unlock(&stream->mutex);
+    return NULL;
+}
+
+static int start_rawcam_stream(const int i)
+{
+    struct rawcam_stream *stream = &cameras_config[i].stream;
+    int ret = 0;
+
+    stream->ready = mmal_queue_create();
+    if (stream->ready == NULL) {
+        print_error("Failed to create ready queue of rawcam %d", i);
+        ret = 1;
+        goto end;
+    }
+    pthread_mutex_init(&stream->mutex, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+    stream->is_exiting = 0;
+    stream->ret = 0;
+    stream->num_frames = stream->num_dropped = 0;
+
+    if ((errno = pthread_create(&stream->thread, NULL, rawcam_producer,
+                                (void*) (intptr_t) i))) {
+        print_error("Failed to create producer of rawcam %d: %s",
+                    i, strerror(errno));
+        pthread_cond_destroy(&stream->cond);
+        pthread_mutex_destroy(&stream->mutex);
+        mmal_queue_destroy(stream->ready);
+        ret = 1;
+        goto end;
+    }
+    stream->is_running = !0;
+
+end:
+    return ret;
+}
+
+static void stop_rawcam_stream(const int i)
+{
+    struct rawcam_stream *stream = &cameras_config[i].stream;
+    MMAL_BUFFER_HEADER_T *header = NULL;
+
+    if (!stream->is_running)
+        return;
+
+    pthread_mutex_lock(&stream->mutex);
+    stream->is_exiting = !0;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+    pthread_join(stream->thread, NULL);
+
+    while ((header = mmal_queue_get(stream->ready)) != NULL)
+        mmal_buffer_header_release(header);
+    mmal_queue_destroy(stream->ready);
+    pthread_cond_destroy(&stream->cond);
+    pthread_mutex_destroy(&stream->mutex);
+    stream->is_running = 0;
+}
+
+/* Streaming capture: takes the oldest ready frame. */
+static int get_rawcam_stream_frame(const int i,
+                                   MMAL_BUFFER_HEADER_T **headerp)
+{
+    struct rawcam_stream *stream = &cameras_config[i].stream;
+    const uint64_t start = priv_rpigrafx_profile_begin();
+    MMAL_BUFFER_HEADER_T *header = NULL;
+    int ret = 0;
+
+    while ((header = mmal_queue_timedwait(stream->ready, STREAM_POLL_MS))
+                                                                      == NULL) {
+        pthread_mutex_lock(&stream->mutex);
+        ret = stream->ret;
+        pthread_mutex_unlock(&stream->mutex);
+        if (ret) {
+            print_error("Producer of rawcam %d failed: %d", i, ret);
+            goto end;
+        }
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+    pthread_cond_signal(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+    priv_rpigrafx_profile_end(
+                    &cameras_config[i].stages[RPIGRAFX_STAGE_READY_WAIT],
+                    start, 0);
+
+end:
+    *headerp = header;
+    return ret;
+}
+
+/* Makes the capture port of camera i emit a frame. */
+static int trigger_capture(const int i)
+{
+    struct cameras_config *cfg = &cameras_config[i];
+    const uint64_t start = priv_rpigrafx_profile_begin();
+    MMAL_STATUS_T status;
+    int ret = 0;
+
+    status = mmal_port_parameter_set_boolean(cp_cameras[i]
+                                        ->output[cfg->camera_output_port_index],
+                                             MMAL_PARAMETER_CAPTURE, MMAL_TRUE);
+    if (status != MMAL_SUCCESS) {
+        print_error("Setting capture to camera %d output %d failed: 0x%08x\n",
+                    i, cfg->camera_output_port_index, status);
+        ret = 1;
+        goto end;
+    }
+    priv_rpigrafx_profile_end(&cfg->stages[RPIGRAFX_STAGE_TRIGGER], start, 0);
+
+end:
+    return ret;
+}
+
+int rpigrafx_capture_next_frame(rpigrafx_frame_config_t *fcp)
+{
+    struct callback_context *ctx = fcp->ctx;
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    const uint64_t start = priv_rpigrafx_profile_begin();
+    int ret = 0;
+    MMAL_BUFFER_HEADER_T *header = NULL;
+
+    if (frame_callbacks[fcp->camera_number][fcp->splitter_output_port_index]
+                                                            .func != NULL) {
+        print_error("Frames of isp %d,%d are passed to a callback",
+                    fcp->camera_number, fcp->splitter_output_port_index);
+        ret = 1;
+        goto end;
+    }
+
+    if (cfg->use_camera_capture_port)
+        if ((ret = trigger_capture(fcp->camera_number)))
+            goto end;
+
+    ret = rpigrafx_free_frame(fcp);
+    if (ret) {
+        print_error("rpigrafx_free_frame failed: %d\n", ret);
+        return ret;
+    }
+
+    if (cfg->is_rawcam) {
+        if (cfg->stream.queue_depth != 0)
+            ret = get_rawcam_stream_frame(fcp->camera_number, &header);
+        else
+            ret = convert_rawcam_frame(fcp->camera_number, &header);
+        if (ret)
+            goto end;
+
+        /*
+         * Wait! The header here is not the one the user requested. We pass
+         * it to the splitter and wait for the isp to crop them.
+         */
+        if ((ret = send_to_splitter(fcp->camera_number, header)))
+            goto end;
+    }
+
+    for (; ; ) {
+        refill_isp(fcp->camera_number, fcp->splitter_output_port_index);
+
+        header = receive_from_isp(fcp->camera_number,
+                                  fcp->splitter_output_port_index, !0);
+        /*
+         * camera[2] returns empty queue once every two headers.
+         * Retry until we get the full header.
+         * It's safe to do this for preview port or rawcam.
+         */
+        /* xxx: Not to do this here? */
+        if (header->length == 0) {
+            mmal_buffer_header_release(header);
+            continue;
+        }
+        break;
+    }
+
+    ctx->header = skip_to_latest(fcp->camera_number,
+                                 fcp->splitter_output_port_index, header);
+    hand_over_frame(fcp->camera_number, fcp->splitter_output_port_index,
+                    ctx->header);
+    priv_rpigrafx_profile_end(&isp_frames[fcp->camera_number]
+                                         [fcp->splitter_output_port_index]
+                                           .stages[RPIGRAFX_STAGE_CAPTURE],
+                              start, ctx->header->length);
+
+end:
+    return ret;
+}
+
+/*
+ * Takes full headers of output j until one with a pts of at least pts, which
+ * is returned, releasing the older ones. A header without a pts cannot be
+ * matched and is returned as is.
+ */
+static MMAL_BUFFER_HEADER_T* receive_from_isp_since(const int i, const int j,
+                                                    const int64_t pts,
+                                                    const uint64_t start,
+                                                    const int timeout_ms,
+                                                    uint64_t *num_dropped)
+{
+    MMAL_BUFFER_HEADER_T *header = NULL;
+
+    for (; ; ) {
+        refill_isp(i, j);
+        header = receive_from_isp(i, j, timeout_ms < 0);
+        if (header == NULL) {
+            const uint64_t elapsed_ms = (get_time_ns() - start) / 1000000;
+            if (elapsed_ms >= (uint64_t) timeout_ms)
+                return NULL;
+            header = mmal_queue_timedwait(isp_frames[i][j].arrived,
+                                          timeout_ms - elapsed_ms);
+            if (header == NULL)
+                continue;
+        }
+        /* See rpigrafx_capture_next_frame. */
+        if (header->length == 0) {
+            mmal_buffer_header_release(header);
+            continue;
+        }
+        if (header->pts == MMAL_TIME_UNKNOWN || header->pts >= pts)
+            return header;
+        if (priv_rpigrafx_verbose)
+            WARN_HEADER("Dropping unmatched header ", header, "");
+        mmal_buffer_header_release(header);
+        (*num_dropped) ++;
+    }
+}
+
+/*
+ * Captures a frame on each of num outputs of one camera, all made by the isps
+ * from the same frame of the camera, as told by their pts. Frames that had
+ * arrived before the call are dropped, and a single frame is requested from
+ * the camera: one capture is triggered, or one rawcam frame is converted, for
+ * the whole set. The delivery of the outputs does not apply. The isps are
+ * waited for up to timeout_ms or, if it is negative, until they all emit the
+ * frame. info, if not NULL, gets the frames dropped; its skew is 0.
+ */
+int rpigrafx_capture_camera_frames(rpigrafx_frame_config_t *const *fcps,
+                                   const int num, const int timeout_ms,
+                                   rpigrafx_sync_info_t *info)
+{
+    const uint64_t start = priv_rpigrafx_profile_begin(),
+                   start_ns = get_time_ns();
+    MMAL_BUFFER_HEADER_T *headers[MAX_OUTPUTS], *header = NULL;
+    _Bool is_taken[MAX_OUTPUTS];
+    struct cameras_config *cfg = NULL;
+    uint64_t num_dropped = 0;
+    int64_t pts = MMAL_TIME_UNKNOWN;
+    int i, j, k, ret = 0;
+
+    if (num <= 0 || num > MAX_OUTPUTS) {
+        print_error("Invalid number of outputs: %d", num);
+        ret = 1;
+        goto end;
+    }
+    i = fcps[0]->camera_number;
+    cfg = &cameras_config[i];
+    for (j = 0; j < MAX_OUTPUTS; j ++)
+        is_taken[j] = 0;
+    for (k = 0; k < num; k ++) {
+        j = fcps[k]->splitter_output_port_index;
+        if (fcps[k]->camera_number != i) {
+            print_error("Outputs of cameras %d and %d cannot be captured "
+                        "together", i, fcps[k]->camera_number);
+            ret = 1;
+            goto end;
+        }
+        if (is_taken[j]) {
+            print_error("Output %d,%d is given twice", i, j);
+            ret = 1;
+            goto end;
+        }
+        if (frame_callbacks[i][j].func != NULL) {
+            print_error("Frames of isp %d,%d are passed to a callback", i, j);
+            ret = 1;
+            goto end;
+        }
+        is_taken[j] = !0;
+        headers[k] = NULL;
+    }
+
+    /* The isps get their buffers back before the frame is requested. */
+    for (k = 0; k < num; k ++) {
+        j = fcps[k]->splitter_output_port_index;
+        if ((ret = rpigrafx_free_frame(fcps[k])))
+            goto end;
+        while ((header = receive_from_isp(i, j, 0)) != NULL) {
+            if (header->length != 0)
+                num_dropped ++;
+            mmal_buffer_header_release(header);
+        }
+        is_frame_requested[i][j] = 0;
+        refill_isp(i, j);
+    }
+
+    if (cfg->use_camera_capture_port)
+        if ((ret = trigger_capture(i)))
+            goto end;
+    if (cfg->is_rawcam) {
+        if (cfg->stream.queue_depth != 0)
+            ret = get_rawcam_stream_frame(i, &header);
+        else
+            ret = convert_rawcam_frame(i, &header);
+        if (ret)
+            goto end;
+        if ((ret = send_to_splitter(i, header)))
+            goto end;
+    }
+
+    /*
+     * An output may have dropped the frame that the others got, so the
+     * newest pts seen so far is the one to match until all have it.
+     */
+    for (; ; ) {
+        _Bool is_matched = !0;
+
+        for (k = 0; k < num; k ++) {
+            j = fcps[k]->splitter_output_port_index;
+            if (headers[k] != NULL) {
+                if (headers[k]->pts == MMAL_TIME_UNKNOWN
+                        || headers[k]->pts >= pts)
+                    continue;
+                mmal_buffer_header_release(headers[k]);
+                num_dropped ++;
+            }
+            headers[k] = receive_from_isp_since(i, j, pts, start_ns,
+                                                timeout_ms, &num_dropped);
+            if (headers[k] == NULL) {
+                print_error("No frame matching the others came from isp "
+                            "%d,%d in %d ms", i, j, timeout_ms);
+                for (k = 0; k < num; k ++)
+                    if (headers[k] != NULL)
+                        mmal_buffer_header_release(headers[k]);
+                ret = 1;
+                goto end;
+            }
+            if (headers[k]->pts != MMAL_TIME_UNKNOWN)
+                pts = MMAL_MAX(pts, headers[k]->pts);
+        }
+        for (k = 0; k < num; k ++)
+            if (headers[k]->pts != MMAL_TIME_UNKNOWN && headers[k]->pts != pts)
+                is_matched = 0;
+        if (is_matched)
+            break;
+    }
+
+    for (k = 0; k < num; k ++) {
+        j = fcps[k]->splitter_output_port_index;
+        fcps[k]->ctx->header = headers[k];
+        hand_over_frame(i, j, headers[k]);
+        priv_rpigrafx_profile_end(&isp_frames[i][j]
+                                                 .stages[RPIGRAFX_STAGE_CAPTURE],
+                                  start, headers[k]->length);
+    }
+
+end:
+    if (info != NULL) {
+        info->skew_ns = 0;
+        info->num_dropped = num_dropped;
+    }
+    return ret;
+}
+
+/*
+ * Sends a ready frame of the streaming mode to the splitter, if any. Returns
+ * 0 with *is_sent unset when none is ready.
+ */
+static int try_send_rawcam_stream_frame(const int i, _Bool *is_sent)
+{
+    struct rawcam_stream *stream = &cameras_config[i].stream;
+    MMAL_BUFFER_HEADER_T *header = NULL;
+    int ret = 0;
+
+    *is_sent = 0;
+    pthread_mutex_lock(&stream->mutex);
+    ret = stream->ret;
+    pthread_mutex_unlock(&stream->mutex);
+    if (ret) {
+        print_error("Producer of rawcam %d failed: %d", i, ret);
+        goto end;
+    }
+
+    header = mmal_queue_get(stream->ready);
+    if (header == NULL)
+        goto end;
+    pthread_mutex_lock(&stream->mutex);
+    pthread_cond_signal(&stream->cond);
+    pthread_mutex_unlock(&stream->mutex);
+
+    if ((ret = send_to_splitter(i, header))) {
+        mmal_buffer_header_release(header);
+        goto end;
+    }
+    *is_sent = !0;
+
+end:
+    return ret;
+}
+
+/*
+ * The non-blocking counterpart of rpigrafx_capture_next_frame, for use with
+ * the fd of rpigrafx_get_frame_fd. If no frame has arrived yet, it returns 0
+ * with *is_captured unset and the current frame kept; the fd becomes readable
+ * when it is worth calling again.
+ */
+int rpigrafx_try_capture_next_frame(rpigrafx_frame_config_t *fcp,
+                                    _Bool *is_captured)
+{
+    const int i = fcp->camera_number, j = fcp->splitter_output_port_index;
+    struct callback_context *ctx = fcp->ctx;
+    struct cameras_config *cfg = &cameras_config[i];
+    MMAL_BUFFER_HEADER_T *header = NULL;
+    int ret = 0;
+
+    *is_captured = 0;
+    if (frame_callbacks[i][j].func != NULL) {
+        print_error("Frames of isp %d,%d are passed to a callback", i, j);
+        ret = 1;
+        goto end;
+    }
+
+    /* Frames that arrive after this signal the fd again. */
+    clear_frame_fd(frame_fds[i][j]);
+
+    /* Request a frame unless one is on the way or already there. */
+    if (!is_frame_requested[i][j] && num_isp_frames_waiting(i, j) == 0) {
+        if (cfg->use_camera_capture_port) {
+            if ((ret = trigger_capture(i)))
+                goto end;
+            is_frame_requested[i][j] = !0;
+        }
+        if (cfg->is_rawcam) {
+            if (cfg->stream.queue_depth == 0) {
+                print_error("Non-blocking capture of rawcam %d needs "
+                            "streaming mode", i);
+                ret = 1;
+                goto end;
+            }
+            if ((ret = try_send_rawcam_stream_frame(i,
+                                                  &is_frame_requested[i][j])))
+                goto end;
+        }
+    }
+
+    refill_isp(i, j);
+
+    while ((header = receive_from_isp(i, j, 0)) != NULL) {
+        /* See rpigrafx_capture_next_frame. */
+        if (header->length != 0)
+            break;
+        mmal_buffer_header_release(header);
+    }
+    if (header == NULL)
+        goto end;
+    header = skip_to_latest(i, j, header);
+
+    if ((ret = rpigrafx_free_frame(fcp))) {
+        print_error("rpigrafx_free_frame failed: %d\n", ret);
+        mmal_buffer_header_release(header);
+        goto end;
+    }
+    hand_over_frame(i, j, header);
+    ctx->header = header;
+    is_frame_requested[i][j] = 0;
+    *is_captured = !0;
+    if (num_isp_frames_waiting(i, j) != 0)
+        signal_frame_fd(frame_fds[i][j]);
+
+end:
+    return ret;
+}
+
+/*
+ * An fd for poll, select or epoll that becomes readable when
+ * rpigrafx_try_capture_next_frame may capture a frame. It is owned by the
+ * library.
+ */
+int rpigrafx_get_frame_fd(rpigrafx_frame_config_t *fcp)
+{
+    return frame_fds[fcp->camera_number][fcp->splitter_output_port_index];
+}
+
+/*
+ * When the current frame of the output was taken: by the sensor if known, or
+ * else when the isp emitted it.
+ */
+static uint64_t frame_time_ns(const rpigrafx_frame_config_t *fcp)
+{
+    const MMAL_BUFFER_HEADER_T *header = fcp->ctx->header;
+    const uint64_t sensor_ns = sensor_time_ns(fcp->camera_number, header);
+    const struct frame_meta *meta = header->user_data;
+
+    return sensor_ns != 0 ? sensor_ns : meta->receive_ns;
+}
+
+/*
+ * Captures a frame on each of num outputs, possibly of different cameras, so
+ * that they were all taken within tolerance_ns of each other. Frames too old
+ * to match the newest of the others are dropped and replaced by the next one
+ * of their output. All the outputs are waited for at once, as with
+ * rpigrafx_try_capture_next_frame, for up to timeout_ms or, if it is
+ * negative, until they match. info, if not NULL, gets the skew of the set
+ * and the frames dropped.
+ */
+int rpigrafx_capture_synced_frames(rpigrafx_frame_config_t *const *fcps,
+                                   const int num,
+                                   const uint64_t tolerance_ns,
+                                   const int timeout_ms,
+                                   rpigrafx_sync_info_t *info)
+{
+    const uint64_t start = get_time_ns();
+    struct pollfd fds[MAX_CAMERAS * MAX_OUTPUTS];
+    uint64_t times[MAX_CAMERAS * MAX_OUTPUTS];
+    _Bool is_captured[MAX_CAMERAS * MAX_OUTPUTS];
+    uint64_t newest = 0, oldest = 0, num_dropped = 0;
+    int k, num_fds, wait_ms, ret = 0;
+
+    if (num <= 0 || num > MAX_CAMERAS * MAX_OUTPUTS) {
+        print_error("Invalid number of outputs: %d", num);
+        ret = 1;
+        goto end;
+    }
+    for (k = 0; k < num; k ++)
+        is_captured[k] = 0;
+
+    for (; ; ) {
+        _Bool is_complete = !0;
+
+        for (k = 0; k < num; k ++) {
+            if (!is_captured[k]) {
+                if ((ret = rpigrafx_try_capture_next_frame(fcps[k],
+                                                           &is_captured[k])))
+                    goto end;
+                if (is_captured[k])
+                    times[k] = frame_time_ns(fcps[k]);
+            }
+            is_complete = is_complete && is_captured[k];
+        }
+
+        if (is_complete) {
+            newest = oldest = times[0];
+            for (k = 1; k < num; k ++) {
+                newest = MMAL_MAX(newest, times[k]);
+                oldest = MMAL_MIN(oldest, times[k]);
+            }
+            if (newest - oldest <= tolerance_ns)
+                break;
+            /* The next frame of the output replaces the current one. */
+            for (k = 0; k < num; k ++) {
+                if (newest - times[k] > tolerance_ns) {
+                    is_captured[k] = 0;
+                    num_dropped ++;
+                }
+            }
+            continue;
+        }
+
+        num_fds = 0;
+        for (k = 0; k < num; k ++) {
+            if (is_captured[k])
+                continue;
+            fds[num_fds].fd = rpigrafx_get_frame_fd(fcps[k]);
+            fds[num_fds].events = POLLIN;
+            num_fds ++;
+        }
+        wait_ms = -1;
+        if (timeout_ms >= 0) {
+            const uint64_t elapsed_ms = (get_time_ns() - start) / 1000000;
+            if (elapsed_ms >= (uint64_t) timeout_ms) {
+                print_error("No frames of %d outputs came within %llu ns of "
+                            "each other in %d ms", num,
+                            (unsigned long long) tolerance_ns, timeout_ms);
+                ret = 1;
+                goto end;
+            }
+            wait_ms = timeout_ms - elapsed_ms;
+        }
+        if (poll(fds, num_fds, wait_ms) == -1 && errno != EINTR) {
+            print_error("Polling frame fds failed: %s", strerror(errno));
+            ret = 1;
+            goto end;
+        }
+    }
+
+end:
+    if (info != NULL) {
+        info->skew_ns = newest - oldest;
+        info->num_dropped = num_dropped;
+    }
+    return ret;
+}
+
+/*
+ * Pool statistics of the hops leading to the output. Only pools that the
+ * library manages can be watched: the isp-render one and, with rawcam, the
+ * splitter input one of the camera-splitter hop. The others, which live in
+ * the firmware, read num_dry as 0.
+ */
+int rpigrafx_get_pool_stats(rpigrafx_frame_config_t *fcp,
+                            rpigrafx_pool_stats_t stats[RPIGRAFX_NUM_HOPS])
+{
+    const int i = fcp->camera_number,
+              j = isp_of(i, fcp->splitter_output_port_index);
+    struct cameras_config *cfg = &cameras_config[i];
+    int ret = 0;
+
+    if (conn_isps_renders[i][j] == NULL) {
+        print_error("Output %d,%d is not connected yet", i, j);
+        ret = 1;
+        goto end;
+    }
+
+    if (cfg->is_rawcam) {
+        stats[RPIGRAFX_HOP_CAMERA_SPLITTER].num_buffers =
+                                        cpw_splitters[i]->input[0]->buffer_num;
+        stats[RPIGRAFX_HOP_CAMERA_SPLITTER].num_dry =
+              __atomic_load_n(&cfg->num_splitter_input_dry, __ATOMIC_SEQ_CST);
+    } else {
+        stats[RPIGRAFX_HOP_CAMERA_SPLITTER].num_buffers =
+                                        cp_splitters[i]->input[0]->buffer_num;
+        stats[RPIGRAFX_HOP_CAMERA_SPLITTER].num_dry = 0;
+    }
+    stats[RPIGRAFX_HOP_SPLITTER_ISP].num_buffers =
+                                        cp_isps[i][j]->input[0]->buffer_num;
+    stats[RPIGRAFX_HOP_SPLITTER_ISP].num_dry = 0;
+    stats[RPIGRAFX_HOP_ISP_RENDER].num_buffers =
+                                        conn_isps_renders[i][j]->pool->headers_num;
+    stats[RPIGRAFX_HOP_ISP_RENDER].num_dry =
+             __atomic_load_n(&isp_pool_stats[i][j].num_dry, __ATOMIC_SEQ_CST);
+
+end:
+    return ret;
+}
+
+/*
+ * How frames reach the output: through how many splitters and which isp, how
+ * many of them the camera needs for all its outputs, and how long setting it
+ * up and reconfiguring the output took.
+ */
+int rpigrafx_get_graph_info(rpigrafx_frame_config_t *fcp,
+                            rpigrafx_graph_info_t *info)
+{
+    const struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int j, ret = 0;
+
+    if (cfg->splitter.num_splitters == 0) {
+        print_error("Camera %d is not set up yet", fcp->camera_number);
+        ret = 1;
+        goto end;
+    }
+    info->num_splitters = cfg->splitter.num_splitters;
+    info->num_splitter_hops =
+                cfg->splitter.num_hops[fcp->splitter_output_port_index];
+    info->setup_ns = cfg->setup_ns;
+    info->reconfig_ns = cfg->isp[fcp->splitter_output_port_index].reconfig_ns;
+    info->num_isps = 0;
+    for (j = 0; j < cfg->splitter.next_output_idx; j ++)
+        if (cfg->isp[j].shared_with == j)
+            info->num_isps ++;
+    info->num_isp_consumers = num_isp_consumers(fcp->camera_number,
+                                isp_of(fcp->camera_number,
+                                       fcp->splitter_output_port_index));
+
+end:
+    return ret;
+}
+
+/*
+ * The rectangle of the camera frame, in pixels, that the isp scales to the
+ * output; see rpigrafx_config_camera_frame_roi.
+ */
+int rpigrafx_get_camera_frame_roi(rpigrafx_frame_config_t *fcp,
+                                  MMAL_RECT_T *rect)
+{
+    const int i = fcp->camera_number, j = fcp->splitter_output_port_index;
+    int ret = 0;
+
+    if (conn_isps_renders[i][isp_of(i, j)] == NULL) {
+        print_error("Output %d,%d is not connected yet", i, j);
+        ret = 1;
+        goto end;
+    }
+    get_isp_crop(i, j, rect);
+
+end:
+    return ret;
+}
+
+/*
+ * Geometry of the frames of the output as the isp emits them: width and height
+ * are the requested ones, and rows are aligned_width pixels apart in buffers of
+ * size bytes.
+ */
+int priv_rpigrafx_get_frame_format(const rpigrafx_frame_config_t *fcp,
+                                   MMAL_FOURCC_T *encoding,
+                                   int32_t *width, int32_t *height,
+                                   int32_t *aligned_width,
+                                   int32_t *aligned_height,
+                                   uint32_t *size)
+{
+    const int i = fcp->camera_number, j = fcp->splitter_output_port_index;
+    const MMAL_PORT_T *port = NULL;
+    int ret = 0;
+
+    if (conn_isps_renders[i][isp_of(i, j)] == NULL) {
+        print_error("Output %d,%d is not connected yet", i, j);
+        ret = 1;
+        goto end;
+    }
+
+    port = conn_isps_renders[i][isp_of(i, j)]->out;
+    *encoding = port->format->encoding;
+    *width = cameras_config[i].isp[j].width;
+    *height = cameras_config[i].isp[j].height;
+    *aligned_width = port->format->es->video.width;
+    *aligned_height = port->format->es->video.height;
+    *size = port->buffer_size;
+
+end:
+    return ret;
+}
+
+/*
+ * Frames of the output skipped by RPIGRAFX_DELIVERY_LATEST or, on a shared
+ * isp, dropped because the output fell behind the others.
+ */
+uint64_t rpigrafx_get_num_dropped_frames(rpigrafx_frame_config_t *fcp)
+{
+    return __atomic_load_n(&cameras_config[fcp->camera_number]
+                                .isp[fcp->splitter_output_port_index]
+                                .num_dropped, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Info of the current frame of the output: the captured one, or in callback
+ * mode the one being delivered when called from the callback.
+ */
+int rpigrafx_get_frame_info(rpigrafx_frame_config_t *fcp,
+                            rpigrafx_frame_info_t *info)
+{
+    const int i = fcp->camera_number, j = fcp->splitter_output_port_index;
+    const struct frame_callback *cb = &frame_callbacks[i][j];
+    const MMAL_BUFFER_HEADER_T *header = fcp->ctx->header;
+    const struct frame_meta *meta = NULL;
+    int ret = 0;
+
+    if (cb->func != NULL)
+        header = cb->header != NULL && pthread_equal(cb->thread, pthread_self())
+                 ? cb->header : NULL;
+    if (header == NULL) {
+        print_error("No frame of isp %d,%d is current", i, j);
+        ret = 1;
+        goto end;
+    }
+    meta = header->user_data;
+    info->pts = header->pts;
+    info->sensor_ns = sensor_time_ns(i, header);
+    info->receive_ns = meta->receive_ns;
+    info->sequence = meta->sequence;
+
+end:
+    return ret;
+}
+
+/* Latency histograms of the output, indexed by rpigrafx_latency_t. */
+int rpigrafx_get_latency_hists(rpigrafx_frame_config_t *fcp,
+                               rpigrafx_latency_hist_t
+                                           hists[RPIGRAFX_NUM_LATENCIES])
+{
+    const struct isp_frames *frames = &isp_frames[fcp->camera_number]
+                                             [fcp->splitter_output_port_index];
+    int k;
+
+    for (k = 0; k < RPIGRAFX_NUM_LATENCIES; k ++)
+        priv_rpigrafx_latency_hist_read(&frames->hists[k], &hists[k]);
+    return 0;
+}
+
+void rpigrafx_reset_latency_hists(rpigrafx_frame_config_t *fcp)
+{
+    struct isp_frames *frames = &isp_frames[fcp->camera_number]
+                                       [fcp->splitter_output_port_index];
+    int k;
+
+    for (k = 0; k < RPIGRAFX_NUM_LATENCIES; k ++)
+        priv_rpigrafx_latency_hist_clear(&frames->hists[k]);
+}
+
+/*
+ * Per-stage profile of the output, indexed by rpigrafx_stage_t. It is only
+ * taken while rpigrafx_set_profiling is on. The stages before the splitter
+ * are shared by the outputs of the camera, so they count its frames.
+ */
+int rpigrafx_get_stats(rpigrafx_frame_config_t *fcp,
+                       rpigrafx_stage_stats_t stats[RPIGRAFX_NUM_STAGES])
+{
+    const struct isp_frames *frames = &isp_frames[fcp->camera_number]
+                                             [fcp->splitter_output_port_index];
+    const struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int k;
+
+    for (k = 0; k < RPIGRAFX_NUM_STAGES; k ++)
+        priv_rpigrafx_stage_stats_read(is_output_stage[k] ? &frames->stages[k]
+                                                          : &cfg->stages[k],
+                                       &stats[k]);
+    return 0;
+}
+
+/* Clears the profile of the output, including that of its camera. */
+void rpigrafx_reset_stats(rpigrafx_frame_config_t *fcp)
+{
+    struct isp_frames *frames = &isp_frames[fcp->camera_number]
+                                       [fcp->splitter_output_port_index];
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int k;
+
+    for (k = 0; k < RPIGRAFX_NUM_STAGES; k ++)
+        priv_rpigrafx_stage_stats_clear(is_output_stage[k] ? &frames->stages[k]
+                                                           : &cfg->stages[k]);
+}
+
+int rpigrafx_get_rawcam_band_timings(rpigrafx_frame_config_t *fcp,
+                                     rpigrafx_band_timing_t *timings,
+                                     int *num_bands)
+{
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int ret = 0;
+
+    if (!cfg->is_rawcam) {
+        print_error("Camera %d is not configured for rawcam",
+                    fcp->camera_number);
+        ret = 1;
+        goto end;
+    }
+    pthread_mutex_lock(&cfg->stats_mutex);
+    *num_bands = MMAL_MIN(*num_bands, cfg->num_band_timings);
+    memcpy(timings, cfg->band_timings, *num_bands * sizeof(*timings));
+    pthread_mutex_unlock(&cfg->stats_mutex);
+
+end:
+    return ret;
+}
+
+int rpigrafx_get_rawcam_stats(rpigrafx_frame_config_t *fcp,
+                              rpigrafx_bayer_stats_t *stats)
+{
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int ret = 0;
+
+    if (!cfg->is_rawcam) {
+        print_error("Camera %d is not configured for rawcam",
+                    fcp->camera_number);
+        ret = 1;
+        goto end;
+    }
+    pthread_mutex_lock(&cfg->stats_mutex);
+    memcpy(stats, &cfg->stats, sizeof(*stats));
+    pthread_mutex_unlock(&cfg->stats_mutex);
+
+end:
+    return ret;
+}
+
+int rpigrafx_lock_rawcam_awb(const _Bool is_locked,
+                             rpigrafx_frame_config_t *fcp)
+{
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int ret = 0;
+
+    if (!cfg->is_rawcam) {
+        print_error("Camera %d is not configured for rawcam",
+                    fcp->camera_number);
+        ret = 1;
+        goto end;
+    }
+    pthread_mutex_lock(&cfg->stats_mutex);
+    cfg->awb.is_locked = is_locked;
+    pthread_mutex_unlock(&cfg->stats_mutex);
+
+end:
+    return ret;
+}
+
+/* Overrides the gains and locks them there until unlocked. */
+int rpigrafx_set_rawcam_awb_gains(const float gain_r, const float gain_g,
+                                  const float gain_b,
+                                  rpigrafx_frame_config_t *fcp)
+{
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int ret = 0;
+
+    if (!cfg->is_rawcam) {
+        print_error("Camera %d is not configured for rawcam",
+                    fcp->camera_number);
+        ret = 1;
+        goto end;
+    }
+    if (!(gain_r >= 0 && gain_g >= 0 && gain_b >= 0)) {
+        print_error("Invalid gains: %f %f %f", gain_r, gain_g, gain_b);
+        ret = 1;
+        goto end;
+    }
+    pthread_mutex_lock(&cfg->stats_mutex);
+    cfg->awb.gains[0] = gain_r;
+    cfg->awb.gains[1] = gain_g;
+    cfg->awb.gains[2] = gain_b;
+    cfg->awb.is_locked = !0;
+    pthread_mutex_unlock(&cfg->stats_mutex);
+
+end:
+    return ret;
+}
+
+int rpigrafx_get_rawcam_awb_gains(rpigrafx_frame_config_t *fcp,
+                                  float *gain_r, float *gain_g, float *gain_b)
+{
+    struct cameras_config *cfg = &cameras_config[fcp->camera_number];
+    int ret = 0;
+
+    if (!cfg->is_rawcam) {
+        print_error("Camera %d is not configured for rawcam",
+                    fcp->camera_number);
+        ret = 1;
+        goto end;
+    }
+    pthread_mutex_lock(&cfg->stats_mutex);
+    *gain_r = cfg->awb.gains[0];
+    *gain_g = cfg->awb.gains[1];
+    *gain_b = cfg->awb.gains[2];
+    pthread_mutex_unlock(&cfg->stats_mutex);
+
+end:
+    return ret;
+}
+
+int rpigrafx_get_rawcam_stream_stats(rpigrafx_frame_config_t *fcp,
+                                     uint64_t *num_frames,
+                                     uint64_t *num_dropped)
+{
+    struct rawcam_stream *stream = &cameras_config[fcp->camera_number].stream;
+    int ret = 0;
+
+    if (!stream->is_running) {
+        print_error("Camera %d is not streaming", fcp->camera_number);
+        ret = 1;
+        goto end;
+    }
+    pthread_mutex_lock(&stream->mutex);
+    *num_frames = stream->num_frames;
+    *num_dropped = stream->num_dropped;
+    pthread_mutex_unlock(&stream->mutex);
+
+end:
+    return ret;
+}
+
+int rpigrafx_set_frame_callback(rpigrafx_frame_config_t *fcp,
+                                rpigrafx_frame_callback_t func,
+                                void *userdata)
+{
+    struct frame_callback *cb = &frame_callbacks[fcp->camera_number]
+                                                [fcp->splitter_output_port_index];
+    int ret = 0;
+
+    if (cameras_config[fcp->camera_number].splitter.num_splitters != 0) {
+        print_error("Callback of isp %d,%d must be set before "
+                    "rpigrafx_finish_config",
+                    fcp->camera_number, fcp->splitter_output_port_index);
+        ret = 1;
+        goto end;
+    }
+    cb->func = func;
+    cb->userdata = userdata;
+    memcpy(&cb->fc, fcp, sizeof(cb->fc));
+
+end:
+    return ret;
+}
+
+/*
+ * Keeps the frame being delivered to the callback from being recycled when
+ * the callback returns. Only the callback may call this.
+ */
+int rpigrafx_hold_frame(rpigrafx_frame_config_t *fcp)
+{
+    struct frame_callback *cb = &frame_callbacks[fcp->camera_number]
+                                                [fcp->splitter_output_port_index];
+    int ret = 0;
+
+    if (cb->header == NULL || !pthread_equal(cb->thread, pthread_self())) {
+        print_error("No frame of isp %d,%d is being delivered",
+                    fcp->camera_number, fcp->splitter_output_port_index);
+        ret = 1;
+        goto end;
+    }
+    if (cb->is_held)
+        goto end;
+
+    pthread_mutex_lock(&cb->held_mutex);
+    if (cb->num_held == MAX_HELD_FRAMES) {
+        print_error("Too many held frames of isp %d,%d",
+                    fcp->camera_number, fcp->splitter_output_port_index);
+        ret = 1;
+    } else {
+        cb->held[cb->num_held ++] = cb->header;
+        cb->is_held = !0;
+    }
+    pthread_mutex_unlock(&cb->held_mutex);
+
+end:
+    return ret;
+}
+
+/* Recycles a frame held by rpigrafx_hold_frame. */
+int rpigrafx_release_frame(rpigrafx_frame_config_t *fcp, void *frame)
+{
+    struct frame_callback *cb = &frame_callbacks[fcp->camera_number]
+                                                [fcp->splitter_output_port_index];
+    MMAL_BUFFER_HEADER_T *header = NULL;
+    int i, ret = 0;
+
+    pthread_mutex_lock(&cb->held_mutex);
+    for (i = 0; i < cb->num_held; i ++) {
+        if (cb->held[i]->data == frame) {
+            header = cb->held[i];
+            cb->held[i] = cb->held[-- cb->num_held];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cb->held_mutex);
+
+    if (header == NULL) {
+        print_error("Frame %p of isp %d,%d is not held",
+                    frame, fcp->camera_number, fcp->splitter_output_port_index);
+        ret = 1;
+        goto end;
+    }
+    if (priv_rpigrafx_verbose)
+        WARN_HEADER("Releasing header ", header, "");
+    /* This sends it back to the isp and delivers frames queued meanwhile. */
+    mmal_buffer_header_release(header);
 
 end:
     return ret;
@@ -1703,7 +5015,8 @@ int rpigrafx_render_frame(rpigrafx_frame_config_t *fcp)
     }
 
     status = mmal_port_send_buffer(conn_isps_renders[fcp->camera_number]
-                                          [fcp->splitter_output_port_index]->in,
+                                        [isp_of(fcp->camera_number,
+                                          fcp->splitter_output_port_index)]->in,
                                    fcp->ctx->header);
     if (status != MMAL_SUCCESS) {
         print_error("Sending header to render failed: 0x%08x", status);
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Per-stage profiling counters.
+ *
+ * A stage is timed by taking priv_rpigrafx_profile_begin() before it and
+ * passing that to priv_rpigrafx_profile_end() after it. Both do nothing but
+ * test a flag while profiling is off. Like the latency histograms, the
+ * counters are updated and read atomically without a lock.
+ */
+
+#include "rpigrafx.h"
+#include "local.h"
+#include <time.h>
+
+_Bool priv_rpigrafx_is_profiling = 0;
+
+void priv_rpigrafx_atomic_max(uint64_t *p, const uint64_t value)
+{
+    uint64_t cur = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    while (value > cur
+            && !__atomic_compare_exchange_n(p, &cur, value, 0,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+uint64_t priv_rpigrafx_profile_begin()
+{
+    struct timespec t;
+
+    if (!__atomic_load_n(&priv_rpigrafx_is_profiling, __ATOMIC_RELAXED))
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+void priv_rpigrafx_profile_end(rpigrafx_stage_stats_t *stats,
+                               const uint64_t start, const uint64_t num_bytes)
+{
+    const uint64_t end = priv_rpigrafx_profile_begin(), ns = end - start;
+
+    /* Profiling was off when the stage began or has been turned off since. */
+    if (start == 0 || end == 0)
+        return;
+
+    __atomic_add_fetch(&stats->total_ns, ns, __ATOMIC_RELAXED);
+    priv_rpigrafx_atomic_max(&stats->max_ns, ns);
+    __atomic_add_fetch(&stats->num_bytes, num_bytes, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats->num_calls, 1, __ATOMIC_RELAXED);
+}
+
+void priv_rpigrafx_stage_stats_read(const rpigrafx_stage_stats_t *stats,
+                                    rpigrafx_stage_stats_t *dst)
+{
+    dst->num_calls = __atomic_load_n(&stats->num_calls, __ATOMIC_RELAXED);
+    dst->total_ns = __atomic_load_n(&stats->total_ns, __ATOMIC_RELAXED);
+    dst->max_ns = __atomic_load_n(&stats->max_ns, __ATOMIC_RELAXED);
+    dst->num_bytes = __atomic_load_n(&stats->num_bytes, __ATOMIC_RELAXED);
+}
+
+void priv_rpigrafx_stage_stats_clear(rpigrafx_stage_stats_t *stats)
+{
+    __atomic_store_n(&stats->num_calls, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->total_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->max_ns, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->num_bytes, 0, __ATOMIC_RELAXED);
+}
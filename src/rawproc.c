@@ -0,0 +1,640 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * CPU-side processing of raw images from rawcam.
+ *
+ * The kernels here work on the buffers of the MMAL headers directly, so they
+ * take explicit strides in bytes for both of the source and the destination.
+ *
+ * The interpolating demosaics are vectorised with GCC vector extensions and,
+ * on CPUs that have it, with NEON in rawproc_neon.c. Each one has a scalar
+ * reference that must give exactly the same output; see test_rawproc.
+ */
+
+#include "rpigrafx.h"
+#include "local.h"
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+#if defined(HAVE_NEON) && !defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif /* defined(HAVE_NEON) && !defined(__aarch64__) */
+
+/* Padding on each side of a row of the demosaic window. */
+#define ROW_PAD 2
+#define ROW_SIZE(width) VCOS_ALIGN_UP((width) + 2 * ROW_PAD, 32)
+#define VEC_LEN 8
+
+typedef uint8_t  v16u8 __attribute__((vector_size(16)));
+typedef uint16_t v8u16 __attribute__((vector_size(16)));
+typedef int16_t  v8s16 __attribute__((vector_size(16)));
+
+/*
+ * Bytes between raw10 rows of width pixels as rawcam usually lays them out,
+ * for making frames; converted frames give their own stride.
+ */
+int32_t priv_rpigrafx_raw10_stride(const int32_t width)
+{
+    /* Four pixels are packed into five bytes; rows are aligned to 32 bytes. */
+    return VCOS_ALIGN_UP(VCOS_ALIGN_UP(width, 32) * 5 / 4, 32);
+}
+
+size_t priv_rpigrafx_demosaic_scratch_size(const rpigrafx_demosaic_t demosaic,
+                                           const int32_t width)
+{
+    if (demosaic == RPIGRAFX_DEMOSAIC_NEAREST)
+        return 0;
+    /* A window of three unpacked rows, plus slack for vector loads. */
+    return 3 * ROW_SIZE(width) + 16;
+}
+
+static void build_gain_lut(uint8_t lut[256], const float gain)
+{
+    int v;
+
+    for (v = 0; v < 256; v ++) {
+        const float g = v * gain + 0.5f;
+        lut[v] = g >= 255.0f ? 255 : (uint8_t) g;
+    }
+}
+
+/* dst_bpp is the bytes per pixel of dst. */
+static int check_args(const int32_t dst_stride, const int dst_bpp,
+                      const int32_t src_stride,
+                      const int32_t width, const int32_t height)
+{
+    if (width <= 0 || height <= 0 || width % 4 != 0 || height % 2 != 0) {
+        print_error("Unsupported size of raw10 image: %dx%d", width, height);
+        return 1;
+    }
+    if (src_stride < width * 5 / 4 || dst_stride < width * dst_bpp) {
+        print_error("Stride is too small: src=%d dst=%d for width %d",
+                    src_stride, dst_stride, width);
+        return 1;
+    }
+    return 0;
+}
+
+static int check_rows(const int32_t height,
+                      const int32_t y_begin, const int32_t y_end)
+{
+    if (y_begin < 0 || y_end > height || y_begin >= y_end
+            || y_begin % 2 != 0 || y_end % 2 != 0) {
+        print_error("Invalid rows [%d, %d) of height %d",
+                    y_begin, y_end, height);
+        return 1;
+    }
+    return 0;
+}
+
+void priv_rpigrafx_bayer_stats_clear(rpigrafx_bayer_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void priv_rpigrafx_bayer_stats_add(rpigrafx_bayer_stats_t *dst,
+                                   const rpigrafx_bayer_stats_t *src)
+{
+    int c, i;
+
+    for (c = 0; c < 3; c ++) {
+        dst->num_samples[c] += src->num_samples[c];
+        dst->sum[c] += src->sum[c];
+        dst->num_saturated[c] += src->num_saturated[c];
+        for (i = 0; i < RPIGRAFX_STATS_HIST_BINS; i ++)
+            dst->hist[c][i] += src->hist[c][i];
+    }
+}
+
+#define HIST_SHIFT 4 /* 256 / RPIGRAFX_STATS_HIST_BINS == 1 << HIST_SHIFT */
+
+static inline void add_sample(rpigrafx_bayer_stats_t *stats, const int c,
+                              const uint8_t v, const uint8_t *lut)
+{
+    stats->num_samples[c] ++;
+    stats->sum[c] += v;
+    stats->hist[c][v >> HIST_SHIFT] ++;
+    stats->num_saturated[c] += lut[v] == 255;
+}
+
+/*
+ * Samples every step-th Bayer quad of the row pair starting at s0 and s1. The
+ * rows are still in L1 from the conversion, so this costs no extra pass over
+ * the frame. Means and histograms are of the values before the gains, so
+ * that white balance can be computed from them; saturation is counted after
+ * the gains, where the output clips.
+ */
+static void accumulate_stats(rpigrafx_bayer_stats_t *stats,
+                             const uint8_t *s0, const uint8_t *s1,
+                             const int32_t width, const int step,
+                             const uint8_t *lut_r, const uint8_t *lut_g,
+                             const uint8_t *lut_b)
+{
+    int32_t x;
+
+    for (x = 0; x < width; x += 2 * step) {
+        /* Quads start on even pixels, so never straddle a 5-byte group. */
+        const int32_t i = x / 4 * 5 + x % 4;
+        add_sample(stats, 2, s0[i],     lut_b);
+        add_sample(stats, 1, s0[i + 1], lut_g);
+        add_sample(stats, 1, s1[i],     lut_g);
+        add_sample(stats, 0, s1[i + 1], lut_r);
+    }
+}
+
+/*
+ * Unpacks BGGR raw10 to 8 bits, applies per-component gains and demosaics by
+ * nearest neighbour into RGB888, all in a single pass over the source.
+ *
+ * One Bayer row pair is processed at a time: the two source rows and the two
+ * destination rows of a pair are touched exactly once and stay in L1 while
+ * the pair is in flight, and the next pair is prefetched meanwhile. Only the
+ * upper 8 bits of each 10-bit sample are used, as in raw10-to-raw8
+ * conversion. Within each 2x2 quad, R and B are shared by the four pixels and
+ * each row takes the G of its own row.
+ */
+static void nearest(uint8_t *dst, const int32_t dst_stride,
+                    const uint8_t *src, const int32_t src_stride,
+                    const int32_t width, const int32_t y_begin,
+                    const int32_t y_end,
+                    const uint8_t *lut_r, const uint8_t *lut_g,
+                    const uint8_t *lut_b,
+                    rpigrafx_bayer_stats_t *stats, const int stats_step)
+{
+    int32_t x, y;
+
+    for (y = y_begin; y < y_end; y += 2) {
+        const uint8_t *s0 = src + y * src_stride, *s1 = s0 + src_stride;
+        uint8_t *d0 = dst + y * dst_stride, *d1 = d0 + dst_stride;
+
+        if (y + 2 < y_end) {
+            __builtin_prefetch(s1 + src_stride);
+            __builtin_prefetch(s1 + 2 * src_stride);
+        }
+
+        for (x = 0; x < width; x += 4, s0 += 5, s1 += 5, d0 += 12, d1 += 12) {
+            /* Row 0 is B G B G and row 1 is G R G R. */
+            const uint8_t b0 = lut_b[s0[0]], g0 = lut_g[s0[1]],
+                          b1 = lut_b[s0[2]], g1 = lut_g[s0[3]],
+                          g2 = lut_g[s1[0]], r0 = lut_r[s1[1]],
+                          g3 = lut_g[s1[2]], r1 = lut_r[s1[3]];
+
+            d0[0] = r0; d0[1]  = g0; d0[2]  = b0;
+            d0[3] = r0; d0[4]  = g0; d0[5]  = b0;
+            d0[6] = r1; d0[7]  = g1; d0[8]  = b1;
+            d0[9] = r1; d0[10] = g1; d0[11] = b1;
+
+            d1[0] = r0; d1[1]  = g2; d1[2]  = b0;
+            d1[3] = r0; d1[4]  = g2; d1[5]  = b0;
+            d1[6] = r1; d1[7]  = g3; d1[8]  = b1;
+            d1[9] = r1; d1[10] = g3; d1[11] = b1;
+        }
+
+        if (stats != NULL && (y / 2) % stats_step == 0)
+            accumulate_stats(stats, src + y * src_stride,
+                             src + (y + 1) * src_stride, width, stats_step,
+                             lut_r, lut_g, lut_b);
+    }
+}
+
+/* Unpacks and gains one source row. */
+static void unpack_row(uint8_t *row, const uint8_t *src, const int32_t width,
+                       const uint8_t *lut_even, const uint8_t *lut_odd)
+{
+    int32_t x;
+
+    for (x = 0; x < width; x += 4, src += 5) {
+        row[x]     = lut_even[src[0]];
+        row[x + 1] = lut_odd [src[1]];
+        row[x + 2] = lut_even[src[2]];
+        row[x + 3] = lut_odd [src[3]];
+    }
+}
+
+/*
+ * Unpacks and gains one source row into the window, then mirrors the edges so
+ * that the neighbours of the border pixels keep their Bayer colours.
+ */
+static void load_row(uint8_t *row, const uint8_t *src, const int32_t width,
+                     const uint8_t *lut_even, const uint8_t *lut_odd)
+{
+    unpack_row(row, src, width, lut_even, lut_odd);
+    row[-1] = row[1];
+    row[-2] = row[2];
+    row[width]     = row[width - 2];
+    row[width + 1] = row[width - 3];
+}
+
+static inline int green_at(const int n, const int s, const int w, const int e,
+                           const _Bool is_edge_aware)
+{
+    if (is_edge_aware) {
+        const int dh = w > e ? w - e : e - w, dv = n > s ? n - s : s - n;
+        if (dh < dv)
+            return (w + e + 1) >> 1;
+        if (dv < dh)
+            return (n + s + 1) >> 1;
+    }
+    return (n + s + w + e + 2) >> 2;
+}
+
+/*
+ * The scalar reference. Colours missing at a site are the rounded means of
+ * the nearest samples of that colour, except that the edge-aware method
+ * interpolates G along the direction with the smaller gradient.
+ */
+void priv_rpigrafx_interpolate_scalar(uint8_t *d, const uint8_t *up,
+                                      const uint8_t *cur, const uint8_t *dn,
+                                      int32_t x, const int32_t width,
+                                      const _Bool is_odd_row,
+                                      const _Bool is_edge_aware)
+{
+    for (; x < width; x ++, d += 3) {
+        const int c = cur[x], w = cur[x - 1], e = cur[x + 1],
+                  n = up[x], s = dn[x];
+        const int diag = (up[x - 1] + up[x + 1] + dn[x - 1] + dn[x + 1] + 2)
+                                                                          >> 2,
+                  hor = (w + e + 1) >> 1, ver = (n + s + 1) >> 1;
+
+        switch ((is_odd_row << 1) | (x & 1)) {
+            case 0: /* B */
+                d[0] = diag;
+                d[1] = green_at(n, s, w, e, is_edge_aware);
+                d[2] = c;
+                break;
+            case 1: /* G on a B row */
+                d[0] = ver;
+                d[1] = c;
+                d[2] = hor;
+                break;
+            case 2: /* G on an R row */
+                d[0] = hor;
+                d[1] = c;
+                d[2] = ver;
+                break;
+            case 3: /* R */
+                d[0] = c;
+                d[1] = green_at(n, s, w, e, is_edge_aware);
+                d[2] = diag;
+                break;
+        }
+    }
+}
+
+static inline v8u16 load8(const uint8_t *p)
+{
+    static const v16u8 zero = {0};
+    static const v16u8 widen = {0, 16, 1, 17, 2, 18, 3, 19,
+                                4, 20, 5, 21, 6, 22, 7, 23};
+    v16u8 v;
+
+    memcpy(&v, p, sizeof(v));
+    return (v8u16) __builtin_shuffle(v, zero, widen);
+}
+
+static inline v8u16 select8(const v8s16 mask, const v8u16 a, const v8u16 b)
+{
+    return ((v8u16) mask & a) | (~(v8u16) mask & b);
+}
+
+static inline v8u16 absdiff8(const v8u16 a, const v8u16 b)
+{
+    return select8(a > b, a - b, b - a);
+}
+
+/* Narrows and interleaves eight pixels into 24 bytes of RGB888. */
+static inline void store8(uint8_t *d, const v8u16 r, const v8u16 g,
+                          const v8u16 b)
+{
+    static const v16u8 zip = {0, 16, 2, 18, 4, 20, 6, 22,
+                              8, 24, 10, 26, 12, 28, 14, 30},
+                       lo = {0, 1, 16, 2, 3, 18, 4, 5,
+                             20, 6, 7, 22, 8, 9, 24, 10},
+                       hi = {11, 26, 12, 13, 28, 14, 15, 30,
+                             0, 0, 0, 0, 0, 0, 0, 0};
+    const v16u8 rg = __builtin_shuffle((v16u8) r, (v16u8) g, zip),
+                out_lo = __builtin_shuffle(rg, (v16u8) b, lo),
+                out_hi = __builtin_shuffle(rg, (v16u8) b, hi);
+
+    memcpy(d, &out_lo, 16);
+    memcpy(d + 16, &out_hi, 8);
+}
+
+/* The same as priv_rpigrafx_interpolate_scalar for eight pixels at a time. */
+static void interpolate_vector(uint8_t *d, const uint8_t *up,
+                               const uint8_t *cur, const uint8_t *dn,
+                               const int32_t width, const _Bool is_odd_row,
+                               const _Bool is_edge_aware)
+{
+    const v8s16 is_odd_col = {0, -1, 0, -1, 0, -1, 0, -1};
+    const v8u16 one = {1, 1, 1, 1, 1, 1, 1, 1}, two = one + one;
+    int32_t x;
+
+    for (x = 0; x + VEC_LEN <= width; x += VEC_LEN, d += 3 * VEC_LEN) {
+        const v8u16 c = load8(cur + x), w = load8(cur + x - 1),
+                    e = load8(cur + x + 1), n = load8(up + x),
+                    s = load8(dn + x);
+        const v8u16 diag = (load8(up + x - 1) + load8(up + x + 1)
+                            + load8(dn + x - 1) + load8(dn + x + 1) + two) >> 2,
+                    cross = (n + s + w + e + two) >> 2,
+                    hor = (w + e + one) >> 1, ver = (n + s + one) >> 1;
+        v8u16 g = cross;
+
+        if (is_edge_aware) {
+            const v8u16 dh = absdiff8(w, e), dv = absdiff8(n, s);
+            g = select8(dh < dv, hor, select8(dv < dh, ver, cross));
+        }
+
+        if (!is_odd_row)
+            store8(d, select8(is_odd_col, ver, diag),
+                      select8(is_odd_col, c, g),
+                      select8(is_odd_col, hor, c));
+        else
+            store8(d, select8(is_odd_col, c, hor),
+                      select8(is_odd_col, g, c),
+                      select8(is_odd_col, diag, ver));
+    }
+    priv_rpigrafx_interpolate_scalar(d, up, cur, dn, x, width, is_odd_row,
+                                     is_edge_aware);
+}
+
+#ifdef HAVE_NEON
+/* Whether the CPU runs the NEON kernels that were built. */
+static _Bool has_neon()
+{
+#ifdef __aarch64__
+    return !0;
+#else /* __aarch64__ */
+    /* The 32-bit OS also runs on cores without NEON. */
+    return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#endif /* __aarch64__ */
+}
+#endif /* HAVE_NEON */
+
+/*
+ * Interpolating demosaics. Source rows are unpacked and gained into a sliding
+ * window of three rows in scratch, so each source row is still read once;
+ * rows above and below the image are mirrored like the columns are. A band
+ * of rows that does not start or end at the border of the image also reads
+ * the row just outside it, so bands can be converted independently.
+ */
+static void interpolate(uint8_t *dst, const int32_t dst_stride,
+                        const uint8_t *src, const int32_t src_stride,
+                        const int32_t width, const int32_t height,
+                        const int32_t y_begin, const int32_t y_end,
+                        const uint8_t *lut_r, const uint8_t *lut_g,
+                        const uint8_t *lut_b, uint8_t *scratch,
+                        const _Bool is_edge_aware, const _Bool is_reference,
+                        rpigrafx_bayer_stats_t *stats, const int stats_step)
+{
+    const int32_t row_size = ROW_SIZE(width);
+#ifdef HAVE_NEON
+    const _Bool is_neon = has_neon();
+#endif /* HAVE_NEON */
+    uint8_t *rows[3];
+    int32_t y;
+
+#define ROW(y) (rows[(y) % 3])
+#define LOAD(y) load_row(ROW(y), src + (y) * src_stride, width, \
+                         (y) % 2 ? lut_g : lut_b, (y) % 2 ? lut_r : lut_g)
+
+    for (y = 0; y < 3; y ++)
+        rows[y] = scratch + y * row_size + ROW_PAD;
+
+    if (y_begin > 0)
+        LOAD(y_begin - 1);
+    LOAD(y_begin);
+    LOAD(y_begin + 1);
+    for (y = y_begin; y < y_end; y ++) {
+        const uint8_t *up = ROW(y == 0 ? 1 : y - 1),
+                      *dn = ROW(y == height - 1 ? height - 2 : y + 1);
+        uint8_t *d = dst + y * dst_stride;
+
+        if (is_reference)
+            priv_rpigrafx_interpolate_scalar(d, up, ROW(y), dn, 0, width,
+                                             y % 2, is_edge_aware);
+#ifdef HAVE_NEON
+        else if (is_neon)
+            priv_rpigrafx_interpolate_neon(d, up, ROW(y), dn, width, y % 2,
+                                           is_edge_aware);
+#endif /* HAVE_NEON */
+        else
+            interpolate_vector(d, up, ROW(y), dn, width, y % 2,
+                               is_edge_aware);
+
+        if (stats != NULL && y % 2 == 0 && (y / 2) % stats_step == 0)
+            accumulate_stats(stats, src + y * src_stride,
+                             src + (y + 1) * src_stride, width, stats_step,
+                             lut_r, lut_g, lut_b);
+
+        if (y + 2 < height && y + 2 <= y_end) {
+            if (y + 3 < height && y + 3 <= y_end)
+                __builtin_prefetch(src + (y + 3) * src_stride);
+            LOAD(y + 2);
+        }
+    }
+
+#undef LOAD
+#undef ROW
+}
+
+static int convert(uint8_t *dst, const int32_t dst_stride,
+                   const uint8_t *src, const int32_t src_stride,
+                   const int32_t width, const int32_t height,
+                   const int32_t y_begin, const int32_t y_end,
+                   const float gain_r, const float gain_g, const float gain_b,
+                   const rpigrafx_demosaic_t demosaic, uint8_t *scratch,
+                   rpigrafx_bayer_stats_t *stats, const int stats_step,
+                   const _Bool is_reference)
+{
+    uint8_t lut_r[256], lut_g[256], lut_b[256];
+
+    if (check_args(dst_stride, 3, src_stride, width, height))
+        return 1;
+    if (check_rows(height, y_begin, y_end))
+        return 1;
+    if (stats != NULL && stats_step < 1) {
+        print_error("Invalid step of statistics: %d", stats_step);
+        return 1;
+    }
+
+    build_gain_lut(lut_r, gain_r);
+    build_gain_lut(lut_g, gain_g);
+    build_gain_lut(lut_b, gain_b);
+
+    switch (demosaic) {
+        case RPIGRAFX_DEMOSAIC_NEAREST:
+            nearest(dst, dst_stride, src, src_stride, width, y_begin, y_end,
+                    lut_r, lut_g, lut_b, stats, stats_step);
+            return 0;
+        case RPIGRAFX_DEMOSAIC_BILINEAR:
+        case RPIGRAFX_DEMOSAIC_EDGE_AWARE:
+            if (scratch == NULL) {
+                print_error("Scratch is needed for demosaic %d", demosaic);
+                return 1;
+            }
+            interpolate(dst, dst_stride, src, src_stride, width, height,
+                        y_begin, y_end, lut_r, lut_g, lut_b, scratch,
+                        demosaic == RPIGRAFX_DEMOSAIC_EDGE_AWARE,
+                        is_reference, stats, stats_step);
+            return 0;
+    }
+
+    print_error("Unknown demosaic: %d", demosaic);
+    return 1;
+}
+
+/*
+ * Unpacks BGGR raw10, applies per-component gains and demosaics into RGB888.
+ * scratch must hold priv_rpigrafx_demosaic_scratch_size(demosaic, width)
+ * bytes.
+ */
+int priv_rpigrafx_raw10bggr_to_rgb888_gain(uint8_t *dst,
+                                           const int32_t dst_stride,
+                                           const uint8_t *src,
+                                           const int32_t src_stride,
+                                           const int32_t width,
+                                           const int32_t height,
+                                           const float gain_r,
+                                           const float gain_g,
+                                           const float gain_b,
+                                           const rpigrafx_demosaic_t demosaic,
+                                           uint8_t *scratch)
+{
+    return convert(dst, dst_stride, src, src_stride, width, height,
+                   0, height, gain_r, gain_g, gain_b, demosaic, scratch,
+                   NULL, 1, 0);
+}
+
+/*
+ * The same as priv_rpigrafx_raw10bggr_to_rgb888_gain but only for the rows
+ * [y_begin, y_end), which must be even. dst and src still point to the first
+ * row of the images. Unless stats is NULL, statistics of every stats_step-th
+ * Bayer quad in both directions, counted from the top-left of the image, are
+ * added to it.
+ */
+int priv_rpigrafx_raw10bggr_to_rgb888_gain_rows(uint8_t *dst,
+                                                const int32_t dst_stride,
+                                                const uint8_t *src,
+                                                const int32_t src_stride,
+                                                const int32_t width,
+                                                const int32_t height,
+                                                const int32_t y_begin,
+                                                const int32_t y_end,
+                                                const float gain_r,
+                                                const float gain_g,
+                                                const float gain_b,
+                                                const rpigrafx_demosaic_t
+                                                                      demosaic,
+                                                uint8_t *scratch,
+                                                rpigrafx_bayer_stats_t *stats,
+                                                const int stats_step)
+{
+    return convert(dst, dst_stride, src, src_stride, width, height,
+                   y_begin, y_end, gain_r, gain_g, gain_b, demosaic, scratch,
+                   stats, stats_step, 0);
+}
+
+/* The scalar reference of priv_rpigrafx_raw10bggr_to_rgb888_gain. */
+int priv_rpigrafx_raw10bggr_to_rgb888_gain_ref(uint8_t *dst,
+                                               const int32_t dst_stride,
+                                               const uint8_t *src,
+                                               const int32_t src_stride,
+                                               const int32_t width,
+                                               const int32_t height,
+                                               const float gain_r,
+                                               const float gain_g,
+                                               const float gain_b,
+                                               const rpigrafx_demosaic_t
+                                                                      demosaic,
+                                               uint8_t *scratch)
+{
+    return convert(dst, dst_stride, src, src_stride, width, height,
+                   0, height, gain_r, gain_g, gain_b, demosaic, scratch,
+                   NULL, 1, !0);
+}
+
+/*
+ * Unpacks the rows [y_begin, y_end) of BGGR raw10 to 8 bits and applies the
+ * per-component gains, leaving the Bayer pattern as is. This is the first
+ * step of the conversion on its own, for measuring it apart.
+ */
+int priv_rpigrafx_raw10bggr_to_raw8_gain_rows(uint8_t *dst,
+                                              const int32_t dst_stride,
+                                              const uint8_t *src,
+                                              const int32_t src_stride,
+                                              const int32_t width,
+                                              const int32_t height,
+                                              const int32_t y_begin,
+                                              const int32_t y_end,
+                                              const float gain_r,
+                                              const float gain_g,
+                                              const float gain_b)
+{
+    uint8_t lut_r[256], lut_g[256], lut_b[256];
+    int32_t y;
+
+    if (check_args(dst_stride, 1, src_stride, width, height))
+        return 1;
+    if (check_rows(height, y_begin, y_end))
+        return 1;
+
+    build_gain_lut(lut_r, gain_r);
+    build_gain_lut(lut_g, gain_g);
+    build_gain_lut(lut_b, gain_b);
+    for (y = y_begin; y < y_end; y += 2) {
+        unpack_row(dst + y * dst_stride, src + y * src_stride, width,
+                   lut_b, lut_g);
+        unpack_row(dst + (y + 1) * dst_stride, src + (y + 1) * src_stride,
+                   width, lut_g, lut_r);
+    }
+    return 0;
+}
+
+/*
+ * Adds the statistics that priv_rpigrafx_raw10bggr_to_rgb888_gain_rows takes
+ * of the rows [y_begin, y_end) to stats, in a pass of its own, for measuring
+ * them apart.
+ */
+int priv_rpigrafx_raw10bggr_stats_rows(const uint8_t *src,
+                                       const int32_t src_stride,
+                                       const int32_t width,
+                                       const int32_t height,
+                                       const int32_t y_begin,
+                                       const int32_t y_end,
+                                       const float gain_r,
+                                       const float gain_g,
+                                       const float gain_b,
+                                       rpigrafx_bayer_stats_t *stats,
+                                       const int stats_step)
+{
+    uint8_t lut_r[256], lut_g[256], lut_b[256];
+    int32_t y;
+
+    if (check_args(width, 1, src_stride, width, height))
+        return 1;
+    if (check_rows(height, y_begin, y_end))
+        return 1;
+    if (stats_step < 1) {
+        print_error("Invalid step of statistics: %d", stats_step);
+        return 1;
+    }
+
+    build_gain_lut(lut_r, gain_r);
+    build_gain_lut(lut_g, gain_g);
+    build_gain_lut(lut_b, gain_b);
+    for (y = y_begin; y < y_end; y += 2)
+        if ((y / 2) % stats_step == 0)
+            accumulate_stats(stats, src + y * src_stride,
+                             src + (y + 1) * src_stride, width, stats_step,
+                             lut_r, lut_g, lut_b);
+    return 0;
+}
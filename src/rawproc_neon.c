@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * NEON kernels of rawproc.c.
+ *
+ * Only this file is built with the flags that enable NEON, so that the rest
+ * of the library still runs on cores without it; rawproc.c calls in here
+ * once it has checked that the CPU has NEON.
+ */
+
+#include "rpigrafx.h"
+#include "local.h"
+#include <stdint.h>
+#include <arm_neon.h>
+
+#define VEC_LEN 8
+
+/* The same as priv_rpigrafx_interpolate_scalar for eight pixels at a time. */
+void priv_rpigrafx_interpolate_neon(uint8_t *d, const uint8_t *up,
+                                    const uint8_t *cur, const uint8_t *dn,
+                                    const int32_t width, const _Bool is_odd_row,
+                                    const _Bool is_edge_aware)
+{
+    static const uint8_t odd_col[VEC_LEN] = {0, 0xff, 0, 0xff, 0, 0xff, 0, 0xff};
+    const uint8x8_t is_odd_col = vld1_u8(odd_col);
+    int32_t x;
+
+    for (x = 0; x + VEC_LEN <= width; x += VEC_LEN, d += 3 * VEC_LEN) {
+        const uint8x8_t c = vld1_u8(cur + x), w = vld1_u8(cur + x - 1),
+                        e = vld1_u8(cur + x + 1), n = vld1_u8(up + x),
+                        s = vld1_u8(dn + x);
+        const uint8x8_t diag = vrshrn_n_u16(
+                    vaddq_u16(vaddl_u8(vld1_u8(up + x - 1), vld1_u8(up + x + 1)),
+                              vaddl_u8(vld1_u8(dn + x - 1), vld1_u8(dn + x + 1))),
+                    2),
+                        cross = vrshrn_n_u16(vaddq_u16(vaddl_u8(n, s),
+                                                       vaddl_u8(w, e)), 2),
+                        hor = vrhadd_u8(w, e), ver = vrhadd_u8(n, s);
+        uint8x8_t g = cross;
+        uint8x8x3_t rgb;
+
+        if (is_edge_aware) {
+            const uint8x8_t dh = vabd_u8(w, e), dv = vabd_u8(n, s);
+            g = vbsl_u8(vclt_u8(dh, dv), hor,
+                        vbsl_u8(vclt_u8(dv, dh), ver, cross));
+        }
+
+        if (!is_odd_row) {
+            rgb.val[0] = vbsl_u8(is_odd_col, ver, diag);
+            rgb.val[1] = vbsl_u8(is_odd_col, c, g);
+            rgb.val[2] = vbsl_u8(is_odd_col, hor, c);
+        } else {
+            rgb.val[0] = vbsl_u8(is_odd_col, c, hor);
+            rgb.val[1] = vbsl_u8(is_odd_col, g, c);
+            rgb.val[2] = vbsl_u8(is_odd_col, diag, ver);
+        }
+        vst3_u8(d, rgb);
+    }
+    priv_rpigrafx_interpolate_scalar(d, up, cur, dn, x, width, is_odd_row,
+                                     is_edge_aware);
+}
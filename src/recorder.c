@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Frame recorder.
+ *
+ * rpigrafx_record_frame() copies the frame and its info into a free slot of a
+ * ring and returns; a writer thread writes the queued slots in order, as many
+ * at a time as are queued, with one vectored write. Slots are aligned records
+ * of the file, so the file is opened with O_DIRECT where the filesystem
+ * allows it and the frames go from the slots to the disk without passing
+ * through the page cache. When the writer falls behind and every slot is
+ * full, the recorder blocks or drops the frame as its policy says and counts
+ * it.
+ */
+
+#define _GNU_SOURCE
+#include "rpigrafx.h"
+#include "local.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+/* Slots written by one call at most. */
+#define MAX_BATCH 16
+
+struct rpigrafx_recorder {
+    rpigrafx_frame_config_t fc;
+    rpigrafx_drop_policy_t drop_policy;
+    int fd;
+    uint8_t *header;
+    uint32_t frame_size, record_size;
+
+    int num_slots;
+    uint8_t **slots;
+    pthread_t thread;
+    _Bool is_running;
+    pthread_mutex_t mutex;
+    /* Signalled when a slot is queued, and when one is freed. */
+    pthread_cond_t cond_queued, cond_free;
+    /*
+     * From next_write on, num_writing slots are being written by the writer,
+     * then num_queued slots wait for it; next_fill is the first free one.
+     */
+    int next_fill, next_write, num_writing, num_queued;
+    _Bool is_exiting;
+    /* Error of the writer; it stops on error. */
+    int ret;
+    rpigrafx_recorder_stats_t stats;
+};
+
+static uint64_t get_time_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* Writes all of iov at offset, going on after short writes. */
+static int write_all(const int fd, struct iovec *iov, int iovcnt, off_t offset)
+{
+    while (iovcnt > 0) {
+        ssize_t n = pwritev(fd, iov, iovcnt, offset);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return 1;
+        }
+        offset += n;
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov ++;
+            iovcnt --;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t*) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Writes the header. Some filesystems take O_DIRECT on open but refuse the
+ * writes; the recorder then goes on through the page cache.
+ */
+static int write_header(rpigrafx_recorder_t *rec)
+{
+    struct iovec iov = {rec->header, RPIGRAFX_RECORDING_ALIGN};
+
+    if (!write_all(rec->fd, &iov, 1, 0))
+        return 0;
+    if (errno == EINVAL && rec->stats.is_direct) {
+        if (fcntl(rec->fd, F_SETFL, fcntl(rec->fd, F_GETFL) & ~O_DIRECT)) {
+            print_error("fcntl: %s", strerror(errno));
+            return 1;
+        }
+        rec->stats.is_direct = 0;
+        return write_header(rec);
+    }
+    print_error("Failed to write the recording header: %s", strerror(errno));
+    return 1;
+}
+
+static void* writer_main(void *arg)
+{
+    rpigrafx_recorder_t *rec = arg;
+    struct iovec iov[MAX_BATCH];
+
+    pthread_mutex_lock(&rec->mutex);
+    for (; ; ) {
+        off_t offset;
+        uint64_t start, ns;
+        int k, n, ret;
+
+        while (!rec->is_exiting && rec->num_queued == 0)
+            pthread_cond_wait(&rec->cond_queued, &rec->mutex);
+        /* The queued frames are written before exiting. */
+        if (rec->num_queued == 0)
+            break;
+
+        n = MMAL_MIN(rec->num_queued, MAX_BATCH);
+        for (k = 0; k < n; k ++) {
+            iov[k].iov_base = rec->slots[(rec->next_write + k)
+                                         % rec->num_slots];
+            iov[k].iov_len = rec->record_size;
+        }
+        offset = RPIGRAFX_RECORDING_ALIGN
+                 + (off_t) rec->stats.num_written * rec->record_size;
+        rec->num_queued -= n;
+        rec->num_writing = n;
+        pthread_mutex_unlock(&rec->mutex);
+
+        start = get_time_ns();
+        ret = write_all(rec->fd, iov, n, offset);
+        ns = get_time_ns() - start;
+        if (ret)
+            print_error("Failed to write %d frame(s): %s", n, strerror(errno));
+
+        pthread_mutex_lock(&rec->mutex);
+        rec->next_write = (rec->next_write + n) % rec->num_slots;
+        rec->num_writing = 0;
+        rec->stats.write_ns += ns;
+        pthread_cond_broadcast(&rec->cond_free);
+        if (ret) {
+            rec->ret = 1;
+            break;
+        }
+        rec->stats.num_written += n;
+        rec->stats.num_bytes += (uint64_t) n * rec->record_size;
+    }
+    pthread_mutex_unlock(&rec->mutex);
+    return NULL;
+}
+
+static void destroy(rpigrafx_recorder_t *rec)
+{
+    int k;
+
+    if (rec->is_running) {
+        pthread_mutex_lock(&rec->mutex);
+        rec->is_exiting = !0;
+        pthread_cond_broadcast(&rec->cond_queued);
+        pthread_mutex_unlock(&rec->mutex);
+        pthread_join(rec->thread, NULL);
+    }
+    if (rec->fd >= 0)
+        close(rec->fd);
+    if (rec->slots != NULL)
+        for (k = 0; k < rec->num_slots; k ++)
+            free(rec->slots[k]);
+    priv_rpigrafx_free(rec->slots);
+    free(rec->header);
+    pthread_mutex_destroy(&rec->mutex);
+    pthread_cond_destroy(&rec->cond_queued);
+    pthread_cond_destroy(&rec->cond_free);
+    priv_rpigrafx_free(rec);
+}
+
+/*
+ * Opens a recording of the output of fcp at path, which is replaced if it
+ * exists. Call after rpigrafx_finish_config. Up to num_slots frames are kept
+ * in memory while the writer is behind; then rpigrafx_record_frame waits
+ * (RPIGRAFX_DROP_POLICY_BLOCK) or drops the frame
+ * (RPIGRAFX_DROP_POLICY_DROP_NEWEST). Dropping the oldest is not offered: the
+ * frames already taken are being written out.
+ */
+int rpigrafx_open_recorder(const char *path, rpigrafx_frame_config_t *fcp,
+                           const int num_slots,
+                           const rpigrafx_drop_policy_t drop_policy,
+                           rpigrafx_recorder_t **recp)
+{
+    rpigrafx_recorder_t *rec = NULL;
+    rpigrafx_recording_header_t *header = NULL;
+    int k;
+    int ret = 0;
+
+    if (num_slots < 1) {
+        print_error("Invalid number of slots: %d", num_slots);
+        ret = 1;
+        goto end;
+    }
+    if (drop_policy != RPIGRAFX_DROP_POLICY_BLOCK
+            && drop_policy != RPIGRAFX_DROP_POLICY_DROP_NEWEST) {
+        print_error("Invalid drop policy for a recorder: %d", drop_policy);
+        ret = 1;
+        goto end;
+    }
+
+    rec = priv_rpigrafx_malloc(sizeof(*rec));
+    if (rec == NULL) {
+        print_error("Failed to allocate recorder");
+        ret = 1;
+        goto end;
+    }
+    memset(rec, 0, sizeof(*rec));
+    rec->fc = *fcp;
+    rec->drop_policy = drop_policy;
+    rec->fd = -1;
+    rec->num_slots = num_slots;
+    rec->stats.num_slots = num_slots;
+    pthread_mutex_init(&rec->mutex, NULL);
+    pthread_cond_init(&rec->cond_queued, NULL);
+    pthread_cond_init(&rec->cond_free, NULL);
+
+    if ((errno = priv_rpigrafx_memalign((void**) &rec->header,
+                                        RPIGRAFX_RECORDING_ALIGN,
+                                        RPIGRAFX_RECORDING_ALIGN))) {
+        print_error("Failed to allocate recording header: %s",
+                    strerror(errno));
+        rec->header = NULL;
+        ret = 1;
+        goto end;
+    }
+    memset(rec->header, 0, RPIGRAFX_RECORDING_ALIGN);
+    header = (rpigrafx_recording_header_t*) rec->header;
+    memcpy(header->magic, RPIGRAFX_RECORDING_MAGIC, sizeof(header->magic));
+    header->version = RPIGRAFX_RECORDING_VERSION;
+    if (priv_rpigrafx_get_frame_format(fcp, &header->encoding,
+                                       &header->width, &header->height,
+                                       &header->aligned_width,
+                                       &header->aligned_height,
+                                       &header->frame_size)) {
+        ret = 1;
+        goto end;
+    }
+    rec->frame_size = header->frame_size;
+    rec->record_size = VCOS_ALIGN_UP(RPIGRAFX_RECORDING_FRAME_OFFSET
+                                     + rec->frame_size,
+                                     RPIGRAFX_RECORDING_ALIGN);
+    header->record_size = rec->record_size;
+
+    rec->slots = priv_rpigrafx_malloc(num_slots * sizeof(*rec->slots));
+    if (rec->slots == NULL) {
+        print_error("Failed to allocate slots");
+        ret = 1;
+        goto end;
+    }
+    memset(rec->slots, 0, num_slots * sizeof(*rec->slots));
+    for (k = 0; k < num_slots; k ++) {
+        if ((errno = priv_rpigrafx_memalign((void**) &rec->slots[k],
+                                            RPIGRAFX_RECORDING_ALIGN,
+                                            rec->record_size))) {
+            print_error("Failed to allocate slot of %u bytes: %s",
+                        rec->record_size, strerror(errno));
+            rec->slots[k] = NULL;
+            ret = 1;
+            goto end;
+        }
+        /* Fault the pages in now; this also zeroes the padding. */
+        memset(rec->slots[k], 0, rec->record_size);
+    }
+
+    rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    rec->stats.is_direct = rec->fd >= 0;
+    if (rec->fd < 0 && errno == EINVAL)
+        rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (rec->fd < 0) {
+        print_error("Failed to open %s: %s", path, strerror(errno));
+        ret = 1;
+        goto end;
+    }
+    if (write_header(rec)) {
+        ret = 1;
+        goto end;
+    }
+
+    if ((errno = pthread_create(&rec->thread, NULL, writer_main, rec))) {
+        print_error("Failed to create writer thread: %s", strerror(errno));
+        ret = 1;
+        goto end;
+    }
+    rec->is_running = !0;
+
+end:
+    if (ret && rec != NULL) {
+        destroy(rec);
+        rec = NULL;
+    }
+    *recp = rec;
+    return ret;
+}
+
+/*
+ * Queues frame, a frame of the output of the recorder, with the info of the
+ * current frame of the output, so call it right after capturing it or from
+ * the callback that is passed it. Not to be called on one recorder from
+ * several threads at once.
+ */
+int rpigrafx_record_frame(rpigrafx_recorder_t *rec, const void *frame)
+{
+    rpigrafx_frame_info_t info;
+    rpigrafx_recording_frame_t *record = NULL;
+    uint8_t *slot = NULL;
+    int ret = 0;
+
+    if (rpigrafx_get_frame_info(&rec->fc, &info)) {
+        ret = 1;
+        goto end;
+    }
+
+    pthread_mutex_lock(&rec->mutex);
+    while (rec->ret == 0 && rec->num_writing + rec->num_queued
+                                                          == rec->num_slots) {
+        uint64_t start;
+        if (rec->drop_policy == RPIGRAFX_DROP_POLICY_DROP_NEWEST) {
+            rec->stats.num_dropped ++;
+            pthread_mutex_unlock(&rec->mutex);
+            goto end;
+        }
+        rec->stats.num_blocked ++;
+        start = get_time_ns();
+        pthread_cond_wait(&rec->cond_free, &rec->mutex);
+        rec->stats.blocked_ns += get_time_ns() - start;
+    }
+    ret = rec->ret;
+    slot = rec->slots[rec->next_fill];
+    pthread_mutex_unlock(&rec->mutex);
+    if (ret) {
+        print_error("The writer of the recorder has stopped on an error");
+        goto end;
+    }
+
+    /* The slot is free, so the writer does not touch it meanwhile. */
+    record = (rpigrafx_recording_frame_t*) slot;
+    record->length = rec->frame_size;
+    record->pts = info.pts;
+    record->sensor_ns = info.sensor_ns;
+    record->receive_ns = info.receive_ns;
+    record->sequence = info.sequence;
+    memcpy(slot + RPIGRAFX_RECORDING_FRAME_OFFSET, frame, rec->frame_size);
+
+    pthread_mutex_lock(&rec->mutex);
+    rec->next_fill = (rec->next_fill + 1) % rec->num_slots;
+    rec->num_queued ++;
+    rec->stats.num_recorded ++;
+    if (rec->num_writing + rec->num_queued > rec->stats.max_queued)
+        rec->stats.max_queued = rec->num_writing + rec->num_queued;
+    pthread_cond_signal(&rec->cond_queued);
+    pthread_mutex_unlock(&rec->mutex);
+
+end:
+    return ret;
+}
+
+int rpigrafx_get_recorder_stats(rpigrafx_recorder_t *rec,
+                                rpigrafx_recorder_stats_t *stats)
+{
+    pthread_mutex_lock(&rec->mutex);
+    *stats = rec->stats;
+    stats->num_queued = rec->num_writing + rec->num_queued;
+    pthread_mutex_unlock(&rec->mutex);
+    return 0;
+}
+
+/*
+ * Writes out the queued frames, completes the header and closes the file.
+ * Fails if any frame could not be written.
+ */
+int rpigrafx_close_recorder(rpigrafx_recorder_t *rec)
+{
+    rpigrafx_recording_header_t *header =
+                                (rpigrafx_recording_header_t*) rec->header;
+    int ret = 0;
+
+    pthread_mutex_lock(&rec->mutex);
+    rec->is_exiting = !0;
+    pthread_cond_broadcast(&rec->cond_queued);
+    pthread_mutex_unlock(&rec->mutex);
+    pthread_join(rec->thread, NULL);
+    rec->is_running = 0;
+
+    ret = rec->ret;
+    if (!ret) {
+        header->num_frames = rec->stats.num_written;
+        ret = write_header(rec);
+    }
+    if (close(rec->fd)) {
+        print_error("Failed to close the recording: %s", strerror(errno));
+        ret = 1;
+    }
+    rec->fd = -1;
+
+    destroy(rec);
+    return ret;
+}
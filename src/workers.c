@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2017 Sugizaki Yukimasa (ysugi@idein.jp)
+ * All rights reserved.
+ *
+ * This software is licensed under a Modified (3-Clause) BSD License.
+ * You should have received a copy of this license along with this
+ * software. If not, contact the copyright holder above.
+ */
+
+/*
+ * Persistent pool of worker threads.
+ *
+ * priv_rpigrafx_workers_run() hands out tasks 0..num_tasks-1 to the workers
+ * and to the calling thread itself and returns when all of them are done, so
+ * a pool of n threads keeps n cores busy with n - 1 extra threads. The
+ * threads are created once and sleep between runs.
+ */
+
+#include "rpigrafx.h"
+#include "local.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+struct priv_rpigrafx_workers {
+    int num_threads;
+    pthread_t threads[PRIV_RPIGRAFX_MAX_WORKERS - 1];
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_start, cond_done;
+    unsigned generation;
+    _Bool is_exiting;
+
+    void (*func)(void *arg, const int task);
+    void *arg;
+    int num_tasks, next_task, num_done;
+    uint64_t task_ns[PRIV_RPIGRAFX_MAX_WORKERS];
+};
+
+static uint64_t get_time_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* Runs tasks until none is left. Called with the mutex held. */
+static void run_tasks(struct priv_rpigrafx_workers *workers)
+{
+    while (workers->next_task < workers->num_tasks) {
+        const int task = workers->next_task ++;
+        uint64_t start;
+
+        pthread_mutex_unlock(&workers->mutex);
+        start = get_time_ns();
+        workers->func(workers->arg, task);
+        workers->task_ns[task] = get_time_ns() - start;
+        pthread_mutex_lock(&workers->mutex);
+
+        if (++ workers->num_done == workers->num_tasks)
+            pthread_cond_broadcast(&workers->cond_done);
+    }
+}
+
+static void* worker_main(void *arg)
+{
+    struct priv_rpigrafx_workers *workers = arg;
+    unsigned generation = 0;
+
+    pthread_mutex_lock(&workers->mutex);
+    for (; ; ) {
+        while (!workers->is_exiting && workers->generation == generation)
+            pthread_cond_wait(&workers->cond_start, &workers->mutex);
+        if (workers->is_exiting)
+            break;
+        generation = workers->generation;
+        run_tasks(workers);
+    }
+    pthread_mutex_unlock(&workers->mutex);
+
+    return NULL;
+}
+
+struct priv_rpigrafx_workers* priv_rpigrafx_workers_create(const int
+                                                                   num_threads)
+{
+    struct priv_rpigrafx_workers *workers = NULL;
+    int i;
+
+    if (num_threads < 1 || num_threads > PRIV_RPIGRAFX_MAX_WORKERS) {
+        print_error("Invalid number of threads: %d", num_threads);
+        goto end;
+    }
+
+    workers = priv_rpigrafx_malloc(sizeof(*workers));
+    if (workers == NULL) {
+        print_error("Failed to allocate workers");
+        goto end;
+    }
+    memset(workers, 0, sizeof(*workers));
+    pthread_mutex_init(&workers->mutex, NULL);
+    pthread_cond_init(&workers->cond_start, NULL);
+    pthread_cond_init(&workers->cond_done, NULL);
+
+    /* The caller works as the last thread. */
+    workers->num_threads = 1;
+    for (i = 0; i < num_threads - 1; i ++) {
+        if ((errno = pthread_create(&workers->threads[i], NULL, worker_main,
+                                    workers))) {
+            print_error("Failed to create worker thread %d: %s",
+                        i, strerror(errno));
+            priv_rpigrafx_workers_destroy(workers);
+            workers = NULL;
+            goto end;
+        }
+        workers->num_threads ++;
+    }
+
+end:
+    return workers;
+}
+
+void priv_rpigrafx_workers_destroy(struct priv_rpigrafx_workers *workers)
+{
+    int i;
+
+    if (workers == NULL)
+        return;
+
+    pthread_mutex_lock(&workers->mutex);
+    workers->is_exiting = !0;
+    pthread_cond_broadcast(&workers->cond_start);
+    pthread_mutex_unlock(&workers->mutex);
+    for (i = 0; i < workers->num_threads - 1; i ++)
+        pthread_join(workers->threads[i], NULL);
+
+    pthread_cond_destroy(&workers->cond_done);
+    pthread_cond_destroy(&workers->cond_start);
+    pthread_mutex_destroy(&workers->mutex);
+    priv_rpigrafx_free(workers);
+}
+
+int priv_rpigrafx_workers_num_threads(const struct priv_rpigrafx_workers
+                                                                      *workers)
+{
+    return workers->num_threads;
+}
+
+/* Time in nanoseconds that the task took in the last run. */
+uint64_t priv_rpigrafx_workers_task_ns(const struct priv_rpigrafx_workers
+                                                                      *workers,
+                                       const int task)
+{
+    return workers->task_ns[task];
+}
+
+int priv_rpigrafx_workers_run(struct priv_rpigrafx_workers *workers,
+                              const int num_tasks,
+                              void (*func)(void *arg, const int task),
+                              void *arg)
+{
+    if (num_tasks < 0 || num_tasks > PRIV_RPIGRAFX_MAX_WORKERS) {
+        print_error("Invalid number of tasks: %d", num_tasks);
+        return 1;
+    }
+
+    pthread_mutex_lock(&workers->mutex);
+    workers->func = func;
+    workers->arg = arg;
+    workers->num_tasks = num_tasks;
+    workers->next_task = 0;
+    workers->num_done = 0;
+    workers->generation ++;
+    pthread_cond_broadcast(&workers->cond_start);
+
+    run_tasks(workers);
+    while (workers->num_done != workers->num_tasks)
+        pthread_cond_wait(&workers->cond_done, &workers->mutex);
+    pthread_mutex_unlock(&workers->mutex);
+
+    return 0;
+}
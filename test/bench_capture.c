@@ -0,0 +1,521 @@
+#include "config.h"
+#include <rpigrafx.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define _check(x) \
+    do { \
+        if ((x)) { \
+            fprintf(stderr, "Error at %s:%d:%s\n", __FILE__, __LINE__, __func__); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define MAX_VALUES 16
+#define MAX_OUTPUTS 16
+/* Splitters a frame can go through with MAX_OUTPUTS outputs. */
+#define MAX_HOPS 3
+#define NUM_WARMUP_FRAMES 5
+/* Frames of the synthetic recording a replay loops over. */
+#define NUM_REPLAY_FRAMES 8
+/* The stand-in has no rawcam, so replays stand in for it by default. */
+#ifdef HAVE_MMAL_EMU
+#define DEFAULT_SOURCES "camera,replay"
+#else
+#define DEFAULT_SOURCES "camera,rawcam"
+#endif
+
+static char *progname = NULL;
+
+/*
+ * The library is configured once per process, so each configuration runs in
+ * a child process of its own, which prints one JSON object on success.
+ */
+static struct sweep {
+    int num_sizes;
+    int32_t widths[MAX_VALUES], heights[MAX_VALUES];
+    int num_encodings;
+    char *encodings[MAX_VALUES];
+    int num_outputs;
+    int outputs[MAX_VALUES];
+    int num_ports;
+    char *ports[MAX_VALUES];
+    int num_sources;
+    char *sources[MAX_VALUES];
+    int num_renders;
+    int renders[MAX_VALUES];
+} sweep;
+
+static const struct encoding {
+    const char *name;
+    MMAL_FOURCC_T fourcc;
+} encodings[] = {
+    {"rgb24", MMAL_ENCODING_RGB24},
+    {"bgr24", MMAL_ENCODING_BGR24},
+    {"rgba",  MMAL_ENCODING_RGBA},
+    {"bgra",  MMAL_ENCODING_BGRA},
+};
+
+static const char *stage_names[RPIGRAFX_NUM_STAGES] = {
+    [RPIGRAFX_STAGE_CAPTURE] = "capture",
+    [RPIGRAFX_STAGE_TRIGGER] = "trigger",
+    [RPIGRAFX_STAGE_RAW_WAIT] = "raw_wait",
+    [RPIGRAFX_STAGE_CONVERT] = "convert",
+    [RPIGRAFX_STAGE_TUNER] = "tuner",
+    [RPIGRAFX_STAGE_READY_WAIT] = "ready_wait",
+    [RPIGRAFX_STAGE_SPLITTER_INPUT_WAIT] = "splitter_input_wait",
+    [RPIGRAFX_STAGE_SPLITTER_SEND] = "splitter_send",
+    [RPIGRAFX_STAGE_ISP_WAIT] = "isp_wait",
+};
+
+static uint64_t get_time_ns(const clockid_t clock)
+{
+    struct timespec t;
+    clock_gettime(clock, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static uint64_t get_cpu_ns()
+{
+    struct rusage r;
+    getrusage(RUSAGE_SELF, &r);
+    return ((uint64_t) r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1000000000
+           + ((uint64_t) r.ru_utime.tv_usec + r.ru_stime.tv_usec) * 1000;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    const double x = *(const double*) a, y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+/* The p-th percentile of n sorted values, or -1 if there are none. */
+static double percentile(const double *v, const int n, const double p)
+{
+    if (n == 0)
+        return -1;
+    return v[(int) ((n - 1) * p / 100 + 0.5)];
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: %s [OPTION]...\n", progname);
+    fprintf(stderr,
+            "\n"
+            "Captures frames in every combination of the values below and\n"
+            "prints a JSON array with one object per combination on stdout.\n"
+            "\n"
+            "  -n NFRAMES         Frames to time per output (default: 60)\n"
+            "  -s WxH,...         Frame sizes (default: 640x480,1280x720,1920x1080)\n"
+            "  -e ENCODING,...    rgb24, bgr24, rgba or bgra (default: rgb24,rgba)\n"
+            "  -o NOUTPUTS,...    Splitter outputs, 1 to %d (default: 1,2)\n"
+            "  -p PORT,...        preview or capture (default: preview,capture)\n"
+            "  -c SOURCE,...      camera, rawcam or replay of a synthetic raw10\n"
+            "                     recording (default: " DEFAULT_SOURCES ")\n"
+            "  -r RENDER,...      Render frames (1) or just free them (0)\n"
+            "                     (default: 0,1)\n"
+            "  -x                 Run the first combination in this process\n"
+            "  -?                 What you are doing\n",
+            MAX_OUTPUTS);
+}
+
+static int split(char *s, char **values)
+{
+    int n = 0;
+    char *save = NULL, *t = NULL;
+
+    for (t = strtok_r(s, ",", &save); t != NULL;
+            t = strtok_r(NULL, ",", &save)) {
+        if (n == MAX_VALUES) {
+            fprintf(stderr, "error: Too many values: %s\n", t);
+            exit(EXIT_FAILURE);
+        }
+        values[n ++] = t;
+    }
+    return n;
+}
+
+static MMAL_FOURCC_T lookup_encoding(const char *name)
+{
+    unsigned i;
+
+    for (i = 0; i < sizeof(encodings) / sizeof(encodings[0]); i ++)
+        if (!strcmp(encodings[i].name, name))
+            return encodings[i].fourcc;
+    fprintf(stderr, "error: Unknown encoding: %s\n", name);
+    exit(EXIT_FAILURE);
+}
+
+/* Only the camera has ports to choose from. */
+static _Bool has_ports(const char *source)
+{
+    return !strcmp(source, "camera");
+}
+
+/*
+ * Writes NUM_REPLAY_FRAMES BGGR raw10 frames of noise to a temporary file,
+ * configures camera 0 to replay them over and over as fast as they are taken
+ * and removes the file, which stays mapped.
+ */
+static void config_replay(const int32_t width, const int32_t height)
+{
+    /* Four pixels are packed into five bytes; rows are aligned to 32 bytes. */
+    const uint32_t stride = VCOS_ALIGN_UP(VCOS_ALIGN_UP(width, 32) * 5 / 4,
+                                          32);
+    char path[] = "/tmp/bench_capture.XXXXXX";
+    rpigrafx_recording_header_t header;
+    rpigrafx_recording_frame_t frame;
+    uint8_t *block = NULL;
+    FILE *fp = NULL;
+    uint32_t k;
+    int fd, n;
+
+    fd = mkstemp(path);
+    _check(fd == -1);
+    fp = fdopen(fd, "wb");
+    _check(fp == NULL);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RPIGRAFX_RECORDING_MAGIC, sizeof(header.magic));
+    header.version = RPIGRAFX_RECORDING_VERSION;
+    header.encoding = MMAL_ENCODING_BAYER_SBGGR10P;
+    header.width = width;
+    header.height = height;
+    header.aligned_width = VCOS_ALIGN_UP(width, 32);
+    header.aligned_height = height;
+    header.frame_size = stride * height;
+    header.record_size = VCOS_ALIGN_UP(RPIGRAFX_RECORDING_FRAME_OFFSET
+                                  + header.frame_size,
+                                  RPIGRAFX_RECORDING_ALIGN);
+    header.num_frames = NUM_REPLAY_FRAMES;
+
+    block = calloc(1, header.record_size);
+    _check(block == NULL);
+    memcpy(block, &header, sizeof(header));
+    _check(fwrite(block, RPIGRAFX_RECORDING_ALIGN, 1, fp) != 1);
+    srand(1);
+    for (n = 0; n < NUM_REPLAY_FRAMES; n ++) {
+        memset(&frame, 0, sizeof(frame));
+        frame.length = header.frame_size;
+        frame.sequence = n;
+        memcpy(block, &frame, sizeof(frame));
+        for (k = 0; k < header.frame_size; k ++)
+            block[RPIGRAFX_RECORDING_FRAME_OFFSET + k] = rand();
+        _check(fwrite(block, header.record_size, 1, fp) != 1);
+    }
+    free(block);
+    _check(fclose(fp));
+
+    _check(rpigrafx_config_replay(0, path, 0, !0));
+    _check(unlink(path));
+}
+
+/* Prints the part of the object that describes the combination. */
+static void print_config(const int32_t width, const int32_t height,
+                         const char *encoding, const int num_outputs,
+                         const char *port, const char *source,
+                         const int render, const int nframes)
+{
+    printf("{\"source\": \"%s\", \"port\": \"%s\", \"width\": %d, "
+           "\"height\": %d, \"encoding\": \"%s\", \"outputs\": %d, "
+           "\"render\": %s, \"frames\": %d",
+           source, has_ports(source) ? port : "none", width, height,
+           encoding, num_outputs, render ? "true" : "false", nframes);
+}
+
+static int run(const int nframes)
+{
+    const int32_t width = sweep.widths[0], height = sweep.heights[0];
+    const int num_outputs = sweep.outputs[0], render = sweep.renders[0];
+    const _Bool is_rawcam = !strcmp(sweep.sources[0], "rawcam"),
+                is_replay = !strcmp(sweep.sources[0], "replay"),
+                is_capture_port = !strcmp(sweep.ports[0], "capture");
+    rpigrafx_frame_config_t fc[MAX_OUTPUTS];
+    rpigrafx_stage_stats_t stages[RPIGRAFX_NUM_STAGES];
+    rpigrafx_graph_info_t graph;
+    int hops[MAX_OUTPUTS];
+    double *capture_ms = NULL, *latency_ms = NULL;
+    /* The latencies of the outputs n + 1 splitters away. */
+    double *hop_latency_ms[MAX_HOPS];
+    int num_latencies = 0, num_hop_latencies[MAX_HOPS];
+    uint64_t start = 0, elapsed, cpu = 0;
+    int i, j, k;
+
+    if (num_outputs < 1 || num_outputs > MAX_OUTPUTS) {
+        fprintf(stderr, "error: Invalid number of outputs: %d\n", num_outputs);
+        return 1;
+    }
+    if (!is_rawcam && !is_replay && !has_ports(sweep.sources[0])) {
+        fprintf(stderr, "error: Unknown source: %s\n", sweep.sources[0]);
+        return 1;
+    }
+    capture_ms = malloc(nframes * num_outputs * sizeof(*capture_ms));
+    latency_ms = malloc(nframes * num_outputs * sizeof(*latency_ms));
+    _check(capture_ms == NULL || latency_ms == NULL);
+    for (k = 0; k < MAX_HOPS; k ++) {
+        hop_latency_ms[k] = malloc(nframes * num_outputs
+                                   * sizeof(*hop_latency_ms[k]));
+        _check(hop_latency_ms[k] == NULL);
+        num_hop_latencies[k] = 0;
+    }
+
+    /* The frames of a replay are configured after it. */
+    if (is_replay)
+        config_replay(width, height);
+    for (j = 0; j < num_outputs; j ++) {
+        _check(rpigrafx_config_camera_frame(0, width, height,
+                                        lookup_encoding(sweep.encodings[0]),
+                                            0, &fc[j]));
+        if (render)
+            _check(rpigrafx_config_camera_frame_render(0,
+                                                       j * width / 4, 0,
+                                                       width / 4, height / 4,
+                                                       5 + j, &fc[j]));
+    }
+    if (is_rawcam) {
+        _check(rpigrafx_config_rawcam(RPIGRAFX_RAWCAM_CAMERA_MODEL_IMX219,
+                                      MMAL_CAMERA_RX_CONFIG_DECODE_NONE,
+                                      MMAL_CAMERA_RX_CONFIG_ENCODE_NONE,
+                                      MMAL_CAMERA_RX_CONFIG_UNPACK_NONE,
+                                      MMAL_CAMERA_RX_CONFIG_PACK_NONE,
+                                      2, 10, RPIGRAFX_BAYER_PATTERN_BGGR,
+                                      &fc[0]));
+        _check(rpigrafx_config_rawcam_imx219(24.0, 0, 0, 1, 1,
+                                       RPIGRAFX_RAWCAM_IMX219_BINNING_MODE_NONE,
+                                             &fc[0]));
+    } else if (!is_replay && is_capture_port)
+        _check(rpigrafx_config_camera_port(0, RPIGRAFX_CAMERA_PORT_CAPTURE));
+    _check(rpigrafx_finish_config());
+    for (j = 0; j < num_outputs; j ++) {
+        _check(rpigrafx_get_graph_info(&fc[j], &graph));
+        hops[j] = graph.num_splitter_hops;
+        _check(hops[j] < 1 || hops[j] > MAX_HOPS);
+    }
+
+    for (i = -NUM_WARMUP_FRAMES; i < nframes; i ++) {
+        if (i == 0) {
+            rpigrafx_set_profiling(!0);
+            start = get_time_ns(CLOCK_MONOTONIC);
+            cpu = get_cpu_ns();
+        }
+        for (j = 0; j < num_outputs; j ++) {
+            const uint64_t t = get_time_ns(CLOCK_MONOTONIC);
+            rpigrafx_frame_info_t info;
+            uint64_t now;
+            _check(rpigrafx_capture_next_frame(&fc[j]));
+            now = get_time_ns(CLOCK_MONOTONIC);
+            _check(rpigrafx_get_frame_info(&fc[j], &info));
+            if (i >= 0) {
+                capture_ms[i * num_outputs + j] = (now - t) * 1e-6;
+                if (info.sensor_ns != 0 && info.sensor_ns <= now) {
+                    const int h = hops[j] - 1;
+                    latency_ms[num_latencies ++] = (now - info.sensor_ns) * 1e-6;
+                    hop_latency_ms[h][num_hop_latencies[h] ++] =
+                                                (now - info.sensor_ns) * 1e-6;
+                }
+            }
+            if (render)
+                _check(rpigrafx_render_frame(&fc[j]));
+            else
+                _check(rpigrafx_free_frame(&fc[j]));
+        }
+    }
+    elapsed = get_time_ns(CLOCK_MONOTONIC) - start;
+    cpu = get_cpu_ns() - cpu;
+    rpigrafx_set_profiling(0);
+    _check(rpigrafx_get_stats(&fc[0], stages));
+
+    qsort(capture_ms, nframes * num_outputs, sizeof(*capture_ms),
+          compare_double);
+    qsort(latency_ms, num_latencies, sizeof(*latency_ms), compare_double);
+    for (k = 0; k < MAX_HOPS; k ++)
+        qsort(hop_latency_ms[k], num_hop_latencies[k],
+              sizeof(*hop_latency_ms[k]), compare_double);
+
+    print_config(width, height, sweep.encodings[0], num_outputs,
+                 sweep.ports[0], sweep.sources[0],
+                 render, nframes);
+    printf(", \"fps\": %.3f, "
+           "\"capture_ms\": {\"p50\": %.3f, \"p99\": %.3f}, "
+           "\"latency_ms\": {\"p50\": %.3f, \"p99\": %.3f}, "
+           "\"cpu_percent\": %.1f, \"splitters\": %d, \"setup_ms\": %.3f, "
+           "\"latency_ms_by_hops\": {",
+           nframes * 1e9 / elapsed,
+           percentile(capture_ms, nframes * num_outputs, 50),
+           percentile(capture_ms, nframes * num_outputs, 99),
+           percentile(latency_ms, num_latencies, 50),
+           percentile(latency_ms, num_latencies, 99),
+           cpu * 100.0 / elapsed, graph.num_splitters, graph.setup_ns * 1e-6);
+    for (k = 0, j = 0; k < MAX_HOPS; k ++) {
+        if (num_hop_latencies[k] == 0)
+            continue;
+        printf("%s\"%d\": {\"p50\": %.3f, \"p99\": %.3f}",
+               j ++ == 0 ? "" : ", ", k + 1,
+               percentile(hop_latency_ms[k], num_hop_latencies[k], 50),
+               percentile(hop_latency_ms[k], num_hop_latencies[k], 99));
+    }
+    printf("}, \"stages\": {");
+    for (k = 0; k < RPIGRAFX_NUM_STAGES; k ++)
+        printf("%s\"%s\": {\"calls\": %llu, \"total_ms\": %.3f, "
+               "\"max_ms\": %.3f, \"bytes\": %llu}",
+               k == 0 ? "" : ", ", stage_names[k],
+               (unsigned long long) stages[k].num_calls,
+               stages[k].total_ns * 1e-6, stages[k].max_ns * 1e-6,
+               (unsigned long long) stages[k].num_bytes);
+    printf("}}");
+    fflush(stdout);
+
+    free(capture_ms);
+    free(latency_ms);
+    for (k = 0; k < MAX_HOPS; k ++)
+        free(hop_latency_ms[k]);
+    return 0;
+}
+
+/* Runs a combination in a child process and prints an error if it fails. */
+static void run_child(const int nframes, const int32_t width,
+                      const int32_t height, const char *encoding,
+                      const int num_outputs, const char *port,
+                      const char *source, const int render)
+{
+    char n[16], size[32], outputs[16], r[16];
+    char *const args[] = {
+        progname, "-x", "-n", n, "-s", size, "-e", (char*) encoding,
+        "-o", outputs, "-p", (char*) port, "-c", (char*) source, "-r", r, NULL
+    };
+    pid_t pid;
+    int status;
+
+    snprintf(n, sizeof(n), "%d", nframes);
+    snprintf(size, sizeof(size), "%dx%d", width, height);
+    snprintf(outputs, sizeof(outputs), "%d", num_outputs);
+    snprintf(r, sizeof(r), "%d", render);
+
+    fflush(stdout);
+    pid = fork();
+    _check(pid == -1);
+    if (pid == 0) {
+        execv("/proc/self/exe", args);
+        execv(progname, args);
+        _exit(127);
+    }
+    _check(waitpid(pid, &status, 0) == -1);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        return;
+    print_config(width, height, encoding, num_outputs, port, source, render,
+                 nframes);
+    if (WIFEXITED(status))
+        printf(", \"error\": \"exit status %d\"}", WEXITSTATUS(status));
+    else
+        printf(", \"error\": \"killed by signal %d\"}", WTERMSIG(status));
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int nframes = 60;
+    _Bool is_child = 0, is_first = !0;
+    char *values[MAX_VALUES];
+    char defaults[][32] = {
+        "640x480,1280x720,1920x1080", "rgb24,rgba", "1,2", "preview,capture",
+        DEFAULT_SOURCES, "0,1"
+    };
+    char *lists[] = {
+        defaults[0], defaults[1], defaults[2], defaults[3], defaults[4],
+        defaults[5]
+    };
+    int a, b, c, d, e, f, i, n;
+
+    progname = argv[0];
+
+    while ((opt = getopt(argc, argv, "n:s:e:o:p:c:r:x?")) != -1) {
+        switch (opt) {
+            case 'n':
+                nframes = atoi(optarg);
+                break;
+            case 's':
+                lists[0] = optarg;
+                break;
+            case 'e':
+                lists[1] = optarg;
+                break;
+            case 'o':
+                lists[2] = optarg;
+                break;
+            case 'p':
+                lists[3] = optarg;
+                break;
+            case 'c':
+                lists[4] = optarg;
+                break;
+            case 'r':
+                lists[5] = optarg;
+                break;
+            case 'x':
+                is_child = !0;
+                break;
+            default:
+                if (opt != '?')
+                    fprintf(stderr, "error: Unknown option: %c\n", opt);
+                usage();
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc || nframes <= 0) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    n = split(lists[0], values);
+    for (i = 0; i < n; i ++) {
+        if (sscanf(values[i], "%dx%d", &sweep.widths[i], &sweep.heights[i])
+                                                                       != 2) {
+            fprintf(stderr, "error: Invalid size: %s\n", values[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    sweep.num_sizes = n;
+    sweep.num_encodings = split(lists[1], sweep.encodings);
+    n = split(lists[2], values);
+    for (i = 0; i < n; i ++)
+        sweep.outputs[i] = atoi(values[i]);
+    sweep.num_outputs = n;
+    sweep.num_ports = split(lists[3], sweep.ports);
+    sweep.num_sources = split(lists[4], sweep.sources);
+    n = split(lists[5], values);
+    for (i = 0; i < n; i ++)
+        sweep.renders[i] = atoi(values[i]);
+    sweep.num_renders = n;
+    if (!sweep.num_sizes || !sweep.num_encodings || !sweep.num_outputs
+            || !sweep.num_ports || !sweep.num_sources || !sweep.num_renders) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    if (is_child)
+        return run(nframes);
+
+    printf("[\n");
+    for (a = 0; a < sweep.num_sources; a ++)
+    for (b = 0; b < sweep.num_ports; b ++)
+    for (c = 0; c < sweep.num_sizes; c ++)
+    for (d = 0; d < sweep.num_encodings; d ++)
+    for (e = 0; e < sweep.num_outputs; e ++)
+    for (f = 0; f < sweep.num_renders; f ++) {
+        if (!has_ports(sweep.sources[a]) && b != 0)
+            continue;
+        if (!is_first)
+            printf(",\n");
+        is_first = 0;
+        run_child(nframes, sweep.widths[c], sweep.heights[c],
+                  sweep.encodings[d], sweep.outputs[e], sweep.ports[b],
+                  sweep.sources[a], sweep.renders[f]);
+    }
+    printf("\n]\n");
+
+    return 0;
+}
@@ -0,0 +1,418 @@
+#include <rpigrafx.h>
+#include "local.h"
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define _check(x) \
+    do { \
+        if ((x)) { \
+            fprintf(stderr, "Error at %s:%d:%s\n", __FILE__, __LINE__, __func__); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define MAX_VALUES 16
+
+static char *progname = NULL;
+
+struct job {
+    uint8_t *dst, *src, *scratch;
+    int32_t src_stride, dst_stride, width, height, band_height;
+    size_t scratch_size;
+    rpigrafx_bayer_stats_t stats[PRIV_RPIGRAFX_MAX_WORKERS];
+    int ret;
+};
+
+static int run_unpack_gain(struct job *job, const int task,
+                           const int32_t y_begin, const int32_t y_end)
+{
+    (void) task;
+    return priv_rpigrafx_raw10bggr_to_raw8_gain_rows(job->dst, job->width,
+                                                     job->src, job->src_stride,
+                                                     job->width, job->height,
+                                                     y_begin, y_end,
+                                                     1.55, 1.0, 1.5);
+}
+
+static int run_stats(struct job *job, const int task,
+                     const int32_t y_begin, const int32_t y_end)
+{
+    return priv_rpigrafx_raw10bggr_stats_rows(job->src, job->src_stride,
+                                              job->width, job->height,
+                                              y_begin, y_end, 1.55, 1.0, 1.5,
+                                              &job->stats[task], 1);
+}
+
+static int run_convert(struct job *job, const int task,
+                       const int32_t y_begin, const int32_t y_end,
+                       const rpigrafx_demosaic_t demosaic)
+{
+    return priv_rpigrafx_raw10bggr_to_rgb888_gain_rows(job->dst,
+                                                       job->dst_stride,
+                                                       job->src,
+                                                       job->src_stride,
+                                                       job->width, job->height,
+                                                       y_begin, y_end,
+                                                       1.55, 1.0, 1.5,
+                                                       demosaic,
+                                    job->scratch + task * job->scratch_size,
+                                                       &job->stats[task], 4);
+}
+
+static int run_nearest(struct job *job, const int task,
+                       const int32_t y_begin, const int32_t y_end)
+{
+    return run_convert(job, task, y_begin, y_end, RPIGRAFX_DEMOSAIC_NEAREST);
+}
+
+static int run_bilinear(struct job *job, const int task,
+                        const int32_t y_begin, const int32_t y_end)
+{
+    return run_convert(job, task, y_begin, y_end, RPIGRAFX_DEMOSAIC_BILINEAR);
+}
+
+static int run_edge_aware(struct job *job, const int task,
+                          const int32_t y_begin, const int32_t y_end)
+{
+    return run_convert(job, task, y_begin, y_end,
+                       RPIGRAFX_DEMOSAIC_EDGE_AWARE);
+}
+
+/*
+ * unpack+gain and stats are the steps of the conversion run on their own; the
+ * demosaics are the whole fused conversion, which also takes the statistics
+ * of every fourth quad as the capture does. bytes is the traffic per pixel:
+ * 1.25 bytes of raw10 read plus what is written.
+ */
+static const struct kernel {
+    const char *name;
+    int (*func)(struct job *job, const int task,
+                const int32_t y_begin, const int32_t y_end);
+    double bytes;
+} kernels[] = {
+    {"unpack+gain", run_unpack_gain, 1.25 + 1},
+    {"stats",       run_stats,       1.25},
+    {"nearest",     run_nearest,     1.25 + 3},
+    {"bilinear",    run_bilinear,    1.25 + 3},
+    {"edge-aware",  run_edge_aware,  1.25 + 3},
+};
+#define NUM_KERNELS ((int) (sizeof(kernels) / sizeof(kernels[0])))
+
+static const struct kernel *kernel = NULL;
+
+static void run_band(void *arg, const int task)
+{
+    struct job *job = arg;
+    const int32_t y_begin = task * job->band_height,
+                  y_end = MMAL_MIN(job->height, y_begin + job->band_height);
+
+    if (kernel->func(job, task, y_begin, y_end))
+        job->ret = 1;
+}
+
+static uint64_t get_time_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/*
+ * Counts the CPU cycles of the calling thread, which does all the work when
+ * there is one thread. Returns -1 where perf events are not available, as in
+ * most containers.
+ */
+static int open_cycles()
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_cycles(const int fd)
+{
+    uint64_t count = 0;
+
+    if (read(fd, &count, sizeof(count)) != sizeof(count))
+        return 0;
+    return count;
+}
+
+struct result {
+    double ns, cycles;
+};
+
+/*
+ * Converts one frame in as many bands as there are threads, repeatedly for at
+ * least min_ms, and keeps the fastest run.
+ */
+static struct result run(struct priv_rpigrafx_workers *workers,
+                         struct job *job, const int cycles_fd,
+                         const int min_ms)
+{
+    const int n = priv_rpigrafx_workers_num_threads(workers);
+    struct result best = {-1, -1};
+    uint64_t begin;
+    int i;
+
+    job->band_height = ALIGN_UP((job->height + n - 1) / n, 2);
+    /* Warm the caches and the threads up first. */
+    for (i = 0, begin = get_time_ns(); i < 2
+            || get_time_ns() - begin < (uint64_t) min_ms * 1000000; i ++) {
+        uint64_t start, ns, cycles = 0;
+        int b;
+
+        job->ret = 0;
+        for (b = 0; b < n; b ++)
+            priv_rpigrafx_bayer_stats_clear(&job->stats[b]);
+        if (cycles_fd >= 0) {
+            ioctl(cycles_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(cycles_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+        start = get_time_ns();
+        _check(priv_rpigrafx_workers_run(workers,
+                                         (job->height + job->band_height - 1)
+                                                           / job->band_height,
+                                         run_band, job));
+        ns = get_time_ns() - start;
+        if (cycles_fd >= 0) {
+            ioctl(cycles_fd, PERF_EVENT_IOC_DISABLE, 0);
+            cycles = read_cycles(cycles_fd);
+        }
+        _check(job->ret);
+        if (i == 0)
+            continue;
+        if (best.ns < 0 || ns < best.ns) {
+            best.ns = ns;
+            best.cycles = cycles_fd >= 0 ? (double) cycles : -1;
+        }
+    }
+    return best;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: %s [OPTION]...\n", progname);
+    fprintf(stderr,
+            "\n"
+            "Times the CPU kernels of the rawcam conversion on synthetic BGGR\n"
+            "raw10 frames, each size in bands on each number of threads.\n"
+            "\n"
+            "  -s WxH,...         Frame sizes (default: 640x480,1280x720,\n"
+            "                     1920x1080,2592x1944,3280x2464)\n"
+            "  -k KERNEL,...      unpack+gain, stats, nearest, bilinear or\n"
+            "                     edge-aware (default: all)\n"
+            "  -t NTHREADS,...    Threads, 1 to %d (default: 1,2,4 and the\n"
+            "                     number of CPUs)\n"
+            "  -m MS              Time each case for at least MS ms\n"
+            "                     (default: 200)\n"
+            "  -?                 What you are doing\n",
+            PRIV_RPIGRAFX_MAX_WORKERS);
+}
+
+static int split(char *s, char **values)
+{
+    int n = 0;
+    char *save = NULL, *t = NULL;
+
+    for (t = strtok_r(s, ",", &save); t != NULL;
+            t = strtok_r(NULL, ",", &save)) {
+        if (n == MAX_VALUES) {
+            fprintf(stderr, "error: Too many values: %s\n", t);
+            exit(EXIT_FAILURE);
+        }
+        values[n ++] = t;
+    }
+    return n;
+}
+
+static const struct kernel* lookup_kernel(const char *name)
+{
+    int i;
+
+    for (i = 0; i < NUM_KERNELS; i ++)
+        if (!strcmp(kernels[i].name, name))
+            return &kernels[i];
+    fprintf(stderr, "error: Unknown kernel: %s\n", name);
+    exit(EXIT_FAILURE);
+}
+
+static void run_size(const int32_t width, const int32_t height,
+                     const struct kernel **ks, const int num_kernels,
+                     const int *threads, const int num_threads,
+                     const int min_ms)
+{
+    const int max_threads = threads[num_threads - 1];
+    const double pixels = (double) width * height;
+    struct job job;
+    int cycles_fd = -1;
+    int i, k, t;
+
+    job.width = width;
+    job.height = height;
+    job.src_stride = priv_rpigrafx_raw10_stride(width);
+    job.dst_stride = ALIGN_UP(width, 32) * 3;
+    job.scratch_size = priv_rpigrafx_demosaic_scratch_size(
+                                        RPIGRAFX_DEMOSAIC_EDGE_AWARE, width);
+    job.src = malloc(job.src_stride * height);
+    job.dst = malloc(job.dst_stride * height);
+    job.scratch = malloc(max_threads * job.scratch_size + 1);
+    _check(job.src == NULL || job.dst == NULL || job.scratch == NULL);
+    for (i = 0; i < job.src_stride * height; i ++)
+        job.src[i] = rand();
+
+    for (k = 0; k < num_kernels; k ++) {
+        double ns_1 = -1;
+
+        kernel = ks[k];
+        for (t = 0; t < num_threads; t ++) {
+            struct priv_rpigrafx_workers *workers =
+                                        priv_rpigrafx_workers_create(threads[t]);
+            struct result r;
+
+            _check(workers == NULL);
+            if (threads[t] == 1)
+                cycles_fd = open_cycles();
+            r = run(workers, &job, cycles_fd, min_ms);
+            if (cycles_fd >= 0) {
+                close(cycles_fd);
+                cycles_fd = -1;
+            }
+            priv_rpigrafx_workers_destroy(workers);
+
+            if (threads[t] == 1)
+                ns_1 = r.ns;
+            printf("%-12s %4dx%-4d %2d thread(s): %8.3f ms %8.1f MP/s "
+                   "%6.2f GB/s", kernel->name, width, height, threads[t],
+                   r.ns / 1e6, pixels / r.ns * 1e3,
+                   pixels * kernel->bytes / r.ns);
+            if (r.cycles >= 0)
+                printf(" %6.2f cycles/px", r.cycles / pixels);
+            else
+                printf("      n/a cycles/px");
+            if (ns_1 >= 0)
+                printf(" %5.2fx", ns_1 / r.ns);
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+
+    free(job.src);
+    free(job.dst);
+    free(job.scratch);
+}
+
+static int compare_int(const void *a, const void *b)
+{
+    return *(const int*) a - *(const int*) b;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    int min_ms = 200;
+    char default_sizes[] = "640x480,1280x720,1920x1080,2592x1944,3280x2464";
+    char *size_list = default_sizes, *kernel_list = NULL, *thread_list = NULL;
+    char *values[MAX_VALUES];
+    int32_t widths[MAX_VALUES], heights[MAX_VALUES];
+    const struct kernel *ks[MAX_VALUES];
+    int threads[MAX_VALUES];
+    int num_sizes, num_kernels, num_threads;
+    int i, n;
+
+    progname = argv[0];
+
+    while ((opt = getopt(argc, argv, "s:k:t:m:?")) != -1) {
+        switch (opt) {
+            case 's':
+                size_list = optarg;
+                break;
+            case 'k':
+                kernel_list = optarg;
+                break;
+            case 't':
+                thread_list = optarg;
+                break;
+            case 'm':
+                min_ms = atoi(optarg);
+                break;
+            default:
+                if (opt != '?')
+                    fprintf(stderr, "error: Unknown option: %c\n", opt);
+                usage();
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc || min_ms < 0) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    num_sizes = split(size_list, values);
+    for (i = 0; i < num_sizes; i ++) {
+        if (sscanf(values[i], "%dx%d", &widths[i], &heights[i]) != 2
+                || widths[i] <= 0 || heights[i] <= 0
+                || widths[i] % 4 != 0 || heights[i] % 2 != 0) {
+            fprintf(stderr, "error: Invalid size: %s\n", values[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (kernel_list == NULL) {
+        for (i = 0; i < NUM_KERNELS; i ++)
+            ks[i] = &kernels[i];
+        num_kernels = NUM_KERNELS;
+    } else {
+        num_kernels = split(kernel_list, values);
+        for (i = 0; i < num_kernels; i ++)
+            ks[i] = lookup_kernel(values[i]);
+    }
+
+    if (thread_list == NULL) {
+        const long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads[0] = 1;
+        threads[1] = 2;
+        threads[2] = 4;
+        num_threads = 3;
+        if (ncpus > 0 && ncpus != 1 && ncpus != 2 && ncpus != 4)
+            threads[num_threads ++] = MMAL_MIN(ncpus,
+                                               PRIV_RPIGRAFX_MAX_WORKERS);
+    } else {
+        n = split(thread_list, values);
+        for (num_threads = i = 0; i < n; i ++) {
+            threads[num_threads ++] = atoi(values[i]);
+            if (threads[num_threads - 1] < 1
+                    || threads[num_threads - 1] > PRIV_RPIGRAFX_MAX_WORKERS) {
+                fprintf(stderr, "error: Invalid number of threads: %s\n",
+                        values[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    /* The scaling is against the run on one thread, so that goes first. */
+    qsort(threads, num_threads, sizeof(threads[0]), compare_int);
+
+    if (!num_sizes || !num_kernels || !num_threads) {
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < num_sizes; i ++)
+        run_size(widths[i], heights[i], ks, num_kernels, threads, num_threads,
+                 min_ms);
+
+    return 0;
+}
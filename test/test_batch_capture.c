@@ -0,0 +1,152 @@
+#include <rpigrafx.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+static const struct output {
+    int32_t width, height;
+    MMAL_FOURCC_T encoding;
+} outputs[] = {
+    {320, 240, MMAL_ENCODING_RGB24},
+    {160, 120, MMAL_ENCODING_BGR24},
+    { 64,  48, MMAL_ENCODING_RGB24},
+};
+#define NUM_OUTPUTS ((int) (sizeof(outputs) / sizeof(outputs[0])))
+
+/*
+ * A replay only makes the frames asked for, so one that the isps hold longer
+ * than the timeout is sure to miss it.
+ */
+#define REPLAY_CAMERA 1
+#define REPLAY_PATH "test_batch_capture.rec"
+#define REPLAY_WIDTH  64
+#define REPLAY_HEIGHT 48
+#define ISP_LATENCY_US "100000"
+#define TIMEOUT_MS 20
+
+/* Blue of the stand-in camera is its frame number; see test_emu_pipeline.c. */
+static int frame_number(const int j, const uint8_t *p)
+{
+    return p[outputs[j].encoding == MMAL_ENCODING_BGR24 ? 0 : 2];
+}
+
+/* A single black RGB24 frame; see test_replay.c. */
+static void write_recording()
+{
+    const uint32_t frame_size = ALIGN_UP(REPLAY_WIDTH, 32) * 3 * REPLAY_HEIGHT;
+    FILE *fp = fopen(REPLAY_PATH, "wb");
+    rpigrafx_recording_header_t header;
+    rpigrafx_recording_frame_t frame;
+    uint8_t *block = NULL;
+
+    _check(fp == NULL);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RPIGRAFX_RECORDING_MAGIC, sizeof(header.magic));
+    header.version = RPIGRAFX_RECORDING_VERSION;
+    header.encoding = MMAL_ENCODING_RGB24;
+    header.width = REPLAY_WIDTH;
+    header.height = REPLAY_HEIGHT;
+    header.aligned_width = ALIGN_UP(REPLAY_WIDTH, 32);
+    header.aligned_height = REPLAY_HEIGHT;
+    header.frame_size = frame_size;
+    header.record_size = ALIGN_UP(RPIGRAFX_RECORDING_FRAME_OFFSET + frame_size,
+                                  RPIGRAFX_RECORDING_ALIGN);
+    header.num_frames = 1;
+
+    block = calloc(1, header.record_size);
+    _check(block == NULL);
+    memcpy(block, &header, sizeof(header));
+    _check(fwrite(block, RPIGRAFX_RECORDING_ALIGN, 1, fp) != 1);
+    memset(block, 0, header.record_size);
+    memset(&frame, 0, sizeof(frame));
+    frame.length = frame_size;
+    memcpy(block, &frame, sizeof(frame));
+    _check(fwrite(block, header.record_size, 1, fp) != 1);
+    free(block);
+    _check(fclose(fp));
+}
+
+int main()
+{
+    rpigrafx_frame_config_t fc[NUM_OUTPUTS];
+    rpigrafx_frame_config_t *fcps[NUM_OUTPUTS + 1];
+    rpigrafx_frame_config_t fc_replay[2];
+    rpigrafx_frame_config_t *fcps_replay[2] = {&fc_replay[0], &fc_replay[1]};
+    rpigrafx_frame_info_t info[NUM_OUTPUTS];
+    rpigrafx_sync_info_t sync;
+    uint64_t num_dropped = 0;
+    int i, j;
+
+    for (j = 0; j < NUM_OUTPUTS; j ++) {
+        _check(rpigrafx_config_camera_frame(0, outputs[j].width,
+                                            outputs[j].height,
+                                            outputs[j].encoding, 0, &fc[j]));
+        fcps[j] = &fc[j];
+    }
+    write_recording();
+    _check(rpigrafx_config_replay(REPLAY_CAMERA, REPLAY_PATH, 0, !0));
+    for (j = 0; j < 2; j ++)
+        _check(rpigrafx_config_camera_frame(REPLAY_CAMERA, REPLAY_WIDTH,
+                                            REPLAY_HEIGHT >> j,
+                                            MMAL_ENCODING_RGB24, 0,
+                                            &fc_replay[j]));
+    _check(setenv("RPIGRAFX_EMU_ISP_LATENCY_US", ISP_LATENCY_US, 1));
+    _check(rpigrafx_finish_config());
+
+    _check(!rpigrafx_capture_camera_frames(fcps, 0, -1, &sync));
+    fcps[NUM_OUTPUTS] = &fc[0];
+    _check(!rpigrafx_capture_camera_frames(fcps, NUM_OUTPUTS + 1, -1, &sync));
+
+    _check(!rpigrafx_capture_camera_frames(fcps_replay, 2, TIMEOUT_MS, &sync));
+    /* The frame that missed the timeout is dropped as stale or matched. */
+    _check(rpigrafx_capture_camera_frames(fcps_replay, 2, -1, &sync));
+    _check(rpigrafx_get_frame_info(&fc_replay[0], &info[0]));
+    _check(rpigrafx_get_frame_info(&fc_replay[1], &info[1]));
+    _check(info[0].pts != info[1].pts);
+
+    for (i = 0; i < 10; i ++) {
+        /* Let the queues fill up, so stale frames are left to be dropped. */
+        if (i % 2 == 1)
+            usleep(100000);
+        _check(rpigrafx_capture_camera_frames(fcps, NUM_OUTPUTS, -1, &sync));
+        for (j = 0; j < NUM_OUTPUTS; j ++) {
+            _check(rpigrafx_get_frame(&fc[j]) == NULL);
+            _check(rpigrafx_get_frame_info(&fc[j], &info[j]));
+        }
+        for (j = 1; j < NUM_OUTPUTS; j ++) {
+            if (info[j].pts != info[0].pts
+                    || frame_number(j, rpigrafx_get_frame(&fc[j]))
+                       != frame_number(0, rpigrafx_get_frame(&fc[0]))) {
+                fprintf(stderr, "Set %d: frame %d is of %lld (%d), frame 0 of "
+                        "%lld (%d)\n", i, j, (long long) info[j].pts,
+                        frame_number(j, rpigrafx_get_frame(&fc[j])),
+                        (long long) info[0].pts,
+                        frame_number(0, rpigrafx_get_frame(&fc[0])));
+                return 1;
+            }
+        }
+        num_dropped += sync.num_dropped;
+    }
+    if (num_dropped == 0) {
+        fprintf(stderr, "No stale frames were dropped\n");
+        return 1;
+    }
+    printf("Dropped %llu frames\n", (unsigned long long) num_dropped);
+
+    for (j = 0; j < NUM_OUTPUTS; j ++)
+        _check(rpigrafx_free_frame(&fc[j]));
+    for (j = 0; j < 2; j ++)
+        _check(rpigrafx_free_frame(&fc_replay[j]));
+    unlink(REPLAY_PATH);
+    return 0;
+}
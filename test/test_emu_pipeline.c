@@ -0,0 +1,117 @@
+#include <rpigrafx.h>
+#include <interface/mmal/mmal_emu.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define CAMERA_WIDTH  640
+#define CAMERA_HEIGHT 480
+
+static const struct output {
+    int32_t width, height;
+    MMAL_FOURCC_T encoding;
+    int bpp;
+    _Bool render;
+} outputs[] = {
+    {CAMERA_WIDTH,     CAMERA_HEIGHT,     MMAL_ENCODING_RGB24, 3, 1},
+    {CAMERA_WIDTH / 2, CAMERA_HEIGHT / 2, MMAL_ENCODING_RGBA,  4, 0},
+    {CAMERA_WIDTH / 4, CAMERA_HEIGHT / 4, MMAL_ENCODING_BGR24, 3, 0},
+};
+#define NUM_OUTPUTS ((int) (sizeof(outputs) / sizeof(outputs[0])))
+
+/*
+ * The stand-in camera produces (256x/w, 256y/h, n) at (x, y) and the isp
+ * scales by nearest neighbour, so every pixel of the output is known.
+ */
+static int check_frame(const struct output *o, const uint8_t *p)
+{
+    const int stride = ALIGN_UP(o->width, 32) * o->bpp;
+    const _Bool is_bgr = o->encoding == MMAL_ENCODING_BGR24;
+    int x, y;
+
+    for (y = 0; y < o->height; y ++) {
+        for (x = 0; x < o->width; x ++) {
+            const int sx = x * CAMERA_WIDTH  / o->width,
+                      sy = y * CAMERA_HEIGHT / o->height;
+            const uint8_t *q = p + y * stride + x * o->bpp;
+            const int r = q[is_bgr ? 2 : 0], g = q[1];
+            if (r != sx * 256 / CAMERA_WIDTH
+                    || g != sy * 256 / CAMERA_HEIGHT) {
+                fprintf(stderr, "%dx%d: Unexpected pixel (%d,%d,%d) at "
+                        "(%d,%d)\n", o->width, o->height, q[0], q[1], q[2],
+                        x, y);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main()
+{
+    int i, j;
+    const int nframes = 30;
+    rpigrafx_frame_config_t fc[NUM_OUTPUTS];
+    MMAL_EMU_PORT_STATS_T stats[64];
+    unsigned n;
+    uint64_t rendered = 0;
+    unsigned long num_heap_allocs = 0;
+
+    for (j = 0; j < NUM_OUTPUTS; j ++) {
+        _check(rpigrafx_config_camera_frame(0, outputs[j].width,
+                                            outputs[j].height,
+                                            outputs[j].encoding, 0, &fc[j]));
+        _check(rpigrafx_config_camera_frame_render(0, 0, 0, outputs[j].width,
+                                                   outputs[j].height, 0,
+                                                   &fc[j]));
+    }
+    _check(rpigrafx_finish_config());
+
+    for (i = 0; i < nframes; i ++) {
+        for (j = 0; j < NUM_OUTPUTS; j ++) {
+            void *p = NULL;
+            _check(rpigrafx_capture_next_frame(&fc[j]));
+            p = rpigrafx_get_frame(&fc[j]);
+            _check(p == NULL);
+            _check(check_frame(&outputs[j], p));
+            if (outputs[j].render)
+                _check(rpigrafx_render_frame(&fc[j]));
+            else
+                _check(rpigrafx_free_frame(&fc[j]));
+        }
+        if (i == 0)
+            num_heap_allocs = rpigrafx_get_num_heap_allocs();
+    }
+
+    /* Nothing is allocated per frame after the first one. */
+    if (rpigrafx_get_num_heap_allocs() != num_heap_allocs) {
+        fprintf(stderr, "%lu heap allocations while capturing\n",
+                rpigrafx_get_num_heap_allocs() - num_heap_allocs);
+        return 1;
+    }
+
+    /* Let the renderer drain. */
+    vcos_sleep(100);
+    mmal_emu_print_stats(stdout);
+
+    n = mmal_emu_get_port_stats(stats, sizeof(stats) / sizeof(stats[0]));
+    for (i = 0; i < (int) n; i ++)
+        if (!strcmp(stats[i].component, "vc.ril.video_render"))
+            rendered += stats[i].buffers;
+    if (rendered != (uint64_t) nframes) {
+        fprintf(stderr, "Rendered %llu frames; expected %d\n",
+                (unsigned long long) rendered, nframes);
+        return 1;
+    }
+
+    return 0;
+}
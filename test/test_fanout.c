@@ -0,0 +1,98 @@
+#include <rpigrafx.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define CAMERA_WIDTH  640
+#define CAMERA_HEIGHT 480
+
+/* More outputs than one splitter has ports, so that a second one is needed. */
+static const struct output {
+    int32_t width, height;
+    MMAL_FOURCC_T encoding;
+    int bpp;
+    int num_splitter_hops;
+} outputs[] = {
+    {CAMERA_WIDTH,     CAMERA_HEIGHT,     MMAL_ENCODING_RGB24, 3, 1},
+    {CAMERA_WIDTH / 2, CAMERA_HEIGHT / 2, MMAL_ENCODING_RGBA,  4, 1},
+    {CAMERA_WIDTH / 4, CAMERA_HEIGHT / 4, MMAL_ENCODING_BGR24, 3, 1},
+    {CAMERA_WIDTH / 2, CAMERA_HEIGHT / 2, MMAL_ENCODING_RGB24, 3, 2},
+    {CAMERA_WIDTH / 5, CAMERA_HEIGHT / 5, MMAL_ENCODING_RGB24, 3, 2},
+    {CAMERA_WIDTH / 8, CAMERA_HEIGHT / 8, MMAL_ENCODING_BGR24, 3, 2},
+};
+#define NUM_OUTPUTS ((int) (sizeof(outputs) / sizeof(outputs[0])))
+
+/* See test_emu_pipeline.c. */
+static int check_frame(const struct output *o, const uint8_t *p)
+{
+    const int stride = ALIGN_UP(o->width, 32) * o->bpp;
+    const _Bool is_bgr = o->encoding == MMAL_ENCODING_BGR24;
+    int x, y;
+
+    for (y = 0; y < o->height; y ++) {
+        for (x = 0; x < o->width; x ++) {
+            const int sx = x * CAMERA_WIDTH  / o->width,
+                      sy = y * CAMERA_HEIGHT / o->height;
+            const uint8_t *q = p + y * stride + x * o->bpp;
+            const int r = q[is_bgr ? 2 : 0], g = q[1];
+            if (r != sx * 256 / CAMERA_WIDTH
+                    || g != sy * 256 / CAMERA_HEIGHT) {
+                fprintf(stderr, "%dx%d: Unexpected pixel (%d,%d,%d) at "
+                        "(%d,%d)\n", o->width, o->height, q[0], q[1], q[2],
+                        x, y);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main()
+{
+    const int nframes = 10;
+    rpigrafx_frame_config_t fc[NUM_OUTPUTS];
+    rpigrafx_graph_info_t info;
+    int i, j;
+
+    for (j = 0; j < NUM_OUTPUTS; j ++)
+        _check(rpigrafx_config_camera_frame(0, outputs[j].width,
+                                            outputs[j].height,
+                                            outputs[j].encoding, 0, &fc[j]));
+    _check(!rpigrafx_get_graph_info(&fc[0], &info));
+    _check(rpigrafx_finish_config());
+
+    for (j = 0; j < NUM_OUTPUTS; j ++) {
+        _check(rpigrafx_get_graph_info(&fc[j], &info));
+        if (info.num_splitters != 2
+                || info.num_splitter_hops != outputs[j].num_splitter_hops
+                || info.setup_ns == 0) {
+            fprintf(stderr, "Output %d: %d splitters, %d hops, set up in "
+                    "%llu ns\n", j, info.num_splitters,
+                    info.num_splitter_hops,
+                    (unsigned long long) info.setup_ns);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < nframes; i ++) {
+        for (j = 0; j < NUM_OUTPUTS; j ++) {
+            void *p = NULL;
+            _check(rpigrafx_capture_next_frame(&fc[j]));
+            p = rpigrafx_get_frame(&fc[j]);
+            _check(p == NULL);
+            _check(check_frame(&outputs[j], p));
+            _check(rpigrafx_free_frame(&fc[j]));
+        }
+    }
+
+    return 0;
+}
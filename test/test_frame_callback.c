@@ -0,0 +1,121 @@
+#include <rpigrafx.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define CAMERA_WIDTH  640
+#define CAMERA_HEIGHT 480
+#define NUM_OUTPUTS 2
+#define NUM_FRAMES 30
+
+/* Every other frame of output 1 is held and released by main. */
+static struct output {
+    int32_t width, height;
+    int num_frames, num_errors;
+    void *held;
+    uint64_t sequence;
+} outputs[NUM_OUTPUTS] = {
+    {CAMERA_WIDTH,     CAMERA_HEIGHT,     0, 0, NULL, 0},
+    {CAMERA_WIDTH / 2, CAMERA_HEIGHT / 2, 0, 0, NULL, 0},
+};
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * The stand-in camera produces (256x/w, 256y/h, n) at (x, y); check the last
+ * row of the frame, which the isp writes last.
+ */
+static int check_frame(const struct output *o, const uint8_t *p)
+{
+    const int stride = ALIGN_UP(o->width, 32) * 3, y = o->height - 1;
+    int x;
+
+    for (x = 0; x < o->width; x ++) {
+        const uint8_t *q = p + y * stride + x * 3;
+        const int sx = x * CAMERA_WIDTH  / o->width,
+                  sy = y * CAMERA_HEIGHT / o->height;
+        if (q[0] != sx * 256 / CAMERA_WIDTH || q[1] != sy * 256 / CAMERA_HEIGHT)
+            return 1;
+    }
+    return 0;
+}
+
+static void on_frame(rpigrafx_frame_config_t *fcp, void *frame, void *userdata)
+{
+    struct output *o = userdata;
+    rpigrafx_frame_info_t info;
+
+    pthread_mutex_lock(&mutex);
+    if (check_frame(o, frame))
+        o->num_errors ++;
+    if (rpigrafx_get_frame_info(fcp, &info)
+            || (o->num_frames != 0 && info.sequence <= o->sequence))
+        o->num_errors ++;
+    else
+        o->sequence = info.sequence;
+    if (o == &outputs[1] && o->held == NULL && o->num_frames % 2 == 0) {
+        if (rpigrafx_hold_frame(fcp))
+            o->num_errors ++;
+        else
+            o->held = frame;
+    }
+    o->num_frames ++;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+int main()
+{
+    int j;
+    rpigrafx_frame_config_t fc[NUM_OUTPUTS];
+
+    for (j = 0; j < NUM_OUTPUTS; j ++) {
+        _check(rpigrafx_config_camera_frame(0, outputs[j].width,
+                                            outputs[j].height,
+                                            MMAL_ENCODING_RGB24, 0, &fc[j]));
+        _check(rpigrafx_set_frame_callback(&fc[j], on_frame, &outputs[j]));
+    }
+    _check(rpigrafx_finish_config());
+
+    /* Frames are delivered, not captured. */
+    _check(!rpigrafx_capture_next_frame(&fc[0]));
+    /* Holding is only for the callback. */
+    _check(!rpigrafx_hold_frame(&fc[0]));
+    /* Only held frames can be released. */
+    _check(!rpigrafx_release_frame(&fc[0], &fc[0]));
+
+    pthread_mutex_lock(&mutex);
+    while (outputs[0].num_frames < NUM_FRAMES
+            || outputs[1].num_frames < NUM_FRAMES) {
+        void *held = outputs[1].held;
+        if (held != NULL) {
+            outputs[1].held = NULL;
+            pthread_mutex_unlock(&mutex);
+            _check(rpigrafx_release_frame(&fc[1], held));
+            pthread_mutex_lock(&mutex);
+            continue;
+        }
+        pthread_cond_wait(&cond, &mutex);
+    }
+    pthread_mutex_unlock(&mutex);
+
+    for (j = 0; j < NUM_OUTPUTS; j ++) {
+        if (outputs[j].num_errors != 0) {
+            fprintf(stderr, "Output %d: %d bad frames of %d\n", j,
+                    outputs[j].num_errors, outputs[j].num_frames);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <rpigrafx.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define CAMERA_WIDTH  640
+#define CAMERA_HEIGHT 480
+#define NUM_OUTPUTS 2
+#define NUM_FRAMES 30
+
+static const struct output {
+    int32_t width, height;
+} outputs[NUM_OUTPUTS] = {
+    {CAMERA_WIDTH,     CAMERA_HEIGHT},
+    {CAMERA_WIDTH / 3, CAMERA_HEIGHT / 3},
+};
+
+/* See test_frame_callback.c. */
+static int check_frame(const struct output *o, const uint8_t *p)
+{
+    const int stride = ALIGN_UP(o->width, 32) * 3, y = o->height - 1;
+    int x;
+
+    for (x = 0; x < o->width; x ++) {
+        const uint8_t *q = p + y * stride + x * 3;
+        const int sx = x * CAMERA_WIDTH  / o->width,
+                  sy = y * CAMERA_HEIGHT / o->height;
+        if (q[0] != sx * 256 / CAMERA_WIDTH || q[1] != sy * 256 / CAMERA_HEIGHT)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * One thread captures from all the outputs with epoll. Every wakeup should
+ * mostly yield a frame; a busy loop would not.
+ */
+int main()
+{
+    int i, j, epfd, num_done = 0, num_empty = 0;
+    int num_frames[NUM_OUTPUTS] = {0};
+    rpigrafx_frame_config_t fc[NUM_OUTPUTS];
+
+    for (j = 0; j < NUM_OUTPUTS; j ++)
+        _check(rpigrafx_config_camera_frame(0, outputs[j].width,
+                                            outputs[j].height,
+                                            MMAL_ENCODING_RGB24, 0, &fc[j]));
+    _check(rpigrafx_finish_config());
+
+    epfd = epoll_create1(0);
+    _check(epfd == -1);
+    for (j = 0; j < NUM_OUTPUTS; j ++) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = j;
+        _check(rpigrafx_get_frame_fd(&fc[j]) == -1);
+        _check(epoll_ctl(epfd, EPOLL_CTL_ADD, rpigrafx_get_frame_fd(&fc[j]),
+                         &ev));
+    }
+
+    while (num_done < NUM_OUTPUTS) {
+        struct epoll_event evs[NUM_OUTPUTS];
+        const int n = epoll_wait(epfd, evs, NUM_OUTPUTS, 5000);
+        if (n <= 0) {
+            fprintf(stderr, "No frame within 5 s\n");
+            return 1;
+        }
+        for (i = 0; i < n; i ++) {
+            _Bool is_captured;
+            j = evs[i].data.u32;
+            _check(rpigrafx_try_capture_next_frame(&fc[j], &is_captured));
+            if (!is_captured) {
+                num_empty ++;
+                continue;
+            }
+            _check(check_frame(&outputs[j], rpigrafx_get_frame(&fc[j])));
+            _check(rpigrafx_free_frame(&fc[j]));
+            if (++ num_frames[j] == NUM_FRAMES)
+                num_done ++;
+        }
+    }
+
+    if (num_empty > NUM_OUTPUTS * NUM_FRAMES) {
+        fprintf(stderr, "%d wakeups without a frame\n", num_empty);
+        return 1;
+    }
+
+    return 0;
+}
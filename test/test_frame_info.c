@@ -0,0 +1,122 @@
+#include <rpigrafx.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define CAMERA_WIDTH  640
+#define CAMERA_HEIGHT 480
+#define NUM_FRAMES 10
+
+static uint64_t get_time_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static int check_hists(rpigrafx_frame_config_t *fcp, const int num_frames)
+{
+    rpigrafx_latency_hist_t hists[RPIGRAFX_NUM_LATENCIES];
+    int k, bin;
+
+    _check(rpigrafx_get_latency_hists(fcp, hists));
+    for (k = 0; k < RPIGRAFX_NUM_LATENCIES; k ++) {
+        const rpigrafx_latency_hist_t *h = &hists[k];
+        uint64_t n = 0;
+        for (bin = 0; bin < RPIGRAFX_LATENCY_HIST_BINS; bin ++)
+            n += h->count[bin];
+        /* The isp may have emitted frames that are not taken yet. */
+        if (n != h->num_samples || h->num_samples < (uint64_t) num_frames
+                || (k != RPIGRAFX_LATENCY_SENSOR_TO_ISP_OUT
+                    && h->num_samples != (uint64_t) num_frames)
+                || h->sum_us > h->num_samples * h->max_us) {
+            fprintf(stderr, "Latency %d: %llu samples, %llu in bins, "
+                    "sum %llu us, max %llu us\n", k,
+                    (unsigned long long) h->num_samples,
+                    (unsigned long long) n, (unsigned long long) h->sum_us,
+                    (unsigned long long) h->max_us);
+            return 1;
+        }
+    }
+    /* The FIFO output falls behind while we sleep. */
+    if (hists[RPIGRAFX_LATENCY_ISP_OUT_TO_USER].max_us < 10000
+            && fcp->splitter_output_port_index == 0) {
+        fprintf(stderr, "Frames did not wait: %llu us\n", (unsigned long long)
+                hists[RPIGRAFX_LATENCY_ISP_OUT_TO_USER].max_us);
+        return 1;
+    }
+
+    rpigrafx_reset_latency_hists(fcp);
+    _check(rpigrafx_get_latency_hists(fcp, hists));
+    for (k = 0; k < RPIGRAFX_NUM_LATENCIES; k ++)
+        if (hists[k].num_samples != 0 || hists[k].max_us != 0)
+            return 1;
+    return 0;
+}
+
+/*
+ * A FIFO and a latest-frame output fall behind the camera. The sequence
+ * numbers of the latter skip exactly the frames it drops.
+ */
+int main()
+{
+    int i, j;
+    rpigrafx_frame_config_t fc[2];
+    rpigrafx_frame_info_t info, last[2];
+
+    for (j = 0; j < 2; j ++)
+        _check(rpigrafx_config_camera_frame(0, CAMERA_WIDTH, CAMERA_HEIGHT,
+                                            MMAL_ENCODING_RGB24, 0, &fc[j]));
+    _check(rpigrafx_config_camera_frame_delivery(RPIGRAFX_DELIVERY_LATEST,
+                                                 &fc[1]));
+    _check(rpigrafx_finish_config());
+
+    /* Nothing is captured yet. */
+    _check(!rpigrafx_get_frame_info(&fc[0], &info));
+
+    for (i = 0; i < NUM_FRAMES; i ++) {
+        vcos_sleep(50);
+        for (j = 0; j < 2; j ++) {
+            _check(rpigrafx_capture_next_frame(&fc[j]));
+            _check(rpigrafx_get_frame_info(&fc[j], &info));
+            if (info.pts == MMAL_TIME_UNKNOWN || info.sensor_ns == 0
+                    || info.sensor_ns > info.receive_ns
+                    || info.receive_ns > get_time_ns()
+                    || (i != 0 && info.sequence <= last[j].sequence)
+                    || (i != 0 && info.pts <= last[j].pts)) {
+                fprintf(stderr, "Output %d frame %d: pts %lld, sensor %llu, "
+                        "receive %llu, sequence %llu\n", j, i,
+                        (long long) info.pts,
+                        (unsigned long long) info.sensor_ns,
+                        (unsigned long long) info.receive_ns,
+                        (unsigned long long) info.sequence);
+                return 1;
+            }
+            last[j] = info;
+        }
+        for (j = 0; j < 2; j ++)
+            _check(rpigrafx_free_frame(&fc[j]));
+    }
+
+    if (last[1].sequence + 1 - NUM_FRAMES
+            != rpigrafx_get_num_dropped_frames(&fc[1])) {
+        fprintf(stderr, "Last sequence %llu after %d frames and %llu drops\n",
+                (unsigned long long) last[1].sequence, NUM_FRAMES,
+                (unsigned long long) rpigrafx_get_num_dropped_frames(&fc[1]));
+        return 1;
+    }
+    for (j = 0; j < 2; j ++)
+        _check(check_hists(&fc[j], NUM_FRAMES));
+
+    return 0;
+}
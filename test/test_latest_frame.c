@@ -0,0 +1,115 @@
+#include <rpigrafx.h>
+#include <interface/mmal/mmal_emu.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define CAMERA_WIDTH  640
+#define CAMERA_HEIGHT 480
+
+#define NUM_ROUNDS 5
+#define WAIT_TIMEOUT_MS 10000
+
+/* Frames the isp of output j emitted; the isps are in the order of outputs. */
+static uint64_t get_num_emitted(const int j)
+{
+    MMAL_EMU_PORT_STATS_T stats[64];
+    const unsigned n = mmal_emu_get_port_stats(stats,
+                                            sizeof(stats) / sizeof(stats[0]));
+    unsigned i, k;
+
+    for (i = 0; i < n; i ++) {
+        int num_before = 0;
+        if (strcmp(stats[i].component, "vc.ril.isp")
+                || stats[i].type != MMAL_PORT_TYPE_OUTPUT)
+            continue;
+        for (k = 0; k < n; k ++)
+            if (!strcmp(stats[k].component, "vc.ril.isp")
+                    && stats[k].type == MMAL_PORT_TYPE_OUTPUT
+                    && stats[k].component_id < stats[i].component_id)
+                num_before ++;
+        if (num_before == j)
+            return stats[i].buffers;
+    }
+    return 0;
+}
+
+/* Waits until the isp of output j emitted num frames. */
+static int wait_emitted(const int j, const uint64_t num)
+{
+    int t;
+
+    for (t = 0; t < WAIT_TIMEOUT_MS; t ++) {
+        if (get_num_emitted(j) >= num)
+            return 0;
+        vcos_sleep(1);
+    }
+    fprintf(stderr, "The isp of output %d emitted %llu of %llu frames\n", j,
+            (unsigned long long) get_num_emitted(j), (unsigned long long) num);
+    return 1;
+}
+
+/*
+ * Two outputs of the same frames fall behind the camera, by two frames of
+ * their isps each time. The FIFO one gets the oldest queued frame, the one
+ * after the last it got, and the latest-frame one a newer one.
+ */
+int main()
+{
+    int i, j;
+    rpigrafx_frame_config_t fc[2];
+    rpigrafx_frame_info_t info[2];
+    /* Frames of each isp that its output took or skipped. */
+    uint64_t num_consumed[2] = {0, 0};
+
+    for (j = 0; j < 2; j ++)
+        _check(rpigrafx_config_camera_frame(0, CAMERA_WIDTH, CAMERA_HEIGHT,
+                                            MMAL_ENCODING_RGB24, 0, &fc[j]));
+    _check(rpigrafx_config_camera_frame_delivery(RPIGRAFX_DELIVERY_LATEST,
+                                                 &fc[1]));
+    _check(!rpigrafx_config_camera_frame_delivery(-1, &fc[1]));
+    _check(rpigrafx_finish_config());
+
+    for (i = 0; i < NUM_ROUNDS; i ++) {
+        for (j = 0; j < 2; j ++)
+            _check(wait_emitted(j, num_consumed[j] + 2));
+        for (j = 0; j < 2; j ++) {
+            _check(rpigrafx_capture_next_frame(&fc[j]));
+            _check(rpigrafx_get_frame(&fc[j]) == NULL);
+            _check(rpigrafx_get_frame_info(&fc[j], &info[j]));
+        }
+        if (info[0].sequence != num_consumed[0]
+                || info[1].sequence < num_consumed[1] + 1) {
+            fprintf(stderr, "Round %d: FIFO got frame %llu of %llu queued "
+                    "first, latest frame %llu of %llu\n", i,
+                    (unsigned long long) info[0].sequence,
+                    (unsigned long long) num_consumed[0],
+                    (unsigned long long) info[1].sequence,
+                    (unsigned long long) num_consumed[1]);
+            return 1;
+        }
+        for (j = 0; j < 2; j ++) {
+            num_consumed[j] = info[j].sequence + 1;
+            _check(rpigrafx_free_frame(&fc[j]));
+        }
+    }
+
+    if (rpigrafx_get_num_dropped_frames(&fc[0]) != 0
+            || rpigrafx_get_num_dropped_frames(&fc[1]) < NUM_ROUNDS) {
+        fprintf(stderr, "Dropped %llu and %llu frames\n",
+                (unsigned long long) rpigrafx_get_num_dropped_frames(&fc[0]),
+                (unsigned long long) rpigrafx_get_num_dropped_frames(&fc[1]));
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include <rpigrafx.h>
+#include <interface/mmal/mmal_emu.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define CAMERA_WIDTH  640
+#define CAMERA_HEIGHT 480
+
+#define STALL_TIMEOUT_MS 10000
+
+/*
+ * Frames that the isp of output j emitted, and that the splitter dropped at
+ * the port feeding it. The isps are created, and the ports taken, in the
+ * order of the outputs.
+ */
+static void get_port_counts(const int j, uint64_t *num_emitted,
+                            uint64_t *num_dropped)
+{
+    MMAL_EMU_PORT_STATS_T stats[64];
+    const unsigned n = mmal_emu_get_port_stats(stats,
+                                            sizeof(stats) / sizeof(stats[0]));
+    unsigned i, k;
+
+    *num_emitted = *num_dropped = 0;
+    for (i = 0; i < n; i ++) {
+        if (!strcmp(stats[i].component, "vc.ril.isp")
+                && stats[i].type == MMAL_PORT_TYPE_OUTPUT) {
+            int num_before = 0;
+            for (k = 0; k < n; k ++)
+                if (!strcmp(stats[k].component, "vc.ril.isp")
+                        && stats[k].type == MMAL_PORT_TYPE_OUTPUT
+                        && stats[k].component_id < stats[i].component_id)
+                    num_before ++;
+            if (num_before == j)
+                *num_emitted = stats[i].buffers;
+        } else if (!strcmp(stats[i].component, "vc.ril.video_splitter")
+                && stats[i].type == MMAL_PORT_TYPE_OUTPUT
+                && stats[i].index == (unsigned) j)
+            *num_dropped = stats[i].dropped;
+    }
+}
+
+/*
+ * Leaves output j alone until its isp has filled every buffer it was given
+ * and the splitter has dropped a frame for want of an isp input buffer.
+ * num_captured is what the output took from the isp so far. The frame freed
+ * last only goes back to the isp on the next capture, so the isp has one
+ * buffer of the pool less.
+ */
+static int stall(const int j, const uint64_t num_captured,
+                 const unsigned pool_size)
+{
+    uint64_t num_emitted, num_dropped, num_dropped_before;
+    int t;
+
+    get_port_counts(j, &num_emitted, &num_dropped_before);
+    for (t = 0; t < STALL_TIMEOUT_MS; t ++) {
+        get_port_counts(j, &num_emitted, &num_dropped);
+        if (num_emitted - num_captured >= pool_size - 1
+                && num_dropped > num_dropped_before)
+            return 0;
+        vcos_sleep(1);
+    }
+    fprintf(stderr, "Output %d: the isp emitted %llu of %llu frames, the "
+            "splitter dropped %llu\n", j, (unsigned long long) num_emitted,
+            (unsigned long long) (num_captured + pool_size - 1),
+            (unsigned long long) (num_dropped - num_dropped_before));
+    return 1;
+}
+
+/*
+ * Output 0 asks for deeper pools than the defaults of output 1. An output
+ * that stops capturing has its isp fill its whole isp-render pool, so the
+ * pool is found dry when it starts again, and the stand-in drops frames
+ * upstream meanwhile.
+ */
+int main()
+{
+    int i, j;
+    const int nframes = 10;
+    rpigrafx_frame_config_t fc[2];
+    rpigrafx_pool_stats_t stats[2][RPIGRAFX_NUM_HOPS];
+    uint64_t num_dry;
+
+    for (j = 0; j < 2; j ++)
+        _check(rpigrafx_config_camera_frame(0, CAMERA_WIDTH >> j,
+                                            CAMERA_HEIGHT >> j,
+                                            MMAL_ENCODING_RGB24, 0, &fc[j]));
+    _check(rpigrafx_config_pool_depth(RPIGRAFX_HOP_CAMERA_SPLITTER, 5, &fc[0]));
+    _check(rpigrafx_config_pool_depth(RPIGRAFX_HOP_SPLITTER_ISP, 4, &fc[0]));
+    _check(rpigrafx_config_pool_depth(RPIGRAFX_HOP_ISP_RENDER, 6, &fc[0]));
+    _check(!rpigrafx_config_pool_depth(RPIGRAFX_NUM_HOPS, 1, &fc[0]));
+    _check(!rpigrafx_config_pool_depth(RPIGRAFX_HOP_ISP_RENDER, -1, &fc[0]));
+    /* Not connected yet. */
+    _check(!rpigrafx_get_pool_stats(&fc[0], stats[0]));
+    _check(rpigrafx_finish_config());
+
+    for (j = 0; j < 2; j ++)
+        _check(rpigrafx_get_pool_stats(&fc[j], stats[j]));
+    for (j = 0; j < 2; j ++)
+        printf("Output %d: buffers %u/%u/%u\n", j,
+               stats[j][RPIGRAFX_HOP_CAMERA_SPLITTER].num_buffers,
+               stats[j][RPIGRAFX_HOP_SPLITTER_ISP].num_buffers,
+               stats[j][RPIGRAFX_HOP_ISP_RENDER].num_buffers);
+
+    /* The camera-splitter hop is shared. */
+    _check(stats[1][RPIGRAFX_HOP_CAMERA_SPLITTER].num_buffers != 5);
+    _check(stats[0][RPIGRAFX_HOP_SPLITTER_ISP].num_buffers != 4);
+    _check(stats[0][RPIGRAFX_HOP_ISP_RENDER].num_buffers != 6);
+    _check(stats[1][RPIGRAFX_HOP_ISP_RENDER].num_buffers == 6);
+
+    for (i = 0; i < nframes; i ++) {
+        for (j = 0; j < 2; j ++) {
+            _check(rpigrafx_capture_next_frame(&fc[j]));
+            _check(rpigrafx_get_frame(&fc[j]) == NULL);
+        }
+    }
+
+    for (j = 0; j < 2; j ++) {
+        const unsigned pool_size =
+                            stats[j][RPIGRAFX_HOP_ISP_RENDER].num_buffers;
+        _check(rpigrafx_free_frame(&fc[j]));
+        _check(rpigrafx_get_pool_stats(&fc[j], stats[j]));
+        num_dry = stats[j][RPIGRAFX_HOP_ISP_RENDER].num_dry;
+        _check(stall(j, nframes, pool_size));
+        _check(rpigrafx_capture_next_frame(&fc[j]));
+        _check(rpigrafx_get_pool_stats(&fc[j], stats[j]));
+        printf("Output %d: isp-render dry %llu times after the stall\n", j,
+               (unsigned long long)
+                   (stats[j][RPIGRAFX_HOP_ISP_RENDER].num_dry - num_dry));
+        if (stats[j][RPIGRAFX_HOP_ISP_RENDER].num_dry == num_dry) {
+            fprintf(stderr, "Output %d: the pool of the stalled isp was not "
+                    "found dry\n", j);
+            return 1;
+        }
+    }
+
+    return 0;
+}
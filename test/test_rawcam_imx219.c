@@ -55,5 +55,21 @@ int main()
     time = end - start;
     fprintf(stderr, "%f [s], %f [frame/s]\n", time, nframes / time);
 
+    {
+        rpigrafx_band_timing_t timings[16];
+        int num_bands = sizeof(timings) / sizeof(timings[0]);
+        _check(rpigrafx_get_rawcam_band_timings(&fc, timings, &num_bands));
+        for (i = 0; i < num_bands; i ++)
+            fprintf(stderr, "Band %d: rows %d-%d: %f [ms]\n", i,
+                    timings[i].y, timings[i].y + timings[i].height - 1,
+                    timings[i].ns * 1e-6);
+    }
+    {
+        float gain_r, gain_g, gain_b;
+        _check(rpigrafx_get_rawcam_awb_gains(&fc, &gain_r, &gain_g, &gain_b));
+        fprintf(stderr, "AWB gains: R %f G %f B %f\n",
+                gain_r, gain_g, gain_b);
+    }
+
     return 0;
 }
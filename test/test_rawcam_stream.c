@@ -0,0 +1,231 @@
+#include <rpigrafx.h>
+#include "local.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define WIDTH  64
+#define HEIGHT 48
+#define STRIDE (ALIGN_UP(WIDTH, 32) * 3)
+#define PATH "test_rawcam_stream.rec"
+#define RAW_PATH "test_rawcam_stream_raw.rec"
+/*
+ * A replay of NUM_FRAMES taken as fast as the producer asks, so it has been
+ * through all of them by the time it stops.
+ */
+#define NUM_FRAMES 8
+#define QUEUE_DEPTH 2
+#define TIMEOUT_NS 10000000000ULL
+/*
+ * A raw10 replay looped on camera 0 with the costliest conversion, to tell
+ * that streaming allocates nothing once it is going.
+ */
+#define RAW_CAMERA 0
+/* Paced, so that its producer leaves the CPU to the others. */
+#define RAW_FPS 200
+#define NUM_RAW_THREADS 2
+#define NUM_WARMUP_FRAMES 4
+#define NUM_RAW_FRAMES (4 * NUM_FRAMES)
+
+/* One replay camera per policy besides RAW_CAMERA. */
+static const struct policy {
+    rpigrafx_drop_policy_t drop_policy;
+    const char *name;
+    /* Of the frames converted, which come out and how many are dropped. */
+    int first, num_captured, num_frames, num_dropped;
+} policies[] = {
+    /* The producer waits for the consumer, so all of them come out. */
+    {RPIGRAFX_DROP_POLICY_BLOCK, "block",
+     0, NUM_FRAMES, QUEUE_DEPTH, 0},
+    {RPIGRAFX_DROP_POLICY_DROP_NEWEST, "drop newest",
+     0, QUEUE_DEPTH, QUEUE_DEPTH, NUM_FRAMES - QUEUE_DEPTH},
+    {RPIGRAFX_DROP_POLICY_DROP_OLDEST, "drop oldest",
+     NUM_FRAMES - QUEUE_DEPTH, QUEUE_DEPTH, NUM_FRAMES,
+     NUM_FRAMES - QUEUE_DEPTH},
+};
+#define NUM_POLICIES ((int) (sizeof(policies) / sizeof(policies[0])))
+
+static uint64_t get_time_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* Every byte of frame n is its value; see test_replay.c for the container. */
+static uint8_t frame_value(const int n)
+{
+    return 16 * n + 8;
+}
+
+static void write_recording(const char *path, const MMAL_FOURCC_T encoding,
+                            const uint32_t frame_size)
+{
+    FILE *fp = fopen(path, "wb");
+    rpigrafx_recording_header_t header;
+    rpigrafx_recording_frame_t frame;
+    uint8_t *block = NULL;
+    int n;
+
+    _check(fp == NULL);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RPIGRAFX_RECORDING_MAGIC, sizeof(header.magic));
+    header.version = RPIGRAFX_RECORDING_VERSION;
+    header.encoding = encoding;
+    header.width = WIDTH;
+    header.height = HEIGHT;
+    header.aligned_width = ALIGN_UP(WIDTH, 32);
+    header.aligned_height = HEIGHT;
+    header.frame_size = frame_size;
+    header.record_size = ALIGN_UP(RPIGRAFX_RECORDING_FRAME_OFFSET
+                                  + header.frame_size,
+                                  RPIGRAFX_RECORDING_ALIGN);
+    header.num_frames = NUM_FRAMES;
+
+    block = calloc(1, header.record_size);
+    _check(block == NULL);
+    memcpy(block, &header, sizeof(header));
+    _check(fwrite(block, RPIGRAFX_RECORDING_ALIGN, 1, fp) != 1);
+    for (n = 0; n < NUM_FRAMES; n ++) {
+        memset(block, 0, header.record_size);
+        memset(&frame, 0, sizeof(frame));
+        frame.length = header.frame_size;
+        frame.sequence = n;
+        memcpy(block, &frame, sizeof(frame));
+        memset(block + RPIGRAFX_RECORDING_FRAME_OFFSET, frame_value(n),
+               header.frame_size);
+        _check(fwrite(block, header.record_size, 1, fp) != 1);
+    }
+    free(block);
+    _check(fclose(fp));
+}
+
+/* Waits until the producer has accounted for the frames as p expects. */
+static int wait_producer(rpigrafx_frame_config_t *fcp, const struct policy *p)
+{
+    const uint64_t start = get_time_ns();
+    uint64_t num_frames, num_dropped;
+
+    for (; ; ) {
+        _check(rpigrafx_get_rawcam_stream_stats(fcp, &num_frames,
+                                                &num_dropped));
+        if (num_frames == (uint64_t) p->num_frames
+                && num_dropped == (uint64_t) p->num_dropped)
+            return 0;
+        if (num_frames > (uint64_t) p->num_frames
+                || num_dropped > (uint64_t) p->num_dropped
+                || get_time_ns() - start > TIMEOUT_NS)
+            break;
+        usleep(1000);
+    }
+    fprintf(stderr, "%s: %llu frames converted and %llu dropped, "
+            "against %d and %d\n", p->name, (unsigned long long) num_frames,
+            (unsigned long long) num_dropped, p->num_frames, p->num_dropped);
+    return 1;
+}
+
+int main()
+{
+    rpigrafx_frame_config_t fc[NUM_POLICIES];
+    rpigrafx_frame_config_t fc_raw;
+    uint64_t num_frames, num_dropped;
+    unsigned long num_heap_allocs = 0;
+    int k, n;
+
+    write_recording(PATH, MMAL_ENCODING_RGB24, STRIDE * HEIGHT);
+    write_recording(RAW_PATH, MMAL_ENCODING_BAYER_SBGGR10P,
+                    priv_rpigrafx_raw10_stride(WIDTH) * HEIGHT);
+    for (k = 0; k < NUM_POLICIES; k ++) {
+        _check(rpigrafx_config_replay(1 + k, PATH, 0, 0));
+        _check(rpigrafx_config_camera_frame(1 + k, WIDTH, HEIGHT,
+                                            MMAL_ENCODING_RGB24, 0, &fc[k]));
+        _check(rpigrafx_config_rawcam_streaming(QUEUE_DEPTH,
+                                                policies[k].drop_policy,
+                                                &fc[k]));
+    }
+    _check(rpigrafx_config_replay(RAW_CAMERA, RAW_PATH, RAW_FPS, !0));
+    _check(rpigrafx_config_camera_frame(RAW_CAMERA, WIDTH, HEIGHT,
+                                        MMAL_ENCODING_RGB24, 0, &fc_raw));
+    _check(rpigrafx_config_rawcam_demosaic(RPIGRAFX_DEMOSAIC_EDGE_AWARE,
+                                           &fc_raw));
+    _check(rpigrafx_config_rawcam_num_threads(NUM_RAW_THREADS, &fc_raw));
+    _check(rpigrafx_config_rawcam_streaming(QUEUE_DEPTH,
+                                            RPIGRAFX_DROP_POLICY_DROP_OLDEST,
+                                            &fc_raw));
+    _check(!rpigrafx_config_rawcam_streaming(-1,
+                                             RPIGRAFX_DROP_POLICY_BLOCK,
+                                             &fc[0]));
+    _check(rpigrafx_finish_config());
+
+    for (k = 0; k < NUM_POLICIES; k ++) {
+        const struct policy *p = &policies[k];
+
+        /* The ready queue is full before anything is taken. */
+        _check(wait_producer(&fc[k], p));
+        for (n = p->first; n < p->first + p->num_captured; n ++) {
+            const uint8_t *frame;
+            _check(rpigrafx_capture_next_frame(&fc[k]));
+            frame = rpigrafx_get_frame(&fc[k]);
+            if (frame[0] != frame_value(n)
+                    || frame[(HEIGHT - 1) * STRIDE + WIDTH * 3 - 1]
+                       != frame_value(n)) {
+                fprintf(stderr, "%s: frame %d is %d, not %d\n", p->name,
+                        n - p->first, frame[0], frame_value(n));
+                return 1;
+            }
+        }
+        /* The replay is over and the producer has stopped. */
+        _check(!rpigrafx_capture_next_frame(&fc[k]));
+        _check(rpigrafx_get_rawcam_stream_stats(&fc[k], &num_frames,
+                                                &num_dropped));
+        printf("%-11s: %d frames captured, %llu converted, %llu dropped\n",
+               p->name, p->num_captured, (unsigned long long) num_frames,
+               (unsigned long long) num_dropped);
+        if (p->drop_policy == RPIGRAFX_DROP_POLICY_BLOCK
+                ? num_frames != NUM_FRAMES || num_dropped != 0
+                : num_frames != (uint64_t) p->num_frames
+                  || num_dropped != (uint64_t) p->num_dropped) {
+            fprintf(stderr, "%s: the counts changed\n", p->name);
+            return 1;
+        }
+        _check(rpigrafx_free_frame(&fc[k]));
+    }
+
+    /*
+     * The other replays are over, so whatever is allocated from here on is
+     * for the raw frames, converted and taken over and over.
+     */
+    for (n = -NUM_WARMUP_FRAMES; n < NUM_RAW_FRAMES; n ++) {
+        if (n == 0)
+            num_heap_allocs = rpigrafx_get_num_heap_allocs();
+        _check(rpigrafx_capture_next_frame(&fc_raw));
+        _check(rpigrafx_get_frame(&fc_raw) == NULL);
+        _check(rpigrafx_free_frame(&fc_raw));
+    }
+    _check(rpigrafx_get_rawcam_stream_stats(&fc_raw, &num_frames,
+                                            &num_dropped));
+    printf("raw        : %d frames captured, %llu converted, %llu dropped\n",
+           NUM_WARMUP_FRAMES + NUM_RAW_FRAMES,
+           (unsigned long long) num_frames, (unsigned long long) num_dropped);
+    if (rpigrafx_get_num_heap_allocs() != num_heap_allocs) {
+        fprintf(stderr, "%lu heap allocations while streaming\n",
+                rpigrafx_get_num_heap_allocs() - num_heap_allocs);
+        return 1;
+    }
+
+    unlink(PATH);
+    unlink(RAW_PATH);
+    return 0;
+}
@@ -0,0 +1,622 @@
+#include <rpigrafx.h>
+#include "local.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+static uint8_t gain(const uint8_t v, const float g)
+{
+    const float f = v * g + 0.5f;
+    return f >= 255.0f ? 255 : (uint8_t) f;
+}
+
+/*
+ * The separate passes the fused kernel replaces: raw10 to raw8, per-component
+ * gain and then nearest-neighbour demosaic.
+ */
+static void reference(uint8_t *dst, const int dst_stride, const uint8_t *src,
+                      const int src_stride, const int width, const int height,
+                      const float gain_r, const float gain_g,
+                      const float gain_b)
+{
+    uint8_t *raw8 = malloc(width * height);
+    int x, y;
+
+    for (y = 0; y < height; y ++)
+        for (x = 0; x < width; x ++)
+            raw8[y * width + x] = src[y * src_stride + x / 4 * 5 + x % 4];
+
+    for (y = 0; y < height; y ++) {
+        for (x = 0; x < width; x ++) {
+            uint8_t *p = &raw8[y * width + x];
+            if (y % 2 == 0 && x % 2 == 0)
+                *p = gain(*p, gain_b);
+            else if (y % 2 == 1 && x % 2 == 1)
+                *p = gain(*p, gain_r);
+            else
+                *p = gain(*p, gain_g);
+        }
+    }
+
+    for (y = 0; y < height; y ++) {
+        for (x = 0; x < width; x ++) {
+            const int qx = x & ~1, qy = y & ~1;
+            uint8_t *d = dst + y * dst_stride + x * 3;
+            d[0] = raw8[(qy + 1) * width + qx + 1];
+            d[1] = raw8[y * width + qx + 1 - (y % 2)];
+            d[2] = raw8[qy * width + qx];
+        }
+    }
+
+    free(raw8);
+}
+
+static int test_size(const int width, const int height)
+{
+    const int src_stride = priv_rpigrafx_raw10_stride(width),
+              dst_stride = ALIGN_UP(width, 32) * 3;
+    uint8_t *src = malloc(src_stride * height),
+            *dst = malloc(dst_stride * height),
+            *ref = malloc(dst_stride * height);
+    int i, y;
+
+    for (i = 0; i < src_stride * height; i ++)
+        src[i] = rand();
+    memset(dst, 0, dst_stride * height);
+    memset(ref, 0, dst_stride * height);
+
+    _check(priv_rpigrafx_raw10bggr_to_rgb888_gain(dst, dst_stride,
+                                                  src, src_stride,
+                                                  width, height,
+                                                  1.55, 1.0, 1.5,
+                                                  RPIGRAFX_DEMOSAIC_NEAREST,
+                                                  NULL));
+    reference(ref, dst_stride, src, src_stride, width, height, 1.55, 1.0, 1.5);
+
+    for (y = 0; y < height; y ++) {
+        if (memcmp(dst + y * dst_stride, ref + y * dst_stride, width * 3)) {
+            fprintf(stderr, "%dx%d: Row %d differs from the reference\n",
+                    width, height, y);
+            return 1;
+        }
+    }
+
+    free(src);
+    free(dst);
+    free(ref);
+    return 0;
+}
+
+static const struct {
+    rpigrafx_demosaic_t demosaic;
+    const char *name;
+} demosaics[] = {
+    {RPIGRAFX_DEMOSAIC_NEAREST,    "nearest"},
+    {RPIGRAFX_DEMOSAIC_BILINEAR,   "bilinear"},
+    {RPIGRAFX_DEMOSAIC_EDGE_AWARE, "edge-aware"},
+};
+#define NUM_DEMOSAICS ((int) (sizeof(demosaics) / sizeof(demosaics[0])))
+
+/* The vectorised kernels must match the scalar references bit by bit. */
+static int test_exact(const rpigrafx_demosaic_t demosaic, const int width,
+                      const int height)
+{
+    const int src_stride = priv_rpigrafx_raw10_stride(width),
+              dst_stride = ALIGN_UP(width, 32) * 3;
+    uint8_t *src = malloc(src_stride * height),
+            *dst = malloc(dst_stride * height),
+            *ref = malloc(dst_stride * height),
+            *scratch = malloc(priv_rpigrafx_demosaic_scratch_size(demosaic,
+                                                                  width) + 1);
+    int i, y, ret = 0;
+
+    for (i = 0; i < src_stride * height; i ++)
+        src[i] = rand();
+
+    _check(priv_rpigrafx_raw10bggr_to_rgb888_gain(dst, dst_stride,
+                                                  src, src_stride,
+                                                  width, height,
+                                                  1.55, 1.0, 1.5,
+                                                  demosaic, scratch));
+    _check(priv_rpigrafx_raw10bggr_to_rgb888_gain_ref(ref, dst_stride,
+                                                      src, src_stride,
+                                                      width, height,
+                                                      1.55, 1.0, 1.5,
+                                                      demosaic, scratch));
+
+    for (y = 0; y < height; y ++) {
+        if (memcmp(dst + y * dst_stride, ref + y * dst_stride, width * 3)) {
+            fprintf(stderr, "%dx%d: Row %d of demosaic %d differs from the "
+                    "scalar reference\n", width, height, y, demosaic);
+            ret = 1;
+            break;
+        }
+    }
+
+    free(src);
+    free(dst);
+    free(ref);
+    free(scratch);
+    return ret;
+}
+
+/* A flat grey field must stay flat whatever the demosaic. */
+static int test_flat(const rpigrafx_demosaic_t demosaic)
+{
+    const int width = 64, height = 8,
+              src_stride = priv_rpigrafx_raw10_stride(width),
+              dst_stride = ALIGN_UP(width, 32) * 3;
+    uint8_t *src = malloc(src_stride * height),
+            *dst = malloc(dst_stride * height),
+            *scratch = malloc(priv_rpigrafx_demosaic_scratch_size(demosaic,
+                                                                  width) + 1);
+    int x, y, ret = 0;
+
+    memset(src, 0x80, src_stride * height);
+    _check(priv_rpigrafx_raw10bggr_to_rgb888_gain(dst, dst_stride,
+                                                  src, src_stride,
+                                                  width, height,
+                                                  1.0, 1.0, 1.0,
+                                                  demosaic, scratch));
+    for (y = 0; y < height; y ++)
+        for (x = 0; x < width * 3; x ++)
+            if (dst[y * dst_stride + x] != 0x80)
+                ret = 1;
+    if (ret)
+        fprintf(stderr, "Demosaic %d changed a flat field\n", demosaic);
+
+    free(src);
+    free(dst);
+    free(scratch);
+    return ret;
+}
+
+struct band_job {
+    uint8_t *dst, *src, *scratch;
+    int src_stride, dst_stride, width, height, band_height;
+    size_t scratch_size;
+    rpigrafx_demosaic_t demosaic;
+    rpigrafx_bayer_stats_t stats[4];
+    int stats_step;
+    int ret;
+};
+
+static void convert_band(void *arg, const int task)
+{
+    struct band_job *job = arg;
+    const int y_begin = task * job->band_height,
+              y_end = MMAL_MIN(job->height, y_begin + job->band_height);
+
+    if (priv_rpigrafx_raw10bggr_to_rgb888_gain_rows(job->dst, job->dst_stride,
+                                                    job->src, job->src_stride,
+                                                    job->width, job->height,
+                                                    y_begin, y_end,
+                                                    1.55, 1.0, 1.5,
+                                                    job->demosaic,
+                                    job->scratch + task * job->scratch_size,
+                                                    &job->stats[task],
+                                                    job->stats_step))
+        job->ret = 1;
+}
+
+static int run_bands(struct priv_rpigrafx_workers *workers,
+                     struct band_job *job)
+{
+    const int n = priv_rpigrafx_workers_num_threads(workers);
+
+    int i;
+
+    job->band_height = ALIGN_UP((job->height + n - 1) / n, 2);
+    job->ret = 0;
+    for (i = 0; i < n; i ++)
+        priv_rpigrafx_bayer_stats_clear(&job->stats[i]);
+    _check(priv_rpigrafx_workers_run(workers,
+                                     (job->height + job->band_height - 1)
+                                                           / job->band_height,
+                                     convert_band, job));
+    return job->ret;
+}
+
+/*
+ * The statistics gathered by the bands, merged, must be those of every
+ * stats_step-th quad of the whole frame.
+ */
+static int check_stats(const struct band_job *job, const int num_bands)
+{
+    rpigrafx_bayer_stats_t stats, ref;
+    int i, x, y;
+
+    priv_rpigrafx_bayer_stats_clear(&stats);
+    for (i = 0; i < num_bands; i ++)
+        priv_rpigrafx_bayer_stats_add(&stats, &job->stats[i]);
+
+    memset(&ref, 0, sizeof(ref));
+    for (y = 0; y < job->height; y += 2 * job->stats_step) {
+        for (x = 0; x < job->width; x += 2 * job->stats_step) {
+            static const int channel[2][2] = {{2, 1}, {1, 0}};
+            static const float gain[3] = {1.55, 1.0, 1.5};
+            int dx, dy;
+            for (dy = 0; dy < 2; dy ++) {
+                for (dx = 0; dx < 2; dx ++) {
+                    const int c = channel[dy][dx],
+                              v = job->src[(y + dy) * job->src_stride
+                                           + (x + dx) / 4 * 5 + (x + dx) % 4];
+                    ref.num_samples[c] ++;
+                    ref.sum[c] += v;
+                    ref.hist[c][v * RPIGRAFX_STATS_HIST_BINS / 256] ++;
+                    ref.num_saturated[c] += gain[c] * v + 0.5f >= 255.0f;
+                }
+            }
+        }
+    }
+
+    if (memcmp(&stats, &ref, sizeof(stats))) {
+        fprintf(stderr, "%dx%d: Statistics of %d bands differ: "
+                "R %u/%llu/%u G %u/%llu/%u B %u/%llu/%u\n",
+                job->width, job->height, num_bands,
+                stats.num_samples[0], (unsigned long long) stats.sum[0],
+                stats.num_saturated[0],
+                stats.num_samples[1], (unsigned long long) stats.sum[1],
+                stats.num_saturated[1],
+                stats.num_samples[2], (unsigned long long) stats.sum[2],
+                stats.num_saturated[2]);
+        return 1;
+    }
+    return 0;
+}
+
+/* Converting in bands on several threads must give the same frame. */
+static int test_bands(const rpigrafx_demosaic_t demosaic,
+                      const int num_threads, const int width, const int height)
+{
+    struct band_job job;
+    struct priv_rpigrafx_workers *workers =
+                                    priv_rpigrafx_workers_create(num_threads);
+    uint8_t *ref;
+    int i, y, ret = 0;
+
+    _check(workers == NULL);
+    job.width = width;
+    job.height = height;
+    job.src_stride = priv_rpigrafx_raw10_stride(width);
+    job.dst_stride = ALIGN_UP(width, 32) * 3;
+    job.demosaic = demosaic;
+    job.stats_step = 3;
+    job.scratch_size = priv_rpigrafx_demosaic_scratch_size(demosaic, width);
+    job.src = malloc(job.src_stride * height);
+    job.dst = malloc(job.dst_stride * height);
+    job.scratch = malloc(num_threads * job.scratch_size + 1);
+    ref = malloc(job.dst_stride * height);
+
+    for (i = 0; i < job.src_stride * height; i ++)
+        job.src[i] = rand();
+
+    _check(run_bands(workers, &job));
+    _check(priv_rpigrafx_raw10bggr_to_rgb888_gain_ref(ref, job.dst_stride,
+                                                      job.src, job.src_stride,
+                                                      width, height,
+                                                      1.55, 1.0, 1.5,
+                                                      demosaic, job.scratch));
+
+    for (y = 0; y < height; y ++) {
+        if (memcmp(job.dst + y * job.dst_stride, ref + y * job.dst_stride,
+                   width * 3)) {
+            fprintf(stderr, "%dx%d: Row %d of demosaic %d in %d bands "
+                    "differs\n", width, height, y, demosaic, num_threads);
+            ret = 1;
+            break;
+        }
+    }
+    if (!ret)
+        ret = check_stats(&job, num_threads);
+
+    priv_rpigrafx_workers_destroy(workers);
+    free(job.src);
+    free(job.dst);
+    free(job.scratch);
+    free(ref);
+    return ret;
+}
+
+static int near(const float a, const float b)
+{
+    return a > b * 0.95f && a < b * 1.05f;
+}
+
+/*
+ * A grey scene seen through a colour cast: the gains estimated from the
+ * statistics of its conversion must undo the cast, and the smoothed gains
+ * must settle on them.
+ */
+static int test_awb(const rpigrafx_awb_mode_t mode)
+{
+    const int width = 320, height = 240;
+    const int src_stride = priv_rpigrafx_raw10_stride(width),
+              dst_stride = ALIGN_UP(width, 32) * 3;
+    const float cast[3] = {0.5, 1.0, 0.7};
+    uint8_t *src = malloc(src_stride * height),
+            *dst = malloc(dst_stride * height);
+    rpigrafx_bayer_stats_t stats;
+    struct priv_rpigrafx_awb awb;
+    float gains[3];
+    int i, x, y, ret = 0;
+
+    memset(src, 0, src_stride * height);
+    for (y = 0; y < height; y ++) {
+        for (x = 0; x < width; x ++) {
+            const int c = y % 2 == 0 ? (x % 2 == 0 ? 2 : 1)
+                                     : (x % 2 == 0 ? 1 : 0);
+            src[y * src_stride + x / 4 * 5 + x % 4] =
+                                            (32 + rand() % 169) * cast[c];
+        }
+    }
+
+    priv_rpigrafx_bayer_stats_clear(&stats);
+    _check(priv_rpigrafx_raw10bggr_to_rgb888_gain_rows(dst, dst_stride,
+                                                       src, src_stride,
+                                                       width, height,
+                                                       0, height,
+                                                       1.0, 1.0, 1.0,
+                                                    RPIGRAFX_DEMOSAIC_NEAREST,
+                                                       NULL, &stats, 2));
+    _check(priv_rpigrafx_awb_estimate(mode, &stats, gains));
+    if (!near(gains[0], 1 / cast[0]) || !near(gains[1], 1.0)
+            || !near(gains[2], 1 / cast[2])) {
+        fprintf(stderr, "AWB mode %d: Gains %f %f %f do not undo the cast\n",
+                mode, gains[0], gains[1], gains[2]);
+        ret = 1;
+        goto end;
+    }
+
+    priv_rpigrafx_awb_init(&awb, 1.0, 1.0, 1.0);
+    awb.mode = mode;
+    priv_rpigrafx_awb_update(&awb, &stats);
+    if (!(awb.gains[0] > 1.0 && awb.gains[0] < gains[0])) {
+        fprintf(stderr, "AWB mode %d: R gain %f is not smoothed\n",
+                mode, awb.gains[0]);
+        ret = 1;
+        goto end;
+    }
+    for (i = 0; i < 50; i ++)
+        priv_rpigrafx_awb_update(&awb, &stats);
+    for (i = 0; i < 3; i ++) {
+        if (!near(awb.gains[i], gains[i])) {
+            fprintf(stderr, "AWB mode %d: Gain %d %f does not settle on %f\n",
+                    mode, i, awb.gains[i], gains[i]);
+            ret = 1;
+            goto end;
+        }
+    }
+
+    /* Locked gains stay where they are. */
+    awb.is_locked = !0;
+    awb.gains[0] = 3.0;
+    priv_rpigrafx_awb_update(&awb, &stats);
+    if (awb.gains[0] != 3.0) {
+        fprintf(stderr, "AWB mode %d: Locked gain moved to %f\n",
+                mode, awb.gains[0]);
+        ret = 1;
+        goto end;
+    }
+
+    /* A black frame gives no estimate. */
+    memset(src, 0, src_stride * height);
+    priv_rpigrafx_bayer_stats_clear(&stats);
+    _check(priv_rpigrafx_raw10bggr_to_rgb888_gain_rows(dst, dst_stride,
+                                                       src, src_stride,
+                                                       width, height,
+                                                       0, height,
+                                                       1.0, 1.0, 1.0,
+                                                    RPIGRAFX_DEMOSAIC_NEAREST,
+                                                       NULL, &stats, 2));
+    _check(!priv_rpigrafx_awb_estimate(mode, &stats, gains));
+
+end:
+    free(src);
+    free(dst);
+    return ret;
+}
+
+/*
+ * The steps of the conversion run on their own for the microbenchmark must
+ * do what they do within it.
+ */
+static int test_steps(const int width, const int height)
+{
+    const int src_stride = priv_rpigrafx_raw10_stride(width),
+              dst_stride = ALIGN_UP(width, 32) * 3;
+    uint8_t *src = malloc(src_stride * height),
+            *dst = malloc(dst_stride * height);
+    rpigrafx_bayer_stats_t stats, ref;
+    int i, x, y, ret = 0;
+
+    for (i = 0; i < src_stride * height; i ++)
+        src[i] = rand();
+
+    _check(priv_rpigrafx_raw10bggr_to_raw8_gain_rows(dst, width,
+                                                     src, src_stride,
+                                                     width, height,
+                                                     0, height,
+                                                     1.55, 1.0, 1.5));
+    for (y = 0; y < height && !ret; y ++) {
+        for (x = 0; x < width; x ++) {
+            const float g = y % 2 == 0 ? (x % 2 == 0 ? 1.5 : 1.0)
+                                       : (x % 2 == 0 ? 1.0 : 1.55);
+            if (dst[y * width + x]
+                    != gain(src[y * src_stride + x / 4 * 5 + x % 4], g)) {
+                fprintf(stderr, "%dx%d: Pixel (%d, %d) of raw8 differs\n",
+                        width, height, x, y);
+                ret = 1;
+                break;
+            }
+        }
+    }
+
+    priv_rpigrafx_bayer_stats_clear(&stats);
+    priv_rpigrafx_bayer_stats_clear(&ref);
+    _check(priv_rpigrafx_raw10bggr_stats_rows(src, src_stride, width, height,
+                                              2, height, 1.55, 1.0, 1.5,
+                                              &stats, 3));
+    _check(priv_rpigrafx_raw10bggr_to_rgb888_gain_rows(dst, dst_stride,
+                                                       src, src_stride,
+                                                       width, height,
+                                                       2, height,
+                                                       1.55, 1.0, 1.5,
+                                                    RPIGRAFX_DEMOSAIC_NEAREST,
+                                                       NULL, &ref, 3));
+    if (!ret && memcmp(&stats, &ref, sizeof(stats))) {
+        fprintf(stderr, "%dx%d: Statistics differ from the conversion\n",
+                width, height);
+        ret = 1;
+    }
+
+    free(src);
+    free(dst);
+    return ret;
+}
+
+static double get_time()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void print_throughput(const rpigrafx_demosaic_t demosaic,
+                             const char *name)
+{
+    const int width = 3280, height = 2464, n = 5,
+              src_stride = priv_rpigrafx_raw10_stride(width),
+              dst_stride = ALIGN_UP(width, 32) * 3;
+    uint8_t *src = calloc(src_stride, height),
+            *dst = malloc(dst_stride * height),
+            *scratch = malloc(priv_rpigrafx_demosaic_scratch_size(demosaic,
+                                                                  width) + 1);
+    double start, vec, ref;
+    int i;
+
+    start = get_time();
+    for (i = 0; i < n; i ++)
+        _check(priv_rpigrafx_raw10bggr_to_rgb888_gain(dst, dst_stride,
+                                                      src, src_stride,
+                                                      width, height,
+                                                      1.0, 1.0, 1.0,
+                                                      demosaic, scratch));
+    vec = get_time() - start;
+    start = get_time();
+    for (i = 0; i < n; i ++)
+        _check(priv_rpigrafx_raw10bggr_to_rgb888_gain_ref(dst, dst_stride,
+                                                          src, src_stride,
+                                                          width, height,
+                                                          1.0, 1.0, 1.0,
+                                                          demosaic, scratch));
+    ref = get_time() - start;
+
+    printf("%-10s %dx%d: %7.1f MP/s (scalar reference: %7.1f MP/s)\n",
+           name, width, height,
+           1e-6 * width * height * n / vec, 1e-6 * width * height * n / ref);
+
+    free(src);
+    free(dst);
+    free(scratch);
+}
+
+static void print_scaling(const rpigrafx_demosaic_t demosaic,
+                          const char *name)
+{
+    const int n = 5;
+    struct band_job job;
+    int num_threads, i;
+    double base = 0;
+
+    job.width = 3280;
+    job.height = 2464;
+    job.src_stride = priv_rpigrafx_raw10_stride(job.width);
+    job.dst_stride = ALIGN_UP(job.width, 32) * 3;
+    job.demosaic = demosaic;
+    job.stats_step = 4;
+    job.scratch_size = priv_rpigrafx_demosaic_scratch_size(demosaic,
+                                                           job.width);
+    job.src = calloc(job.src_stride, job.height);
+    job.dst = malloc(job.dst_stride * job.height);
+    job.scratch = malloc(4 * job.scratch_size + 1);
+
+    for (num_threads = 1; num_threads <= 4; num_threads ++) {
+        struct priv_rpigrafx_workers *workers =
+                                    priv_rpigrafx_workers_create(num_threads);
+        double start, time;
+
+        _check(workers == NULL);
+        _check(run_bands(workers, &job));
+        start = get_time();
+        for (i = 0; i < n; i ++)
+            _check(run_bands(workers, &job));
+        time = (get_time() - start) / n;
+        if (num_threads == 1)
+            base = time;
+        printf("%-10s %d thread(s): %7.1f MP/s, %.2fx; bands:", name,
+               num_threads, 1e-6 * job.width * job.height / time,
+               base / time);
+        for (i = 0; i < num_threads; i ++)
+            printf(" %.2f", priv_rpigrafx_workers_task_ns(workers, i) * 1e-6);
+        printf(" ms\n");
+        priv_rpigrafx_workers_destroy(workers);
+    }
+
+    free(job.src);
+    free(job.dst);
+    free(job.scratch);
+}
+
+int main()
+{
+    int i, j;
+
+    _check(test_size(64, 2));
+    _check(test_size(100, 50));
+    _check(test_size(3280, 2464));
+
+    for (i = 0; i < NUM_DEMOSAICS; i ++) {
+        _check(test_exact(demosaics[i].demosaic, 4, 2));
+        _check(test_exact(demosaics[i].demosaic, 12, 6));
+        _check(test_exact(demosaics[i].demosaic, 100, 50));
+        _check(test_exact(demosaics[i].demosaic, 640, 480));
+        _check(test_flat(demosaics[i].demosaic));
+    }
+    for (i = 0; i < NUM_DEMOSAICS; i ++) {
+        for (j = 1; j <= 4; j ++) {
+            _check(test_bands(demosaics[i].demosaic, j, 100, 50));
+            _check(test_bands(demosaics[i].demosaic, j, 64, 6));
+        }
+        _check(test_bands(demosaics[i].demosaic, 3, 640, 480));
+    }
+    _check(test_awb(RPIGRAFX_AWB_MODE_GREY_WORLD));
+    _check(test_awb(RPIGRAFX_AWB_MODE_WHITE_PATCH));
+    _check(test_steps(100, 50));
+    _check(test_steps(640, 480));
+    for (i = 0; i < NUM_DEMOSAICS; i ++)
+        print_throughput(demosaics[i].demosaic, demosaics[i].name);
+    for (i = 0; i < NUM_DEMOSAICS; i ++)
+        print_scaling(demosaics[i].demosaic, demosaics[i].name);
+
+    /* Odd sizes are rejected. */
+    _check(!priv_rpigrafx_raw10bggr_to_rgb888_gain(NULL, 0, NULL, 0, 6, 4,
+                                                   1.0, 1.0, 1.0,
+                                                   RPIGRAFX_DEMOSAIC_NEAREST,
+                                                   NULL));
+    _check(!priv_rpigrafx_raw10bggr_to_rgb888_gain(NULL, 0, NULL, 0, 8, 3,
+                                                   1.0, 1.0, 1.0,
+                                                   RPIGRAFX_DEMOSAIC_NEAREST,
+                                                   NULL));
+    return 0;
+}
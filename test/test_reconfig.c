@@ -0,0 +1,191 @@
+#include <rpigrafx.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+/* The camera runs at the size of the largest output. */
+#define CAMERA_WIDTH  320
+#define CAMERA_HEIGHT 240
+
+#define NUM_FRAMES 5
+
+struct output {
+    int32_t width, height;
+    MMAL_FOURCC_T encoding;
+    int bpp;
+};
+
+static const struct output steady = {
+    CAMERA_WIDTH, CAMERA_HEIGHT, MMAL_ENCODING_RGB24, 3
+};
+/* What the reconfigured output goes through; all divide the camera frame. */
+static const struct output formats[] = {
+    {CAMERA_WIDTH / 2, CAMERA_HEIGHT / 2, MMAL_ENCODING_RGB24, 3},
+    {CAMERA_WIDTH / 4, CAMERA_HEIGHT / 4, MMAL_ENCODING_BGR24, 3},
+    {CAMERA_WIDTH / 5, CAMERA_HEIGHT / 5, MMAL_ENCODING_RGBA,  4},
+    {CAMERA_WIDTH,     CAMERA_HEIGHT,     MMAL_ENCODING_BGR24, 3},
+    {CAMERA_WIDTH / 2, CAMERA_HEIGHT / 2, MMAL_ENCODING_RGB24, 3},
+};
+#define NUM_FORMATS ((int) (sizeof(formats) / sizeof(formats[0])))
+
+static rpigrafx_frame_config_t fc_steady;
+static uint64_t num_steady_frames;
+static _Bool is_stopping;
+static int steady_ret;
+
+/* See test_emu_pipeline.c. */
+static int check_frame(const struct output *o, const uint8_t *p)
+{
+    const int stride = ALIGN_UP(o->width, 32) * o->bpp;
+    const _Bool is_bgr = o->encoding == MMAL_ENCODING_BGR24;
+    int x, y;
+
+    for (y = 0; y < o->height; y ++) {
+        for (x = 0; x < o->width; x ++) {
+            const int sx = x * CAMERA_WIDTH  / o->width,
+                      sy = y * CAMERA_HEIGHT / o->height;
+            const uint8_t *q = p + y * stride + x * o->bpp;
+            const int r = q[is_bgr ? 2 : 0], g = q[1];
+            if (r != sx * 256 / CAMERA_WIDTH
+                    || g != sy * 256 / CAMERA_HEIGHT) {
+                fprintf(stderr, "%dx%d: Unexpected pixel (%d,%d,%d) at "
+                        "(%d,%d)\n", o->width, o->height, q[0], q[1], q[2],
+                        x, y);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Captures from the output that is left alone until told to stop. */
+static void* run_steady(void *arg)
+{
+    (void) arg;
+
+    while (!__atomic_load_n(&is_stopping, __ATOMIC_SEQ_CST)) {
+        if ((steady_ret = rpigrafx_capture_next_frame(&fc_steady)))
+            break;
+        if ((steady_ret = check_frame(&steady,
+                                      rpigrafx_get_frame(&fc_steady))))
+            break;
+        __atomic_add_fetch(&num_steady_frames, 1, __ATOMIC_SEQ_CST);
+    }
+    rpigrafx_free_frame(&fc_steady);
+    return NULL;
+}
+
+static uint64_t get_time_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void capture_frames(rpigrafx_frame_config_t *fcp,
+                           const struct output *o)
+{
+    int i;
+
+    for (i = 0; i < NUM_FRAMES; i ++) {
+        _check(rpigrafx_capture_next_frame(fcp));
+        _check(check_frame(o, rpigrafx_get_frame(fcp)));
+    }
+}
+
+int main()
+{
+    rpigrafx_frame_config_t fc, fc_shared;
+    rpigrafx_graph_info_t info;
+    MMAL_RECT_T rect;
+    pthread_t thread;
+    int k;
+
+    _check(rpigrafx_config_camera_frame(0, steady.width, steady.height,
+                                        steady.encoding, 0, &fc_steady));
+    _check(rpigrafx_config_camera_frame(0, formats[0].width,
+                                        formats[0].height,
+                                        formats[0].encoding, 0, &fc));
+    /* Shares the isp of the steady output. */
+    _check(rpigrafx_config_camera_frame(0, steady.width, steady.height,
+                                        steady.encoding, 0, &fc_shared));
+    _check(rpigrafx_config_camera_frame_delivery(RPIGRAFX_DELIVERY_LATEST,
+                                                 &fc_steady));
+    _check(rpigrafx_config_camera_frame_delivery(RPIGRAFX_DELIVERY_LATEST,
+                                                 &fc_shared));
+    _check(!rpigrafx_reconfig_camera_frame(64, 48, MMAL_ENCODING_RGB24, &fc));
+    _check(rpigrafx_finish_config());
+
+    _check(rpigrafx_get_graph_info(&fc, &info));
+    _check(info.reconfig_ns != 0);
+    capture_frames(&fc, &formats[0]);
+    _check(pthread_create(&thread, NULL, run_steady, NULL));
+
+    for (k = 1; k < NUM_FORMATS; k ++) {
+        const struct output *o = &formats[k];
+        const uint64_t num_before =
+                        __atomic_load_n(&num_steady_frames, __ATOMIC_SEQ_CST);
+        const uint64_t start = get_time_ns();
+        uint64_t first_ns;
+
+        _check(rpigrafx_reconfig_camera_frame(o->width, o->height,
+                                              o->encoding, &fc));
+        _check(rpigrafx_capture_next_frame(&fc));
+        first_ns = get_time_ns() - start;
+        _check(check_frame(o, rpigrafx_get_frame(&fc)));
+        capture_frames(&fc, o);
+        _check(rpigrafx_get_camera_frame_roi(&fc, &rect));
+        if (rect.width != CAMERA_WIDTH || rect.height != CAMERA_HEIGHT) {
+            fprintf(stderr, "The isp scales %dx%d of the camera\n",
+                    rect.width, rect.height);
+            return 1;
+        }
+        _check(rpigrafx_get_graph_info(&fc, &info));
+        printf("%3dx%3d %.4s: reconfigured in %6.2f ms, first frame after "
+               "%6.2f ms\n", o->width, o->height, (const char*) &o->encoding,
+               info.reconfig_ns / 1e6, first_ns / 1e6);
+        if (info.reconfig_ns == 0 || info.reconfig_ns > first_ns) {
+            fprintf(stderr, "Reconfiguration took %llu ns\n",
+                    (unsigned long long) info.reconfig_ns);
+            return 1;
+        }
+        if (__atomic_load_n(&num_steady_frames, __ATOMIC_SEQ_CST)
+                                                          == num_before) {
+            fprintf(stderr, "The other output got no frame meanwhile\n");
+            return 1;
+        }
+    }
+
+    /* What cannot be reconfigured leaves the output as it was. */
+    _check(!rpigrafx_reconfig_camera_frame(0, 48, MMAL_ENCODING_RGB24, &fc));
+    _check(!rpigrafx_reconfig_camera_frame(100000, 48, MMAL_ENCODING_RGB24,
+                                           &fc));
+    /* The sensor is larger, but the camera runs at the largest output. */
+    _check(!rpigrafx_reconfig_camera_frame(CAMERA_WIDTH * 2,
+                                           CAMERA_HEIGHT * 2,
+                                           MMAL_ENCODING_RGB24, &fc));
+    _check(!rpigrafx_reconfig_camera_frame(CAMERA_WIDTH, CAMERA_HEIGHT + 1,
+                                           MMAL_ENCODING_RGB24, &fc));
+    _check(!rpigrafx_reconfig_camera_frame(64, 48, MMAL_ENCODING_RGB24,
+                                           &fc_shared));
+    capture_frames(&fc, &formats[NUM_FORMATS - 1]);
+
+    __atomic_store_n(&is_stopping, !0, __ATOMIC_SEQ_CST);
+    _check(pthread_join(thread, NULL));
+    _check(steady_ret);
+    printf("The other output got %llu frames\n",
+           (unsigned long long) num_steady_frames);
+    _check(rpigrafx_free_frame(&fc));
+    return 0;
+}
@@ -0,0 +1,134 @@
+#include <rpigrafx.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define WIDTH  320
+#define HEIGHT 240
+#define NUM_FRAMES 20
+#define PATH "test_recorder.rec"
+#define FRAME_SIZE (ALIGN_UP(WIDTH, 32) * 3 * HEIGHT)
+
+/* Reads the recording back: every frame taken must be in it, in order. */
+static int check_recording(uint8_t *const *frames, const uint64_t *sequences,
+                           const int num_frames)
+{
+    FILE *fp = fopen(PATH, "rb");
+    rpigrafx_recording_header_t header;
+    rpigrafx_recording_frame_t frame;
+    uint8_t *record = NULL;
+    long size;
+    int n, ret = 0;
+
+    _check(fp == NULL);
+    _check(fread(&header, sizeof(header), 1, fp) != 1);
+    if (memcmp(header.magic, RPIGRAFX_RECORDING_MAGIC, sizeof(header.magic))
+            || header.version != RPIGRAFX_RECORDING_VERSION
+            || header.encoding != MMAL_ENCODING_RGB24
+            || header.width != WIDTH || header.height != HEIGHT
+            || header.aligned_width != ALIGN_UP(WIDTH, 32)
+            || header.frame_size < FRAME_SIZE
+            || header.record_size % RPIGRAFX_RECORDING_ALIGN != 0
+            || header.num_frames != (uint64_t) num_frames) {
+        fprintf(stderr, "Bad header: %ux%u, %u-byte frames in %u-byte "
+                "records, %llu frames\n", header.width, header.height,
+                header.frame_size, header.record_size,
+                (unsigned long long) header.num_frames);
+        ret = 1;
+        goto end;
+    }
+    _check(fseek(fp, 0, SEEK_END));
+    size = ftell(fp);
+    if (size != RPIGRAFX_RECORDING_ALIGN
+                + (long) num_frames * header.record_size) {
+        fprintf(stderr, "Bad size of recording: %ld\n", size);
+        ret = 1;
+        goto end;
+    }
+
+    record = malloc(header.record_size);
+    for (n = 0; n < num_frames; n ++) {
+        _check(fseek(fp, RPIGRAFX_RECORDING_ALIGN
+                         + (long) n * header.record_size, SEEK_SET));
+        _check(fread(record, header.record_size, 1, fp) != 1);
+        memcpy(&frame, record, sizeof(frame));
+        if (frame.length != header.frame_size
+                || frame.sequence != sequences[n]
+                || frame.sensor_ns == 0 || frame.receive_ns == 0
+                || memcmp(record + RPIGRAFX_RECORDING_FRAME_OFFSET,
+                          frames[n], FRAME_SIZE)) {
+            fprintf(stderr, "Bad record %d: sequence %llu\n", n,
+                    (unsigned long long) frame.sequence);
+            ret = 1;
+            goto end;
+        }
+    }
+
+end:
+    free(record);
+    fclose(fp);
+    return ret;
+}
+
+int main()
+{
+    rpigrafx_frame_config_t fc;
+    rpigrafx_recorder_t *rec = NULL;
+    rpigrafx_recorder_stats_t stats;
+    rpigrafx_frame_info_t info;
+    uint8_t *frames[NUM_FRAMES];
+    uint64_t sequences[NUM_FRAMES];
+    int n;
+
+    _check(rpigrafx_config_camera_frame(0, WIDTH, HEIGHT, MMAL_ENCODING_RGB24,
+                                        0, &fc));
+    /* The output has no frames to record yet. */
+    _check(!rpigrafx_open_recorder(PATH, &fc, 4, RPIGRAFX_DROP_POLICY_BLOCK,
+                                   &rec));
+    _check(rpigrafx_finish_config());
+
+    _check(!rpigrafx_open_recorder(PATH, &fc, 0, RPIGRAFX_DROP_POLICY_BLOCK,
+                                   &rec));
+    _check(!rpigrafx_open_recorder(PATH, &fc, 4,
+                                   RPIGRAFX_DROP_POLICY_DROP_OLDEST, &rec));
+
+    /* Few slots, so that the capture runs into the writer. */
+    _check(rpigrafx_open_recorder(PATH, &fc, 2, RPIGRAFX_DROP_POLICY_BLOCK,
+                                  &rec));
+    for (n = 0; n < NUM_FRAMES; n ++) {
+        _check(rpigrafx_capture_next_frame(&fc));
+        _check(rpigrafx_get_frame_info(&fc, &info));
+        sequences[n] = info.sequence;
+        frames[n] = malloc(FRAME_SIZE);
+        memcpy(frames[n], rpigrafx_get_frame(&fc), FRAME_SIZE);
+        _check(rpigrafx_record_frame(rec, rpigrafx_get_frame(&fc)));
+        _check(rpigrafx_free_frame(&fc));
+    }
+    _check(rpigrafx_get_recorder_stats(rec, &stats));
+    if (stats.num_recorded != NUM_FRAMES || stats.num_dropped != 0
+            || stats.num_slots != 2 || stats.max_queued > 2
+            || stats.max_queued < 1) {
+        fprintf(stderr, "Bad stats: %llu recorded, %llu dropped, "
+                "%d queued at most\n",
+                (unsigned long long) stats.num_recorded,
+                (unsigned long long) stats.num_dropped, stats.max_queued);
+        return 1;
+    }
+    _check(rpigrafx_close_recorder(rec));
+    _check(check_recording(frames, sequences, NUM_FRAMES));
+
+    for (n = 0; n < NUM_FRAMES; n ++)
+        free(frames[n]);
+    unlink(PATH);
+    return 0;
+}
@@ -0,0 +1,241 @@
+#include <rpigrafx.h>
+#include "local.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define WIDTH  320
+#define HEIGHT 240
+#define RAW_PATH "test_replay_raw.rec"
+#define RGB_PATH "test_replay_rgb.rec"
+#define TALL_PATH "test_replay_tall.rec"
+/* Not backed by a camera of the stand-in, which has one by default. */
+#define RAW_CAMERA 1
+#define RGB_CAMERA 2
+/* A replay takes the place of the camera of the stand-in. */
+#define TALL_CAMERA 0
+/* Neither a multiple of 32 wide nor of 16 high, as the isp buffers are. */
+#define TALL_WIDTH  200
+#define TALL_HEIGHT 1080
+#define NUM_RAW_FRAMES 3
+#define NUM_RGB_FRAMES 2
+#define RGB_FPS 25
+/* As rows of rawcam buffers. */
+#define RAW_STRIDE ALIGN_UP(ALIGN_UP(WIDTH, 32) * 5 / 4, 32)
+#define RGB_STRIDE (ALIGN_UP(WIDTH, 32) * 3)
+
+static uint64_t get_time_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* Writes frames in the container of rpigrafx_open_recorder. */
+static void write_recording(const char *path, const MMAL_FOURCC_T encoding,
+                            const int32_t width, const int32_t height,
+                            const uint32_t frame_size, uint8_t *const *frames,
+                            const int num_frames)
+{
+    FILE *fp = fopen(path, "wb");
+    rpigrafx_recording_header_t header;
+    rpigrafx_recording_frame_t frame;
+    uint8_t *block = NULL;
+    int n;
+
+    _check(fp == NULL);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RPIGRAFX_RECORDING_MAGIC, sizeof(header.magic));
+    header.version = RPIGRAFX_RECORDING_VERSION;
+    header.encoding = encoding;
+    header.width = width;
+    header.height = height;
+    header.aligned_width = ALIGN_UP(width, 32);
+    header.aligned_height = height;
+    header.frame_size = frame_size;
+    header.record_size = ALIGN_UP(RPIGRAFX_RECORDING_FRAME_OFFSET + frame_size,
+                                  RPIGRAFX_RECORDING_ALIGN);
+    header.num_frames = num_frames;
+
+    block = calloc(1, header.record_size);
+    _check(block == NULL);
+    memcpy(block, &header, sizeof(header));
+    _check(fwrite(block, RPIGRAFX_RECORDING_ALIGN, 1, fp) != 1);
+    for (n = 0; n < num_frames; n ++) {
+        memset(block, 0, header.record_size);
+        memset(&frame, 0, sizeof(frame));
+        frame.length = frame_size;
+        frame.sequence = n;
+        memcpy(block, &frame, sizeof(frame));
+        memcpy(block + RPIGRAFX_RECORDING_FRAME_OFFSET, frames[n], frame_size);
+        _check(fwrite(block, header.record_size, 1, fp) != 1);
+    }
+    free(block);
+    _check(fclose(fp));
+}
+
+/*
+ * Checks that frame is what the converter makes of the raw10 frame raw with
+ * the gains of 1 and the nearest demosaic of a replay.
+ */
+static int check_converted(const uint8_t *frame, const uint8_t *raw,
+                           const int32_t width, const int32_t height)
+{
+    const int32_t stride = ALIGN_UP(width, 32) * 3;
+    uint8_t *expected = malloc(stride * height);
+    int y, ret = 0;
+
+    _check(expected == NULL);
+    _check(priv_rpigrafx_raw10bggr_to_rgb888_gain(expected, stride, raw,
+                                            priv_rpigrafx_raw10_stride(width),
+                                                  width, height,
+                                                  1.0, 1.0, 1.0,
+                                                  RPIGRAFX_DEMOSAIC_NEAREST,
+                                                  NULL));
+    for (y = 0; y < height; y ++) {
+        if (memcmp(frame + y * stride, expected + y * stride, width * 3)) {
+            fprintf(stderr, "Row %d of the %dx%d frame differs from the "
+                    "converter\n", y, width, height);
+            ret = 1;
+            break;
+        }
+    }
+    free(expected);
+    return ret;
+}
+
+static uint8_t* make_raw_frame(const int32_t width, const int32_t height)
+{
+    const int32_t size = priv_rpigrafx_raw10_stride(width) * height;
+    uint8_t *raw = malloc(size);
+    int k;
+
+    _check(raw == NULL);
+    for (k = 0; k < size; k ++)
+        raw[k] = rand();
+    return raw;
+}
+
+int main()
+{
+    rpigrafx_frame_config_t fc_raw, fc_rgb, fc_tall, fc_none;
+    uint8_t *raw[NUM_RAW_FRAMES], *rgb[NUM_RGB_FRAMES], *tall;
+    uint8_t *outputs[2 * NUM_RAW_FRAMES];
+    uint64_t start, elapsed_ns;
+    int n, y;
+
+    srand(1);
+    for (n = 0; n < NUM_RAW_FRAMES; n ++)
+        raw[n] = make_raw_frame(WIDTH, HEIGHT);
+    tall = make_raw_frame(TALL_WIDTH, TALL_HEIGHT);
+    for (n = 0; n < NUM_RGB_FRAMES; n ++) {
+        rgb[n] = malloc(RGB_STRIDE * HEIGHT);
+        for (y = 0; y < RGB_STRIDE * HEIGHT; y ++)
+            rgb[n][y] = rand();
+    }
+    write_recording(RAW_PATH, MMAL_ENCODING_BAYER_SBGGR10P, WIDTH, HEIGHT,
+                    RAW_STRIDE * HEIGHT, raw, NUM_RAW_FRAMES);
+    write_recording(RGB_PATH, MMAL_ENCODING_RGB24, WIDTH, HEIGHT,
+                    RGB_STRIDE * HEIGHT, rgb, NUM_RGB_FRAMES);
+    write_recording(TALL_PATH, MMAL_ENCODING_BAYER_SBGGR10P, TALL_WIDTH,
+                    TALL_HEIGHT,
+                    priv_rpigrafx_raw10_stride(TALL_WIDTH) * TALL_HEIGHT,
+                    &tall, 1);
+
+    _check(!rpigrafx_config_replay(RAW_CAMERA, "/nonexistent.rec", 0, 0));
+    _check(!rpigrafx_config_replay(RAW_CAMERA, RAW_PATH, -1, 0));
+    _check(rpigrafx_config_replay(RAW_CAMERA, RAW_PATH, 0, !0));
+    _check(rpigrafx_config_replay(RGB_CAMERA, RGB_PATH, RGB_FPS, 0));
+    _check(rpigrafx_config_replay(TALL_CAMERA, TALL_PATH, 0, !0));
+    /* The frames are as large as recorded at most. */
+    _check(!rpigrafx_config_camera_frame(RAW_CAMERA, WIDTH * 2, HEIGHT,
+                                         MMAL_ENCODING_RGB24, 0, &fc_raw));
+    _check(rpigrafx_config_camera_frame(RAW_CAMERA, WIDTH, HEIGHT,
+                                        MMAL_ENCODING_RGB24, 0, &fc_raw));
+    _check(rpigrafx_config_camera_frame(RGB_CAMERA, WIDTH, HEIGHT,
+                                        MMAL_ENCODING_RGB24, 0, &fc_rgb));
+    _check(rpigrafx_config_camera_frame(TALL_CAMERA, TALL_WIDTH, TALL_HEIGHT,
+                                        MMAL_ENCODING_RGB24, 0, &fc_tall));
+    /* Neither a camera nor a replay. */
+    _check(!rpigrafx_config_camera_frame(RGB_CAMERA + 1, WIDTH, HEIGHT,
+                                         MMAL_ENCODING_RGB24, 0, &fc_none));
+    _check(rpigrafx_finish_config());
+
+    /* Fixed gains, so that a frame comes out the same on every pass. */
+    _check(rpigrafx_set_rawcam_awb_gains(1.0, 1.0, 1.0, &fc_raw));
+    _check(rpigrafx_lock_rawcam_awb(!0, &fc_raw));
+    _check(rpigrafx_set_rawcam_awb_gains(1.0, 1.0, 1.0, &fc_tall));
+    for (n = 0; n < 2 * NUM_RAW_FRAMES; n ++) {
+        _check(rpigrafx_capture_next_frame(&fc_raw));
+        outputs[n] = malloc(RGB_STRIDE * HEIGHT);
+        memcpy(outputs[n], rpigrafx_get_frame(&fc_raw), RGB_STRIDE * HEIGHT);
+    }
+    for (n = 0; n < NUM_RAW_FRAMES; n ++) {
+        if (memcmp(outputs[n], outputs[n + NUM_RAW_FRAMES],
+                   RGB_STRIDE * HEIGHT)) {
+            fprintf(stderr, "Frame %d differs on the second pass\n", n);
+            return 1;
+        }
+        if (!memcmp(outputs[n], outputs[(n + 1) % NUM_RAW_FRAMES],
+                    RGB_STRIDE * HEIGHT)) {
+            fprintf(stderr, "Frames %d and %d are the same\n", n,
+                    (n + 1) % NUM_RAW_FRAMES);
+            return 1;
+        }
+        if (check_converted(outputs[n], raw[n], WIDTH, HEIGHT))
+            return 1;
+    }
+
+    /* Twice, for the looping frame to go through the same buffers again. */
+    for (n = 0; n < 2; n ++) {
+        _check(rpigrafx_capture_next_frame(&fc_tall));
+        if (check_converted(rpigrafx_get_frame(&fc_tall), tall, TALL_WIDTH,
+                            TALL_HEIGHT))
+            return 1;
+    }
+
+    start = get_time_ns();
+    for (n = 0; n < NUM_RGB_FRAMES; n ++) {
+        const uint8_t *frame;
+        _check(rpigrafx_capture_next_frame(&fc_rgb));
+        frame = rpigrafx_get_frame(&fc_rgb);
+        for (y = 0; y < HEIGHT; y ++)
+            if (memcmp(frame + y * RGB_STRIDE, rgb[n] + y * RGB_STRIDE,
+                       WIDTH * 3)) {
+                fprintf(stderr, "Row %d of RGB frame %d differs\n", y, n);
+                return 1;
+            }
+    }
+    elapsed_ns = get_time_ns() - start;
+    if (elapsed_ns < (NUM_RGB_FRAMES - 1) * 1000000000ULL / RGB_FPS) {
+        fprintf(stderr, "Replay is ahead of %d fps: %d frames in %.1f ms\n",
+                RGB_FPS, NUM_RGB_FRAMES, elapsed_ns / 1e6);
+        return 1;
+    }
+    /* Not looping. */
+    _check(!rpigrafx_capture_next_frame(&fc_rgb));
+
+    for (n = 0; n < NUM_RAW_FRAMES; n ++)
+        free(raw[n]);
+    for (n = 0; n < NUM_RGB_FRAMES; n ++)
+        free(rgb[n]);
+    free(tall);
+    for (n = 0; n < 2 * NUM_RAW_FRAMES; n ++)
+        free(outputs[n]);
+    unlink(RAW_PATH);
+    unlink(RGB_PATH);
+    unlink(TALL_PATH);
+    return 0;
+}
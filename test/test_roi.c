@@ -0,0 +1,102 @@
+#include <rpigrafx.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+/* The camera runs at what the zoomed output needs. */
+#define CAMERA_WIDTH  320
+#define CAMERA_HEIGHT 240
+#define WIDTH  160
+#define HEIGHT 120
+#define STRIDE (ALIGN_UP(WIDTH, 32) * 3)
+
+/*
+ * Whether the frame is the rectangle of the stand-in camera frame scaled to
+ * the output; see test_emu_pipeline.c for the pattern.
+ */
+static int check_frame(const MMAL_RECT_T *rect, const uint8_t *p)
+{
+    int x, y;
+
+    for (y = 0; y < HEIGHT; y ++) {
+        for (x = 0; x < WIDTH; x ++) {
+            const int sx = rect->x + x * rect->width  / WIDTH,
+                      sy = rect->y + y * rect->height / HEIGHT;
+            const uint8_t *q = p + y * STRIDE + x * 3;
+            if (q[0] != sx * 256 / CAMERA_WIDTH
+                    || q[1] != sy * 256 / CAMERA_HEIGHT)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/* Captures until a frame of the rectangle comes, as older ones may be queued. */
+static int capture_rect(rpigrafx_frame_config_t *fcp, const MMAL_RECT_T *rect)
+{
+    int i;
+
+    for (i = 0; i < 10; i ++) {
+        _check(rpigrafx_capture_next_frame(fcp));
+        if (!check_frame(rect, rpigrafx_get_frame(fcp)))
+            return 0;
+    }
+    fprintf(stderr, "No frame of (%d,%d) %dx%d came\n", rect->x, rect->y,
+            rect->width, rect->height);
+    return 1;
+}
+
+int main()
+{
+    const MMAL_RECT_T whole = {0, 0, CAMERA_WIDTH, CAMERA_HEIGHT},
+                      centre = {80, 60, 160, 120},
+                      corner = {160, 120, 160, 120};
+    rpigrafx_frame_config_t fc[3];
+    MMAL_RECT_T rect;
+    int j;
+
+    for (j = 0; j < 3; j ++)
+        _check(rpigrafx_config_camera_frame(0, WIDTH, HEIGHT,
+                                            MMAL_ENCODING_RGB24, 0, &fc[j]));
+    _check(!rpigrafx_config_camera_frame_roi(0.5, 0, 0.6, 1, &fc[0]));
+    _check(!rpigrafx_config_camera_frame_roi(0, 0, 0, 1, &fc[0]));
+    /* Zooms in by two, so the camera runs at twice the output size. */
+    _check(rpigrafx_config_camera_frame_roi(0.25, 0.25, 0.5, 0.5, &fc[0]));
+    /* Scales the whole frame, as the default does for a whole multiple. */
+    _check(rpigrafx_config_camera_frame_roi(0, 0, 1, 1, &fc[1]));
+    _check(rpigrafx_config_camera_frame_roi(0, 0, 1, 1, &fc[2]));
+    /* Those two can then share an isp. */
+    _check(rpigrafx_config_camera_frame_delivery(RPIGRAFX_DELIVERY_LATEST,
+                                                 &fc[1]));
+    _check(rpigrafx_config_camera_frame_delivery(RPIGRAFX_DELIVERY_LATEST,
+                                                 &fc[2]));
+    _check(rpigrafx_finish_config());
+
+    _check(rpigrafx_get_camera_frame_roi(&fc[0], &rect));
+    if (rect.x != centre.x || rect.y != centre.y
+            || rect.width != centre.width || rect.height != centre.height) {
+        fprintf(stderr, "Region is (%d,%d) %dx%d\n", rect.x, rect.y,
+                rect.width, rect.height);
+        return 1;
+    }
+    _check(capture_rect(&fc[0], &centre));
+    _check(capture_rect(&fc[1], &whole));
+
+    /* Pans at runtime. */
+    _check(rpigrafx_config_camera_frame_roi(0.5, 0.5, 0.5, 0.5, &fc[0]));
+    _check(capture_rect(&fc[0], &corner));
+    _check(capture_rect(&fc[1], &whole));
+
+    /* The other two share an isp, which one of them cannot move alone. */
+    _check(!rpigrafx_config_camera_frame_roi(0.5, 0.5, 0.5, 0.5, &fc[1]));
+
+    return 0;
+}
@@ -0,0 +1,188 @@
+#include <rpigrafx.h>
+#include <interface/mmal/mmal_emu.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define CAMERA_WIDTH  640
+#define CAMERA_HEIGHT 480
+
+/*
+ * The first two outputs are identical, in latest-frame delivery, and share an
+ * isp. The next two are identical too but in FIFO delivery, which must not
+ * lose frames, and the last differs from the first two only in its pool
+ * depth, so those get an isp each.
+ */
+static const struct output {
+    int32_t width, height;
+    MMAL_FOURCC_T encoding;
+    int bpp;
+    rpigrafx_delivery_t delivery;
+    int pool_depth;
+    int num_isp_consumers;
+} outputs[] = {
+    {CAMERA_WIDTH / 2, CAMERA_HEIGHT / 2, MMAL_ENCODING_RGB24, 3,
+     RPIGRAFX_DELIVERY_LATEST, 0, 2},
+    {CAMERA_WIDTH / 2, CAMERA_HEIGHT / 2, MMAL_ENCODING_RGB24, 3,
+     RPIGRAFX_DELIVERY_LATEST, 0, 2},
+    {CAMERA_WIDTH / 4, CAMERA_HEIGHT / 4, MMAL_ENCODING_BGR24, 3,
+     RPIGRAFX_DELIVERY_FIFO, 0, 1},
+    {CAMERA_WIDTH / 4, CAMERA_HEIGHT / 4, MMAL_ENCODING_BGR24, 3,
+     RPIGRAFX_DELIVERY_FIFO, 0, 1},
+    {CAMERA_WIDTH / 2, CAMERA_HEIGHT / 2, MMAL_ENCODING_RGB24, 3,
+     RPIGRAFX_DELIVERY_LATEST, 8, 1},
+};
+#define NUM_OUTPUTS ((int) (sizeof(outputs) / sizeof(outputs[0])))
+#define NUM_ISPS 4
+
+/* See test_emu_pipeline.c. */
+static int check_frame(const struct output *o, const uint8_t *p)
+{
+    const int stride = ALIGN_UP(o->width, 32) * o->bpp;
+    const _Bool is_bgr = o->encoding == MMAL_ENCODING_BGR24;
+    int x, y;
+
+    for (y = 0; y < o->height; y ++) {
+        for (x = 0; x < o->width; x ++) {
+            const int sx = x * CAMERA_WIDTH  / o->width,
+                      sy = y * CAMERA_HEIGHT / o->height;
+            const uint8_t *q = p + y * stride + x * o->bpp;
+            const int r = q[is_bgr ? 2 : 0], g = q[1];
+            if (r != sx * 256 / CAMERA_WIDTH
+                    || g != sy * 256 / CAMERA_HEIGHT) {
+                fprintf(stderr, "%dx%d: Unexpected pixel (%d,%d,%d) at "
+                        "(%d,%d)\n", o->width, o->height, q[0], q[1], q[2],
+                        x, y);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main()
+{
+    const int nframes = 10;
+    rpigrafx_frame_config_t fc[NUM_OUTPUTS];
+    rpigrafx_frame_config_t *fcps[2] = {&fc[0], &fc[1]};
+    rpigrafx_graph_info_t graph;
+    rpigrafx_frame_info_t info[2];
+    rpigrafx_pool_stats_t pools[2][RPIGRAFX_NUM_HOPS];
+    MMAL_EMU_PORT_STATS_T stats[64];
+    uint64_t sequence = 0;
+    unsigned n;
+    int i, j, num_isp_inputs = 0;
+
+    for (j = 0; j < NUM_OUTPUTS; j ++) {
+        _check(rpigrafx_config_camera_frame(0, outputs[j].width,
+                                            outputs[j].height,
+                                            outputs[j].encoding, 0, &fc[j]));
+        _check(rpigrafx_config_camera_frame_delivery(outputs[j].delivery,
+                                                     &fc[j]));
+        if (outputs[j].pool_depth != 0)
+            _check(rpigrafx_config_pool_depth(RPIGRAFX_HOP_ISP_RENDER,
+                                              outputs[j].pool_depth, &fc[j]));
+    }
+    _check(rpigrafx_finish_config());
+
+    for (j = 0; j < NUM_OUTPUTS; j ++) {
+        _check(rpigrafx_get_graph_info(&fc[j], &graph));
+        if (graph.num_isps != NUM_ISPS
+                || graph.num_isp_consumers != outputs[j].num_isp_consumers) {
+            fprintf(stderr, "Output %d: %d isps, %d consumers\n", j,
+                    graph.num_isps, graph.num_isp_consumers);
+            return 1;
+        }
+    }
+    n = mmal_emu_get_port_stats(stats, sizeof(stats) / sizeof(stats[0]));
+    for (i = 0; i < (int) n; i ++)
+        if (!strcmp(stats[i].component, "vc.ril.isp")
+                && stats[i].type == MMAL_PORT_TYPE_INPUT)
+            num_isp_inputs ++;
+    if (num_isp_inputs != NUM_ISPS) {
+        fprintf(stderr, "%d isps were created\n", num_isp_inputs);
+        return 1;
+    }
+    _check(rpigrafx_get_pool_stats(&fc[0], pools[0]));
+    _check(rpigrafx_get_pool_stats(&fc[1], pools[1]));
+    if (pools[0][RPIGRAFX_HOP_ISP_RENDER].num_buffers
+            != pools[1][RPIGRAFX_HOP_ISP_RENDER].num_buffers) {
+        fprintf(stderr, "The shared isp has %u and %u buffers\n",
+                pools[0][RPIGRAFX_HOP_ISP_RENDER].num_buffers,
+                pools[1][RPIGRAFX_HOP_ISP_RENDER].num_buffers);
+        return 1;
+    }
+
+    /* Both outputs get the same frames, in the same memory. */
+    for (i = 0; i < nframes; i ++) {
+        _check(rpigrafx_capture_camera_frames(fcps, 2, -1, NULL));
+        for (j = 0; j < NUM_OUTPUTS; j ++) {
+            if (j >= 2)
+                _check(rpigrafx_capture_next_frame(&fc[j]));
+            _check(rpigrafx_get_frame(&fc[j]) == NULL);
+            _check(check_frame(&outputs[j], rpigrafx_get_frame(&fc[j])));
+        }
+        _check(rpigrafx_get_frame_info(&fc[0], &info[0]));
+        _check(rpigrafx_get_frame_info(&fc[1], &info[1]));
+        if (rpigrafx_get_frame(&fc[0]) != rpigrafx_get_frame(&fc[1])
+                || info[0].sequence != info[1].sequence) {
+            fprintf(stderr, "Frame %d: %p (%llu) and %p (%llu) differ\n", i,
+                    rpigrafx_get_frame(&fc[0]),
+                    (unsigned long long) info[0].sequence,
+                    rpigrafx_get_frame(&fc[1]),
+                    (unsigned long long) info[1].sequence);
+            return 1;
+        }
+        for (j = 0; j < NUM_OUTPUTS; j ++)
+            _check(rpigrafx_free_frame(&fc[j]));
+    }
+
+    /*
+     * An output left behind drops its oldest frames instead of holding up
+     * the isp, which goes on with new frames for the other.
+     */
+    for (i = 0; i < nframes; i ++) {
+        _check(rpigrafx_capture_next_frame(&fc[0]));
+        _check(check_frame(&outputs[0], rpigrafx_get_frame(&fc[0])));
+        _check(rpigrafx_get_frame_info(&fc[0], &info[0]));
+        if (i != 0 && info[0].sequence <= sequence) {
+            fprintf(stderr, "Frame %llu after %llu\n",
+                    (unsigned long long) info[0].sequence,
+                    (unsigned long long) sequence);
+            return 1;
+        }
+        sequence = info[0].sequence;
+    }
+    if (rpigrafx_get_num_dropped_frames(&fc[1]) == 0) {
+        fprintf(stderr, "The output left behind dropped no frames\n");
+        return 1;
+    }
+    _check(rpigrafx_capture_next_frame(&fc[1]));
+    _check(check_frame(&outputs[1], rpigrafx_get_frame(&fc[1])));
+
+    /* A FIFO output left behind loses nothing, as it has an isp of its own. */
+    for (i = 0; i < nframes; i ++) {
+        _check(rpigrafx_capture_next_frame(&fc[2]));
+        _check(check_frame(&outputs[2], rpigrafx_get_frame(&fc[2])));
+    }
+    _check(rpigrafx_capture_next_frame(&fc[3]));
+    _check(check_frame(&outputs[3], rpigrafx_get_frame(&fc[3])));
+    if (rpigrafx_get_num_dropped_frames(&fc[2]) != 0
+            || rpigrafx_get_num_dropped_frames(&fc[3]) != 0) {
+        fprintf(stderr, "FIFO outputs dropped %llu and %llu frames\n",
+                (unsigned long long) rpigrafx_get_num_dropped_frames(&fc[2]),
+                (unsigned long long) rpigrafx_get_num_dropped_frames(&fc[3]));
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <rpigrafx.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define WIDTH  320
+#define HEIGHT 240
+#define NUM_FRAMES 10
+
+static void capture(rpigrafx_frame_config_t *fcp, const int n)
+{
+    int i;
+
+    for (i = 0; i < n; i ++) {
+        _check(rpigrafx_capture_next_frame(fcp));
+        _check(rpigrafx_get_frame(fcp) == NULL);
+    }
+    _check(rpigrafx_free_frame(fcp));
+}
+
+static int check_zero(rpigrafx_frame_config_t *fcp)
+{
+    rpigrafx_stage_stats_t stats[RPIGRAFX_NUM_STAGES];
+    int k;
+
+    _check(rpigrafx_get_stats(fcp, stats));
+    for (k = 0; k < RPIGRAFX_NUM_STAGES; k ++) {
+        if (stats[k].num_calls != 0 || stats[k].total_ns != 0
+                || stats[k].max_ns != 0 || stats[k].num_bytes != 0) {
+            fprintf(stderr, "Stage %d was counted\n", k);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Frames of the camera capture port are counted per stage only while
+ * profiling is on. There is no rawcam, so its stages stay empty.
+ */
+int main()
+{
+    rpigrafx_frame_config_t fc;
+    rpigrafx_stage_stats_t stats[RPIGRAFX_NUM_STAGES];
+    const uint64_t frame_size = ALIGN_UP(WIDTH, 32) * HEIGHT * 3;
+    int k;
+
+    _check(rpigrafx_config_camera_port(0, RPIGRAFX_CAMERA_PORT_CAPTURE));
+    _check(rpigrafx_config_camera_frame(0, WIDTH, HEIGHT, MMAL_ENCODING_RGB24,
+                                        0, &fc));
+    _check(rpigrafx_finish_config());
+
+    capture(&fc, 3);
+    _check(check_zero(&fc));
+
+    rpigrafx_set_profiling(!0);
+    capture(&fc, NUM_FRAMES);
+    rpigrafx_set_profiling(0);
+    capture(&fc, 3);
+
+    _check(rpigrafx_get_stats(&fc, stats));
+    for (k = 0; k < RPIGRAFX_NUM_STAGES; k ++) {
+        const rpigrafx_stage_stats_t *s = &stats[k];
+        uint64_t num_calls = 0, num_bytes = 0;
+        switch (k) {
+            case RPIGRAFX_STAGE_CAPTURE:
+                num_calls = NUM_FRAMES;
+                num_bytes = NUM_FRAMES * frame_size;
+                break;
+            case RPIGRAFX_STAGE_TRIGGER:
+                num_calls = NUM_FRAMES;
+                break;
+            case RPIGRAFX_STAGE_ISP_WAIT:
+                /* The capture port emits empty frames in between. */
+                num_calls = s->num_calls < NUM_FRAMES ? NUM_FRAMES
+                                                      : s->num_calls;
+                num_bytes = NUM_FRAMES * frame_size;
+                break;
+        }
+        if (s->num_calls != num_calls || s->num_bytes != num_bytes
+                || s->max_ns > s->total_ns
+                || (num_calls != 0 && s->max_ns == 0)) {
+            fprintf(stderr, "Stage %d: %llu calls, %llu bytes, total %llu ns, "
+                    "max %llu ns\n", k, (unsigned long long) s->num_calls,
+                    (unsigned long long) s->num_bytes,
+                    (unsigned long long) s->total_ns,
+                    (unsigned long long) s->max_ns);
+            return 1;
+        }
+    }
+
+    rpigrafx_reset_stats(&fc);
+    _check(check_zero(&fc));
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <rpigrafx.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define NUM_OUTPUTS 3
+
+int main(int argc, char *argv[])
+{
+    const char *fps_env = getenv("RPIGRAFX_EMU_FPS");
+    /* A frame period, so that the nearest frames of two cameras match. */
+    const uint64_t tolerance_ns =
+        1000000000ULL / (fps_env != NULL && atoi(fps_env) > 0 ? atoi(fps_env)
+                                                              : 30);
+    rpigrafx_frame_config_t fc[NUM_OUTPUTS];
+    rpigrafx_frame_config_t *fcps[NUM_OUTPUTS];
+    rpigrafx_frame_info_t info[NUM_OUTPUTS];
+    rpigrafx_sync_info_t sync;
+    uint64_t num_dropped = 0;
+    int i, j;
+
+    /* The stand-in reads its number of cameras before main. */
+    (void) argc;
+    if (getenv("RPIGRAFX_EMU_NUM_CAMERAS") == NULL) {
+        _check(setenv("RPIGRAFX_EMU_NUM_CAMERAS", "2", 1));
+        execv("/proc/self/exe", argv);
+        perror("execv");
+        return 1;
+    }
+
+    _check(rpigrafx_config_camera_frame(0, 320, 240, MMAL_ENCODING_RGB24, 0,
+                                        &fc[0]));
+    _check(rpigrafx_config_camera_frame(1, 320, 240, MMAL_ENCODING_RGB24, 0,
+                                        &fc[1]));
+    _check(rpigrafx_config_camera_frame(1, 160, 120, MMAL_ENCODING_BGR24, 0,
+                                        &fc[2]));
+    _check(rpigrafx_finish_config());
+    for (j = 0; j < NUM_OUTPUTS; j ++)
+        fcps[j] = &fc[j];
+
+    _check(!rpigrafx_capture_synced_frames(fcps, 0, tolerance_ns, -1, &sync));
+
+    for (i = 0; i < 10; i ++) {
+        /*
+         * Let the queues fill up, then bring those of camera 0 ahead of the
+         * others, whose old frames then match none of it.
+         */
+        if (i % 2 == 1) {
+            usleep(100000);
+            for (j = 0; j < 3; j ++)
+                _check(rpigrafx_capture_next_frame(&fc[0]));
+        }
+        _check(rpigrafx_capture_synced_frames(fcps, NUM_OUTPUTS, tolerance_ns,
+                                              1000, &sync));
+        if (sync.skew_ns > tolerance_ns) {
+            fprintf(stderr, "Set %d: skew of %llu ns\n", i,
+                    (unsigned long long) sync.skew_ns);
+            return 1;
+        }
+        for (j = 0; j < NUM_OUTPUTS; j ++) {
+            _check(rpigrafx_get_frame(&fc[j]) == NULL);
+            _check(rpigrafx_get_frame_info(&fc[j], &info[j]));
+            if (info[j].sensor_ns == 0) {
+                fprintf(stderr, "Set %d: frame %d has no sensor time\n", i, j);
+                return 1;
+            }
+        }
+        for (j = 1; j < NUM_OUTPUTS; j ++) {
+            const uint64_t d = info[j].sensor_ns > info[0].sensor_ns
+                               ? info[j].sensor_ns - info[0].sensor_ns
+                               : info[0].sensor_ns - info[j].sensor_ns;
+            if (d > sync.skew_ns) {
+                fprintf(stderr, "Set %d: frames %d and 0 are %llu ns apart, "
+                        "more than the skew of %llu ns\n", i, j,
+                        (unsigned long long) d,
+                        (unsigned long long) sync.skew_ns);
+                return 1;
+            }
+        }
+        num_dropped += sync.num_dropped;
+    }
+    if (num_dropped == 0) {
+        fprintf(stderr, "No frames were dropped to match\n");
+        return 1;
+    }
+    printf("Dropped %llu frames to match\n", (unsigned long long) num_dropped);
+
+    for (j = 0; j < NUM_OUTPUTS; j ++)
+        _check(rpigrafx_free_frame(&fc[j]));
+    return 0;
+}
@@ -0,0 +1,224 @@
+#include <rpigrafx.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#define _check(x) \
+    do { \
+        const int ret = ((x)); \
+        if (ret) { \
+            fprintf(stderr, "%s:%d: error: %d\n", __FILE__, __LINE__, ret); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+#define NUM_CAMERAS 4
+#define FPS "100"
+#define PHASE_US 500000
+/* How long the slow consumer of the contended phase holds each frame. */
+#define HOLD_US 100000
+#define SLOW_OUTPUT 1
+
+/*
+ * The first three outputs of each camera are identical, in latest-frame
+ * delivery, and share an isp.
+ */
+static const struct output {
+    int32_t width, height;
+    MMAL_FOURCC_T encoding;
+    rpigrafx_delivery_t delivery;
+} outputs[] = {
+    {64, 48, MMAL_ENCODING_RGB24, RPIGRAFX_DELIVERY_LATEST},
+    {64, 48, MMAL_ENCODING_RGB24, RPIGRAFX_DELIVERY_LATEST},
+    {64, 48, MMAL_ENCODING_RGB24, RPIGRAFX_DELIVERY_LATEST},
+    {32, 24, MMAL_ENCODING_BGR24, RPIGRAFX_DELIVERY_FIFO},
+};
+#define NUM_OUTPUTS ((int) (sizeof(outputs) / sizeof(outputs[0])))
+
+/* One thread per output, which captures from it alone. */
+static struct worker {
+    rpigrafx_frame_config_t fc;
+    const struct output *o;
+    pthread_t thread;
+    useconds_t hold_us;
+    uint64_t num_frames;
+    int ret;
+} workers[NUM_CAMERAS][NUM_OUTPUTS];
+static _Bool is_stopping;
+
+/*
+ * The stand-in camera produces (256x/w, 256y/h, n) at (x, y). Without its
+ * size, check that red grows along the last row, which the isp writes last,
+ * and that blue, the frame number, is the same throughout.
+ */
+static int check_frame(const struct output *o, const uint8_t *p)
+{
+    const int stride = ALIGN_UP(o->width, 32) * 3, y = o->height - 1;
+    const _Bool is_bgr = o->encoding == MMAL_ENCODING_BGR24;
+    const uint8_t *row = p + y * stride;
+    int x;
+
+    for (x = 1; x < o->width; x ++) {
+        const uint8_t *q = row + x * 3, *prev = q - 3;
+        if (q[is_bgr ? 2 : 0] < prev[is_bgr ? 2 : 0]
+                || q[is_bgr ? 0 : 2] != row[is_bgr ? 0 : 2])
+            return 1;
+    }
+    return 0;
+}
+
+static void* run_worker(void *arg)
+{
+    struct worker *w = arg;
+    rpigrafx_frame_info_t info;
+    uint64_t sequence = 0;
+    _Bool is_first = !0;
+
+    while (!__atomic_load_n(&is_stopping, __ATOMIC_SEQ_CST)) {
+        if ((w->ret = rpigrafx_capture_next_frame(&w->fc)))
+            break;
+        if ((w->ret = rpigrafx_get_frame_info(&w->fc, &info)))
+            break;
+        if (check_frame(w->o, rpigrafx_get_frame(&w->fc))
+                || (!is_first && info.sequence <= sequence)) {
+            fprintf(stderr, "Bad frame %llu after %llu\n",
+                    (unsigned long long) info.sequence,
+                    (unsigned long long) sequence);
+            w->ret = 1;
+            break;
+        }
+        sequence = info.sequence;
+        is_first = 0;
+        w->num_frames ++;
+        if (w->hold_us != 0)
+            usleep(w->hold_us);
+    }
+    rpigrafx_free_frame(&w->fc);
+    return NULL;
+}
+
+static uint64_t get_time_us()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+/* Frames per second captured by num_outputs threads on the cameras. */
+static double run_phase(const int num_cameras, const int num_outputs)
+{
+    uint64_t start, num_frames = 0;
+    int i, j;
+
+    __atomic_store_n(&is_stopping, 0, __ATOMIC_SEQ_CST);
+    start = get_time_us();
+    for (i = 0; i < num_cameras; i ++) {
+        for (j = 0; j < num_outputs; j ++) {
+            workers[i][j].num_frames = 0;
+            _check(pthread_create(&workers[i][j].thread, NULL, run_worker,
+                                  &workers[i][j]));
+        }
+    }
+    usleep(PHASE_US);
+    __atomic_store_n(&is_stopping, !0, __ATOMIC_SEQ_CST);
+    for (i = 0; i < num_cameras; i ++) {
+        for (j = 0; j < num_outputs; j ++) {
+            _check(pthread_join(workers[i][j].thread, NULL));
+            _check(workers[i][j].ret);
+            num_frames += workers[i][j].num_frames;
+        }
+    }
+    return num_frames * 1e6 / (get_time_us() - start);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct phase {
+        int num_cameras, num_outputs;
+    } phases[] = {
+        {1, 1},
+        {1, NUM_OUTPUTS},
+        {2, NUM_OUTPUTS},
+        {NUM_CAMERAS, NUM_OUTPUTS},
+    };
+    const int num_phases = sizeof(phases) / sizeof(phases[0]);
+    uint64_t num_alone[NUM_OUTPUTS];
+    double fps, base = 0;
+    int i, j, k;
+
+    /* The stand-in reads its settings before main. */
+    (void) argc;
+    if (getenv("RPIGRAFX_EMU_NUM_CAMERAS") == NULL) {
+        _check(setenv("RPIGRAFX_EMU_NUM_CAMERAS", "4", 1));
+        _check(setenv("RPIGRAFX_EMU_FPS", FPS, 1));
+        execv("/proc/self/exe", argv);
+        perror("execv");
+        return 1;
+    }
+
+    for (i = 0; i < NUM_CAMERAS; i ++) {
+        for (j = 0; j < NUM_OUTPUTS; j ++) {
+            workers[i][j].o = &outputs[j];
+            _check(rpigrafx_config_camera_frame(i, outputs[j].width,
+                                                outputs[j].height,
+                                                outputs[j].encoding, 0,
+                                                &workers[i][j].fc));
+            _check(rpigrafx_config_camera_frame_delivery(outputs[j].delivery,
+                                                         &workers[i][j].fc));
+        }
+    }
+    _check(rpigrafx_finish_config());
+
+    /*
+     * Each output gets the frame rate of its camera if the threads do not
+     * hold each other up, so the total grows with the threads.
+     */
+    for (k = 0; k < num_phases; k ++) {
+        const int num_threads = phases[k].num_cameras * phases[k].num_outputs;
+        fps = run_phase(phases[k].num_cameras, phases[k].num_outputs);
+        if (k == 0)
+            base = fps;
+        printf("%d camera(s), %2d thread(s): %7.1f frames/s, %5.2fx\n",
+               phases[k].num_cameras, num_threads, fps, fps / base);
+        if (fps < base * num_threads / 2) {
+            fprintf(stderr, "%d threads captured %.1f frames/s, against "
+                    "%.1f of one\n", num_threads, fps, base);
+            return 1;
+        }
+        if (k == 1)
+            for (j = 0; j < NUM_OUTPUTS; j ++)
+                num_alone[j] = workers[0][j].num_frames;
+    }
+
+    /*
+     * Contended: all the threads capture from one camera, and all but one
+     * from one isp, while one of those holds each of its frames for long.
+     * The others keep the frame rate they had without it.
+     */
+    workers[0][SLOW_OUTPUT].hold_us = HOLD_US;
+    run_phase(1, NUM_OUTPUTS);
+    for (j = 0; j < NUM_OUTPUTS; j ++) {
+        printf("Output %d%s: %3llu frames, %3llu without a slow one\n", j,
+               j == SLOW_OUTPUT ? " (slow)" : "       ",
+               (unsigned long long) workers[0][j].num_frames,
+               (unsigned long long) num_alone[j]);
+        if (j == SLOW_OUTPUT) {
+            if (workers[0][j].num_frames == 0
+                    || workers[0][j].num_frames > PHASE_US / HOLD_US + 1) {
+                fprintf(stderr, "The slow output got %llu frames\n",
+                        (unsigned long long) workers[0][j].num_frames);
+                return 1;
+            }
+        } else if (workers[0][j].num_frames < num_alone[j] / 2) {
+            fprintf(stderr, "Output %d got %llu frames beside a slow one, "
+                    "against %llu\n", j,
+                    (unsigned long long) workers[0][j].num_frames,
+                    (unsigned long long) num_alone[j]);
+            return 1;
+        }
+    }
+    return 0;
+}